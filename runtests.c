@@ -0,0 +1,706 @@
+/*
+ * runtests.c
+ *
+ * Purpose: Runs the UM test suite and benchmarks in parallel. Every program
+ *          listed in testing/UMTESTS and testing/UMBENCH is run by a
+ *          separate um process, its output is compared with the expected
+ *          output, and its wall time and instruction count are reported.
+ *          Times can be saved as a baseline, and later runs flag any
+ *          program that got slower than the baseline by more than a
+ *          threshold.
+ *
+ *          With --check, every program is run by um --check instead, so
+ *          that it also fails if the engine ever differs from the
+ *          reference semantics.
+ *
+ *          With --micro, the runner instead runs the microbenchmarks
+ *          listed in testing/MICROBENCH one at a time, with loop
+ *          fast-forwarding turned off, and reports what each measured
+ *          instruction costs once the time of the empty loop, bench-loop,
+ *          is taken away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <seq.h>
+#include <mem.h>
+#include <assert.h>
+
+#define NAME_LEN        64
+#define PATH_LEN        512
+#define NOISE_SECONDS   0.05
+
+typedef enum result_t { PENDING = 0, PASSED, FAILED, CRASHED } result_t;
+
+/* struct job
+ * Purpose:     One program to run and what became of it
+ * Members:     char name[]: program file name without its extension
+ *              char program[], input[], expected[]: paths of the program,
+ *                  the file given as its stdin and its expected stdout;
+ *                  expected is "" for a microbenchmark, whose stdout is
+ *                  not checked
+ *              char out_path[], err_path[]: temporary files holding the
+ *                  program's stdout and stderr
+ *              pid_t pid: the running um process, or 0
+ *              struct timespec start: when the process was started
+ *              double seconds: wall time of the run
+ *              uint64_t instructions: instructions executed, from um --count
+ *                  or --check
+ *              result_t result: outcome of the run
+ *              bool has_baseline: true iff the baseline has this program
+ *              double base_seconds: baseline wall time
+ *              uint64_t base_instructions: baseline instruction count
+ *              unsigned ops, iterations: for a microbenchmark, the measured
+ *                  instructions per iteration and the number of iterations
+ */
+struct job {
+    char            name[NAME_LEN];
+    char            program[PATH_LEN];
+    char            input[PATH_LEN];
+    char            expected[PATH_LEN];
+    char            out_path[PATH_LEN];
+    char            err_path[PATH_LEN];
+    pid_t           pid;
+    struct timespec start;
+    double          seconds;
+    uint64_t        instructions;
+    result_t        result;
+    bool            has_baseline;
+    double          base_seconds;
+    uint64_t        base_instructions;
+    unsigned        ops;
+    unsigned        iterations;
+};
+
+/* struct config
+ * Purpose:     Command line settings
+ */
+struct config {
+    char           *um;
+    char           *dir;
+    char           *engine;
+    char           *baseline;
+    char           *save;
+    double          threshold;
+    long            jobs;
+    bool            quick;
+    bool            micro;
+    bool            check;
+};
+
+void usage_and_exit();
+void add_jobs(Seq_T jobs, struct config *config, const char *list);
+void add_micro_jobs(Seq_T jobs, struct config *config);
+FILE *open_list(struct config *config, const char *list);
+struct job *new_job(struct config *config, const char *file);
+void first_existing(char *path, const char *dir, const char *name,
+                    const char *const *suffixes);
+void read_baseline(Seq_T jobs, const char *path);
+void save_baseline(Seq_T jobs, const char *path);
+void run_all(Seq_T jobs, struct config *config);
+void start_job(struct job *job, struct config *config);
+void finish_job(struct job *job, int status);
+bool same_contents(const char *path_a, const char *path_b);
+uint64_t read_instruction_count(const char *path);
+double ns_per_op(struct job *job, struct job *loop);
+bool is_regression(struct job *job, struct config *config);
+double seconds_since(struct timespec *start);
+
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "jobs",      required_argument, NULL, 'j' },
+        { "um",        required_argument, NULL, 'u' },
+        { "dir",       required_argument, NULL, 'D' },
+        { "engine",    required_argument, NULL, 'e' },
+        { "baseline",  required_argument, NULL, 'b' },
+        { "save",      required_argument, NULL, 's' },
+        { "threshold", required_argument, NULL, 'r' },
+        { "quick",     no_argument,       NULL, 'q' },
+        { "micro",     no_argument,       NULL, 'm' },
+        { "check",     no_argument,       NULL, 'c' },
+        { NULL,        0,                 NULL, 0   }
+    };
+
+    struct config config = { "./um", "testing", NULL, NULL, NULL, 25.0,
+                             sysconf(_SC_NPROCESSORS_ONLN), false, false,
+                             false };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "j:u:D:e:b:s:r:qmc", long_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'j':
+            config.jobs = strtol(optarg, NULL, 10);
+            break;
+        case 'u':
+            config.um = optarg;
+            break;
+        case 'D':
+            config.dir = optarg;
+            break;
+        case 'e':
+            config.engine = optarg;
+            break;
+        case 'b':
+            config.baseline = optarg;
+            break;
+        case 's':
+            config.save = optarg;
+            break;
+        case 'r':
+            config.threshold = strtod(optarg, NULL);
+            break;
+        case 'q':
+            config.quick = true;
+            break;
+        case 'm':
+            config.micro = true;
+            break;
+        case 'c':
+            config.check = true;
+            break;
+        default:
+            usage_and_exit();
+        }
+    }
+
+    if (optind != argc || config.jobs < 1 || (config.micro && config.check)) {
+        usage_and_exit();
+    }
+
+    /* the long benchmarks go first so they overlap the short tests */
+    Seq_T jobs = Seq_new(32);
+    if (config.micro) {
+        /* microbenchmarks running side by side would time each other */
+        config.jobs = 1;
+        add_micro_jobs(jobs, &config);
+    } else {
+        if (!config.quick) {
+            add_jobs(jobs, &config, "UMBENCH");
+        }
+        add_jobs(jobs, &config, "UMTESTS");
+    }
+
+    if (config.baseline != NULL) {
+        read_baseline(jobs, config.baseline);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_all(jobs, &config);
+    double total = seconds_since(&start);
+
+    int passed = 0, failed = 0, slower = 0;
+    printf("%-16s %-8s %10s %14s", "program", "result", "seconds",
+           "instructions");
+    if (config.micro) {
+        printf(" %10s %10s", "ns/instr", "ns/op");
+    }
+    printf(" %10s\n", "baseline");
+
+    for (int i = 0; i < Seq_length(jobs); i++) {
+        struct job *job = Seq_get(jobs, i);
+        const char *result = (job->result == PASSED) ? "ok" :
+                             (job->result == FAILED) ? "FAIL" : "CRASH";
+
+        printf("%-16s %-8s %10.3f %14llu", job->name, result, job->seconds,
+               (unsigned long long)job->instructions);
+        if (config.micro) {
+            printf(" %10.2f", job->instructions == 0 ? 0.0 :
+                              job->seconds * 1e9 / job->instructions);
+            if (job->ops > 0 && i > 0) {
+                printf(" %10.2f", ns_per_op(job, Seq_get(jobs, 0)));
+            } else {
+                printf(" %10s", "-");
+            }
+        }
+        if (job->has_baseline) {
+            printf(" %+9.1f%%", 100.0 * (job->seconds - job->base_seconds) /
+                                (job->base_seconds > 0 ? job->base_seconds
+                                                       : 1.0));
+        }
+        if (job->has_baseline &&
+            job->instructions != job->base_instructions) {
+            printf("  instructions changed from %llu",
+                   (unsigned long long)job->base_instructions);
+        }
+        if (is_regression(job, &config)) {
+            printf("  SLOWER");
+            slower++;
+        }
+        printf("\n");
+
+        passed += (job->result == PASSED);
+        failed += (job->result != PASSED);
+    }
+
+    printf("\n%d passed, %d failed", passed, failed);
+    if (config.baseline != NULL) {
+        printf(", %d slower than baseline by more than %.0f%%", slower,
+               config.threshold);
+    }
+    printf(" (%.2f s wall, %ld jobs)\n", total, config.jobs);
+
+    if (config.save != NULL) {
+        save_baseline(jobs, config.save);
+    }
+
+    while (Seq_length(jobs) > 0) {
+        struct job *job = Seq_remhi(jobs);
+        FREE(job);
+    }
+    Seq_free(&jobs);
+
+    return (failed == 0 && slower == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* usage_and_exit
+ * Purpose:     Prints the command line usage and exits with failure
+ * Parameters:  None
+ * Returns:     None
+ */
+void usage_and_exit()
+{
+    fprintf(stderr, "USAGE: ./runtests [--jobs N] [--um PATH] [--dir DIR] "
+                    "[--engine NAME] [--check] [--quick | --micro] "
+                    "[--baseline FILE "
+                    "[--threshold PCT]] [--save FILE]\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/* add_jobs
+ * Purpose:     Adds a job for every program named in a list file
+ * Parameters:  Seq_T jobs: the jobs to add to
+ *              struct config *config: where the lists and programs live
+ *              const char *list: name of the list file in config->dir
+ * Returns:     None
+ * Notes:       A program NAME.um or NAME.umz reads NAME.0 if it exists and
+ *                  is expected to print NAME.1 (or NAME.out), or nothing if
+ *                  neither exists. Each is looked for in DIR/output first
+ *                  and then in DIR/tests.
+ */
+void add_jobs(Seq_T jobs, struct config *config, const char *list)
+{
+    static const char *const input_suffixes[] = { ".0", NULL };
+    static const char *const output_suffixes[] = { ".1", ".out", NULL };
+
+    FILE *fp = open_list(config, list);
+
+    char line[NAME_LEN];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+
+        struct job *job = new_job(config, line);
+        first_existing(job->input, config->dir, job->name, input_suffixes);
+        first_existing(job->expected, config->dir, job->name,
+                       output_suffixes);
+
+        if (job->input[0] == '\0') {
+            strcpy(job->input, "/dev/null");
+        }
+        if (job->expected[0] == '\0') {
+            strcpy(job->expected, "/dev/null");
+        }
+
+        Seq_addhi(jobs, job);
+    }
+
+    fclose(fp);
+}
+
+
+/* add_micro_jobs
+ * Purpose:     Adds a job for every microbenchmark in DIR/MICROBENCH
+ * Parameters:  Seq_T jobs: the jobs to add to
+ *              struct config *config: where the list and programs live
+ * Returns:     None
+ * Notes:       Each line of the list, as written by writetests --bench,
+ *                  is "FILE OPS ITERATIONS". The first must be the empty
+ *                  loop. Every benchmark reads /dev/zero, and its output
+ *                  is not checked.
+ */
+void add_micro_jobs(Seq_T jobs, struct config *config)
+{
+    FILE *fp = open_list(config, "MICROBENCH");
+
+    char file[NAME_LEN];
+    unsigned ops, iterations;
+    while (fscanf(fp, "%63s %u %u", file, &ops, &iterations) == 3) {
+        struct job *job = new_job(config, file);
+        strcpy(job->input, "/dev/zero");
+        job->ops = ops;
+        job->iterations = iterations;
+        Seq_addhi(jobs, job);
+    }
+
+    fclose(fp);
+
+    struct job *loop = Seq_length(jobs) > 0 ? Seq_get(jobs, 0) : NULL;
+    if (loop == NULL || loop->ops != 0) {
+        fprintf(stderr, "%s/MICROBENCH must start with the empty loop; "
+                        "run writetests --bench in %s\n",
+                config->dir, config->dir);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* open_list
+ * Purpose:     Opens a list file in config->dir
+ * Parameters:  struct config *config: where the list lives
+ *              const char *list: name of the list file
+ * Returns:     FILE *: the open list; client closes it
+ * Notes:       Exits with an error message if the list cannot be opened
+ */
+FILE *open_list(struct config *config, const char *list)
+{
+    char path[PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", config->dir, list);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return fp;
+}
+
+
+/* new_job
+ * Purpose:     Makes a job running one program in DIR/tests
+ * Parameters:  struct config *config: where the programs live
+ *              const char *file: the program's file name
+ * Returns:     struct job *: the job, with no input or expected output
+ *                  yet; client frees it with FREE
+ */
+struct job *new_job(struct config *config, const char *file)
+{
+    struct job *job;
+    NEW0(job);
+    snprintf(job->program, sizeof(job->program), "%s/tests/%s",
+             config->dir, file);
+    snprintf(job->name, sizeof(job->name), "%.*s",
+             (int)strcspn(file, "."), file);
+    return job;
+}
+
+
+/* first_existing
+ * Purpose:     Finds the first existing DIR/output/NAME.SUFFIX or
+ *                  DIR/tests/NAME.SUFFIX, trying each suffix in turn
+ * Parameters:  char *path: set to the path found, or "" if none exists;
+ *                  must hold PATH_LEN characters
+ *              const char *dir, *name: where to look and for what
+ *              const char *const *suffixes: NULL-terminated suffixes
+ * Returns:     None
+ */
+void first_existing(char *path, const char *dir, const char *name,
+                    const char *const *suffixes)
+{
+    static const char *const subdirs[] = { "output", "tests" };
+
+    for (int i = 0; suffixes[i] != NULL; i++) {
+        for (int j = 0; j < 2; j++) {
+            snprintf(path, PATH_LEN, "%s/%s/%s%s", dir, subdirs[j], name,
+                     suffixes[i]);
+            if (access(path, R_OK) == 0) {
+                return;
+            }
+        }
+    }
+
+    path[0] = '\0';
+}
+
+
+/* read_baseline
+ * Purpose:     Attaches baseline times and counts to the matching jobs
+ * Parameters:  Seq_T jobs: the jobs to update
+ *              const char *path: file of "name seconds instructions" lines,
+ *                  as written by save_baseline
+ * Returns:     None
+ */
+void read_baseline(Seq_T jobs, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open baseline %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    char name[NAME_LEN];
+    double seconds;
+    unsigned long long instructions;
+    while (fscanf(fp, "%63s %lf %llu", name, &seconds, &instructions) == 3) {
+        for (int i = 0; i < Seq_length(jobs); i++) {
+            struct job *job = Seq_get(jobs, i);
+            if (strcmp(job->name, name) == 0) {
+                job->has_baseline = true;
+                job->base_seconds = seconds;
+                job->base_instructions = instructions;
+            }
+        }
+    }
+
+    fclose(fp);
+}
+
+
+/* save_baseline
+ * Purpose:     Writes the time and count of every passing job
+ * Parameters:  Seq_T jobs: the finished jobs
+ *              const char *path: the file to write
+ * Returns:     None
+ */
+void save_baseline(Seq_T jobs, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open baseline %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < Seq_length(jobs); i++) {
+        struct job *job = Seq_get(jobs, i);
+        if (job->result == PASSED) {
+            fprintf(fp, "%s %.6f %llu\n", job->name, job->seconds,
+                    (unsigned long long)job->instructions);
+        }
+    }
+
+    fclose(fp);
+}
+
+
+/* run_all
+ * Purpose:     Runs every job, keeping up to config->jobs running at once
+ * Parameters:  Seq_T jobs: the jobs to run, in starting order
+ *              struct config *config: the um to run and how many at once
+ * Returns:     None
+ */
+void run_all(Seq_T jobs, struct config *config)
+{
+    int next = 0, running = 0;
+
+    while (next < Seq_length(jobs) || running > 0) {
+        while (next < Seq_length(jobs) && running < config->jobs) {
+            start_job(Seq_get(jobs, next++), config);
+            running++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        assert(pid > 0);
+
+        for (int i = 0; i < next; i++) {
+            struct job *job = Seq_get(jobs, i);
+            if (job->pid == pid) {
+                finish_job(job, status);
+                running--;
+                break;
+            }
+        }
+    }
+}
+
+
+/* start_job
+ * Purpose:     Starts a um process running one job
+ * Parameters:  struct job *job: the job to start
+ *              struct config *config: the um to run and its engine
+ * Returns:     None
+ * Notes:       The process reads the job's input, and its stdout and
+ *                  stderr go to new temporary files
+ */
+void start_job(struct job *job, struct config *config)
+{
+    strcpy(job->out_path, "/tmp/umtest-out.XXXXXX");
+    strcpy(job->err_path, "/tmp/umtest-err.XXXXXX");
+    int out = mkstemp(job->out_path);
+    int err = mkstemp(job->err_path);
+    int in = open(job->input, O_RDONLY);
+    if (out == -1 || err == -1 || in == -1) {
+        fprintf(stderr, "Could not set up files for %s\n", job->name);
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->pid = fork();
+    assert(job->pid != -1);
+
+    if (job->pid == 0) {
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+
+        char *args[7];
+        int n = 0;
+        args[n++] = config->um;
+        args[n++] = config->check ? "--check" : "--count";
+        if (config->micro) {
+            /* each measured instruction must be dispatched on its own */
+            args[n++] = "--no-fast-loops";
+        }
+        if (config->engine != NULL) {
+            args[n++] = "--engine";
+            args[n++] = config->engine;
+        }
+        args[n++] = job->program;
+        args[n] = NULL;
+
+        execv(config->um, args);
+        perror(config->um);
+        _exit(127);
+    }
+
+    close(in);
+    close(out);
+    close(err);
+}
+
+
+/* finish_job
+ * Purpose:     Records the outcome of a job whose process has exited
+ * Parameters:  struct job *job: the finished job
+ *              int status: the process's wait status
+ * Returns:     None
+ * Notes:       A test passes if it exits cleanly and prints exactly its
+ *                  expected file, which add_jobs sets to /dev/null when a
+ *                  test has none. A microbenchmark has no expected file at
+ *                  all, and passes if it exits cleanly. Removes the job's
+ *                  temporary files.
+ */
+void finish_job(struct job *job, int status)
+{
+    job->seconds = seconds_since(&job->start);
+    job->pid = 0;
+    job->instructions = read_instruction_count(job->err_path);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        job->result = CRASHED;
+    } else if (job->expected[0] == '\0' ||
+               same_contents(job->out_path, job->expected)) {
+        job->result = PASSED;
+    } else {
+        job->result = FAILED;
+    }
+
+    remove(job->out_path);
+    remove(job->err_path);
+}
+
+
+/* same_contents
+ * Purpose:     Compares two files byte for byte
+ * Parameters:  const char *path_a, *path_b: the files to compare
+ * Returns:     bool: true iff both can be read and are identical
+ */
+bool same_contents(const char *path_a, const char *path_b)
+{
+    FILE *a = fopen(path_a, "rb");
+    FILE *b = fopen(path_b, "rb");
+    bool same = (a != NULL && b != NULL);
+
+    while (same) {
+        int c = getc(a);
+        same = (c == getc(b));
+        if (c == EOF) {
+            break;
+        }
+    }
+
+    if (a != NULL) {
+        fclose(a);
+    }
+    if (b != NULL) {
+        fclose(b);
+    }
+    return same;
+}
+
+
+/* read_instruction_count
+ * Purpose:     Finds the count printed by um --count or --check in a
+ *                  stderr file
+ * Parameters:  const char *path: the file to search
+ * Returns:     uint64_t: the count, or 0 if none was printed
+ */
+uint64_t read_instruction_count(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    char line[256];
+    unsigned long long count = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        sscanf(line, "instructions: %llu", &count);
+    }
+
+    fclose(fp);
+    return count;
+}
+
+
+/* ns_per_op
+ * Purpose:     Works out what one measured instruction of a microbenchmark
+ *                  costs
+ * Parameters:  struct job *job: the finished microbenchmark
+ *              struct job *loop: the finished empty loop
+ * Returns:     double: nanoseconds per measured instruction, once the
+ *                  empty loop's time per iteration is taken away
+ */
+double ns_per_op(struct job *job, struct job *loop)
+{
+    double overhead = loop->seconds * job->iterations / loop->iterations;
+    return (job->seconds - overhead) * 1e9 /
+           ((double)job->ops * job->iterations);
+}
+
+
+/* is_regression
+ * Purpose:     Checks whether a job got slower than its baseline by more
+ *                  than the threshold
+ * Parameters:  struct job *job: the finished job
+ *              struct config *config: the threshold, in percent
+ * Returns:     bool: true iff the job regressed
+ * Notes:       Differences under NOISE_SECONDS are never regressions, so
+ *                  that the short tests, which mostly time process startup,
+ *                  do not trip the threshold
+ */
+bool is_regression(struct job *job, struct config *config)
+{
+    if (!job->has_baseline || job->result != PASSED) {
+        return false;
+    }
+
+    double extra = job->seconds - job->base_seconds;
+    return extra > NOISE_SECONDS &&
+           extra > job->base_seconds * config->threshold / 100.0;
+}
+
+
+double seconds_since(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) +
+           (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -10,40 +10,447 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 #include <bitpack.h>
+#include <mem.h>
 #include "um_operate.h"
-#include <sys/stat.h>
+#include "um_debug.h"
+#include "um_checkpoint.h"
+#include "um_serve.h"
+#include "um_pipeline.h"
+#include "um_cache.h"
+#include "um_check.h"
+#include "um_perf.h"
+#include <unistd.h>
 #include "open_or_die.h"
 
+/* loops listed by --cfg */
+#define CFG_TOP_LOOPS 10
+
+void usage_and_exit();
+um_data_t load_program(char *program_file);
+um_engine_t parse_engine(const char *name);
+void set_memory_mode(um_data_t um, um_store_t store, um_huge_t huge,
+                     bool handles);
+void write_cfg(um_cfg_t cfg, const char *prefix);
+FILE *open_cfg_file(const char *prefix, const char *extension);
+
 
 int main(int argc, char *argv[])
 {
-    if (argc >= 3 || argc == 1) {
-        fprintf(stderr, "USAGE: ./um program_filename.um\n");
+    static struct option long_options[] = {
+        { "engine", required_argument, NULL, 'e' },
+        { "trace",  required_argument, NULL, 't' },
+        { "debug",  optional_argument, NULL, 'd' },
+        { "count",  no_argument,       NULL, 'c' },
+        { "checkpoint", required_argument, NULL, 'k' },
+        { "every",  required_argument, NULL, 'n' },
+        { "resume", required_argument, NULL, 'r' },
+        { "serve",  required_argument, NULL, 's' },
+        { "workers", required_argument, NULL, 'w' },
+        { "async-output", no_argument,   NULL, 'a' },
+        { "stats",  no_argument,       NULL, 'm' },
+        { "metrics", optional_argument, NULL, 'p' },
+        { "pipeline", no_argument,     NULL, 'P' },
+        { "store",  required_argument, NULL, 'S' },
+        { "handles", no_argument,      NULL, 'H' },
+        { "huge",   no_argument,       NULL, 'u' },
+        { "check",  no_argument,       NULL, 'C' },
+        { "perf",   no_argument,       NULL, 'f' },
+        { "cfg",    required_argument, NULL, 'g' },
+        { "no-fast-loops", no_argument, NULL, 'l' },
+        { NULL,     0,                 NULL, 0   }
+    };
+
+    um_engine_t engine = UM_ENGINE_GENERIC;
+    char *trace_file = NULL;
+    char *debug_file = NULL;
+    bool count = false;
+    char *checkpoint_file = NULL;
+    char *resume_file = NULL;
+    uint64_t every = 100000000;
+    bool every_given = false;
+    char *socket_path = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    bool async_output = false;
+    bool stats = false;
+    bool metrics = false;
+    char *metrics_socket = NULL;
+    bool pipeline = false;
+    char *store_dir = NULL;
+    bool handles = false;
+    bool use_huge = false;
+    bool check = false;
+    bool perf = false;
+    char *cfg_prefix = NULL;
+    bool fast_loops = true;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "e:t:d::ck:n:r:s:w:amp::PS:HuCfg:l", long_options, 
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'e':
+            engine = parse_engine(optarg);
+            break;
+        case 't':
+            trace_file = optarg;
+            break;
+        case 'd':
+            debug_file = (optarg != NULL) ? optarg : "/dev/tty";
+            break;
+        case 'c':
+            count = true;
+            break;
+        case 'k':
+            checkpoint_file = optarg;
+            break;
+        case 'n':
+            every = strtoull(optarg, NULL, 10);
+            every_given = true;
+            break;
+        case 'r':
+            resume_file = optarg;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'w':
+            workers = strtol(optarg, NULL, 10);
+            break;
+        case 'a':
+            async_output = true;
+            break;
+        case 'm':
+            stats = true;
+            break;
+        case 'p':
+            metrics = true;
+            metrics_socket = optarg;
+            break;
+        case 'P':
+            pipeline = true;
+            break;
+        case 'S':
+            store_dir = optarg;
+            break;
+        case 'H':
+            handles = true;
+            break;
+        case 'u':
+            use_huge = true;
+            break;
+        case 'C':
+            check = true;
+            break;
+        case 'f':
+            perf = true;
+            break;
+        case 'g':
+            cfg_prefix = optarg;
+            break;
+        case 'l':
+            fast_loops = false;
+            break;
+        default:
+            usage_and_exit();
+        }
+    }
+
+    int modes = (trace_file != NULL) + (debug_file != NULL) + count +
+                (checkpoint_file != NULL || resume_file != NULL) +
+                (socket_path != NULL) + stats + metrics + pipeline + check +
+                perf + (cfg_prefix != NULL);
+    int num_programs = (resume_file != NULL) ? 0 : 1;
+    /* the debugger, server, pipelines, checker and counters do their own
+     * input and output */
+    bool own_io = debug_file != NULL || socket_path != NULL || pipeline ||
+                  check || perf;
+    /* an arena has no dirty tracking, statistics, store or pool */
+    bool no_handles = store_dir != NULL || use_huge ||
+                      checkpoint_file != NULL || resume_file != NULL ||
+                      stats || metrics || check;
+    if ((pipeline ? argc - optind < 1 : argc - optind != num_programs) ||
+        modes > 1 || every == 0 || workers < 1 || (async_output && own_io) ||
+        (handles && no_handles)) {
+        usage_and_exit();
+    }
+    if (check && !every_given) {
+        every = UM_CHECK_BLOCK;
+    }
+
+    um_store_t store = NULL;
+    if (store_dir != NULL) {
+        store = um_store_new(store_dir);
+        if (store == NULL) {
+            fprintf(stderr, "Could not create a segment store in %s\n", 
+                    store_dir);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    um_huge_t huge = NULL;
+    if (use_huge) {
+        huge = um_huge_new();
+        if (huge == NULL) {
+            fprintf(stderr, "Could not reserve a huge-page segment pool\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (pipeline) {
+        um_pipeline_t stages = um_pipeline_new(engine);
+        for (int i = optind; i < argc; i++) {
+            um_data_t stage = load_program(argv[i]);
+            set_memory_mode(stage, store, huge, handles);
+            set_um_fast_loops(stage, fast_loops);
+            um_pipeline_add(stages, stage);
+        }
+        /* stages of the same file already share segment 0 */
+        um_cache_clear();
+        um_pipeline_run(stages, STDIN_FILENO, STDOUT_FILENO);
+        um_pipeline_free(&stages);
+        if (store != NULL) {
+            um_store_free(&store);
+        }
+        if (huge != NULL) {
+            um_huge_free(&huge);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    um_data_t UM;
+    uint64_t executed = 0;
+    um_checkpoint_t log = NULL;
+    int status = EXIT_SUCCESS;
+    /* counting starts before the program is loaded, to charge the load */
+    um_perf_t counters = perf ? um_perf_new() : NULL;
+
+    if (resume_file != NULL) {
+        UM = initialize_um();
+        set_memory_mode(UM, store, huge, handles);
+        set_um_fast_loops(UM, fast_loops);
+        log = um_checkpoint_resume(resume_file, UM, &executed);
+        if (log == NULL) {
+            fprintf(stderr, "No checkpoint to resume in %s\n", resume_file);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        UM = load_program(argv[optind]);
+        /* nothing else is loaded, and the server clones UM itself, so the
+         * cached copy would only keep segment 0 shared */
+        um_cache_clear();
+        set_memory_mode(UM, store, huge, handles);
+        set_um_fast_loops(UM, fast_loops);
+    }
+
+    if (checkpoint_file != NULL) {
+        log = um_checkpoint_new(checkpoint_file);
+    }
+
+    um_stream_t stream = NULL;
+    if (async_output) {
+        stream = um_stream_new(STDIN_FILENO, STDOUT_FILENO);
+        set_um_stream(UM, stream);
+    }
+
+    if (socket_path != NULL) {
+        run_um_server(socket_path, UM, engine, workers);
+    } else if (log != NULL) {
+        run_um_checkpointed(UM, engine, log, every, executed);
+        um_checkpoint_free(&log);
+    } else if (debug_file != NULL) {
+        /* debugger commands must not compete with the program for stdin */
+        FILE *commands = open_or_die(debug_file);
+        run_um_debug(UM, commands, stderr);
+        fclose(commands);
+    } else if (trace_file != NULL) {
+        FILE *trace_fp = fopen(trace_file, "wb");
+        if (trace_fp == NULL) {
+            fprintf(stderr, "Could not open trace file %s\n", trace_file);
+            exit(EXIT_FAILURE);
+        }
+
+        um_trace_t trace = um_trace_new(trace_fp);
+        run_um_traced(UM, engine, trace);
+        um_trace_free(&trace);
+        fclose(trace_fp);
+    } else if (cfg_prefix != NULL) {
+        um_cfg_t cfg = um_cfg_new();
+        run_um_cfg(UM, engine, cfg);
+        write_cfg(cfg, cfg_prefix);
+        um_cfg_report(cfg, stderr, CFG_TOP_LOOPS);
+        um_cfg_free(&cfg);
+    } else if (check) {
+        uint64_t executed;
+        bool agreed = run_um_check(UM, engine, every, stderr, &executed);
+        fprintf(stderr, "instructions: %llu\n", (unsigned long long)executed);
+        status = agreed ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (counters != NULL) {
+        uint64_t executed = run_um_perf(UM, engine, counters);
+        um_perf_report(counters, stderr, engine, executed);
+        if (huge != NULL) {
+            um_huge_report(huge, stderr);
+        }
+        fprintf(stderr, "instructions: %llu\n", (unsigned long long)executed);
+        um_perf_free(&counters);
+    } else if (metrics) {
+        um_metrics_t live = um_metrics_new(metrics_socket);
+        run_um_metrics(UM, engine, live);
+        um_metrics_free(&live);
+    } else if (stats) {
+        uint64_t executed = run_um_stats(UM, engine, stderr);
+        if (huge != NULL) {
+            um_huge_report(huge, stderr);
+        }
+        fprintf(stderr, "instructions: %llu\n", (unsigned long long)executed);
+    } else if (count) {
+        uint64_t executed = run_um_counted(UM, engine);
+        fprintf(stderr, "instructions: %llu\n", (unsigned long long)executed);
+    } else {
+        run_um(UM, engine);
+    }
+
+    if (stream != NULL) {
+        um_stream_free(&stream);
+    }
+    free_um(UM);
+    if (store != NULL) {
+        um_store_free(&store);
+    }
+    if (huge != NULL) {
+        um_huge_free(&huge);
+    }
+
+    return status;
+}
+
+
+/* usage_and_exit
+ * Purpose:     Prints the command line usage and exits with failure
+ * Parameters:  None
+ * Returns:     None
+ */
+void usage_and_exit()
+{
+    fprintf(stderr, "USAGE: ./um [--engine generic|specialized] "
+                    "[--async-output] [--store DIR] [--huge | --handles] "
+                    "[--no-fast-loops] "
+                    "[--count | --stats | --metrics[=SOCKET] | "
+                    "--check [--every N] | --perf | --cfg PREFIX | "
+                    "--trace FILE | --debug[=COMMANDS] | "
+                    "--checkpoint LOG [--every N] | "
+                    "--serve SOCKET [--workers N]] program_filename.um\n"
+                    "       ./um [--engine generic|specialized] "
+                    "[--async-output] [--store DIR] [--huge] "
+                    "[--no-fast-loops] --resume LOG [--every N]\n"
+                    "       ./um [--engine generic|specialized] "
+                    "[--store DIR] [--huge | --handles] [--no-fast-loops] "
+                    "--pipeline first.um next.um ...\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/* load_program
+ * Purpose:     Loads a program file into segment 0 of a new UM
+ * Parameters:  char *program_file: path of the .um or .umx file
+ * Returns:     um_data_t: the UM; client frees with free_um
+ * Notes:       Loads through the program cache, so machines loaded from the
+ *                  same file share segment 0 until one of them changes it.
+ *                  The caller clears the cache once it has loaded every
+ *                  program, so that segment 0 is not held for the run.
+ *              Exits with an error message if the file cannot be read.
+ */
+um_data_t load_program(char *program_file)
+{
+    um_data_t um = um_cache_load(program_file);
+    if (um == NULL) {
+        fprintf(stderr, "Could not read %s\n", program_file);
         exit(EXIT_FAILURE);
     }
+    return um;
+}
 
-    /* get program file data */
-    struct stat sb;
-    if (stat(argv[1], &sb) == -1) {
-        fprintf(stderr, "Stat Error\n");
+
+/* set_memory_mode
+ * Purpose:     Applies the memory options to a newly loaded UM
+ * Parameters:  um_data_t um: the UM, with only segment 0 mapped
+ *              um_store_t store: the segment store, or NULL
+ *              um_huge_t huge: the huge-page segment pool, or NULL
+ *              bool handles: whether segment IDs are arena handles
+ * Returns:     None
+ * Notes:       Exits with an error message if the arena cannot be reserved
+ */
+void set_memory_mode(um_data_t um, um_store_t store, um_huge_t huge,
+                     bool handles)
+{
+    set_um_store(um, store);
+    set_um_huge(um, huge);
+
+    if (handles && !use_um_handles(um)) {
+        fprintf(stderr, "Could not reserve a segment arena\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    int num_words = sb.st_size / 4;
 
-    FILE *fp = open_or_die(argv[1]);
+/* write_cfg
+ * Purpose:     Writes a control-flow graph to PREFIX.dot and PREFIX.folded
+ * Parameters:  um_cfg_t cfg: the graph
+ *              const char *prefix: path of both files without extension
+ * Returns:     None
+ */
+void write_cfg(um_cfg_t cfg, const char *prefix)
+{
+    FILE *dot = open_cfg_file(prefix, ".dot");
+    um_cfg_write_dot(cfg, dot);
+    fclose(dot);
 
-    um_data_t UM = initialize_um();
+    FILE *folded = open_cfg_file(prefix, ".folded");
+    um_cfg_write_folded(cfg, folded);
+    fclose(folded);
+}
 
-    read_um_program(fp, UM, num_words);
 
-    while (!is_halting(UM)) {
-        read_instruction(UM);
+/* open_cfg_file
+ * Purpose:     Creates one of the files --cfg writes
+ * Parameters:  const char *prefix: path of the file without extension
+ *              const char *extension: the extension, with its dot
+ * Returns:     FILE *: the file, open for writing
+ * Notes:       Exits with an error message if the file cannot be created
+ */
+FILE *open_cfg_file(const char *prefix, const char *extension)
+{
+    size_t length = strlen(prefix) + strlen(extension) + 1;
+    char *path = ALLOC(length);
+
+    snprintf(path, length, "%s%s", prefix, extension);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(EXIT_FAILURE);
     }
+    FREE(path);
 
-    free_um(UM);
-    fclose(fp);
+    return fp;
+}
+
+
+/* parse_engine
+ * Purpose:     Converts an engine name from the command line to an engine
+ * Parameters:  const char *name: "generic" or "specialized"
+ * Returns:     um_engine_t: the matching engine
+ * Notes:       Prints usage and exits on an unknown name
+ */
+um_engine_t parse_engine(const char *name)
+{
+    if (strcmp(name, "generic") == 0) {
+        return UM_ENGINE_GENERIC;
+    } else if (strcmp(name, "specialized") == 0) {
+        return UM_ENGINE_SPECIALIZED;
+    }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    fprintf(stderr, "Unknown engine: %s\n", name);
+    usage_and_exit();
+    return UM_ENGINE_GENERIC;
+}
@@ -0,0 +1,224 @@
+/*
+ * um_arena.c
+ *
+ * Purpose: Implementation of the handle-addressed word arena.
+ *
+ *          The arena is one anonymous mapping of 2^32 words, reserved
+ *          without swap, so only the pages segments touch take memory.
+ *          Each segment is a block of a power of two words: two header
+ *          words and then the segment's words, whose index is its handle.
+ *          The header holds the bitwise complement of the handle, which is
+ *          cleared when the block is released, and the segment's length.
+ *          The complement lets um_arena_holds tell a live handle from an
+ *          arbitrary number without any table.
+ *
+ *          Blocks are handed out by a um_blocks allocator counting words.
+ *          Released blocks go on a free list for their size and are handed
+ *          out again before the unused part of the arena; large ones give
+ *          their pages back to the system first. The allocator is not
+ *          locked, since an arena is never shared: clones copy it.
+ */
+
+#include "um_arena.h"
+#include "um_blocks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <mem.h>
+#include <assert.h>
+
+#define ARENA_SHIFT     32
+#define ARENA_WORDS     (1ULL << ARENA_SHIFT)
+#define HEADER_WORDS    2
+#define PAGE_WORDS      1024
+
+/* words of the block a segment of length words needs */
+#define BLOCK_WORDS(length) ((uint64_t)(length) + HEADER_WORDS)
+
+/* struct um_arena_t
+ * Purpose:     The arena's words and the blocks carved out of them
+ * Members:     uint32_t *words: the mapping of ARENA_WORDS words
+ *              um_blocks_t blocks: the blocks of the arena, in words,
+ *                  headers included
+ */
+struct um_arena_t {
+    uint32_t   *words;
+    um_blocks_t blocks;
+};
+
+um_arena_t reserve_arena(um_blocks_t blocks);
+
+
+/* um_arena_new
+ * Purpose:     Reserves an empty arena
+ * Parameters:  None
+ * Returns:     um_arena_t: the arena; client frees with um_arena_free.
+ *                  NULL if the address space cannot be reserved.
+ */
+um_arena_t um_arena_new()
+{
+    return reserve_arena(um_blocks_new(ARENA_SHIFT, 0, false));
+}
+
+
+/* um_arena_copy
+ * Purpose:     Creates an arena with the same segments under the same
+ *                  handles as another
+ * Parameters:  um_arena_t arena: the arena to copy
+ * Returns:     um_arena_t: the copy; client frees with um_arena_free.
+ *                  NULL if the address space cannot be reserved.
+ * Notes:       Takes time in the words ever handed out, not in 2^32
+ */
+um_arena_t um_arena_copy(um_arena_t arena)
+{
+    assert(arena != NULL);
+
+    um_arena_t copy = reserve_arena(um_blocks_copy(arena->blocks));
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    memcpy(copy->words, arena->words,
+           um_blocks_top(arena->blocks) * sizeof(uint32_t));
+    return copy;
+}
+
+
+/* um_arena_free
+ * Purpose:     Unmaps an arena and every segment in it
+ * Parameters:  um_arena_t *arena: pointer to the arena to free
+ * Returns:     None
+ */
+void um_arena_free(um_arena_t *arena)
+{
+    assert(arena != NULL && *arena != NULL);
+    um_arena_t a = *arena;
+
+    munmap(a->words, ARENA_WORDS * sizeof(uint32_t));
+    um_blocks_free(&a->blocks);
+    FREE(*arena);
+}
+
+
+/* um_arena_words
+ * Purpose:     Gives direct access to the arena
+ * Parameters:  um_arena_t arena: the arena
+ * Returns:     uint32_t *: its words; word i of the segment with handle h
+ *                  is at index h + i
+ */
+uint32_t *um_arena_words(um_arena_t arena)
+{
+    assert(arena != NULL);
+    return arena->words;
+}
+
+
+/* um_arena_alloc
+ * Purpose:     Makes a new segment in the arena
+ * Parameters:  um_arena_t arena: the arena
+ *              uint32_t length: the segment's length in words
+ * Returns:     uint32_t: the segment's handle; its words are all 0
+ * Notes:       Exits with an error message once the arena is full
+ */
+uint32_t um_arena_alloc(um_arena_t arena, uint32_t length)
+{
+    assert(arena != NULL);
+
+    uint64_t start;
+    if (!um_blocks_alloc(arena->blocks, BLOCK_WORDS(length), &start)) {
+        fprintf(stderr, "Segment arena is full\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t handle = start + HEADER_WORDS;
+
+    arena->words[handle - 2] = ~handle;
+    arena->words[handle - 1] = length;
+    memset(&arena->words[handle], 0, (size_t)length * sizeof(uint32_t));
+
+    return handle;
+}
+
+
+/* um_arena_release
+ * Purpose:     Frees a segment
+ * Parameters:  um_arena_t arena: the arena
+ *              uint32_t handle: the segment's handle
+ * Returns:     None
+ * Notes:       Whole pages inside a block of more than a few pages are
+ *                  given back to the system; the block is zeroed again
+ *                  when it is reused
+ */
+void um_arena_release(um_arena_t arena, uint32_t handle)
+{
+    assert(um_arena_holds(arena, handle));
+
+    uint32_t length = arena->words[handle - 1];
+    int k = um_blocks_class(arena->blocks, BLOCK_WORDS(length));
+    uint64_t start = handle - HEADER_WORDS;
+    uint64_t size = (uint64_t)1 << k;
+
+    arena->words[handle - 2] = 0;
+    if (size >= 4 * PAGE_WORDS) {
+        uint64_t first = (start + PAGE_WORDS) & ~(uint64_t)(PAGE_WORDS - 1);
+        uint64_t last = (start + size) & ~(uint64_t)(PAGE_WORDS - 1);
+        madvise(&arena->words[first], (last - first) * sizeof(uint32_t),
+                MADV_DONTNEED);
+    }
+
+    um_blocks_release(arena->blocks, k, start);
+}
+
+
+/* um_arena_holds
+ * Purpose:     Tells a live handle from any other number
+ * Parameters:  um_arena_t arena: the arena
+ *              uint32_t handle: the number to check
+ * Returns:     bool: true iff handle names a segment that has not been
+ *                  released
+ */
+bool um_arena_holds(um_arena_t arena, uint32_t handle)
+{
+    assert(arena != NULL);
+
+    return handle >= HEADER_WORDS && handle < um_blocks_top(arena->blocks) &&
+           arena->words[handle - 2] == ~handle;
+}
+
+
+/* um_arena_length
+ * Purpose:     Gets the length of a segment
+ * Parameters:  um_arena_t arena: the arena
+ *              uint32_t handle: the segment's handle
+ * Returns:     uint32_t: the number of words in the segment
+ */
+uint32_t um_arena_length(um_arena_t arena, uint32_t handle)
+{
+    assert(um_arena_holds(arena, handle));
+    return arena->words[handle - 1];
+}
+
+
+/* reserve_arena
+ * Purpose:     Maps the address space for a new arena
+ * Parameters:  um_blocks_t blocks: the arena's blocks, taken over by it
+ * Returns:     um_arena_t: the arena, or NULL if mmap fails, in which case
+ *                  blocks is freed
+ */
+um_arena_t reserve_arena(um_blocks_t blocks)
+{
+    void *words = mmap(NULL, ARENA_WORDS * sizeof(uint32_t),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (words == MAP_FAILED) {
+        um_blocks_free(&blocks);
+        return NULL;
+    }
+
+    um_arena_t arena;
+    NEW0(arena);
+    arena->words = words;
+    arena->blocks = blocks;
+
+    return arena;
+}
@@ -0,0 +1,44 @@
+/*
+ * um_arena.h
+ *
+ * Purpose: Interface for a word arena addressed by 32-bit handles. Every
+ *          segment in the arena is named by the index of its first word,
+ *          so the word at offset i of the segment with handle h is simply
+ *          words[h + i], with no table in between. Handles are never 0.
+ */
+
+#ifndef UM_ARENA_H
+#define UM_ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct um_arena_t* um_arena_t;
+
+/* reserves an empty arena of 2^32 words; NULL if it cannot be reserved */
+um_arena_t um_arena_new();
+
+/* creates an arena holding a copy of every segment, under the same
+ * handles; NULL if it cannot be reserved */
+um_arena_t um_arena_copy(um_arena_t arena);
+
+/* releases the arena and every segment in it */
+void um_arena_free(um_arena_t *arena);
+
+
+/* returns the arena's words, which never move */
+uint32_t *um_arena_words(um_arena_t arena);
+
+/* returns the handle of a new segment of length words, all 0 */
+uint32_t um_arena_alloc(um_arena_t arena, uint32_t length);
+
+/* gives a segment's space back to the arena */
+void um_arena_release(um_arena_t arena, uint32_t handle);
+
+/* returns whether handle names a segment in the arena */
+bool um_arena_holds(um_arena_t arena, uint32_t handle);
+
+/* returns the number of words in a segment */
+uint32_t um_arena_length(um_arena_t arena, uint32_t handle);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * um_blocks.c
+ *
+ * Purpose: Implementation of the power-of-two block allocator.
+ *
+ *          There is one free list per class, a Seq_T of the offsets of
+ *          released blocks, used as a stack so the block released last,
+ *          whose memory is the likeliest to be warm, is handed out first.
+ *          A class with an empty list takes its block from top, the end of
+ *          the part of the space handed out so far, which the caller's
+ *          space keeps untouched.
+ *
+ *          The lock is only taken by allocators created locked.
+ */
+
+#include "um_blocks.h"
+#include <pthread.h>
+#include <seq.h>
+#include <mem.h>
+#include <assert.h>
+
+#define MAX_SHIFT   40
+
+/* struct um_blocks_t
+ * Purpose:     The state of a space's blocks
+ * Members:     int limit_shift: the space is 2^limit_shift units
+ *              int min_shift: the smallest class
+ *              bool locked: whether lock guards top and free
+ *              uint64_t top: units handed out at least once
+ *              Seq_T free[]: offsets of released blocks, for each class
+ *                  from 0 to limit_shift; blocks of class k are 2^k units
+ *              pthread_mutex_t lock: guards top and free if locked
+ */
+struct um_blocks_t {
+    int             limit_shift;
+    int             min_shift;
+    bool            locked;
+    uint64_t        top;
+    Seq_T           free[MAX_SHIFT + 1];
+    pthread_mutex_t lock;
+};
+
+
+/* um_blocks_new
+ * Purpose:     Creates an allocator with no blocks handed out
+ * Parameters:  int limit_shift: the space is 2^limit_shift units long
+ *              int min_shift: the class of the smallest block, at most
+ *                  limit_shift
+ *              bool locked: whether to guard the allocator with a mutex
+ * Returns:     um_blocks_t: the allocator; client frees with
+ *                  um_blocks_free
+ */
+um_blocks_t um_blocks_new(int limit_shift, int min_shift, bool locked)
+{
+    assert(limit_shift <= MAX_SHIFT && min_shift >= 0 &&
+           min_shift <= limit_shift);
+
+    um_blocks_t blocks;
+    NEW0(blocks);
+    blocks->limit_shift = limit_shift;
+    blocks->min_shift = min_shift;
+    blocks->locked = locked;
+    for (int k = 0; k <= limit_shift; k++) {
+        blocks->free[k] = Seq_new(0);
+    }
+    pthread_mutex_init(&blocks->lock, NULL);
+
+    return blocks;
+}
+
+
+/* um_blocks_copy
+ * Purpose:     Creates an allocator in the same state as another
+ * Parameters:  um_blocks_t blocks: the allocator to copy
+ * Returns:     um_blocks_t: the copy; client frees with um_blocks_free
+ * Notes:       Takes time in the number of free blocks
+ */
+um_blocks_t um_blocks_copy(um_blocks_t blocks)
+{
+    assert(blocks != NULL);
+
+    um_blocks_t copy = um_blocks_new(blocks->limit_shift, blocks->min_shift,
+                                     blocks->locked);
+    if (blocks->locked) {
+        pthread_mutex_lock(&blocks->lock);
+    }
+    copy->top = blocks->top;
+    for (int k = 0; k <= blocks->limit_shift; k++) {
+        int n = Seq_length(blocks->free[k]);
+        for (int i = 0; i < n; i++) {
+            Seq_addhi(copy->free[k], Seq_get(blocks->free[k], i));
+        }
+    }
+    if (blocks->locked) {
+        pthread_mutex_unlock(&blocks->lock);
+    }
+
+    return copy;
+}
+
+
+/* um_blocks_free
+ * Purpose:     Frees an allocator
+ * Parameters:  um_blocks_t *blocks: pointer to the allocator to free
+ * Returns:     None
+ * Notes:       Does nothing to the space itself
+ */
+void um_blocks_free(um_blocks_t *blocks)
+{
+    assert(blocks != NULL && *blocks != NULL);
+    um_blocks_t b = *blocks;
+
+    for (int k = 0; k <= b->limit_shift; k++) {
+        Seq_free(&b->free[k]);
+    }
+    pthread_mutex_destroy(&b->lock);
+    FREE(*blocks);
+}
+
+
+/* um_blocks_class
+ * Purpose:     Finds the size of block a request needs
+ * Parameters:  um_blocks_t blocks: the allocator
+ *              uint64_t units: the units the block must hold
+ * Returns:     int: the smallest k, at least the allocator's smallest
+ *                  class, such that 2^k units hold the request
+ * Notes:       May be larger than the whole space
+ *              2^k is the next power of two after units - 1, which is
+ *                  found from its leading zeros rather than by a loop
+ */
+int um_blocks_class(um_blocks_t blocks, uint64_t units)
+{
+    assert(blocks != NULL);
+
+    if (units <= (uint64_t)1 << blocks->min_shift) {
+        return blocks->min_shift;
+    }
+    return 64 - __builtin_clzll(units - 1);
+}
+
+
+/* um_blocks_alloc
+ * Purpose:     Hands out a block
+ * Parameters:  um_blocks_t blocks: the allocator
+ *              uint64_t units: the units the block must hold
+ *              uint64_t *offset: set to the block's offset in the space
+ * Returns:     bool: false if no block of the size needed is free and the
+ *                  rest of the space is too small for one
+ * Notes:       The block's class is um_blocks_class of units
+ */
+bool um_blocks_alloc(um_blocks_t blocks, uint64_t units, uint64_t *offset)
+{
+    assert(blocks != NULL && offset != NULL);
+
+    int k = um_blocks_class(blocks, units);
+    if (k > blocks->limit_shift) {
+        return false;
+    }
+
+    uint64_t size = (uint64_t)1 << k;
+    bool found = true;
+
+    if (blocks->locked) {
+        pthread_mutex_lock(&blocks->lock);
+    }
+    if (Seq_length(blocks->free[k]) > 0) {
+        *offset = (uintptr_t)Seq_remhi(blocks->free[k]);
+    } else if (blocks->top + size <= (uint64_t)1 << blocks->limit_shift) {
+        *offset = blocks->top;
+        blocks->top += size;
+    } else {
+        found = false;
+    }
+    if (blocks->locked) {
+        pthread_mutex_unlock(&blocks->lock);
+    }
+
+    return found;
+}
+
+
+/* um_blocks_release
+ * Purpose:     Makes a block available to be handed out again
+ * Parameters:  um_blocks_t blocks: the allocator that handed it out
+ *              int k: the block's class
+ *              uint64_t offset: the block's offset
+ * Returns:     None
+ * Notes:       The caller must have put the block's memory back in the
+ *                  state a block from top is in
+ */
+void um_blocks_release(um_blocks_t blocks, int k, uint64_t offset)
+{
+    assert(blocks != NULL && k >= blocks->min_shift &&
+           k <= blocks->limit_shift && offset < blocks->top);
+
+    if (blocks->locked) {
+        pthread_mutex_lock(&blocks->lock);
+    }
+    Seq_addhi(blocks->free[k], (void *)(uintptr_t)offset);
+    if (blocks->locked) {
+        pthread_mutex_unlock(&blocks->lock);
+    }
+}
+
+
+/* um_blocks_top
+ * Purpose:     Tells how much of the space has been handed out
+ * Parameters:  um_blocks_t blocks: the allocator
+ * Returns:     uint64_t: the units handed out at least once; every block
+ *                  lies below this offset
+ */
+uint64_t um_blocks_top(um_blocks_t blocks)
+{
+    assert(blocks != NULL);
+    return blocks->top;
+}
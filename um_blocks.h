@@ -0,0 +1,47 @@
+/*
+ * um_blocks.h
+ *
+ * Purpose: Interface for a power-of-two block allocator, shared by the
+ *          segment store, the huge-page pool and the handle arena. It only
+ *          hands out offsets into a space of 2^limit_shift units (bytes,
+ *          pages or words, as the caller counts them): a block of class k
+ *          is 2^k units long, and comes from a free list for its class or
+ *          else from the end of the part of the space handed out so far.
+ *          What the space is, and what is done to a block's memory when it
+ *          is released, is up to the caller.
+ */
+
+#ifndef UM_BLOCKS_H
+#define UM_BLOCKS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct um_blocks_t* um_blocks_t;
+
+/* creates an allocator for a space of 2^limit_shift units, whose blocks
+ * are at least 2^min_shift units; locked guards it with a mutex, for
+ * spaces shared by UMs on different threads */
+um_blocks_t um_blocks_new(int limit_shift, int min_shift, bool locked);
+
+/* creates an allocator with the same blocks handed out and free */
+um_blocks_t um_blocks_copy(um_blocks_t blocks);
+
+void um_blocks_free(um_blocks_t *blocks);
+
+
+/* returns the class of the smallest block holding units units */
+int um_blocks_class(um_blocks_t blocks, uint64_t units);
+
+/* sets *offset to the smallest block holding units units; false if the
+ * space is full */
+bool um_blocks_alloc(um_blocks_t blocks, uint64_t units, uint64_t *offset);
+
+/* puts the block of class k at offset on its free list */
+void um_blocks_release(um_blocks_t blocks, int k, uint64_t offset);
+
+/* returns the units handed out at least once, from the start of the
+ * space */
+uint64_t um_blocks_top(um_blocks_t blocks);
+
+#endif
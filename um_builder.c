@@ -0,0 +1,358 @@
+/*
+ * um_builder.c
+ *
+ * Purpose: Implementation of the streaming program builder.
+ *
+ *          Instructions are stored big-endian in a buffer of BUFFER_WORDS
+ *          words, which is written out whenever it fills. A label is an
+ *          index into an array holding its address once bound, and until
+ *          then the places that load it. Binding patches those places,
+ *          seeking back in the file for any already written, and frees
+ *          them, so memory grows with the number of labels and of
+ *          references still waiting for their label, never with the
+ *          length of the program.
+ */
+
+#include "um_builder.h"
+#include <stdlib.h>
+#include <seq.h>
+#include <mem.h>
+#include <assert.h>
+
+#define BUFFER_WORDS    (1 << 16)
+#define UNBOUND         0xffffffffu
+#define LV_LIMIT        (1u << 25)
+
+enum { MUL = 4, ADD = 3, LV = 13 };
+
+
+/* struct fixup
+ * Purpose:     A load of a label whose address was not yet known
+ * Members:     uint32_t at: address of the first instruction of the load
+ *              unsigned ra, rt: the registers the load was emitted with
+ *              bool wide: true for the five instruction form
+ */
+struct fixup {
+    uint32_t    at;
+    unsigned    ra;
+    unsigned    rt;
+    bool        wide;
+};
+
+/* struct label
+ * Purpose:     A label and the loads waiting for it
+ * Members:     uint32_t address: where the label is bound, or UNBOUND
+ *              Seq_T fixups: struct fixup * for each load waiting for the
+ *                  label, or NULL if there are none
+ */
+struct label {
+    uint32_t    address;
+    Seq_T       fixups;
+};
+
+/* struct um_builder_t
+ * Purpose:     A program being written
+ * Members:     FILE *fp: where the program goes
+ *              long base: fp's position when the program was started, or
+ *                  -1 if fp cannot seek
+ *              unsigned char *buffer: instructions not yet written
+ *              uint32_t written: instructions written to fp
+ *              uint32_t buffered: instructions in buffer
+ *              struct label *labels: every label, by number
+ *              uint32_t num_labels, capacity: labels used and allocated
+ *              bool ok: false once a write has failed
+ */
+struct um_builder_t {
+    FILE           *fp;
+    long            base;
+    unsigned char  *buffer;
+    uint32_t        written;
+    uint32_t        buffered;
+    struct label   *labels;
+    uint32_t        num_labels;
+    uint32_t        capacity;
+    bool            ok;
+};
+
+void emit_load(um_builder_t builder, struct fixup *fixup, um_label_t label);
+void flush_buffer(um_builder_t builder);
+void put_word(um_builder_t builder, uint32_t at, uint32_t word);
+void put_load(um_builder_t builder, struct fixup *fixup, uint32_t address);
+
+
+/* um_builder_new
+ * Purpose:     Starts writing a program
+ * Parameters:  FILE *fp: the stream to write to, open for writing
+ * Returns:     um_builder_t: the builder; client finishes it with
+ *                  um_builder_finish
+ */
+um_builder_t um_builder_new(FILE *fp)
+{
+    assert(fp != NULL);
+
+    um_builder_t builder;
+    NEW0(builder);
+    builder->fp = fp;
+    builder->base = ftell(fp);
+    builder->buffer = ALLOC(BUFFER_WORDS * sizeof(uint32_t));
+    builder->ok = true;
+
+    return builder;
+}
+
+
+/* um_builder_finish
+ * Purpose:     Writes out the rest of a program and frees its builder
+ * Parameters:  um_builder_t *builder: pointer to the builder to finish
+ * Returns:     bool: true iff every instruction and patch was written
+ * Notes:       It is a checked runtime error for a label that has been
+ *                  loaded never to be bound. fp is flushed but not closed.
+ */
+bool um_builder_finish(um_builder_t *builder)
+{
+    assert(builder != NULL && *builder != NULL);
+    um_builder_t b = *builder;
+
+    flush_buffer(b);
+    bool ok = b->ok && fflush(b->fp) == 0;
+
+    for (uint32_t i = 0; i < b->num_labels; i++) {
+        assert(b->labels[i].fixups == NULL);
+    }
+
+    FREE(b->labels);
+    FREE(b->buffer);
+    FREE(*builder);
+    return ok;
+}
+
+
+/* um_builder_emit
+ * Purpose:     Appends an instruction to the program
+ * Parameters:  um_builder_t builder: the builder
+ *              uint32_t word: the instruction
+ * Returns:     None
+ */
+void um_builder_emit(um_builder_t builder, uint32_t word)
+{
+    assert(builder != NULL);
+    assert(builder->written + builder->buffered != UNBOUND);
+
+    if (builder->buffered == BUFFER_WORDS) {
+        flush_buffer(builder);
+    }
+
+    unsigned char *p = builder->buffer + 4 * builder->buffered++;
+    p[0] = word >> 24;
+    p[1] = word >> 16;
+    p[2] = word >> 8;
+    p[3] = word;
+}
+
+
+/* um_builder_here
+ * Purpose:     Gets the address the next instruction will have
+ * Parameters:  um_builder_t builder: the builder
+ * Returns:     uint32_t: the number of instructions emitted so far
+ */
+uint32_t um_builder_here(um_builder_t builder)
+{
+    assert(builder != NULL);
+    return builder->written + builder->buffered;
+}
+
+
+/* um_builder_label
+ * Purpose:     Makes a new label
+ * Parameters:  um_builder_t builder: the builder
+ * Returns:     um_label_t: the label, which is not bound
+ */
+um_label_t um_builder_label(um_builder_t builder)
+{
+    assert(builder != NULL);
+
+    if (builder->num_labels == builder->capacity) {
+        builder->capacity = 2 * builder->capacity + 16;
+        RESIZE(builder->labels,
+               builder->capacity * (long)sizeof(struct label));
+    }
+
+    struct label *label = &builder->labels[builder->num_labels];
+    label->address = UNBOUND;
+    label->fixups = NULL;
+
+    return builder->num_labels++;
+}
+
+
+/* um_builder_bind
+ * Purpose:     Binds a label to the address of the next instruction, and
+ *                  patches every load of it emitted so far
+ * Parameters:  um_builder_t builder: the builder
+ *              um_label_t label: the label; it is a checked runtime error
+ *                  for it to be bound already
+ * Returns:     None
+ */
+void um_builder_bind(um_builder_t builder, um_label_t label)
+{
+    assert(builder != NULL && label < builder->num_labels);
+
+    struct label *l = &builder->labels[label];
+    assert(l->address == UNBOUND);
+    l->address = um_builder_here(builder);
+
+    if (l->fixups == NULL) {
+        return;
+    }
+    while (Seq_length(l->fixups) > 0) {
+        struct fixup *fixup = Seq_remlo(l->fixups);
+        put_load(builder, fixup, l->address);
+        FREE(fixup);
+    }
+    Seq_free(&l->fixups);
+}
+
+
+/* um_builder_load_label
+ * Purpose:     Emits a load_val of a label's address
+ * Parameters:  um_builder_t builder: the builder
+ *              unsigned ra: the register to load
+ *              um_label_t label: the label, bound or not
+ * Returns:     None
+ * Notes:       It is a checked runtime error for the label's address to be
+ *                  2^25 or more
+ */
+void um_builder_load_label(um_builder_t builder, unsigned ra,
+                           um_label_t label)
+{
+    assert(builder != NULL && ra < 8);
+    struct fixup fixup = { um_builder_here(builder), ra, 0, false };
+    emit_load(builder, &fixup, label);
+}
+
+
+/* um_builder_load_label_wide
+ * Purpose:     Emits instructions loading a label's address of any size
+ * Parameters:  um_builder_t builder: the builder
+ *              unsigned ra: the register to load
+ *              unsigned rt: a register to use as a temporary; it must
+ *                  differ from ra
+ *              um_label_t label: the label, bound or not
+ * Returns:     None
+ * Notes:       Emits the address's top 16 bits, a multiply by 2^16 and an
+ *                  add of the bottom 16 bits: five instructions in all
+ */
+void um_builder_load_label_wide(um_builder_t builder, unsigned ra,
+                                unsigned rt, um_label_t label)
+{
+    assert(builder != NULL && ra < 8 && rt < 8 && ra != rt);
+    struct fixup fixup = { um_builder_here(builder), ra, rt, true };
+    emit_load(builder, &fixup, label);
+}
+
+
+/* emit_load
+ * Purpose:     Emits a load of a label, filled in now if the label is
+ *                  bound and otherwise when it is
+ * Parameters:  um_builder_t builder: the builder
+ *              struct fixup *fixup: the load, at the next address
+ *              um_label_t label: the label
+ * Returns:     None
+ */
+void emit_load(um_builder_t builder, struct fixup *fixup, um_label_t label)
+{
+    assert(label < builder->num_labels);
+    struct label *l = &builder->labels[label];
+
+    for (int i = fixup->wide ? 5 : 1; i > 0; i--) {
+        um_builder_emit(builder, 0);
+    }
+
+    if (l->address != UNBOUND) {
+        put_load(builder, fixup, l->address);
+        return;
+    }
+
+    if (l->fixups == NULL) {
+        l->fixups = Seq_new(4);
+    }
+    struct fixup *waiting;
+    NEW(waiting);
+    *waiting = *fixup;
+    Seq_addhi(l->fixups, waiting);
+}
+
+
+/* flush_buffer
+ * Purpose:     Writes the buffered instructions to the file
+ * Parameters:  um_builder_t builder: the builder
+ * Returns:     None
+ */
+void flush_buffer(um_builder_t builder)
+{
+    size_t n = builder->buffered;
+    if (fwrite(builder->buffer, sizeof(uint32_t), n, builder->fp) != n) {
+        builder->ok = false;
+    }
+    builder->written += builder->buffered;
+    builder->buffered = 0;
+}
+
+
+/* put_word
+ * Purpose:     Overwrites an instruction already emitted
+ * Parameters:  um_builder_t builder: the builder
+ *              uint32_t at: the instruction's address
+ *              uint32_t word: its new value
+ * Returns:     None
+ * Notes:       An instruction already written is overwritten in the file;
+ *                  if the file cannot seek, the builder fails
+ */
+void put_word(um_builder_t builder, uint32_t at, uint32_t word)
+{
+    unsigned char bytes[4] = { word >> 24, word >> 16, word >> 8, word };
+
+    if (at >= builder->written) {
+        unsigned char *p = builder->buffer + 4 * (at - builder->written);
+        for (int i = 0; i < 4; i++) {
+            p[i] = bytes[i];
+        }
+        return;
+    }
+
+    if (builder->base < 0 ||
+        fseek(builder->fp, builder->base + 4 * (long)at, SEEK_SET) != 0 ||
+        fwrite(bytes, 1, 4, builder->fp) != 4 ||
+        fseek(builder->fp, builder->base + 4 * (long)builder->written,
+              SEEK_SET) != 0) {
+        builder->ok = false;
+    }
+}
+
+
+/* put_load
+ * Purpose:     Fills in a load of a label with the label's address
+ * Parameters:  um_builder_t builder: the builder
+ *              struct fixup *fixup: where the load is and its registers
+ *              uint32_t address: the label's address
+ * Returns:     None
+ */
+void put_load(um_builder_t builder, struct fixup *fixup, uint32_t address)
+{
+    uint32_t lv_a = (LV << 28) | (fixup->ra << 25);
+
+    if (!fixup->wide) {
+        assert(address < LV_LIMIT);
+        put_word(builder, fixup->at, lv_a | address);
+        return;
+    }
+
+    uint32_t lv_t = (LV << 28) | (fixup->rt << 25);
+    uint32_t rrr = (fixup->ra << 6) | (fixup->ra << 3) | fixup->rt;
+
+    put_word(builder, fixup->at, lv_a | (address >> 16));
+    put_word(builder, fixup->at + 1, lv_t | (1 << 16));
+    put_word(builder, fixup->at + 2, ((uint32_t)MUL << 28) | rrr);
+    put_word(builder, fixup->at + 3, lv_t | (address & 0xffff));
+    put_word(builder, fixup->at + 4, ((uint32_t)ADD << 28) | rrr);
+}
@@ -0,0 +1,52 @@
+/*
+ * um_builder.h
+ *
+ * Purpose: Interface for writing a UM program to a file as it is built.
+ *          Words go through a fixed-size buffer, so memory use does not
+ *          grow with the program. Labels can be loaded into registers
+ *          before they are bound; each reference is patched when its label
+ *          is bound, in the buffer or, once written, in the file.
+ */
+
+#ifndef UM_BUILDER_H
+#define UM_BUILDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct um_builder_t* um_builder_t;
+typedef uint32_t um_label_t;
+
+/* starts a program at fp's current position; fp must be seekable if a
+ * label is bound after a reference to it has been written out */
+um_builder_t um_builder_new(FILE *fp);
+
+/* writes out the rest of the program and frees the builder; false if a
+ * write failed */
+bool um_builder_finish(um_builder_t *builder);
+
+
+/* appends one instruction */
+void um_builder_emit(um_builder_t builder, uint32_t word);
+
+/* returns the address the next instruction will have */
+uint32_t um_builder_here(um_builder_t builder);
+
+
+/* returns a new label, not yet bound */
+um_label_t um_builder_label(um_builder_t builder);
+
+/* binds a label to the next instruction's address */
+void um_builder_bind(um_builder_t builder, um_label_t label);
+
+/* emits one load_val of a label's address, which must be under 2^25 */
+void um_builder_load_label(um_builder_t builder, unsigned ra,
+                           um_label_t label);
+
+/* emits five instructions loading any label's address into ra, using rt
+ * as a temporary */
+void um_builder_load_label_wide(um_builder_t builder, unsigned ra,
+                                unsigned rt, um_label_t label);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * um_cache.c
+ *
+ * Purpose: Implementation of the program cache.
+ *
+ *          A cached program is a loaded UM that never runs, kept under
+ *          its file's device, inode, size and modification time, so every
+ *          path to the same file finds it and an edited file is read
+ *          again. Loading returns a clone of it; clones share segments
+ *          copy-on-write (see um_mem_clone), so a load costs a few small
+ *          allocations however long the program is. The cache is guarded
+ *          by a mutex, since cloning changes the cached UM's memory.
+ */
+
+#include "um_cache.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <seq.h>
+#include <mem.h>
+#include <assert.h>
+#include "um_image.h"
+
+
+/* struct entry
+ * Purpose:     A cached program
+ * Members:     dev_t dev, ino_t ino: the file's identity
+ *              off_t size, struct timespec mtime: its size and modification
+ *                  time when it was read
+ *              um_data_t image: a UM with the program loaded, never run
+ */
+struct entry {
+    dev_t           dev;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+    um_data_t       image;
+};
+
+static Seq_T entries = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct entry *find_entry(const struct stat *sb);
+um_data_t read_program_file(const char *path, const struct stat *sb);
+
+
+/* um_cache_load
+ * Purpose:     Loads a program into a new UM, reading the file only if it
+ *                  is not cached yet
+ * Parameters:  const char *path: the program, a .umx image or a .um file
+ * Returns:     um_data_t: the UM, ready to run; client frees with free_um.
+ *                  NULL if the file cannot be read.
+ * Notes:       Any file that is not a valid .umx image is read as a .um
+ */
+um_data_t um_cache_load(const char *path)
+{
+    assert(path != NULL);
+
+    struct stat sb;
+    if (stat(path, &sb) == -1) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    struct entry *entry = find_entry(&sb);
+    if (entry == NULL) {
+        um_data_t image = read_program_file(path, &sb);
+        if (image == NULL) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+
+        NEW(entry);
+        entry->dev = sb.st_dev;
+        entry->ino = sb.st_ino;
+        entry->size = sb.st_size;
+        entry->mtime = sb.st_mtim;
+        entry->image = image;
+
+        if (entries == NULL) {
+            entries = Seq_new(4);
+        }
+        Seq_addhi(entries, entry);
+    }
+
+    um_data_t um = clone_um(entry->image);
+
+    pthread_mutex_unlock(&lock);
+    return um;
+}
+
+
+/* um_cache_clear
+ * Purpose:     Frees every cached program
+ * Parameters:  None
+ * Returns:     None
+ * Notes:       A segment still shared by a loaded UM lives on until that
+ *                  UM lets go of it
+ */
+void um_cache_clear()
+{
+    pthread_mutex_lock(&lock);
+
+    while (entries != NULL && Seq_length(entries) > 0) {
+        struct entry *entry = Seq_remhi(entries);
+        free_um(entry->image);
+        FREE(entry);
+    }
+    if (entries != NULL) {
+        Seq_free(&entries);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+
+/* find_entry
+ * Purpose:     Looks up the cached copy of a file
+ * Parameters:  const struct stat *sb: the file's current status
+ * Returns:     struct entry *: the entry, or NULL if the file is not
+ *                  cached or has changed since it was
+ */
+struct entry *find_entry(const struct stat *sb)
+{
+    int n = (entries == NULL) ? 0 : Seq_length(entries);
+
+    for (int i = 0; i < n; i++) {
+        struct entry *entry = Seq_get(entries, i);
+        if (entry->dev == sb->st_dev && entry->ino == sb->st_ino &&
+            entry->size == sb->st_size &&
+            entry->mtime.tv_sec == sb->st_mtim.tv_sec &&
+            entry->mtime.tv_nsec == sb->st_mtim.tv_nsec) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* read_program_file
+ * Purpose:     Reads a program file into segment 0 of a new UM
+ * Parameters:  const char *path: the .umx or .um file
+ *              const struct stat *sb: the file's status
+ * Returns:     um_data_t: the UM, or NULL if the file cannot be opened
+ * Notes:       Only a file without the image magic is read as a .um file.
+ *                  Exits with an error message if the file is a corrupt
+ *                  image, rather than running its header as code.
+ */
+um_data_t read_program_file(const char *path, const struct stat *sb)
+{
+    const char *error;
+    um_image_t image = um_image_open(path, &error);
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        exit(EXIT_FAILURE);
+    }
+
+    um_data_t um = initialize_um();
+    if (image != NULL) {
+        uint32_t num_words;
+        const uint32_t *words = um_image_words(image, &num_words);
+        load_um_words(um, words, num_words);
+        um_image_close(&image);
+        return um;
+    }
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        free_um(um);
+        return NULL;
+    }
+    read_um_program(fp, um, sb->st_size / 4);
+    fclose(fp);
+
+    return um;
+}
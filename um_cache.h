@@ -0,0 +1,22 @@
+/*
+ * um_cache.h
+ *
+ * Purpose: Interface for the process-wide program cache. Each program
+ *          file is read and converted once; every UM loaded from it gets
+ *          segment 0 shared copy-on-write with the others, and only a UM
+ *          that stores to segment 0 pays for its own copy.
+ */
+
+#ifndef UM_CACHE_H
+#define UM_CACHE_H
+
+#include "um_operate.h"
+
+/* returns a new UM with the program at path (.um or .umx) loaded; NULL if
+ * the file cannot be read */
+um_data_t um_cache_load(const char *path);
+
+/* frees every cached program; UMs already loaded keep their segments */
+void um_cache_clear();
+
+#endif
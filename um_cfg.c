@@ -0,0 +1,863 @@
+/*
+ * um_cfg.c
+ *
+ * Purpose: Implementation of the dynamic control-flow graph.
+ *
+ *          A block is named by the word it starts at. Since only load_prog
+ *          transfers control, a block always ends at the same load_prog
+ *          unless the program rewrites its own code, so the block and its
+ *          length are known once its load_prog is reached. Blocks are
+ *          looked up by start through an array indexed by program counter.
+ *          A load_prog that copies a segment into segment 0 starts a new
+ *          version of the code, whose blocks are new nodes, since the same
+ *          word may now hold different instructions.
+ *
+ *          Loops are found when the graph is written. Dominators are
+ *          computed with the iterative algorithm of Cooper, Harvey and
+ *          Kennedy over the observed edges, from the first block. An edge
+ *          to a block that dominates its source is a back edge, and the
+ *          natural loop of a header is every block that reaches one of its
+ *          back edges without passing through it. Natural loops are nested
+ *          or disjoint, so handing each block to loops from the largest to
+ *          the smallest leaves it in its innermost loop. Cycles entered at
+ *          more than one block have no natural loop, and their retreating
+ *          edges are only counted.
+ */
+
+#include "um_cfg.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <mem.h>
+#include <assert.h>
+
+#define NO_NODE         UINT32_MAX
+#define NO_LOOP         UINT32_MAX
+#define HEAT_LEVELS     255
+
+/* struct edge
+ * Purpose:     A jump observed from a block
+ * Members:     uint32_t to: the block jumped to
+ *              uint64_t count: times the jump was taken
+ */
+struct edge {
+    uint32_t    to;
+    uint64_t    count;
+};
+
+/* struct node
+ * Purpose:     A block of segment 0
+ * Members:     uint32_t version: copies of segment 0 loaded before it ran
+ *              uint32_t start, end: its first word and its load_prog or halt
+ *              uint64_t runs: times it ran to its end
+ *              uint64_t instructions: instructions executed in it
+ *              struct edge *edges: jumps taken from its end
+ *              uint32_t num_edges, edge_capacity: entries used, allocated
+ *              uint32_t order: its place in reverse postorder
+ *              uint32_t idom: its immediate dominator
+ *              uint32_t loop: the innermost loop holding it, or NO_LOOP
+ */
+struct node {
+    uint32_t     version;
+    uint32_t     start;
+    uint32_t     end;
+    uint64_t     runs;
+    uint64_t     instructions;
+    struct edge *edges;
+    uint32_t     num_edges;
+    uint32_t     edge_capacity;
+    uint32_t     order;
+    uint32_t     idom;
+    uint32_t     loop;
+};
+
+/* struct loop
+ * Purpose:     A natural loop
+ * Members:     uint32_t header: the block every entry goes through
+ *              uint32_t parent: the innermost loop holding it, or NO_LOOP
+ *              uint32_t depth: 1 for an outermost loop
+ *              uint32_t *body, size: its blocks, the header among them
+ *              uint64_t instructions: executed in its blocks, including
+ *                  those of loops nested in it
+ *              uint64_t iterations: back edges taken to its header
+ */
+struct loop {
+    uint32_t    header;
+    uint32_t    parent;
+    uint32_t    depth;
+    uint32_t   *body;
+    uint32_t    size;
+    uint64_t    instructions;
+    uint64_t    iterations;
+};
+
+/* struct um_cfg_t
+ * Purpose:     The graph and what was found in it
+ * Members:     struct node *nodes: the blocks, the first block first
+ *              uint32_t num_nodes, node_capacity: entries used, allocated
+ *              uint32_t *node_at: the block of the current version that
+ *                  starts at each word, or NO_NODE
+ *              uint32_t at_capacity: entries allocated in node_at
+ *              uint32_t version: copies of segment 0 loaded so far
+ *              uint32_t current: the block running now
+ *              uint64_t instructions: executed in blocks that have ended
+ *              uint64_t edges: distinct edges
+ *              struct loop *loops: the natural loops, largest first
+ *              uint32_t num_loops: entries in loops
+ *              uint64_t retreating: edges back to blocks that do not
+ *                  dominate them
+ *              uint64_t hottest: most instructions executed in one block
+ *              bool analyzed: true iff the loops are up to date
+ */
+struct um_cfg_t {
+    struct node *nodes;
+    uint32_t     num_nodes;
+    uint32_t     node_capacity;
+    uint32_t    *node_at;
+    uint32_t     at_capacity;
+    uint32_t     version;
+    uint32_t     current;
+    uint64_t     instructions;
+    uint64_t     edges;
+    struct loop *loops;
+    uint32_t     num_loops;
+    uint64_t     retreating;
+    uint64_t     hottest;
+    bool         analyzed;
+};
+
+uint32_t node_for(um_cfg_t cfg, uint32_t start);
+void end_block(um_cfg_t cfg, uint32_t tail);
+void analyze(um_cfg_t cfg);
+void free_loops(um_cfg_t cfg);
+void number_nodes(um_cfg_t cfg);
+void find_dominators(um_cfg_t cfg, const uint32_t *by_order,
+                     const uint32_t *pred_start, const uint32_t *preds);
+bool dominates(um_cfg_t cfg, uint32_t a, uint32_t b);
+void find_loops(um_cfg_t cfg, const uint32_t *pred_start,
+                const uint32_t *preds, const uint64_t *pred_counts);
+int compare_sizes(const void *a, const void *b);
+void nest_loops(um_cfg_t cfg);
+void print_location(FILE *fp, const struct node *node);
+void write_cluster(um_cfg_t cfg, FILE *fp, uint32_t loop, int indent);
+void write_dot_node(um_cfg_t cfg, FILE *fp, uint32_t i, int indent);
+
+
+/* um_cfg_new
+ * Purpose:     Creates an empty graph
+ * Parameters:  None
+ * Returns:     um_cfg_t: the graph, whose first block starts at word 0;
+ *                  client frees with um_cfg_free
+ */
+um_cfg_t um_cfg_new()
+{
+    um_cfg_t cfg;
+    NEW0(cfg);
+
+    cfg->node_capacity = 64;
+    cfg->nodes = ALLOC(cfg->node_capacity * sizeof(struct node));
+    cfg->current = node_for(cfg, 0);
+
+    return cfg;
+}
+
+
+/* um_cfg_free
+ * Purpose:     Frees a graph
+ * Parameters:  um_cfg_t *cfg: pointer to the graph to free
+ * Returns:     None
+ */
+void um_cfg_free(um_cfg_t *cfg)
+{
+    assert(cfg != NULL && *cfg != NULL);
+
+    free_loops(*cfg);
+    for (uint32_t i = 0; i < (*cfg)->num_nodes; i++) {
+        FREE((*cfg)->nodes[i].edges);
+    }
+    FREE((*cfg)->nodes);
+    FREE((*cfg)->node_at);
+    FREE(*cfg);
+}
+
+
+/* um_cfg_jump
+ * Purpose:     Ends the current block at a load_prog and follows its jump
+ * Parameters:  um_cfg_t cfg: the graph
+ *              uint32_t tail: address of the load_prog
+ *              uint32_t seg_id: the segment it loads, 0 for a jump
+ *              uint32_t target: the address it jumps to
+ * Returns:     None
+ * Notes:       The client must not pass a target outside segment 0, which
+ *                  the UM faults on
+ */
+void um_cfg_jump(um_cfg_t cfg, uint32_t tail, uint32_t seg_id,
+                 uint32_t target)
+{
+    assert(cfg != NULL);
+
+    uint32_t from = cfg->current;
+    end_block(cfg, tail);
+
+    if (seg_id != 0) {
+        cfg->version++;
+        for (uint32_t pc = 0; pc < cfg->at_capacity; pc++) {
+            cfg->node_at[pc] = NO_NODE;
+        }
+    }
+    uint32_t to = node_for(cfg, target);
+
+    struct node *node = &cfg->nodes[from];
+    uint32_t e = 0;
+    while (e < node->num_edges && node->edges[e].to != to) {
+        e++;
+    }
+    if (e == node->num_edges) {
+        if (node->num_edges == node->edge_capacity) {
+            node->edge_capacity = 2 * node->edge_capacity + 1;
+            RESIZE(node->edges, node->edge_capacity * sizeof(struct edge));
+        }
+        node->edges[e].to = to;
+        node->edges[e].count = 0;
+        node->num_edges++;
+        cfg->edges++;
+    }
+    node->edges[e].count++;
+
+    cfg->current = to;
+    cfg->analyzed = false;
+}
+
+
+/* um_cfg_halt
+ * Purpose:     Ends the current block at a halt
+ * Parameters:  um_cfg_t cfg: the graph
+ *              uint32_t tail: address of the halt
+ * Returns:     None
+ */
+void um_cfg_halt(um_cfg_t cfg, uint32_t tail)
+{
+    assert(cfg != NULL);
+
+    end_block(cfg, tail);
+    cfg->analyzed = false;
+}
+
+
+/* um_cfg_write_dot
+ * Purpose:     Writes the graph in Graphviz DOT
+ * Parameters:  um_cfg_t cfg: the graph
+ *              FILE *fp: where to write it
+ * Returns:     None
+ * Notes:       Blocks are labeled with their words and the share of
+ *                  instructions executed in them, and shaded by it. Loops
+ *                  are nested clusters labeled with their share and
+ *                  iterations. Edges are labeled with their counts.
+ */
+void um_cfg_write_dot(um_cfg_t cfg, FILE *fp)
+{
+    assert(cfg != NULL && fp != NULL);
+
+    analyze(cfg);
+
+    fprintf(fp, "digraph cfg {\n");
+    fprintf(fp, "    node [shape=box, style=filled, "
+                "fontname=\"monospace\"];\n");
+    write_cluster(cfg, fp, NO_LOOP, 1);
+
+    uint64_t busiest = 1;
+    for (uint32_t i = 0; i < cfg->num_nodes; i++) {
+        for (uint32_t e = 0; e < cfg->nodes[i].num_edges; e++) {
+            if (cfg->nodes[i].edges[e].count > busiest) {
+                busiest = cfg->nodes[i].edges[e].count;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < cfg->num_nodes; i++) {
+        for (uint32_t e = 0; e < cfg->nodes[i].num_edges; e++) {
+            struct edge *edge = &cfg->nodes[i].edges[e];
+            fprintf(fp, "    n%u -> n%u [label=\"%llu\", penwidth=%.1f];\n",
+                    i, edge->to, (unsigned long long)edge->count,
+                    1.0 + 4.0 * edge->count / busiest);
+        }
+    }
+    fprintf(fp, "}\n");
+}
+
+
+/* um_cfg_write_folded
+ * Purpose:     Writes the graph as folded stacks for flame graph tools
+ * Parameters:  um_cfg_t cfg: the graph
+ *              FILE *fp: where to write it
+ * Returns:     None
+ * Notes:       One line per block that executed instructions, for example
+ *                  "loop@12;loop@40;block@40-57 1234", where a loop is
+ *                  named by its header's first word and a block in a later
+ *                  copy of segment 0 is prefixed with its version ("v1:")
+ */
+void um_cfg_write_folded(um_cfg_t cfg, FILE *fp)
+{
+    assert(cfg != NULL && fp != NULL);
+
+    analyze(cfg);
+
+    uint32_t *nest = ALLOC((cfg->num_loops + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < cfg->num_nodes; i++) {
+        struct node *node = &cfg->nodes[i];
+        if (node->instructions == 0) {
+            continue;
+        }
+
+        uint32_t depth = 0;
+        for (uint32_t l = node->loop; l != NO_LOOP; l = cfg->loops[l].parent) {
+            nest[depth++] = l;
+        }
+        while (depth > 0) {
+            fprintf(fp, "loop@");
+            print_location(fp, &cfg->nodes[cfg->loops[nest[--depth]].header]);
+            fprintf(fp, ";");
+        }
+        fprintf(fp, "block@");
+        print_location(fp, node);
+        fprintf(fp, "-%u %llu\n", node->end,
+                (unsigned long long)node->instructions);
+    }
+    FREE(nest);
+}
+
+
+/* um_cfg_report
+ * Purpose:     Prints the size of the graph and its hottest loops
+ * Parameters:  um_cfg_t cfg: the graph
+ *              FILE *fp: where to print
+ *              unsigned top: the most loops to list
+ * Returns:     None
+ * Notes:       Loops are listed by instructions executed in them, nested
+ *                  loops included; entries counts the times the header ran
+ *                  other than by a back edge
+ */
+void um_cfg_report(um_cfg_t cfg, FILE *fp, unsigned top)
+{
+    assert(cfg != NULL && fp != NULL);
+
+    analyze(cfg);
+
+    fprintf(fp, "cfg: %u blocks, %llu edges, %u loops, %llu instructions",
+            cfg->num_nodes, (unsigned long long)cfg->edges, cfg->num_loops,
+            (unsigned long long)cfg->instructions);
+    if (cfg->version > 0) {
+        fprintf(fp, ", %u later version%s of segment 0", cfg->version,
+                (cfg->version == 1) ? "" : "s");
+    }
+    fprintf(fp, "\n");
+    if (cfg->retreating > 0) {
+        fprintf(fp, "%llu retreating edges are in cycles with more than one "
+                    "entry, outside any loop\n",
+                (unsigned long long)cfg->retreating);
+    }
+    if (cfg->num_loops == 0) {
+        return;
+    }
+
+    uint32_t shown = (cfg->num_loops < top) ? cfg->num_loops : top;
+    bool *listed = CALLOC(cfg->num_loops, sizeof(bool));
+
+    fprintf(fp, "%-14s %5s %7s %16s %7s %14s %12s\n", "loop", "depth",
+            "blocks", "instructions", "share", "iterations", "entries");
+    for (uint32_t k = 0; k < shown; k++) {
+        uint32_t best = NO_LOOP;
+        for (uint32_t l = 0; l < cfg->num_loops; l++) {
+            if (!listed[l] && (best == NO_LOOP ||
+                cfg->loops[l].instructions > cfg->loops[best].instructions)) {
+                best = l;
+            }
+        }
+        listed[best] = true;
+
+        struct loop *loop = &cfg->loops[best];
+        struct node *header = &cfg->nodes[loop->header];
+        uint64_t runs = header->runs;
+        char name[32];
+
+        if (header->version > 0) {
+            snprintf(name, sizeof(name), "v%u:%u", header->version,
+                     header->start);
+        } else {
+            snprintf(name, sizeof(name), "%u", header->start);
+        }
+        fprintf(fp, "%-14s %5u %7u %16llu %6.2f%% %14llu %12llu\n", name,
+                loop->depth, loop->size,
+                (unsigned long long)loop->instructions,
+                100.0 * loop->instructions / cfg->instructions,
+                (unsigned long long)loop->iterations,
+                (unsigned long long)(runs > loop->iterations ?
+                                     runs - loop->iterations : 0));
+    }
+    FREE(listed);
+}
+
+
+/* node_for
+ * Purpose:     Finds the block of the current version starting at a word,
+ *                  creating it if it has not run before
+ * Parameters:  um_cfg_t cfg: the graph
+ *              uint32_t start: the block's first word
+ * Returns:     uint32_t: the block
+ */
+uint32_t node_for(um_cfg_t cfg, uint32_t start)
+{
+    if (start >= cfg->at_capacity) {
+        uint32_t capacity = 2 * cfg->at_capacity;
+        if (capacity <= start) {
+            capacity = start + 1;
+        }
+        RESIZE(cfg->node_at, capacity * sizeof(uint32_t));
+        for (uint32_t pc = cfg->at_capacity; pc < capacity; pc++) {
+            cfg->node_at[pc] = NO_NODE;
+        }
+        cfg->at_capacity = capacity;
+    }
+
+    if (cfg->node_at[start] == NO_NODE) {
+        if (cfg->num_nodes == cfg->node_capacity) {
+            cfg->node_capacity *= 2;
+            RESIZE(cfg->nodes, cfg->node_capacity * sizeof(struct node));
+        }
+
+        struct node *node = &cfg->nodes[cfg->num_nodes];
+        node->version = cfg->version;
+        node->start = start;
+        node->end = start;
+        node->runs = 0;
+        node->instructions = 0;
+        node->edges = NULL;
+        node->num_edges = 0;
+        node->edge_capacity = 0;
+        node->loop = NO_LOOP;
+        cfg->node_at[start] = cfg->num_nodes++;
+    }
+
+    return cfg->node_at[start];
+}
+
+
+/* end_block
+ * Purpose:     Counts a run of the current block, ending at tail
+ * Parameters:  um_cfg_t cfg: the graph
+ *              uint32_t tail: address of its load_prog or halt
+ * Returns:     None
+ * Notes:       The block ran every word from its start through tail
+ */
+void end_block(um_cfg_t cfg, uint32_t tail)
+{
+    struct node *node = &cfg->nodes[cfg->current];
+    uint64_t length = (uint64_t)tail - node->start + 1;
+
+    node->end = tail;
+    node->runs++;
+    node->instructions += length;
+    cfg->instructions += length;
+}
+
+
+/* analyze
+ * Purpose:     Finds the loops of the graph as it stands
+ * Parameters:  um_cfg_t cfg: the graph
+ * Returns:     None
+ * Notes:       Does nothing if no jump has been recorded since the last call
+ */
+void analyze(um_cfg_t cfg)
+{
+    if (cfg->analyzed) {
+        return;
+    }
+    free_loops(cfg);
+    cfg->retreating = 0;
+
+    uint32_t n = cfg->num_nodes;
+
+    cfg->hottest = 1;
+    for (uint32_t i = 0; i < n; i++) {
+        if (cfg->nodes[i].instructions > cfg->hottest) {
+            cfg->hottest = cfg->nodes[i].instructions;
+        }
+    }
+
+    /* predecessors of each block, from pred_start[i] to pred_start[i + 1] */
+    uint32_t *pred_start = CALLOC(n + 1, sizeof(uint32_t));
+    uint32_t *preds = ALLOC((cfg->edges + 1) * sizeof(uint32_t));
+    uint64_t *pred_counts = ALLOC((cfg->edges + 1) * sizeof(uint64_t));
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t e = 0; e < cfg->nodes[i].num_edges; e++) {
+            pred_start[cfg->nodes[i].edges[e].to + 1]++;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        pred_start[i + 1] += pred_start[i];
+    }
+    uint32_t *filled = CALLOC(n, sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t e = 0; e < cfg->nodes[i].num_edges; e++) {
+            struct edge *edge = &cfg->nodes[i].edges[e];
+            uint32_t slot = pred_start[edge->to] + filled[edge->to]++;
+            preds[slot] = i;
+            pred_counts[slot] = edge->count;
+        }
+    }
+    FREE(filled);
+
+    number_nodes(cfg);
+    uint32_t *by_order = ALLOC(n * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+        by_order[cfg->nodes[i].order] = i;
+    }
+
+    find_dominators(cfg, by_order, pred_start, preds);
+    find_loops(cfg, pred_start, preds, pred_counts);
+    nest_loops(cfg);
+
+    FREE(by_order);
+    FREE(pred_counts);
+    FREE(preds);
+    FREE(pred_start);
+    cfg->analyzed = true;
+}
+
+
+/* free_loops
+ * Purpose:     Forgets the loops found by the last analysis
+ * Parameters:  um_cfg_t cfg: the graph
+ * Returns:     None
+ */
+void free_loops(um_cfg_t cfg)
+{
+    for (uint32_t l = 0; l < cfg->num_loops; l++) {
+        FREE(cfg->loops[l].body);
+    }
+    if (cfg->loops != NULL) {
+        FREE(cfg->loops);
+    }
+    cfg->num_loops = 0;
+    for (uint32_t i = 0; i < cfg->num_nodes; i++) {
+        cfg->nodes[i].loop = NO_LOOP;
+    }
+}
+
+
+/* number_nodes
+ * Purpose:     Numbers the blocks in reverse postorder from the first
+ * Parameters:  um_cfg_t cfg: the graph
+ * Returns:     None
+ * Notes:       Every block was reached by an edge from the first, so every
+ *                  block is numbered. The walk keeps its own stack, since
+ *                  the graph may be deeper than the call stack allows.
+ */
+void number_nodes(um_cfg_t cfg)
+{
+    uint32_t n = cfg->num_nodes;
+    uint32_t *stack = ALLOC(n * sizeof(uint32_t));
+    uint32_t *next_edge = CALLOC(n, sizeof(uint32_t));
+    bool *seen = CALLOC(n, sizeof(bool));
+    uint32_t depth = 0;
+    uint32_t remaining = n;
+
+    stack[depth++] = 0;
+    seen[0] = true;
+    while (depth > 0) {
+        struct node *node = &cfg->nodes[stack[depth - 1]];
+        uint32_t *e = &next_edge[stack[depth - 1]];
+
+        if (*e < node->num_edges) {
+            uint32_t to = node->edges[(*e)++].to;
+            if (!seen[to]) {
+                seen[to] = true;
+                stack[depth++] = to;
+            }
+        } else {
+            node->order = --remaining;
+            depth--;
+        }
+    }
+    assert(remaining == 0);
+
+    FREE(seen);
+    FREE(next_edge);
+    FREE(stack);
+}
+
+
+/* find_dominators
+ * Purpose:     Sets the immediate dominator of every block
+ * Parameters:  um_cfg_t cfg: the graph, numbered in reverse postorder
+ *              const uint32_t *by_order: the blocks in reverse postorder
+ *              const uint32_t *pred_start, *preds: predecessors of each
+ *                  block (see analyze)
+ * Returns:     None
+ * Notes:       The first block is its own immediate dominator
+ */
+void find_dominators(um_cfg_t cfg, const uint32_t *by_order,
+                     const uint32_t *pred_start, const uint32_t *preds)
+{
+    struct node *nodes = cfg->nodes;
+
+    for (uint32_t i = 0; i < cfg->num_nodes; i++) {
+        nodes[i].idom = NO_NODE;
+    }
+    nodes[0].idom = 0;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t k = 1; k < cfg->num_nodes; k++) {
+            uint32_t b = by_order[k];
+            uint32_t idom = NO_NODE;
+
+            for (uint32_t p = pred_start[b]; p < pred_start[b + 1]; p++) {
+                uint32_t other = preds[p];
+                if (nodes[other].idom == NO_NODE) {
+                    continue;
+                }
+                if (idom == NO_NODE) {
+                    idom = other;
+                    continue;
+                }
+                while (idom != other) {
+                    while (nodes[idom].order > nodes[other].order) {
+                        idom = nodes[idom].idom;
+                    }
+                    while (nodes[other].order > nodes[idom].order) {
+                        other = nodes[other].idom;
+                    }
+                }
+            }
+
+            if (nodes[b].idom != idom) {
+                nodes[b].idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+
+/* dominates
+ * Purpose:     Tells whether every path from the first block to b passes
+ *                  through a
+ * Parameters:  um_cfg_t cfg: the graph, with dominators found
+ *              uint32_t a, b: the blocks
+ * Returns:     bool: true iff a dominates b
+ */
+bool dominates(um_cfg_t cfg, uint32_t a, uint32_t b)
+{
+    while (b != a && b != 0) {
+        b = cfg->nodes[b].idom;
+    }
+    return b == a;
+}
+
+
+/* find_loops
+ * Purpose:     Finds the natural loop of every block that is the target of
+ *                  a back edge, and counts the other retreating edges
+ * Parameters:  um_cfg_t cfg: the graph, with dominators found
+ *              const uint32_t *pred_start, *preds: predecessors of each
+ *                  block (see analyze)
+ *              const uint64_t *pred_counts: times each of those edges was
+ *                  taken
+ * Returns:     None
+ */
+void find_loops(um_cfg_t cfg, const uint32_t *pred_start,
+                const uint32_t *preds, const uint64_t *pred_counts)
+{
+    uint32_t n = cfg->num_nodes;
+    uint32_t capacity = 0;
+    uint32_t *mark = ALLOC(n * sizeof(uint32_t));
+    uint32_t *work = ALLOC(n * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < n; i++) {
+        mark[i] = NO_LOOP;
+    }
+
+    for (uint32_t h = 0; h < n; h++) {
+        uint32_t l = NO_LOOP;
+        uint32_t *body = NULL;
+        uint32_t size = 0;
+        uint32_t pending = 0;
+
+        for (uint32_t p = pred_start[h]; p < pred_start[h + 1]; p++) {
+            uint32_t tail = preds[p];
+
+            if (!dominates(cfg, h, tail)) {
+                if (cfg->nodes[h].order <= cfg->nodes[tail].order) {
+                    cfg->retreating++;
+                }
+                continue;
+            }
+
+            if (l == NO_LOOP) {
+                if (cfg->num_loops == capacity) {
+                    capacity = 2 * capacity + 4;
+                    RESIZE(cfg->loops, capacity * sizeof(struct loop));
+                }
+                l = cfg->num_loops++;
+                cfg->loops[l].header = h;
+                cfg->loops[l].iterations = 0;
+                body = ALLOC(n * sizeof(uint32_t));
+                body[size++] = h;
+                mark[h] = l;
+            }
+            cfg->loops[l].iterations += pred_counts[p];
+
+            if (mark[tail] != l) {
+                mark[tail] = l;
+                body[size++] = tail;
+                work[pending++] = tail;
+            }
+        }
+
+        /* everything that reaches a back edge without passing the header */
+        while (pending > 0) {
+            uint32_t b = work[--pending];
+            for (uint32_t p = pred_start[b]; p < pred_start[b + 1]; p++) {
+                if (mark[preds[p]] != l) {
+                    mark[preds[p]] = l;
+                    body[size++] = preds[p];
+                    work[pending++] = preds[p];
+                }
+            }
+        }
+
+        if (l != NO_LOOP) {
+            RESIZE(body, size * sizeof(uint32_t));
+            cfg->loops[l].body = body;
+            cfg->loops[l].size = size;
+        }
+    }
+
+    FREE(work);
+    FREE(mark);
+}
+
+
+/* compare_sizes
+ * Purpose:     qsort comparison putting larger loops first
+ * Parameters:  const void *a, *b: the loops
+ * Returns:     int: negative if a is larger, positive if b is, else 0
+ */
+int compare_sizes(const void *a, const void *b)
+{
+    const struct loop *x = a;
+    const struct loop *y = b;
+
+    return (x->size < y->size) - (x->size > y->size);
+}
+
+
+/* nest_loops
+ * Purpose:     Finds the parent and depth of every loop, the innermost
+ *                  loop of every block, and the instructions in every loop
+ * Parameters:  um_cfg_t cfg: the graph, with its loops found
+ * Returns:     None
+ * Notes:       Sorts the loops largest first; a loop's parent is then the
+ *                  innermost loop its header was in before its own turn
+ */
+void nest_loops(um_cfg_t cfg)
+{
+    if (cfg->num_loops == 0) {
+        return;
+    }
+    qsort(cfg->loops, cfg->num_loops, sizeof(struct loop), compare_sizes);
+
+    for (uint32_t l = 0; l < cfg->num_loops; l++) {
+        struct loop *loop = &cfg->loops[l];
+
+        loop->parent = cfg->nodes[loop->header].loop;
+        loop->depth = (loop->parent == NO_LOOP) ? 1 :
+                      cfg->loops[loop->parent].depth + 1;
+        loop->instructions = 0;
+        for (uint32_t k = 0; k < loop->size; k++) {
+            cfg->nodes[loop->body[k]].loop = l;
+            loop->instructions += cfg->nodes[loop->body[k]].instructions;
+        }
+    }
+}
+
+
+/* print_location
+ * Purpose:     Prints the first word of a block, prefixed with its version
+ *                  of segment 0 if it is not the first
+ * Parameters:  FILE *fp: where to print
+ *              const struct node *node: the block
+ * Returns:     None
+ */
+void print_location(FILE *fp, const struct node *node)
+{
+    if (node->version > 0) {
+        fprintf(fp, "v%u:", node->version);
+    }
+    fprintf(fp, "%u", node->start);
+}
+
+
+/* write_cluster
+ * Purpose:     Writes the DOT for the blocks and loops directly inside a
+ *                  loop, and then for everything nested in those loops
+ * Parameters:  um_cfg_t cfg: the graph, analyzed
+ *              FILE *fp: where to write
+ *              uint32_t loop: the loop, or NO_LOOP for the whole graph
+ *              int indent: nesting level, for readable output
+ * Returns:     None
+ */
+void write_cluster(um_cfg_t cfg, FILE *fp, uint32_t loop, int indent)
+{
+    for (uint32_t l = 0; l < cfg->num_loops; l++) {
+        struct loop *inner = &cfg->loops[l];
+        if (inner->parent != loop) {
+            continue;
+        }
+
+        fprintf(fp, "%*ssubgraph cluster_%u {\n", 4 * indent, "", l);
+        fprintf(fp, "%*slabel=\"loop at ", 4 * (indent + 1), "");
+        print_location(fp, &cfg->nodes[inner->header]);
+        fprintf(fp, "\\n%.2f%% of instructions, %llu iterations\";\n",
+                cfg->instructions == 0 ? 0.0 :
+                100.0 * inner->instructions / cfg->instructions,
+                (unsigned long long)inner->iterations);
+        write_cluster(cfg, fp, l, indent + 1);
+        fprintf(fp, "%*s}\n", 4 * indent, "");
+    }
+
+    for (uint32_t i = 0; i < cfg->num_nodes; i++) {
+        if (cfg->nodes[i].loop == loop) {
+            write_dot_node(cfg, fp, i, indent);
+        }
+    }
+}
+
+
+/* write_dot_node
+ * Purpose:     Writes the DOT for one block
+ * Parameters:  um_cfg_t cfg: the graph
+ *              FILE *fp: where to write
+ *              uint32_t i: the block
+ *              int indent: nesting level, for readable output
+ * Returns:     None
+ * Notes:       Loop headers get a double border. The hottest block is
+ *                  red, and cooler ones fade to white.
+ */
+void write_dot_node(um_cfg_t cfg, FILE *fp, uint32_t i, int indent)
+{
+    struct node *node = &cfg->nodes[i];
+    double share = (cfg->instructions == 0) ? 0.0 :
+                   100.0 * node->instructions / cfg->instructions;
+    bool header = node->loop != NO_LOOP &&
+                  cfg->loops[node->loop].header == i;
+    unsigned fade = HEAT_LEVELS - (unsigned)((double)HEAT_LEVELS *
+                                             node->instructions / cfg->hottest);
+
+    fprintf(fp, "%*sn%u [label=\"", 4 * indent, "", i);
+    print_location(fp, node);
+    fprintf(fp, "-%u\\n%llu instructions, %.2f%%\", "
+                "fillcolor=\"#ff%02x%02x\"%s];\n", node->end,
+            (unsigned long long)node->instructions, share, fade, fade,
+            header ? ", peripheries=2" : "");
+}
@@ -0,0 +1,49 @@
+/*
+ * um_cfg.h
+ *
+ * Purpose: Interface for building a control-flow graph of segment 0 from
+ *          the jumps a program actually takes. The UM has no calls or
+ *          branches, only load_prog, so a block runs straight from a jump
+ *          target to the next load_prog. Each block is counted as it ends,
+ *          each jump is an edge with a count, and natural loops are found
+ *          from the dominators of the observed graph. The graph is written
+ *          as Graphviz DOT and as folded stacks for flame graphs, with loop
+ *          nests as frames.
+ */
+
+#ifndef UM_CFG_H
+#define UM_CFG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct um_cfg_t* um_cfg_t;
+
+/* starts an empty graph whose first block starts at word 0 */
+um_cfg_t um_cfg_new();
+
+/* frees the graph */
+void um_cfg_free(um_cfg_t *cfg);
+
+
+/* records the load_prog at tail: it ends the current block and jumps to
+ * target, in a new copy of segment 0 unless seg_id is 0 */
+void um_cfg_jump(um_cfg_t cfg, uint32_t tail, uint32_t seg_id,
+                 uint32_t target);
+
+/* records the halt at tail, which ends the current block */
+void um_cfg_halt(um_cfg_t cfg, uint32_t tail);
+
+
+/* writes the graph in DOT, with loops as nested clusters */
+void um_cfg_write_dot(um_cfg_t cfg, FILE *fp);
+
+/* writes one folded stack per block: its loop nest, outermost first, then
+ * the block, weighted by the instructions executed in it */
+void um_cfg_write_folded(um_cfg_t cfg, FILE *fp);
+
+/* prints the size of the graph and the top loops by instructions executed
+ * in them */
+void um_cfg_report(um_cfg_t cfg, FILE *fp, unsigned top);
+
+#endif
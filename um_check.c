@@ -0,0 +1,419 @@
+/*
+ * um_check.c
+ *
+ * Purpose: Implementation of the lockstep engine checker.
+ *
+ *          The reference and the machine under check each get io buffers,
+ *          fed the same input. Each block, the reference runs up to block
+ *          instructions through read_instruction with fast loops off, and
+ *          the other machine runs as many through run_um_for, so that it
+ *          takes every shortcut its engine would in a normal run. Then the
+ *          two are compared: instructions run, halting and waiting, program
+ *          counter, registers, bytes read and written, the output of the
+ *          block, and a hash of the segments each stored to, mapped or
+ *          unmapped during the block (see hash_dirty_segments).
+ *
+ *          After every block the two agree on, the reference is cloned.
+ *          Since they agree, the clone stands for both. If a later block
+ *          differs, that block is replayed from the clone, by a fresh pair
+ *          of machines each time, to bisect the number of instructions
+ *          after which they first differ. Every replay starts from clones,
+ *          whose hashes cover all of memory, so the bisection compares the
+ *          whole state of the two machines.
+ *
+ *          Input read from stdin is kept, so replays can be fed the same
+ *          input as the run they repeat.
+ */
+
+#include "um_check.h"
+#include "um_data.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <mem.h>
+#include <assert.h>
+
+#define READ_CHUNK (64 * 1024)
+
+/* names of the engines and opcodes, for reports */
+static const char *const engine_names[] = { "generic", "specialized" };
+static const char *const op_names[16] = {
+    "mov", "seg_load", "seg_store", "add", "mult", "div", "nand", "halt",
+    "map", "unmap", "output", "input", "load_prog", "load_val", "?14", "?15"
+};
+
+/* struct checker
+ * Purpose:     A check in progress
+ * Members:     um_engine_t engine: the engine under check
+ *              um_data_t agreed: a clone of the reference at the end of
+ *                  the last block both machines agreed on
+ *              uint64_t agreed_at: instructions run before that point
+ *              char *input: all input read so far
+ *              size_t input_length, input_capacity: bytes in input and
+ *                  bytes allocated for it
+ *              bool input_ended: true once stdin has run out
+ */
+struct checker {
+    um_engine_t engine;
+    um_data_t   agreed;
+    uint64_t    agreed_at;
+    char       *input;
+    size_t      input_length;
+    size_t      input_capacity;
+    bool        input_ended;
+};
+
+uint64_t step_reference(um_data_t um, uint64_t limit);
+bool same_state(struct checker *check, um_data_t ref, um_io_t ref_io,
+                uint64_t ref_ran, um_data_t other, um_io_t other_io,
+                uint64_t other_ran, FILE *report);
+void read_check_input(struct checker *check, um_io_t ref_io,
+                      um_io_t other_io);
+um_data_t replay_machine(struct checker *check, um_io_t io);
+bool replay_agrees(struct checker *check, uint64_t limit, FILE *report);
+void report_divergence(struct checker *check, uint64_t block, FILE *report);
+
+
+/* run_um_check
+ * Purpose:     Runs a UM on the reference and on an engine in lockstep,
+ *                  and reports where they first differ, if they do
+ * Parameters:  um_data_t um: a loaded UM, with no io or stream attached;
+ *                  used as the reference
+ *              um_engine_t engine: the engine to check
+ *              uint64_t block: instructions between comparisons; a
+ *                  divergence is found by replaying up to this many
+ *              FILE *report: where to describe a divergence
+ *              uint64_t *executed: set to the instructions both ran alike
+ * Returns:     bool: true iff the two agreed until the UM halted
+ * Notes:       Writes the reference's output to stdout, after comparing
+ *                  it with the engine's, and reads stdin only when the
+ *                  reference waits for input. Segment IDs must not be
+ *                  handles, since the machines' memories are compared by
+ *                  ID.
+ */
+bool run_um_check(um_data_t um, um_engine_t engine, uint64_t block,
+                  FILE *report, uint64_t *executed)
+{
+    assert(um != NULL && block > 0 && report != NULL && executed != NULL);
+    assert(um->io == NULL && um->stream == NULL && um->words == NULL);
+
+    struct checker check = { engine, NULL, 0, NULL, 0, 0, false };
+    um_data_t other = clone_um(um);
+    um_io_t ref_io = um_io_new();
+    um_io_t other_io = um_io_new();
+    bool agreed = true;
+
+    set_um_io(um, ref_io);
+    set_um_io(other, other_io);
+    check.agreed = clone_um(um);
+
+    /* both start with every segment unhashed */
+    hash_dirty_segments(um->memory);
+    hash_dirty_segments(other->memory);
+
+    for (;;) {
+        uint64_t ref_ran = step_reference(um, block);
+        uint64_t other_ran = run_um_for(other, engine, block);
+
+        if (!same_state(&check, um, ref_io, ref_ran, other, other_io,
+                        other_ran, NULL)) {
+            report_divergence(&check, block, report);
+            agreed = false;
+            break;
+        }
+
+        size_t length;
+        const char *output = um_io_output(ref_io, &length);
+        fwrite(output, 1, length, stdout);
+        um_io_drain(ref_io, length);
+        um_io_drain(other_io, length);
+        check.agreed_at += ref_ran;
+
+        if (is_waiting(um)) {
+            fflush(stdout);
+            read_check_input(&check, ref_io, other_io);
+        } else if (is_halting(um)) {
+            break;
+        }
+
+        free_um(check.agreed);
+        check.agreed = clone_um(um);
+    }
+
+    fflush(stdout);
+    *executed = check.agreed_at;
+
+    free_um(check.agreed);
+    free_um(other);
+    set_um_io(um, NULL);
+    um_io_free(&ref_io);
+    um_io_free(&other_io);
+    FREE(check.input);
+
+    return agreed;
+}
+
+
+/* step_reference
+ * Purpose:     Runs the reference semantics: generic handlers, one
+ *                  instruction at a time, with no loop fast-forwarding
+ * Parameters:  um_data_t um: the UM to run
+ *              uint64_t limit: the most instructions to run
+ * Returns:     uint64_t: the number of instructions run
+ * Notes:       Stops and resumes for input as run_um_for does
+ */
+uint64_t step_reference(um_data_t um, uint64_t limit)
+{
+    if (um->waiting) {
+        um->waiting = false;
+        um->halting = false;
+    }
+
+    uint64_t n = 0;
+    while (n < limit && !um->halting) {
+        read_instruction(um);
+        n++;
+    }
+
+    return n - um->waiting;
+}
+
+
+/* same_state
+ * Purpose:     Compares the reference with the machine under check after
+ *                  they have run the same block
+ * Parameters:  struct checker *check: the check
+ *              um_data_t ref, other: the two machines
+ *              um_io_t ref_io, other_io: their buffers, whose output has
+ *                  not been drained since the block began
+ *              uint64_t ref_ran, other_ran: instructions each ran
+ *              FILE *report: where to list the differences, or NULL
+ * Returns:     bool: true iff the two are the same
+ * Notes:       Marks both memories' segments clean
+ */
+bool same_state(struct checker *check, um_data_t ref, um_io_t ref_io,
+                uint64_t ref_ran, um_data_t other, um_io_t other_io,
+                uint64_t other_ran, FILE *report)
+{
+    const char *name = engine_names[check->engine];
+    bool same = true;
+
+    if (ref_ran != other_ran) {
+        same = false;
+        if (report != NULL) {
+            fprintf(report, "  instructions run: reference %llu, %s %llu\n",
+                    (unsigned long long)ref_ran, name,
+                    (unsigned long long)other_ran);
+        }
+    }
+    if (ref->halting != other->halting || ref->waiting != other->waiting) {
+        same = false;
+        if (report != NULL) {
+            fprintf(report, "  stopped: reference %s, %s %s\n",
+                    ref->waiting ? "for input" :
+                    ref->halting ? "halted" : "no", name,
+                    other->waiting ? "for input" :
+                    other->halting ? "halted" : "no");
+        }
+    }
+    if (ref->program_counter != other->program_counter) {
+        same = false;
+        if (report != NULL) {
+            fprintf(report, "  pc: reference %u, %s %u\n",
+                    ref->program_counter, name, other->program_counter);
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        if (ref->regs[i] != other->regs[i]) {
+            same = false;
+            if (report != NULL) {
+                fprintf(report, "  r%d: reference 0x%08x, %s 0x%08x\n", i,
+                        ref->regs[i], name, other->regs[i]);
+            }
+        }
+    }
+    if (ref->input_bytes != other->input_bytes) {
+        same = false;
+        if (report != NULL) {
+            fprintf(report, "  input read: reference %llu bytes, "
+                    "%s %llu bytes\n",
+                    (unsigned long long)ref->input_bytes, name,
+                    (unsigned long long)other->input_bytes);
+        }
+    }
+
+    size_t ref_length, other_length;
+    const char *ref_output = um_io_output(ref_io, &ref_length);
+    const char *other_output = um_io_output(other_io, &other_length);
+    if (ref->output_bytes != other->output_bytes ||
+        ref_length != other_length ||
+        memcmp(ref_output, other_output, ref_length) != 0) {
+        same = false;
+        if (report != NULL) {
+            fprintf(report, "  output: reference %llu bytes, %s %llu bytes,"
+                    " differing in the last %zu\n",
+                    (unsigned long long)ref->output_bytes, name,
+                    (unsigned long long)other->output_bytes,
+                    ref_length > other_length ? ref_length : other_length);
+        }
+    }
+
+    if (hash_dirty_segments(ref->memory) !=
+        hash_dirty_segments(other->memory)) {
+        same = false;
+        if (report != NULL) {
+            fprintf(report, "  memory: segments differ\n");
+        }
+    }
+
+    return same;
+}
+
+
+/* read_check_input
+ * Purpose:     Feeds both machines the next block of stdin, waiting for it
+ *                  if necessary, and keeps it for replays
+ * Parameters:  struct checker *check: the check
+ *              um_io_t ref_io, other_io: the two machines' buffers
+ * Returns:     None
+ * Notes:       Ends both machines' input at the end of stdin or on an
+ *                  error
+ */
+void read_check_input(struct checker *check, um_io_t ref_io,
+                      um_io_t other_io)
+{
+    char buffer[READ_CHUNK];
+    ssize_t n;
+
+    do {
+        n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0) {
+        check->input_ended = true;
+        um_io_end_input(ref_io);
+        um_io_end_input(other_io);
+        return;
+    }
+
+    if (check->input_length + n > check->input_capacity) {
+        check->input_capacity = 2 * (check->input_length + n);
+        RESIZE(check->input, check->input_capacity);
+    }
+    memcpy(check->input + check->input_length, buffer, n);
+    check->input_length += n;
+
+    um_io_feed(ref_io, buffer, n);
+    um_io_feed(other_io, buffer, n);
+}
+
+
+/* replay_machine
+ * Purpose:     Makes a machine in the state both last agreed on, to replay
+ *                  the block after it
+ * Parameters:  struct checker *check: the check
+ *              um_io_t io: new buffers for the machine, fed here with the
+ *                  input the agreed state had not yet read
+ * Returns:     um_data_t: the machine; client frees it with free_um
+ */
+um_data_t replay_machine(struct checker *check, um_io_t io)
+{
+    um_data_t um = clone_um(check->agreed);
+    size_t used = check->agreed->input_bytes;
+
+    if (used < check->input_length) {
+        um_io_feed(io, check->input + used, check->input_length - used);
+    }
+    if (check->input_ended) {
+        um_io_end_input(io);
+    }
+    set_um_io(um, io);
+
+    return um;
+}
+
+
+/* replay_agrees
+ * Purpose:     Replays part of the block after the agreed state on both
+ *                  the reference and the engine, and compares them
+ * Parameters:  struct checker *check: the check
+ *              uint64_t limit: instructions to replay
+ *              FILE *report: where to list any differences, or NULL
+ * Returns:     bool: true iff the two agree after limit instructions
+ */
+bool replay_agrees(struct checker *check, uint64_t limit, FILE *report)
+{
+    um_io_t ref_io = um_io_new();
+    um_io_t other_io = um_io_new();
+    um_data_t ref = replay_machine(check, ref_io);
+    um_data_t other = replay_machine(check, other_io);
+
+    uint64_t ref_ran = step_reference(ref, limit);
+    uint64_t other_ran = run_um_for(other, check->engine, limit);
+    bool same = same_state(check, ref, ref_io, ref_ran, other, other_io,
+                           other_ran, report);
+
+    free_um(ref);
+    free_um(other);
+    um_io_free(&ref_io);
+    um_io_free(&other_io);
+
+    return same;
+}
+
+
+/* report_divergence
+ * Purpose:     Finds and describes the first instruction after which the
+ *                  machines differ
+ * Parameters:  struct checker *check: the check, whose last block ended
+ *                  with the machines differing
+ *              uint64_t block: the instructions in that block
+ *              FILE *report: where to describe the divergence
+ * Returns:     None
+ * Notes:       Bisects the block, so it replays about log2(block) times
+ */
+void report_divergence(struct checker *check, uint64_t block, FILE *report)
+{
+    uint64_t same = 0;
+    uint64_t differ = block;
+
+    while (differ - same > 1) {
+        uint64_t middle = same + (differ - same) / 2;
+        if (replay_agrees(check, middle, NULL)) {
+            same = middle;
+        } else {
+            differ = middle;
+        }
+    }
+
+    um_io_t io = um_io_new();
+    um_data_t ref = replay_machine(check, io);
+    step_reference(ref, same);
+
+    uint32_t pc = ref->program_counter;
+    fprintf(report, "%s engine differs from the reference after "
+            "instruction %llu",
+            engine_names[check->engine],
+            (unsigned long long)(check->agreed_at + same + 1));
+    if (is_seg_mapped(ref->memory, 0) &&
+        pc < get_seg_length(ref->memory, 0)) {
+        uint32_t inst = get_seg_value(ref->memory, 0, pc);
+        unsigned op = inst >> 28;
+
+        if (op == 13) {
+            fprintf(report, ", pc %u: %08x %s r%u, %u\n", pc, inst,
+                    op_names[op], (inst >> 25) & 0x7, inst & 0x1ffffff);
+        } else {
+            fprintf(report, ", pc %u: %08x %s r%u, r%u, r%u\n", pc, inst,
+                    op_names[op], (inst >> 6) & 0x7, (inst >> 3) & 0x7,
+                    inst & 0x7);
+        }
+    } else {
+        fprintf(report, ", pc %u\n", pc);
+    }
+    free_um(ref);
+    um_io_free(&io);
+
+    replay_agrees(check, differ, report);
+}
@@ -0,0 +1,32 @@
+/*
+ * um_check.h
+ *
+ * Purpose: Interface for checking an execution engine against the
+ *          reference semantics. The generic handlers of um_operate.c, run
+ *          one instruction at a time with no fast paths, are the
+ *          reference. A copy of the same machine runs on the engine being
+ *          checked, in lockstep with the reference, and the two are
+ *          compared every block of instructions. If they ever differ, the
+ *          first instruction at which they do is found and reported.
+ */
+
+#ifndef UM_CHECK_H
+#define UM_CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "um_operate.h"
+
+/* instructions between comparisons when the caller has no preference */
+#define UM_CHECK_BLOCK (1 << 20)
+
+/* runs um on the reference and on engine side by side until it halts or
+ * the two differ, comparing them every block instructions; the reference's
+ * output goes to stdout, a divergence is described on report, and
+ * *executed is set to the instructions the two agreed on. False if they
+ * differed. */
+bool run_um_check(um_data_t um, um_engine_t engine, uint64_t block,
+                  FILE *report, uint64_t *executed);
+
+#endif
@@ -0,0 +1,363 @@
+/*
+ * um_checkpoint.c
+ *
+ * Purpose: Implementation of checkpoint logs.
+ *
+ *          A log starts with the 8-byte magic "UMCKPT1\n" and is followed
+ *          by records. Each record has a header holding a magic number,
+ *          flags, the body length and a checksum of the body, and then
+ *          the body: the number of instructions executed, the program
+ *          counter, the 8 registers and the segments written by
+ *          write_dirty_segments. The first record of a log is FULL and
+ *          holds every segment; the others only hold segments changed
+ *          since the record before them. Everything is in host byte order,
+ *          so a log can only be resumed on the kind of machine that wrote
+ *          it.
+ *
+ *          Records are only ever appended, and each is flushed to disk
+ *          before the run continues. A crash while appending leaves a
+ *          torn last record, which fails its length or checksum test and
+ *          is discarded on resume. When the records after the FULL one
+ *          outgrow it by COMPACT_RATIO, the next checkpoint is written as
+ *          a FULL record into a new log that then replaces the old one.
+ */
+
+#include "um_checkpoint.h"
+#include "um_data.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mem.h>
+#include <assert.h>
+
+#define RECORD_MAGIC    0x4b434d55
+#define FLAG_FULL       0x1
+#define COMPACT_RATIO   2
+
+static const char magic[8] = { 'U', 'M', 'C', 'K', 'P', 'T', '1', '\n' };
+
+
+/* struct record_header
+ * Purpose:     Header in front of every record body
+ * Members:     uint32_t magic: RECORD_MAGIC
+ *              uint32_t flags: FLAG_FULL iff the body has every segment
+ *              uint64_t length: number of bytes in the body
+ *              uint32_t checksum: FNV-1a hash of the body
+ *              uint32_t unused: keeps the header free of padding
+ */
+struct record_header {
+    uint32_t    magic;
+    uint32_t    flags;
+    uint64_t    length;
+    uint32_t    checksum;
+    uint32_t    unused;
+};
+
+
+/* struct um_checkpoint_t
+ * Purpose:     An open checkpoint log
+ * Members:     char *path: where the log lives
+ *              FILE *fp: the log, positioned at its end
+ *              uint64_t full_bytes: size of the log's FULL record, or 0 if
+ *                  no record has been written yet
+ *              uint64_t log_bytes: size of every record in the log
+ */
+struct um_checkpoint_t {
+    char       *path;
+    FILE       *fp;
+    uint64_t    full_bytes;
+    uint64_t    log_bytes;
+};
+
+FILE *create_log(const char *path);
+uint64_t append_record(FILE *fp, um_data_t um, uint64_t executed, bool full);
+bool apply_record(unsigned char *body, uint64_t length, um_data_t um,
+                  uint64_t *executed);
+void compact(um_checkpoint_t log, um_data_t um, uint64_t executed);
+void sync_dir(const char *path);
+uint32_t checksum(const unsigned char *bytes, uint64_t length);
+
+
+/* um_checkpoint_new
+ * Purpose:     Creates an empty checkpoint log
+ * Parameters:  const char *path: where to create the log
+ * Returns:     um_checkpoint_t: the log; client frees with um_checkpoint_free
+ * Notes:       Exits with an error message if the log cannot be created
+ */
+um_checkpoint_t um_checkpoint_new(const char *path)
+{
+    um_checkpoint_t log;
+    NEW0(log);
+    log->path = ALLOC(strlen(path) + 1);
+    strcpy(log->path, path);
+    log->fp = create_log(path);
+
+    return log;
+}
+
+
+/* um_checkpoint_resume
+ * Purpose:     Restores a UM from a checkpoint log and reopens the log for
+ *                  further checkpoints
+ * Parameters:  const char *path: the log
+ *              um_data_t um: a UM with no segments mapped
+ *              uint64_t *executed: set to the number of instructions the
+ *                  UM had executed when the checkpoint was taken
+ * Returns:     um_checkpoint_t: the log, or NULL if it holds no complete
+ *                  checkpoint
+ * Notes:       Applies every complete record in order and cuts off anything
+ *                  after the last one, such as a record torn by a crash
+ */
+um_checkpoint_t um_checkpoint_resume(const char *path, um_data_t um,
+                                     uint64_t *executed)
+{
+    assert(um != NULL && executed != NULL);
+
+    FILE *fp = fopen(path, "r+b");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    struct stat sb;
+    char file_magic[sizeof(magic)];
+    if (fstat(fileno(fp), &sb) == -1 ||
+        fread(file_magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+        memcmp(file_magic, magic, sizeof(magic)) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    uint64_t good_end = sizeof(magic);
+    uint64_t full_bytes = 0, log_bytes = 0;
+    struct record_header header;
+
+    while (fread(&header, sizeof(header), 1, fp) == 1 &&
+           header.magic == RECORD_MAGIC &&
+           header.length <= (uint64_t)sb.st_size - good_end - sizeof(header) &&
+           (full_bytes != 0 || (header.flags & FLAG_FULL))) {
+        unsigned char *body = ALLOC(header.length + 1);
+        bool ok = fread(body, 1, header.length, fp) == header.length &&
+                  checksum(body, header.length) == header.checksum &&
+                  apply_record(body, header.length, um, executed);
+        FREE(body);
+        if (!ok) {
+            break;
+        }
+
+        uint64_t record_bytes = sizeof(header) + header.length;
+        if (header.flags & FLAG_FULL) {
+            full_bytes = record_bytes;
+            log_bytes = 0;
+        }
+        log_bytes += record_bytes;
+        good_end += record_bytes;
+    }
+
+    if (full_bytes == 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    fflush(fp);
+    if (ftruncate(fileno(fp), good_end) == -1) {
+        fprintf(stderr, "Could not truncate checkpoint log %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fseek(fp, good_end, SEEK_SET);
+
+    um_checkpoint_t log;
+    NEW0(log);
+    log->path = ALLOC(strlen(path) + 1);
+    strcpy(log->path, path);
+    log->fp = fp;
+    log->full_bytes = full_bytes;
+    log->log_bytes = log_bytes;
+
+    return log;
+}
+
+
+/* um_checkpoint_write
+ * Purpose:     Appends a checkpoint of a UM to a log
+ * Parameters:  um_checkpoint_t log: the log
+ *              um_data_t um: the UM to save
+ *              uint64_t executed: instructions the UM has executed so far
+ * Returns:     None
+ * Notes:       The first checkpoint in a log, and any checkpoint that
+ *                  triggers compaction, holds every segment; the others
+ *                  only hold those changed since the previous checkpoint
+ */
+void um_checkpoint_write(um_checkpoint_t log, um_data_t um, uint64_t executed)
+{
+    assert(log != NULL && um != NULL);
+
+    if (log->full_bytes == 0) {
+        log->full_bytes = append_record(log->fp, um, executed, true);
+        log->log_bytes = log->full_bytes;
+    } else if (log->log_bytes > (COMPACT_RATIO + 1) * log->full_bytes) {
+        compact(log, um, executed);
+    } else {
+        log->log_bytes += append_record(log->fp, um, executed, false);
+    }
+}
+
+
+/* um_checkpoint_free
+ * Purpose:     Closes a checkpoint log and frees it
+ * Parameters:  um_checkpoint_t *log: pointer to the log to free
+ * Returns:     None
+ */
+void um_checkpoint_free(um_checkpoint_t *log)
+{
+    assert(log != NULL && *log != NULL);
+
+    fclose((*log)->fp);
+    FREE((*log)->path);
+    FREE(*log);
+}
+
+
+/* create_log
+ * Purpose:     Creates a file holding only the log magic
+ * Parameters:  const char *path: the file to create
+ * Returns:     FILE *: the file, open for appending records
+ */
+FILE *create_log(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open checkpoint log %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(magic, 1, sizeof(magic), fp);
+    return fp;
+}
+
+
+/* append_record
+ * Purpose:     Writes one record to the end of a log and syncs it to disk
+ * Parameters:  FILE *fp: the log
+ *              um_data_t um: the UM to save
+ *              uint64_t executed: instructions the UM has executed so far
+ *              bool full: true iff every segment should be saved
+ * Returns:     uint64_t: the number of bytes written
+ * Notes:       The body is built in memory first, since its length and
+ *                  checksum go in front of it
+ */
+uint64_t append_record(FILE *fp, um_data_t um, uint64_t executed, bool full)
+{
+    char *body;
+    size_t length;
+    FILE *stream = open_memstream(&body, &length);
+    assert(stream != NULL);
+
+    fwrite(&executed, sizeof(executed), 1, stream);
+    fwrite(&um->program_counter, sizeof(uint32_t), 1, stream);
+    fwrite(um->regs, sizeof(uint32_t), 8, stream);
+    write_dirty_segments(um->memory, stream, full);
+    fclose(stream);
+
+    struct record_header header = { RECORD_MAGIC, full ? FLAG_FULL : 0,
+                                    length, 0, 0 };
+    header.checksum = checksum((unsigned char *)body, length);
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fwrite(body, 1, length, fp) != length || fflush(fp) != 0 ||
+        fsync(fileno(fp)) != 0) {
+        fprintf(stderr, "Could not write checkpoint\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(body);
+    return sizeof(header) + length;
+}
+
+
+/* apply_record
+ * Purpose:     Restores the state saved in one record body
+ * Parameters:  unsigned char *body: the body
+ *              uint64_t length: the number of bytes in the body
+ *              um_data_t um: the UM to restore into
+ *              uint64_t *executed: set to the instruction count saved
+ * Returns:     bool: false if the body is malformed
+ */
+bool apply_record(unsigned char *body, uint64_t length, um_data_t um,
+                  uint64_t *executed)
+{
+    FILE *stream = fmemopen(body, length, "rb");
+    assert(stream != NULL);
+
+    bool ok = fread(executed, sizeof(*executed), 1, stream) == 1 &&
+              fread(&um->program_counter, sizeof(uint32_t), 1, stream) == 1 &&
+              fread(um->regs, sizeof(uint32_t), 8, stream) == 8 &&
+              read_dirty_segments(um->memory, stream);
+
+    fclose(stream);
+    return ok;
+}
+
+
+/* compact
+ * Purpose:     Replaces a log with a new one holding a single FULL record
+ * Parameters:  um_checkpoint_t log: the log to replace
+ *              um_data_t um: the UM to save
+ *              uint64_t executed: instructions the UM has executed so far
+ * Returns:     None
+ * Notes:       The new log is written beside the old one and renamed over
+ *                  it, so a crash at any point leaves one complete log
+ */
+void compact(um_checkpoint_t log, um_data_t um, uint64_t executed)
+{
+    char *tmp_path = ALLOC(strlen(log->path) + 5);
+    sprintf(tmp_path, "%s.tmp", log->path);
+
+    FILE *fp = create_log(tmp_path);
+    uint64_t bytes = append_record(fp, um, executed, true);
+
+    if (rename(tmp_path, log->path) != 0) {
+        fprintf(stderr, "Could not replace checkpoint log %s\n", log->path);
+        exit(EXIT_FAILURE);
+    }
+    sync_dir(log->path);
+
+    fclose(log->fp);
+    log->fp = fp;
+    log->full_bytes = bytes;
+    log->log_bytes = bytes;
+    FREE(tmp_path);
+}
+
+
+/* sync_dir
+ * Purpose:     Syncs the directory holding a file, making a rename durable
+ * Parameters:  const char *path: the file
+ * Returns:     None
+ */
+void sync_dir(const char *path)
+{
+    char *copy = ALLOC(strlen(path) + 1);
+    strcpy(copy, path);
+
+    int fd = open(dirname(copy), O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+
+    FREE(copy);
+}
+
+
+uint32_t checksum(const unsigned char *bytes, uint64_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (uint64_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,34 @@
+/*
+ * um_checkpoint.h
+ *
+ * Purpose: Interface for saving a running UM to a checkpoint log and
+ *          resuming it later. Each checkpoint only holds the segments
+ *          changed since the one before it, so its cost follows the
+ *          program's write set rather than the size of its memory.
+ */
+
+#ifndef UM_CHECKPOINT_H
+#define UM_CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "um_operate.h"
+
+typedef struct um_checkpoint_t* um_checkpoint_t;
+
+/* creates a new, empty checkpoint log at path, replacing any file there */
+um_checkpoint_t um_checkpoint_new(const char *path);
+
+/* restores a UM with no memory from the latest complete checkpoint in the
+ * log at path and reopens the log to append to; returns NULL if the log
+ * holds no complete checkpoint */
+um_checkpoint_t um_checkpoint_resume(const char *path, um_data_t um,
+                                     uint64_t *executed);
+
+/* appends a checkpoint of the UM after the given number of instructions */
+void um_checkpoint_write(um_checkpoint_t log, um_data_t um, uint64_t executed);
+
+/* closes the log and frees it */
+void um_checkpoint_free(um_checkpoint_t *log);
+
+#endif
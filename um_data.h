@@ -0,0 +1,85 @@
+/*
+ * um_data.h
+ *
+ * Purpose: Layout of a UM instance, shared by the modules that work on its
+ *          state directly (um_operate.c, the generated um_special.c, the
+ *          debugger and checkpointing). Clients should only use the 
+ *          um_operate.h interface.
+ */
+
+#ifndef UM_DATA_H
+#define UM_DATA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "um_mem.h"
+#include "um_io.h"
+#include "um_stream.h"
+#include "um_loop.h"
+#include "um_perf.h"
+
+/* struct um_data_t 
+ * Purpose:     stores the data for a UM instance
+ * Members:     uint32_t regs[8]: array holding the 8 registers for the machine
+ *              uint32_t program_counter: holds the word index of the next 
+ *                  instruction to be read in segment 0
+ *              um_mem_t memory: the memory storage for the UM instance 
+ *              bool halting: true iff the halt instruction has been executed,
+ *                  or the UM has stopped to wait for input
+ *              bool waiting: true iff the UM stopped because input was 
+ *                  empty; its program counter is left on the input 
+ *                  instruction so that it runs again when resumed
+ *              um_io_t io: buffers used for input and output, or NULL to
+ *                  use stdin and stdout
+ *              um_stream_t stream: asynchronous streams used for input
+ *                  and output when io is NULL, or NULL to use stdio
+ *              uint64_t input_bytes, output_bytes: bytes read by input
+ *                  and written by output, including end of input
+ *              bool fast_loops: true while running under a loop that can
+ *                  fast-forward loops (see um_loop.h)
+ *              bool fast_loops_allowed: false if fast-forwarding has been
+ *                  turned off with set_um_fast_loops
+ *              bool looping: true iff load_prog stopped the UM at the
+ *                  head of a loop decoded into loop; halting is also set
+ *              um_loop_t loop: the loops decoded at each jump site, or
+ *                  NULL before the first backward jump
+ *              uint32_t *words: when segment IDs are handles (see 
+ *                  use_um_handles), the arena that segments other than 0 
+ *                  are in, indexed by ID plus offset; else NULL
+ *              um_perf_t perf: counters that load_prog charges its copies
+ *                  to (see run_um_perf), or NULL
+ */
+struct um_data_t {
+    uint32_t    regs[8];
+    uint32_t    program_counter;
+    um_mem_t    memory;
+    bool        halting;
+    bool        waiting;
+    um_io_t     io;
+    um_stream_t stream;
+    uint64_t    input_bytes;
+    uint64_t    output_bytes;
+    bool        fast_loops;
+    bool        fast_loops_allowed;
+    bool        looping;
+    um_loop_t   loop;
+    uint32_t   *words;
+    um_perf_t   perf;
+};
+
+/* generic handlers for opcodes 0-13, and illegal_inst for 14 and 15,
+ * defined in um_operate.c */
+extern void (*instructions[16])();
+
+/* the handler for opcodes 14 and 15: reports the instruction and raises
+ * Illegal_Instruction */
+void illegal_inst(um_data_t um, uint32_t inst);
+
+/* called by load_prog after jumping back to tail or earlier in segment 0
+ * while fast_loops is set; stops the UM if the loop can be fast-forwarded */
+void find_loop(um_data_t um, uint32_t tail);
+
+/* called by load_prog to replace segment 0 with a copy of a segment */
+void copy_program(um_data_t um, uint32_t seg_id);
+
+#endif
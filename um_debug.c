@@ -0,0 +1,603 @@
+/*
+ * um_debug.c
+ *
+ * Purpose: Implementation of the UM debugger. The debugger never checks
+ *          for breakpoints while the program runs; instead it executes
+ *          through its own copy of the dispatch table and edits the machine
+ *          so that only the interesting instructions reach debug code:
+ *
+ *          - a breakpoint replaces the word at its pc in segment 0 with the
+ *            otherwise unused opcode 14, whose table entry stops the
+ *            machine. The original word is kept aside and is what the
+ *            program sees through seg_load, seg_store and step.
+ *          - while any breakpoint or watchpoint exists, the seg_load,
+ *            seg_store and load_prog entries are swapped for versions that
+ *            hide the patched words, check watched words, and re-apply
+ *            breakpoints when segment 0 is replaced. With none set, the
+ *            table is identical to the generic one.
+ *
+ *          There is a single debugger per process.
+ */
+
+#include "um_debug.h"
+#include "um_data.h"
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define MAX_BREAKPOINTS 64
+#define MAX_WATCHPOINTS 64
+#define TRAP_OPCODE     14
+#define TRAP_WORD       ((uint32_t)TRAP_OPCODE << 28)
+
+/* struct breakpoint
+ * Purpose:     A breakpoint on a program counter
+ * Members:     uint32_t pc: the word index in segment 0
+ *              uint32_t original: the instruction replaced by the trap
+ *              bool active: false while pc is beyond the end of segment 0
+ */
+struct breakpoint {
+    uint32_t    pc;
+    uint32_t    original;
+    bool        active;
+};
+
+/* struct watchpoint
+ * Purpose:     A watchpoint on one segment word
+ * Members:     uint32_t seg_id, word_id: the watched word
+ *              bool on_load: true to stop on loads, false to stop on stores
+ */
+struct watchpoint {
+    uint32_t    seg_id;
+    uint32_t    word_id;
+    bool        on_load;
+};
+
+/* struct debugger
+ * Purpose:     State of the debugging session
+ * Members:     FILE *log: where the debugger reports
+ *              void (*table[16])(): dispatch table used while debugging
+ *              struct breakpoint breakpoints[]: the breakpoints set
+ *              struct watchpoint watchpoints[]: the watchpoints set
+ *              bool trapped: true iff the machine was stopped by a
+ *                  breakpoint or watchpoint rather than by halt
+ */
+static struct debugger {
+    FILE                *log;
+    void                (*table[16])();
+    struct breakpoint   breakpoints[MAX_BREAKPOINTS];
+    unsigned            num_breakpoints;
+    struct watchpoint   watchpoints[MAX_WATCHPOINTS];
+    unsigned            num_watchpoints;
+    bool                trapped;
+} dbg;
+
+typedef enum action { CONTINUE, STEP, QUIT, DETACH } action;
+
+static action prompt(um_data_t um, FILE *commands, unsigned *count);
+static void run_free(um_data_t um);
+static void step_one(um_data_t um);
+static void stop(um_data_t um);
+static void update_table(void);
+static void add_breakpoint(um_data_t um, uint32_t pc);
+static void delete_breakpoint(um_data_t um, uint32_t pc);
+static void patch_breakpoints(um_data_t um);
+static void remove_all(um_data_t um);
+static struct breakpoint *find_breakpoint(uint32_t pc);
+static struct watchpoint *find_watchpoint(uint32_t seg_id, uint32_t word_id,
+                                          bool on_load);
+static uint32_t read_word(um_data_t um, uint32_t seg_id, uint32_t word_id);
+static void print_location(um_data_t um);
+static void print_registers(um_data_t um);
+static void print_segment(um_data_t um, uint32_t seg_id, uint32_t start,
+                          uint32_t count);
+static void print_help(void);
+
+static void trap(um_data_t um, uint32_t inst);
+static void debug_seg_load(um_data_t um, uint32_t inst);
+static void debug_seg_store(um_data_t um, uint32_t inst);
+static void debug_load_prog(um_data_t um, uint32_t inst);
+
+
+/* run_um_debug
+ * Purpose:     Runs a UM under the debugger until it halts or the user quits
+ * Parameters:  um_data_t um: the UM, with its program already read in
+ *              FILE *commands: where debugger commands are read from
+ *              FILE *log: where the debugger writes its output
+ * Returns:     None
+ * Notes:       The program keeps stdin and stdout for its own I/O.
+ *              At the end of the commands the debugger detaches and the
+ *                  program runs to completion with the generic handlers.
+ */
+void run_um_debug(um_data_t um, FILE *commands, FILE *log)
+{
+    assert(um != NULL && commands != NULL && log != NULL);
+
+    memset(&dbg, 0, sizeof(dbg));
+    dbg.log = log;
+    memcpy(dbg.table, instructions, sizeof(instructions));
+    dbg.table[TRAP_OPCODE] = trap;
+
+    fprintf(log, "UM debugger; type 'help' for commands\n");
+    print_location(um);
+
+    while (!um->halting) {
+        unsigned count = 1;
+        action act = prompt(um, commands, &count);
+
+        if (act == QUIT) {
+            fprintf(log, "Program stopped at pc %u\n", um->program_counter);
+            break;
+        } else if (act == DETACH) {
+            remove_all(um);
+            run_free(um);
+            break;
+        } else if (act == STEP) {
+            for (unsigned i = 0; i < count && !um->halting; i++) {
+                step_one(um);
+            }
+        } else {
+            step_one(um);
+            run_free(um);
+        }
+
+        if (dbg.trapped) {
+            dbg.trapped = false;
+            um->halting = false;
+            print_location(um);
+        } else if (um->halting) {
+            fprintf(log, "Program halted\n");
+        } else {
+            print_location(um);
+        }
+    }
+
+    remove_all(um);
+}
+
+
+/* prompt
+ * Purpose:     Reads and carries out debugger commands until one of them
+ *                  resumes or ends execution
+ * Parameters:  um_data_t um: the stopped UM
+ *              FILE *commands: where commands are read from
+ *              unsigned *count: set to the number of instructions to step
+ * Returns:     action: what the debugger should do next
+ */
+static action prompt(um_data_t um, FILE *commands, unsigned *count)
+{
+    char line[256];
+    char cmd[32];
+    unsigned long args[3];
+
+    for (;;) {
+        fprintf(dbg.log, "(umdb) ");
+        fflush(dbg.log);
+
+        if (fgets(line, sizeof(line), commands) == NULL) {
+            fprintf(dbg.log, "\n");
+            return DETACH;
+        }
+
+        int n = sscanf(line, "%31s %lu %lu %lu", cmd, &args[0], &args[1],
+                       &args[2]) - 1;
+        if (n < 0) {
+            continue;
+        }
+
+        if (!strcmp(cmd, "c") || !strcmp(cmd, "continue")) {
+            return CONTINUE;
+        } else if (!strcmp(cmd, "s") || !strcmp(cmd, "step")) {
+            *count = (n >= 1) ? args[0] : 1;
+            return STEP;
+        } else if (!strcmp(cmd, "q") || !strcmp(cmd, "quit")) {
+            return QUIT;
+        } else if ((!strcmp(cmd, "b") || !strcmp(cmd, "break")) && n >= 1) {
+            add_breakpoint(um, args[0]);
+        } else if ((!strcmp(cmd, "d") || !strcmp(cmd, "delete")) && n >= 1) {
+            delete_breakpoint(um, args[0]);
+        } else if ((!strcmp(cmd, "w") || !strcmp(cmd, "watch") ||
+                    !strcmp(cmd, "rwatch")) && n >= 2) {
+            bool on_load = !strcmp(cmd, "rwatch");
+            if (find_watchpoint(args[0], args[1], on_load) != NULL) {
+                continue;
+            } else if (dbg.num_watchpoints == MAX_WATCHPOINTS) {
+                fprintf(dbg.log, "Too many watchpoints\n");
+                continue;
+            }
+            struct watchpoint *wp = &dbg.watchpoints[dbg.num_watchpoints++];
+            wp->seg_id = args[0];
+            wp->word_id = args[1];
+            wp->on_load = on_load;
+            update_table();
+        } else if (!strcmp(cmd, "unwatch") && n >= 2) {
+            for (int on_load = 0; on_load <= 1; on_load++) {
+                struct watchpoint *wp = find_watchpoint(args[0], args[1],
+                                                        on_load);
+                if (wp != NULL) {
+                    *wp = dbg.watchpoints[--dbg.num_watchpoints];
+                }
+            }
+            update_table();
+        } else if (!strcmp(cmd, "r") || !strcmp(cmd, "regs")) {
+            print_registers(um);
+        } else if ((!strcmp(cmd, "x") || !strcmp(cmd, "seg")) && n >= 1) {
+            print_segment(um, args[0], (n >= 2) ? args[1] : 0,
+                          (n >= 3) ? args[2] : 8);
+        } else if (!strcmp(cmd, "i") || !strcmp(cmd, "info")) {
+            for (unsigned i = 0; i < dbg.num_breakpoints; i++) {
+                fprintf(dbg.log, "break  pc %u%s\n", dbg.breakpoints[i].pc,
+                        dbg.breakpoints[i].active ? "" : " (pending)");
+            }
+            for (unsigned i = 0; i < dbg.num_watchpoints; i++) {
+                fprintf(dbg.log, "%s m[%u][%u]\n",
+                        dbg.watchpoints[i].on_load ? "rwatch" : "watch ",
+                        dbg.watchpoints[i].seg_id,
+                        dbg.watchpoints[i].word_id);
+            }
+        } else if (!strcmp(cmd, "h") || !strcmp(cmd, "help")) {
+            print_help();
+        } else {
+            fprintf(dbg.log, "Unknown command; type 'help' for commands\n");
+        }
+    }
+}
+
+
+/* run_free
+ * Purpose:     Executes instructions through the debug table until the
+ *                  machine halts or a breakpoint or watchpoint stops it
+ * Parameters:  um_data_t um: the UM to run
+ * Returns:     None
+ * Notes:       Same loop as the generic engine; breakpoints and
+ *                  watchpoints stop it by setting um->halting
+ */
+static void run_free(um_data_t um)
+{
+    while (!um->halting) {
+        uint32_t inst = get_seg_value(um->memory, 0, um->program_counter);
+        um->program_counter++;
+        dbg.table[inst >> 28](um, inst);
+    }
+}
+
+
+/* step_one
+ * Purpose:     Executes the instruction at the program counter, running the
+ *                  original instruction if a breakpoint is set there
+ * Parameters:  um_data_t um: the UM to step
+ * Returns:     None
+ */
+static void step_one(um_data_t um)
+{
+    uint32_t inst = read_word(um, 0, um->program_counter);
+    um->program_counter++;
+    dbg.table[inst >> 28](um, inst);
+}
+
+
+/* stop
+ * Purpose:     Stops the machine after the current instruction
+ * Parameters:  um_data_t um: the UM to stop
+ * Returns:     None
+ */
+static void stop(um_data_t um)
+{
+    um->halting = true;
+    dbg.trapped = true;
+}
+
+
+/* update_table
+ * Purpose:     Swaps the instrumented handlers in or out of the debug table
+ *                  depending on which breakpoints and watchpoints exist
+ * Parameters:  None
+ * Returns:     None
+ */
+static void update_table(void)
+{
+    bool memory_hooks = dbg.num_breakpoints > 0 || dbg.num_watchpoints > 0;
+
+    dbg.table[1] = memory_hooks ? debug_seg_load : instructions[1];
+    dbg.table[2] = memory_hooks ? debug_seg_store : instructions[2];
+    dbg.table[12] = dbg.num_breakpoints > 0 ? debug_load_prog
+                                            : instructions[12];
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                       Breakpoints                          *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* add_breakpoint
+ * Purpose:     Sets a breakpoint and patches the trap into segment 0
+ * Parameters:  um_data_t um: the UM being debugged
+ *              uint32_t pc: where to break
+ * Returns:     None
+ * Notes:       A pc beyond the end of segment 0 stays pending until a
+ *                  load_prog makes segment 0 long enough
+ */
+static void add_breakpoint(um_data_t um, uint32_t pc)
+{
+    if (find_breakpoint(pc) != NULL) {
+        return;
+    } else if (dbg.num_breakpoints == MAX_BREAKPOINTS) {
+        fprintf(dbg.log, "Too many breakpoints\n");
+        return;
+    }
+
+    struct breakpoint *bp = &dbg.breakpoints[dbg.num_breakpoints++];
+    bp->pc = pc;
+    bp->active = pc < get_seg_length(um->memory, 0);
+
+    if (bp->active) {
+        bp->original = get_seg_value(um->memory, 0, pc);
+        set_seg_value(um->memory, 0, pc, TRAP_WORD);
+    }
+
+    update_table();
+}
+
+
+/* delete_breakpoint
+ * Purpose:     Removes a breakpoint and restores the original instruction
+ * Parameters:  um_data_t um: the UM being debugged
+ *              uint32_t pc: the breakpoint to remove
+ * Returns:     None
+ */
+static void delete_breakpoint(um_data_t um, uint32_t pc)
+{
+    struct breakpoint *bp = find_breakpoint(pc);
+    if (bp == NULL) {
+        fprintf(dbg.log, "No breakpoint at pc %u\n", pc);
+        return;
+    }
+
+    if (bp->active) {
+        set_seg_value(um->memory, 0, pc, bp->original);
+    }
+
+    *bp = dbg.breakpoints[--dbg.num_breakpoints];
+    update_table();
+}
+
+
+/* patch_breakpoints
+ * Purpose:     Re-applies every breakpoint to a new segment 0
+ * Parameters:  um_data_t um: the UM whose segment 0 was replaced
+ * Returns:     None
+ */
+static void patch_breakpoints(um_data_t um)
+{
+    uint32_t length = get_seg_length(um->memory, 0);
+
+    for (unsigned i = 0; i < dbg.num_breakpoints; i++) {
+        struct breakpoint *bp = &dbg.breakpoints[i];
+        bp->active = bp->pc < length;
+
+        if (bp->active) {
+            bp->original = get_seg_value(um->memory, 0, bp->pc);
+            set_seg_value(um->memory, 0, bp->pc, TRAP_WORD);
+        }
+    }
+}
+
+
+/* remove_all
+ * Purpose:     Removes every breakpoint and watchpoint
+ * Parameters:  um_data_t um: the UM being debugged
+ * Returns:     None
+ * Notes:       Leaves the debug table identical to the generic table
+ */
+static void remove_all(um_data_t um)
+{
+    while (dbg.num_breakpoints > 0) {
+        delete_breakpoint(um, dbg.breakpoints[0].pc);
+    }
+
+    dbg.num_watchpoints = 0;
+    update_table();
+}
+
+
+static struct breakpoint *find_breakpoint(uint32_t pc)
+{
+    for (unsigned i = 0; i < dbg.num_breakpoints; i++) {
+        if (dbg.breakpoints[i].pc == pc) {
+            return &dbg.breakpoints[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static struct watchpoint *find_watchpoint(uint32_t seg_id, uint32_t word_id,
+                                          bool on_load)
+{
+    for (unsigned i = 0; i < dbg.num_watchpoints; i++) {
+        struct watchpoint *wp = &dbg.watchpoints[i];
+        if (wp->seg_id == seg_id && wp->word_id == word_id &&
+            wp->on_load == on_load) {
+            return wp;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* read_word
+ * Purpose:     Reads a segment word as the program sees it
+ * Parameters:  um_data_t um: the UM being debugged
+ *              uint32_t seg_id, word_id: the word to read
+ * Returns:     uint32_t: the word, with breakpoint traps replaced by the
+ *                  instructions they hide
+ */
+static uint32_t read_word(um_data_t um, uint32_t seg_id, uint32_t word_id)
+{
+    if (seg_id == 0) {
+        struct breakpoint *bp = find_breakpoint(word_id);
+        if (bp != NULL && bp->active) {
+            return bp->original;
+        }
+    }
+
+    return get_seg_value(um->memory, seg_id, word_id);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                   Instrumented handlers                    *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* trap
+ * Purpose:     Handler for the breakpoint opcode; stops the machine with the
+ *                  program counter on the breakpoint
+ * Parameters:  um_data_t um: the UM that hit the breakpoint
+ *              uint32_t inst: the trap word
+ * Returns:     None
+ */
+static void trap(um_data_t um, uint32_t inst)
+{
+    (void) inst;
+
+    um->program_counter--;
+    fprintf(dbg.log, "Breakpoint at pc %u\n", um->program_counter);
+    stop(um);
+}
+
+
+/* debug_seg_load
+ * Purpose:     seg_load that hides breakpoint traps and checks read
+ *                  watchpoints
+ * Parameters:  um_data_t um: the UM being debugged
+ *              uint32_t inst: the instruction holding the register indices
+ * Returns:     None
+ */
+static void debug_seg_load(um_data_t um, uint32_t inst)
+{
+    uint32_t seg_id = um->regs[(inst >> 3) & 0x7];
+    uint32_t word_id = um->regs[inst & 0x7];
+    uint32_t value = read_word(um, seg_id, word_id);
+
+    um->regs[(inst >> 6) & 0x7] = value;
+
+    if (find_watchpoint(seg_id, word_id, true) != NULL) {
+        fprintf(dbg.log, "Watchpoint: load m[%u][%u] == %u at pc %u\n",
+                seg_id, word_id, value, um->program_counter - 1);
+        stop(um);
+    }
+}
+
+
+/* debug_seg_store
+ * Purpose:     seg_store that preserves breakpoint traps and checks write
+ *                  watchpoints
+ * Parameters:  um_data_t um: the UM being debugged
+ *              uint32_t inst: the instruction holding the register indices
+ * Returns:     None
+ * Notes:       A store over a breakpoint changes the hidden instruction
+ */
+static void debug_seg_store(um_data_t um, uint32_t inst)
+{
+    uint32_t seg_id = um->regs[(inst >> 6) & 0x7];
+    uint32_t word_id = um->regs[(inst >> 3) & 0x7];
+    uint32_t value = um->regs[inst & 0x7];
+    bool watched = find_watchpoint(seg_id, word_id, false) != NULL;
+    uint32_t old = watched ? read_word(um, seg_id, word_id) : 0;
+
+    struct breakpoint *bp = (seg_id == 0) ? find_breakpoint(word_id) : NULL;
+    if (bp != NULL && bp->active) {
+        bp->original = value;
+    } else {
+        set_seg_value(um->memory, seg_id, word_id, value);
+    }
+
+    if (watched) {
+        fprintf(dbg.log, "Watchpoint: store m[%u][%u] %u -> %u at pc %u\n",
+                seg_id, word_id, old, value, um->program_counter - 1);
+        stop(um);
+    }
+}
+
+
+/* debug_load_prog
+ * Purpose:     load_prog that re-applies breakpoints when segment 0 is
+ *                  replaced
+ * Parameters:  um_data_t um: the UM being debugged
+ *              uint32_t inst: the instruction holding the register indices
+ * Returns:     None
+ */
+static void debug_load_prog(um_data_t um, uint32_t inst)
+{
+    uint32_t seg_id = um->regs[(inst >> 3) & 0x7];
+
+    instructions[12](um, inst);
+
+    if (seg_id != 0) {
+        patch_breakpoints(um);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                          Output                            *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void print_location(um_data_t um)
+{
+    uint32_t pc = um->program_counter;
+
+    if (pc < get_seg_length(um->memory, 0)) {
+        uint32_t inst = read_word(um, 0, pc);
+        fprintf(dbg.log, "pc %u: %08x (opcode %u)\n", pc, inst, inst >> 28);
+    } else {
+        fprintf(dbg.log, "pc %u: beyond end of segment 0\n", pc);
+    }
+}
+
+
+static void print_registers(um_data_t um)
+{
+    fprintf(dbg.log, "pc %u\n", um->program_counter);
+    for (int i = 0; i < 8; i++) {
+        fprintf(dbg.log, "r%d = %u (0x%08x)\n", i, um->regs[i], um->regs[i]);
+    }
+}
+
+
+static void print_segment(um_data_t um, uint32_t seg_id, uint32_t start,
+                          uint32_t count)
+{
+    if (!is_seg_mapped(um->memory, seg_id)) {
+        fprintf(dbg.log, "Segment %u is not mapped\n", seg_id);
+        return;
+    }
+
+    uint32_t length = get_seg_length(um->memory, seg_id);
+    fprintf(dbg.log, "segment %u: %u words\n", seg_id, length);
+
+    for (uint32_t i = start; i < length && i - start < count; i++) {
+        fprintf(dbg.log, "m[%u][%u] = %u (0x%08x)\n", seg_id, i,
+                read_word(um, seg_id, i), read_word(um, seg_id, i));
+    }
+}
+
+
+static void print_help(void)
+{
+    fprintf(dbg.log,
+            "break PC         (b)  stop before executing the word at PC\n"
+            "delete PC        (d)  remove the breakpoint at PC\n"
+            "watch SEG WORD   (w)  stop after stores to m[SEG][WORD]\n"
+            "rwatch SEG WORD       stop after loads from m[SEG][WORD]\n"
+            "unwatch SEG WORD      remove watchpoints on m[SEG][WORD]\n"
+            "continue         (c)  run until a breakpoint, watchpoint or halt\n"
+            "step [N]         (s)  execute N instructions (default 1)\n"
+            "regs             (r)  show the registers and program counter\n"
+            "seg SEG [I [N]]  (x)  show N words of SEG from word I\n"
+            "info             (i)  list breakpoints and watchpoints\n"
+            "quit             (q)  stop the program\n"
+            "At the end of the commands the program runs to completion.\n");
+}
@@ -0,0 +1,18 @@
+/*
+ * um_debug.h
+ *
+ * Purpose: Interface for running a UM under an interactive debugger with 
+ *          breakpoints on program counters and watchpoints on segment words.
+ */
+
+#ifndef UM_DEBUG_H
+#define UM_DEBUG_H
+
+#include <stdio.h>
+#include "um_operate.h"
+
+/* runs a UM to completion, reading debugger commands from the given file
+ * and reporting to the given log */
+void run_um_debug(um_data_t um, FILE *commands, FILE *log);
+
+#endif
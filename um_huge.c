@@ -0,0 +1,228 @@
+/*
+ * um_huge.c
+ *
+ * Purpose: Implementation of the huge-page segment pool.
+ *
+ *          The pool is one anonymous mapping of POOL_BYTES, reserved
+ *          without swap and aligned to HUGE_BYTES, and advised
+ *          MADV_HUGEPAGE so the kernel backs it with 2 MB pages as it is
+ *          touched. If the kernel refuses the advice (no transparent huge
+ *          pages, or turned off), the pool runs on ordinary pages and the
+ *          report says so.
+ *
+ *          Each segment is a block of a power of two bytes holding its
+ *          UArray_T header and then its words, so a load or store touches
+ *          one place instead of a heap header and a separate heap array.
+ *          Blocks are handed out by a locked um_blocks allocator counting
+ *          bytes, since clones sharing the pool may run on different
+ *          threads. A block from the end of the used part of the pool is
+ *          all zeros, so a released block is zeroed before it goes back:
+ *          small ones with memset, while the words are still in cache, and
+ *          blocks of a huge page or more by handing their pages back with
+ *          MADV_DONTNEED.
+ */
+
+#include "um_huge.h"
+#include "um_blocks.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <uarrayrep.h>
+#include <mem.h>
+#include <assert.h>
+
+#define POOL_SHIFT      38
+#define POOL_BYTES      (1ULL << POOL_SHIFT)
+#define HUGE_SHIFT      21
+#define HUGE_BYTES      (1ULL << HUGE_SHIFT)
+#define MIN_SHIFT       5
+
+/* bytes of the block a segment of length words needs, header included */
+#define BLOCK_BYTES(length) (sizeof(struct UArray_T) +                      \
+                             (uint64_t)(length) * sizeof(uint32_t))
+
+/* struct um_huge_t
+ * Purpose:     The pool's mapping and the blocks carved out of it
+ * Members:     char *map: the mapping, with room to align it
+ *              char *base: the first HUGE_BYTES boundary in map
+ *              bool advised: whether the kernel took MADV_HUGEPAGE
+ *              um_blocks_t blocks: the blocks of the pool, in bytes from
+ *                  base
+ */
+struct um_huge_t {
+    char           *map;
+    char           *base;
+    bool            advised;
+    um_blocks_t     blocks;
+};
+
+void read_smaps(um_huge_t huge, uint64_t *resident, uint64_t *in_huge);
+
+
+/* um_huge_new
+ * Purpose:     Reserves an empty pool
+ * Parameters:  None
+ * Returns:     um_huge_t: the pool; client frees with um_huge_free.
+ *                  NULL if the address space cannot be reserved.
+ * Notes:       A kernel without transparent huge pages is not an error
+ */
+um_huge_t um_huge_new()
+{
+    void *map = mmap(NULL, POOL_BYTES + HUGE_BYTES, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    um_huge_t huge;
+    NEW0(huge);
+    huge->map = map;
+    huge->base = (char *)(((uintptr_t)map + HUGE_BYTES - 1) &
+                          ~(uintptr_t)(HUGE_BYTES - 1));
+    huge->advised = madvise(huge->base, POOL_BYTES, MADV_HUGEPAGE) == 0;
+    huge->blocks = um_blocks_new(POOL_SHIFT, MIN_SHIFT, true);
+
+    return huge;
+}
+
+
+/* um_huge_free
+ * Purpose:     Unmaps a pool
+ * Parameters:  um_huge_t *huge: pointer to the pool to free
+ * Returns:     None
+ * Notes:       Segments not yet released are lost with it
+ */
+void um_huge_free(um_huge_t *huge)
+{
+    assert(huge != NULL && *huge != NULL);
+    um_huge_t h = *huge;
+
+    munmap(h->map, POOL_BYTES + HUGE_BYTES);
+    um_blocks_free(&h->blocks);
+    FREE(*huge);
+}
+
+
+/* um_huge_alloc
+ * Purpose:     Makes a new segment in the pool
+ * Parameters:  um_huge_t huge: the pool
+ *              uint32_t length: the segment's length in words
+ * Returns:     UArray_T: the segment, all zeros; release it with
+ *                  um_huge_release, never UArray_free
+ * Notes:       Exits with an error message if the pool is full
+ */
+UArray_T um_huge_alloc(um_huge_t huge, uint32_t length)
+{
+    assert(huge != NULL && length <= INT32_MAX);
+
+    uint64_t offset;
+    if (!um_blocks_alloc(huge->blocks, BLOCK_BYTES(length), &offset)) {
+        fprintf(stderr, "Huge-page segment pool is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    UArray_T segment = (UArray_T)(huge->base + offset);
+    UArrayRep_init(segment, length, sizeof(uint32_t), segment + 1);
+
+    return segment;
+}
+
+
+/* um_huge_release
+ * Purpose:     Frees a segment made by um_huge_alloc
+ * Parameters:  um_huge_t huge: the pool that made the segment
+ *              UArray_T *segment: pointer to the segment; set to NULL
+ * Returns:     None
+ */
+void um_huge_release(um_huge_t huge, UArray_T *segment)
+{
+    assert(huge != NULL && segment != NULL && um_huge_owns(huge, *segment));
+
+    uint32_t length = UArray_length(*segment);
+    int k = um_blocks_class(huge->blocks, BLOCK_BYTES(length));
+    char *block = (char *)*segment;
+
+    if (k >= HUGE_SHIFT) {
+        madvise(block, (size_t)1 << k, MADV_DONTNEED);
+    } else {
+        memset(block, 0, sizeof(struct UArray_T) +
+                         (size_t)length * sizeof(uint32_t));
+    }
+
+    um_blocks_release(huge->blocks, k, block - huge->base);
+
+    *segment = NULL;
+}
+
+
+/* um_huge_owns
+ * Purpose:     Tells segments made by the pool from other segments
+ * Parameters:  um_huge_t huge: the pool
+ *              UArray_T segment: a segment
+ * Returns:     bool: true iff the segment's header is in the pool
+ */
+bool um_huge_owns(um_huge_t huge, UArray_T segment)
+{
+    assert(huge != NULL && segment != NULL);
+
+    char *header = (char *)segment;
+    return header >= huge->base && header < huge->base + POOL_BYTES;
+}
+
+
+/* um_huge_report
+ * Purpose:     Prints how the pool is backed
+ * Parameters:  um_huge_t huge: the pool
+ *              FILE *fp: the stream to print to
+ * Returns:     None
+ * Notes:       Resident sizes come from /proc/self/smaps, and are left out
+ *                  where it cannot be read
+ */
+void um_huge_report(um_huge_t huge, FILE *fp)
+{
+    assert(huge != NULL && fp != NULL);
+
+    uint64_t resident = 0, in_huge = 0;
+    read_smaps(huge, &resident, &in_huge);
+
+    fprintf(fp, "huge-page pool:     %s, %llu KB handed out, "
+                "%llu KB resident, %llu KB in huge pages\n",
+            huge->advised ? "MADV_HUGEPAGE taken" : "no huge pages",
+            (unsigned long long)(um_blocks_top(huge->blocks) >> 10),
+            (unsigned long long)resident, (unsigned long long)in_huge);
+}
+
+
+/* read_smaps
+ * Purpose:     Sums the resident and huge-page sizes of the pool's mapping
+ * Parameters:  um_huge_t huge: the pool
+ *              uint64_t *resident, *in_huge: set to the sizes in KB
+ * Returns:     None
+ * Notes:       The kernel may split the mapping into several areas, so
+ *                  every area inside it is counted
+ */
+void read_smaps(um_huge_t huge, uint64_t *resident, uint64_t *in_huge)
+{
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) {
+        return;
+    }
+
+    uintptr_t low = (uintptr_t)huge->map;
+    uintptr_t high = low + POOL_BYTES + HUGE_BYTES;
+    bool inside = false;
+    char line[256];
+
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        unsigned long start, end, kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            inside = start >= low && end <= high;
+        } else if (inside && sscanf(line, "Rss: %lu kB", &kb) == 1) {
+            *resident += kb;
+        } else if (inside &&
+                   sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            *in_huge += kb;
+        }
+    }
+    fclose(smaps);
+}
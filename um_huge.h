@@ -0,0 +1,44 @@
+/*
+ * um_huge.h
+ *
+ * Purpose: Interface for a segment pool backed by transparent huge pages.
+ *          Segments are carved, header and words together, out of one
+ *          2 MB-aligned mapping that the kernel is asked to back with huge
+ *          pages, so the segments a program touches share a few TLB
+ *          entries instead of spreading across the pages of the heap.
+ *          Where huge pages are not available the pool still works, on
+ *          ordinary pages.
+ */
+
+#ifndef UM_HUGE_H
+#define UM_HUGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <uarray.h>
+
+typedef struct um_huge_t* um_huge_t;
+
+/* reserves an empty pool; NULL if the address space cannot be reserved */
+um_huge_t um_huge_new();
+
+/* releases the pool, whose segments must all be released */
+void um_huge_free(um_huge_t *huge);
+
+
+/* returns a new segment of length 32-bit words, all 0, in the pool */
+UArray_T um_huge_alloc(um_huge_t huge, uint32_t length);
+
+/* gives a segment's space back to the pool */
+void um_huge_release(um_huge_t huge, UArray_T *segment);
+
+/* returns whether a segment was made by the pool */
+bool um_huge_owns(um_huge_t huge, UArray_T segment);
+
+
+/* prints whether huge pages were granted and how much of the pool is
+ * resident in them */
+void um_huge_report(um_huge_t huge, FILE *fp);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * um_image.c
+ *
+ * Purpose: Implementation of .umx images.
+ *
+ *          An image starts with a header holding the magic "UMXIMG1\n", a
+ *          byte order mark, the program length in words, an FNV-1a
+ *          checksum taken a word at a time, flags reserved for optional
+ *          sections and the offset of the words, always WORDS_OFFSET. The
+ *          header is padded with zeros up to that offset, and the words
+ *          follow in host byte order. An image written on a host of the
+ *          other byte order fails the mark test and is rejected.
+ *
+ *          A file without the magic is not an image, and um reads it as a
+ *          .um file. A file with the magic that fails any other check is a
+ *          corrupt image, and is reported as one rather than being run as
+ *          a .um file, whose first words would be the header.
+ */
+
+#include "um_image.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mem.h>
+#include <assert.h>
+
+#define BYTE_ORDER_MARK 0x01020304
+#define WORDS_OFFSET    4096
+
+static const char magic[8] = { 'U', 'M', 'X', 'I', 'M', 'G', '1', '\n' };
+
+
+/* struct image_header
+ * Purpose:     Header at the start of every image
+ * Members:     char magic[8]: "UMXIMG1\n"
+ *              uint32_t byte_order: BYTE_ORDER_MARK in the writer's order
+ *              uint32_t num_words: length of the program in words
+ *              uint32_t checksum: FNV-1a hash of the words, a word at a
+ *                  time
+ *              uint32_t flags: 0; reserved for optional sections
+ *              uint64_t words_offset: file offset of the first word
+ */
+struct image_header {
+    char        magic[8];
+    uint32_t    byte_order;
+    uint32_t    num_words;
+    uint32_t    checksum;
+    uint32_t    flags;
+    uint64_t    words_offset;
+};
+
+
+/* struct um_image_t
+ * Purpose:     A mapped image
+ * Members:     void *map: the whole file, mapped read-only
+ *              size_t size: the file's size
+ *              const uint32_t *words: the program, inside map
+ *              uint32_t num_words: length of the program in words
+ */
+struct um_image_t {
+    void           *map;
+    size_t          size;
+    const uint32_t *words;
+    uint32_t        num_words;
+};
+
+uint32_t checksum_words(const uint32_t *words, uint32_t num_words);
+
+
+/* um_image_write
+ * Purpose:     Writes a program to a stream as a .umx image
+ * Parameters:  FILE *fp: the stream, positioned at its start
+ *              const uint32_t *words: the program, in host byte order
+ *              uint32_t num_words: length of the program in words
+ * Returns:     bool: true iff every byte was written
+ */
+bool um_image_write(FILE *fp, const uint32_t *words, uint32_t num_words)
+{
+    assert(fp != NULL && (words != NULL || num_words == 0));
+
+    static char page[WORDS_OFFSET];
+    struct image_header header = { { 0 }, BYTE_ORDER_MARK, num_words,
+                                   checksum_words(words, num_words), 0,
+                                   WORDS_OFFSET };
+    memcpy(header.magic, magic, sizeof(magic));
+
+    memset(page, 0, sizeof(page));
+    memcpy(page, &header, sizeof(header));
+
+    return fwrite(page, 1, sizeof(page), fp) == sizeof(page) &&
+           fwrite(words, sizeof(uint32_t), num_words, fp) == num_words;
+}
+
+
+/* um_image_open
+ * Purpose:     Maps a .umx image into memory and checks it
+ * Parameters:  const char *path: the image
+ *              const char **error: set to NULL, or to why an image was
+ *                  rejected
+ * Returns:     um_image_t: the image; client closes it with um_image_close.
+ *                  NULL if the file cannot be read or is not an image,
+ *                  leaving *error NULL, or if it starts with the magic but
+ *                  was written on a host of the other byte order, or is
+ *                  truncated or corrupt, setting *error.
+ * Notes:       The file is mapped privately, so nothing is copied until a
+ *                  page is first touched
+ */
+um_image_t um_image_open(const char *path, const char **error)
+{
+    assert(path != NULL && error != NULL);
+    *error = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    char start[sizeof(magic)];
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 ||
+        pread(fd, start, sizeof(start), 0) != sizeof(start) ||
+        memcmp(start, magic, sizeof(magic)) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if ((size_t)sb.st_size < WORDS_OFFSET) {
+        close(fd);
+        *error = "image is truncated";
+        return NULL;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const struct image_header *header = map;
+    const uint32_t *words = (const uint32_t *)((char *)map + WORDS_OFFSET);
+    uint64_t words_size = (uint64_t)sb.st_size - WORDS_OFFSET;
+
+    if (header->byte_order != BYTE_ORDER_MARK) {
+        *error = "image was written on a host of the other byte order";
+    } else if (header->words_offset != WORDS_OFFSET ||
+               words_size != (uint64_t)header->num_words * sizeof(uint32_t)) {
+        *error = "image is truncated or its header is corrupt";
+    } else if (checksum_words(words, header->num_words) != header->checksum) {
+        *error = "image fails its checksum";
+    }
+    if (*error != NULL) {
+        munmap(map, sb.st_size);
+        return NULL;
+    }
+
+    um_image_t image;
+    NEW(image);
+    image->map = map;
+    image->size = sb.st_size;
+    image->words = words;
+    image->num_words = header->num_words;
+
+    return image;
+}
+
+
+/* um_image_close
+ * Purpose:     Unmaps an image and frees it
+ * Parameters:  um_image_t *image: pointer to the image to close
+ * Returns:     None
+ */
+void um_image_close(um_image_t *image)
+{
+    assert(image != NULL && *image != NULL);
+
+    munmap((*image)->map, (*image)->size);
+    FREE(*image);
+}
+
+
+/* um_image_words
+ * Purpose:     Gets the program held in an image
+ * Parameters:  um_image_t image: the image
+ *              uint32_t *num_words: set to the program's length in words
+ * Returns:     const uint32_t *: the words, valid until the image is closed
+ */
+const uint32_t *um_image_words(um_image_t image, uint32_t *num_words)
+{
+    assert(image != NULL && num_words != NULL);
+
+    *num_words = image->num_words;
+    return image->words;
+}
+
+
+uint32_t checksum_words(const uint32_t *words, uint32_t num_words)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < num_words; i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,34 @@
+/*
+ * um_image.h
+ *
+ * Purpose: Interface for .umx images. A .umx image holds a UM program in
+ *          the host's byte order at a page-aligned offset, so it can be
+ *          mapped into memory and loaded without converting any words.
+ *          umx writes images; um loads them in place of .um files.
+ */
+
+#ifndef UM_IMAGE_H
+#define UM_IMAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct um_image_t* um_image_t;
+
+/* writes words as a .umx image; false if the write failed */
+bool um_image_write(FILE *fp, const uint32_t *words, uint32_t num_words);
+
+/* maps a .umx image; NULL if path cannot be read, is not an image, or is
+ * an image that fails its checks, in which case *error says why; *error is
+ * NULL when the file is simply not an image */
+um_image_t um_image_open(const char *path, const char **error);
+
+/* unmaps an image */
+void um_image_close(um_image_t *image);
+
+
+/* returns the image's program and sets its length in words */
+const uint32_t *um_image_words(um_image_t image, uint32_t *num_words);
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * um_io.c
+ *
+ * Purpose: Implementation of UM input and output buffers. Both buffers
+ *          are byte arrays with a read offset that are compacted when
+ *          they would otherwise have to grow. A UM reads from its own
+ *          input buffer, or from another UM's output buffer after
+ *          um_io_chain, so bytes pass between chained UMs without being
+ *          copied.
+ */
+
+#include "um_io.h"
+#include <string.h>
+#include <mem.h>
+#include <assert.h>
+
+#define INITIAL_CAPACITY 4096
+
+
+/* struct buffer
+ * Purpose:     A queue of bytes
+ * Members:     char *bytes: the storage
+ *              size_t start, end: the queued bytes are bytes[start, end)
+ *              size_t capacity: size of bytes
+ */
+struct buffer {
+    char   *bytes;
+    size_t  start;
+    size_t  end;
+    size_t  capacity;
+};
+
+/* struct um_io_t
+ * Purpose:     A UM's input and output
+ * Members:     struct buffer in, out: bytes to be read and bytes written
+ *              struct buffer *source: the buffer input is taken from;
+ *                  &in, or another UM's out once chained
+ *              bool input_ended: true iff no more input will be fed
+ */
+struct um_io_t {
+    struct buffer in;
+    struct buffer out;
+    struct buffer *source;
+    bool input_ended;
+};
+
+void buffer_append(struct buffer *buffer, const char *bytes, size_t length);
+
+
+/* um_io_new
+ * Purpose:     Creates empty input and output buffers
+ * Parameters:  None
+ * Returns:     um_io_t: the buffers; client frees with um_io_free
+ */
+um_io_t um_io_new()
+{
+    um_io_t io;
+    NEW0(io);
+    io->in.bytes = ALLOC(INITIAL_CAPACITY);
+    io->in.capacity = INITIAL_CAPACITY;
+    io->out.bytes = ALLOC(INITIAL_CAPACITY);
+    io->out.capacity = INITIAL_CAPACITY;
+    io->source = &io->in;
+
+    return io;
+}
+
+
+/* um_io_free
+ * Purpose:     Frees a pair of buffers
+ * Parameters:  um_io_t *io: pointer to the buffers to free
+ * Returns:     None
+ */
+void um_io_free(um_io_t *io)
+{
+    assert(io != NULL && *io != NULL);
+
+    FREE((*io)->in.bytes);
+    FREE((*io)->out.bytes);
+    FREE(*io);
+}
+
+
+/* um_io_feed
+ * Purpose:     Appends bytes to the input
+ * Parameters:  um_io_t io: the buffers
+ *              const char *bytes, size_t length: the bytes to append
+ * Returns:     None
+ */
+void um_io_feed(um_io_t io, const char *bytes, size_t length)
+{
+    assert(io != NULL && io->source == &io->in);
+    buffer_append(&io->in, bytes, length);
+}
+
+
+/* um_io_end_input
+ * Purpose:     Marks the end of the input
+ * Parameters:  um_io_t io: the buffers
+ * Returns:     None
+ */
+void um_io_end_input(um_io_t io)
+{
+    assert(io != NULL);
+    io->input_ended = true;
+}
+
+
+/* um_io_output
+ * Purpose:     Gives the output that has not been drained yet
+ * Parameters:  um_io_t io: the buffers
+ *              size_t *length: set to the number of bytes pending
+ * Returns:     const char *: the pending bytes; valid until the buffers
+ *                  next change
+ */
+const char *um_io_output(um_io_t io, size_t *length)
+{
+    assert(io != NULL && length != NULL);
+
+    *length = io->out.end - io->out.start;
+    return io->out.bytes + io->out.start;
+}
+
+
+/* um_io_drain
+ * Purpose:     Removes bytes from the front of the output
+ * Parameters:  um_io_t io: the buffers
+ *              size_t length: how many bytes to remove
+ * Returns:     None
+ */
+void um_io_drain(um_io_t io, size_t length)
+{
+    assert(io != NULL && length <= io->out.end - io->out.start);
+
+    io->out.start += length;
+    if (io->out.start == io->out.end) {
+        io->out.start = io->out.end = 0;
+    }
+}
+
+
+/* um_io_chain
+ * Purpose:     Connects one UM's output to another's input
+ * Parameters:  um_io_t from: the buffers of the UM whose output is read
+ *              um_io_t to: the buffers of the UM that reads it
+ * Returns:     None
+ * Notes:       Input already fed to to is discarded. The input instruction
+ *                  of to consumes from's output in place, so from's owner
+ *                  must not drain it, and um_io_output(from) gives what to
+ *                  has not read yet. to's owner still ends its input.
+ */
+void um_io_chain(um_io_t from, um_io_t to)
+{
+    assert(from != NULL && to != NULL && from != to);
+
+    to->in.start = to->in.end = 0;
+    to->source = &from->out;
+}
+
+
+/* um_io_unread
+ * Purpose:     Counts the input waiting to be read
+ * Parameters:  um_io_t io: the buffers
+ * Returns:     size_t: bytes fed, or written by the chained UM, that the
+ *                  input instruction has not read yet
+ */
+size_t um_io_unread(um_io_t io)
+{
+    assert(io != NULL);
+    return io->source->end - io->source->start;
+}
+
+
+/* um_io_readable
+ * Purpose:     Checks whether the input instruction can proceed
+ * Parameters:  um_io_t io: the buffers
+ * Returns:     bool: true iff a byte is waiting or the input has ended
+ */
+bool um_io_readable(um_io_t io)
+{
+    assert(io != NULL);
+    return io->source->start < io->source->end || io->input_ended;
+}
+
+
+/* um_io_put
+ * Purpose:     Appends one byte to the output
+ * Parameters:  um_io_t io: the buffers
+ *              uint32_t c: the byte; only its low 8 bits are kept
+ * Returns:     None
+ */
+void um_io_put(um_io_t io, uint32_t c)
+{
+    struct buffer *out = &io->out;
+
+    if (out->end < out->capacity) {
+        out->bytes[out->end++] = (char)c;
+    } else {
+        char byte = (char)c;
+        buffer_append(out, &byte, 1);
+    }
+}
+
+
+/* um_io_get
+ * Purpose:     Takes one byte from the input
+ * Parameters:  um_io_t io: the buffers
+ *              uint32_t *c: set to the byte, or to ~0 if the input has
+ *                  ended and been used up
+ * Returns:     bool: false iff the input is empty but has not ended, in
+ *                  which case the caller must wait for more input
+ */
+bool um_io_get(um_io_t io, uint32_t *c)
+{
+    struct buffer *in = io->source;
+
+    if (in->start < in->end) {
+        *c = (unsigned char)in->bytes[in->start++];
+        return true;
+    } else if (io->input_ended) {
+        *c = ~(uint32_t)0;
+        return true;
+    }
+
+    in->start = in->end = 0;
+    return false;
+}
+
+
+/* buffer_append
+ * Purpose:     Appends bytes to a buffer, making room for them first
+ * Parameters:  struct buffer *buffer: the buffer
+ *              const char *bytes: the bytes to append
+ *              size_t length: how many bytes to append
+ * Returns:     None
+ * Notes:       Moves the queued bytes to the front before growing
+ */
+void buffer_append(struct buffer *buffer, const char *bytes, size_t length)
+{
+    if (buffer->end + length > buffer->capacity && buffer->start > 0) {
+        memmove(buffer->bytes, buffer->bytes + buffer->start,
+                buffer->end - buffer->start);
+        buffer->end -= buffer->start;
+        buffer->start = 0;
+    }
+
+    if (buffer->end + length > buffer->capacity) {
+        size_t capacity = buffer->capacity * 2;
+        while (capacity < buffer->end + length) {
+            capacity *= 2;
+        }
+        RESIZE(buffer->bytes, capacity);
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->bytes + buffer->end, bytes, length);
+    buffer->end += length;
+}
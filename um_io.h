@@ -0,0 +1,55 @@
+/*
+ * um_io.h
+ *
+ * Purpose: Interface for byte buffers that stand in for stdin and stdout
+ *          when a UM is not attached to the terminal, as in server mode.
+ *          The owner feeds input and drains output; the UM's input and
+ *          output instructions take from and add to the buffers.
+ */
+
+#ifndef UM_IO_H
+#define UM_IO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct um_io_t* um_io_t;
+
+/* creates empty input and output buffers */
+um_io_t um_io_new();
+
+/* frees the buffers */
+void um_io_free(um_io_t *io);
+
+
+/* appends bytes to the input */
+void um_io_feed(um_io_t io, const char *bytes, size_t length);
+
+/* marks the end of the input; once the input is used up, reads give ~0 */
+void um_io_end_input(um_io_t io);
+
+/* returns the output not yet drained and sets its length */
+const char *um_io_output(um_io_t io, size_t *length);
+
+/* removes bytes from the front of the output */
+void um_io_drain(um_io_t io, size_t length);
+
+/* makes to read its input straight out of from's output, which must then
+ * not be drained by its owner; to is no longer fed */
+void um_io_chain(um_io_t from, um_io_t to);
+
+/* returns the number of input bytes fed but not yet read */
+size_t um_io_unread(um_io_t io);
+
+/* returns whether the input instruction would get a byte or ~0 now */
+bool um_io_readable(um_io_t io);
+
+
+/* used by the output instruction */
+void um_io_put(um_io_t io, uint32_t c);
+
+/* used by the input instruction; false if the next byte has not arrived */
+bool um_io_get(um_io_t io, uint32_t *c);
+
+#endif
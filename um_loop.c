@@ -0,0 +1,327 @@
+/*
+ * um_loop.c
+ *
+ * Purpose: Implementation of loop fast-forwarding.
+ *
+ *          A loop is recognized when load_prog jumps backward within
+ *          segment 0. If every instruction from the target up to the
+ *          load_prog is a conditional move, segmented load or store, add,
+ *          multiply, divide, nand or load value, the loop neither maps
+ *          memory nor does I/O, and it can be run without the interpreter.
+ *          The body is decoded into an array of operations with their
+ *          register fields already extracted, and run over a local copy of
+ *          the registers in a plain C loop, until the load_prog would go
+ *          anywhere but back to the head. Loads and stores go through
+ *          um_mem, or straight to the arena when segment IDs are handles,
+ *          just as the interpreter's do.
+ *
+ *          The interpreter runs the closing load_prog of the last
+ *          iteration, any iteration that would go over the instruction
+ *          budget, any divide by zero, and any store to segment 0, so
+ *          those behave exactly as they would have without this module. A
+ *          store to segment 0 may rewrite the body being run, so the loop
+ *          stops in front of it; the store then makes the loop's cache
+ *          entry stale, as described below.
+ *
+ *          Each jump site, named by the address of its load_prog, has an
+ *          entry in a direct-mapped cache. The entry remembers the site's
+ *          last target and what decoding found there: the decoded body, or
+ *          that the loop cannot be fast-forwarded. A jump that comes back
+ *          to the same target goes straight to the cached body, or straight
+ *          back to the interpreter, without reading the program again. The
+ *          entry also holds segment 0's version (get_program_version), so
+ *          any store to segment 0, or load_prog replacing it, makes every
+ *          entry stale.
+ */
+
+#include "um_loop.h"
+#include <string.h>
+#include <mem.h>
+#include <assert.h>
+
+/* jump sites remembered; a power of two, as sites are hashed by masking */
+#define LOOP_SITES 256
+
+/* struct loop_op
+ * Purpose:     One decoded instruction of a loop body
+ * Members:     uint8_t op: the opcode, one of 0 to 6 and 13
+ *              uint8_t a, b, c: the register fields
+ *              uint32_t value: the value loaded by load value
+ */
+struct loop_op {
+    uint8_t     op, a, b, c;
+    uint32_t    value;
+};
+
+/* struct loop_site
+ * Purpose:     What the last jump from one load_prog found at its target
+ * Members:     uint32_t head, tail: addresses of the target and of the
+ *                  load_prog; tail is UINT32_MAX while the entry is empty
+ *              uint64_t version: segment 0's version when it was decoded
+ *              bool usable: whether the loop can be fast-forwarded
+ *              uint8_t jump_b, jump_c: the load_prog's register fields
+ *              struct loop_op *body: instructions head to tail - 1, or
+ *                  NULL until a loop at this entry is first decoded
+ */
+struct loop_site {
+    uint32_t        head, tail;
+    uint64_t        version;
+    bool            usable;
+    uint8_t         jump_b, jump_c;
+    struct loop_op *body;
+};
+
+/* struct um_loop_t
+ * Purpose:     The loops decoded at recent jump sites
+ * Members:     struct loop_site sites[]: entries, indexed by tail
+ *              struct loop_site *current: the loop decoded last, which
+ *                  um_loop_run runs
+ *              uint64_t decodes, hits: decodes asked for, and how many of
+ *                  them the cache answered
+ */
+struct um_loop_t {
+    struct loop_site    sites[LOOP_SITES];
+    struct loop_site   *current;
+    uint64_t            decodes, hits;
+};
+
+bool decode_site(struct loop_site *site, um_mem_t memory, uint32_t head,
+                 uint32_t tail);
+
+
+/* um_loop_new
+ * Purpose:     Creates a loop with nothing decoded
+ * Parameters:  None
+ * Returns:     um_loop_t: the loop; client frees with um_loop_free
+ */
+um_loop_t um_loop_new()
+{
+    um_loop_t loop;
+    NEW0(loop);
+    for (int i = 0; i < LOOP_SITES; i++) {
+        loop->sites[i].tail = UINT32_MAX;
+    }
+    return loop;
+}
+
+
+/* um_loop_free
+ * Purpose:     Frees a loop
+ * Parameters:  um_loop_t *loop: pointer to the loop to free
+ * Returns:     None
+ */
+void um_loop_free(um_loop_t *loop)
+{
+    assert(loop != NULL && *loop != NULL);
+
+    for (int i = 0; i < LOOP_SITES; i++) {
+        if ((*loop)->sites[i].body != NULL) {
+            FREE((*loop)->sites[i].body);
+        }
+    }
+    FREE(*loop);
+}
+
+
+/* um_loop_decode
+ * Purpose:     Finds the loop a load_prog closes, and whether it can be
+ *                  fast-forwarded
+ * Parameters:  um_loop_t loop: the cache of jump sites
+ *              um_mem_t memory: the memory holding the program
+ *              uint32_t head: address the load_prog jumps to
+ *              uint32_t tail: address of the load_prog, at least head
+ * Returns:     bool: true iff the loop can be fast-forwarded; if so, it is
+ *                  the one um_loop_run runs next
+ * Notes:       Answers from the site's cache entry if the site last jumped
+ *                  to the same head and segment 0 has not changed since,
+ *                  and else decodes the loop into that entry
+ */
+bool um_loop_decode(um_loop_t loop, um_mem_t memory, uint32_t head,
+                    uint32_t tail)
+{
+    assert(loop != NULL && memory != NULL && head <= tail);
+
+    struct loop_site *site = &loop->sites[tail & (LOOP_SITES - 1)];
+    uint64_t version = get_program_version(memory);
+
+    loop->decodes++;
+    if (site->tail == tail && site->head == head &&
+        site->version == version) {
+        loop->hits++;
+    } else {
+        site->usable = decode_site(site, memory, head, tail);
+        site->head = head;
+        site->tail = tail;
+        site->version = version;
+    }
+
+    if (site->usable) {
+        loop->current = site;
+    }
+    return site->usable;
+}
+
+
+/* um_loop_hits
+ * Purpose:     Reports how well the jump site cache did
+ * Parameters:  um_loop_t loop: the cache
+ *              uint64_t *hits: set to the decodes the cache answered
+ * Returns:     uint64_t: the number of decodes asked for
+ */
+uint64_t um_loop_hits(um_loop_t loop, uint64_t *hits)
+{
+    assert(loop != NULL && hits != NULL);
+
+    *hits = loop->hits;
+    return loop->decodes;
+}
+
+
+/* um_loop_run
+ * Purpose:     Runs the decoded loop for as many whole iterations as it
+ *                  keeps jumping back and the budget allows
+ * Parameters:  um_loop_t loop: the cache, whose last um_loop_decode
+ *                  returned true
+ *              um_mem_t memory: the UM's memory
+ *              uint32_t *words: the arena that segments other than 0 are
+ *                  in when segment IDs are handles, or NULL
+ *              uint32_t *regs: the UM's eight registers, updated in place
+ *              uint32_t *pc: the UM's program counter, on the loop's head
+ *              uint64_t budget: the most instructions to run
+ * Returns:     uint64_t: the number of instructions run, counting each
+ *                  load_prog that jumped back
+ * Notes:       Leaves *pc on the head if the budget ran out, on the
+ *                  load_prog if it would not jump back, on a divide with
+ *                  a zero divisor, or on a store to segment 0
+ */
+uint64_t um_loop_run(um_loop_t loop, um_mem_t memory, uint32_t *words,
+                     uint32_t *regs, uint32_t *pc, uint64_t budget)
+{
+    assert(loop != NULL && loop->current != NULL && regs != NULL && 
+           pc != NULL && *pc == loop->current->head);
+
+    const struct loop_site *site = loop->current;
+    uint32_t r[8];
+    uint32_t length = site->tail - site->head + 1;
+    const struct loop_op *body = site->body;
+    uint64_t ran = 0;
+
+    memcpy(r, regs, sizeof(r));
+
+    while (budget - ran >= length) {
+        for (uint32_t i = 0; i < length - 1; i++) {
+            const struct loop_op *op = &body[i];
+
+            switch (op->op) {
+            case 0:
+                if (r[op->c] != 0) {
+                    r[op->a] = r[op->b];
+                }
+                break;
+            case 1:
+                if (words != NULL && r[op->b] != 0) {
+                    r[op->a] = words[(size_t)r[op->b] + r[op->c]];
+                } else {
+                    r[op->a] = get_seg_value(memory, r[op->b], r[op->c]);
+                }
+                break;
+            case 2:
+                if (r[op->a] == 0) {
+                    *pc = site->head + i;
+                    ran += i;
+                    memcpy(regs, r, sizeof(r));
+                    return ran;
+                }
+                if (words != NULL) {
+                    words[(size_t)r[op->a] + r[op->b]] = r[op->c];
+                } else {
+                    set_seg_value(memory, r[op->a], r[op->b], r[op->c]);
+                }
+                break;
+            case 3:
+                r[op->a] = r[op->b] + r[op->c];
+                break;
+            case 4:
+                r[op->a] = r[op->b] * r[op->c];
+                break;
+            case 5:
+                if (r[op->c] == 0) {
+                    *pc = site->head + i;
+                    ran += i;
+                    memcpy(regs, r, sizeof(r));
+                    return ran;
+                }
+                r[op->a] = r[op->b] / r[op->c];
+                break;
+            case 6:
+                r[op->a] = ~(r[op->b] & r[op->c]);
+                break;
+            default:
+                r[op->a] = op->value;
+                break;
+            }
+        }
+
+        if (r[site->jump_b] != 0 || r[site->jump_c] != site->head) {
+            *pc = site->tail;
+            ran += length - 1;
+            memcpy(regs, r, sizeof(r));
+            return ran;
+        }
+        ran += length;
+    }
+
+    *pc = site->head;
+    memcpy(regs, r, sizeof(r));
+    return ran;
+}
+
+
+/* decode_site
+ * Purpose:     Decodes a loop body into a cache entry, if it neither maps
+ *                  memory, does I/O nor jumps
+ * Parameters:  struct loop_site *site: the entry to decode into
+ *              um_mem_t memory: the memory holding the program
+ *              uint32_t head: address the load_prog jumps to
+ *              uint32_t tail: address of the load_prog, at least head
+ * Returns:     bool: true iff the loop can be fast-forwarded
+ * Notes:       Stops reading at the first instruction that disqualifies
+ *                  the loop, so a loop that does I/O early is rejected in
+ *                  a few steps
+ */
+bool decode_site(struct loop_site *site, um_mem_t memory, uint32_t head,
+                 uint32_t tail)
+{
+    if (tail - head >= UM_LOOP_MAX) {
+        return false;
+    }
+    if (site->body == NULL) {
+        site->body = ALLOC((UM_LOOP_MAX - 1) * sizeof(struct loop_op));
+    }
+
+    for (uint32_t pc = head; pc < tail; pc++) {
+        uint32_t inst = get_seg_value(memory, 0, pc);
+        struct loop_op *op = &site->body[pc - head];
+
+        op->op = inst >> 28;
+        switch (op->op) {
+        case 0: case 1: case 2: case 3: case 4: case 5: case 6:
+            op->a = (inst >> 6) & 0x7;
+            op->b = (inst >> 3) & 0x7;
+            op->c = inst & 0x7;
+            break;
+        case 13:
+            op->a = (inst >> 25) & 0x7;
+            op->value = inst & 0x1ffffff;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    uint32_t jump = get_seg_value(memory, 0, tail);
+    site->jump_b = (jump >> 3) & 0x7;
+    site->jump_c = jump & 0x7;
+
+    return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * um_loop.h
+ *
+ * Purpose: Interface for fast-forwarding loops. A loop whose body only
+ *          moves, loads values, does arithmetic on registers, and loads
+ *          and stores words of mapped segments, and which closes with a
+ *          load_prog of segment 0 back to its first instruction, is decoded
+ *          once and then run on a copy of the registers without fetching
+ *          or dispatching any instruction. Every instruction it runs is
+ *          still counted. What was found at each recent jump site is cached
+ *          until segment 0 changes.
+ */
+
+#ifndef UM_LOOP_H
+#define UM_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "um_mem.h"
+
+/* longest loop fast-forwarded, in instructions, counting the load_prog */
+#define UM_LOOP_MAX 64
+
+typedef struct um_loop_t* um_loop_t;
+
+/* creates a cache of jump sites with nothing decoded */
+um_loop_t um_loop_new();
+
+/* frees the cache */
+void um_loop_free(um_loop_t *loop);
+
+
+/* decodes the loop from head to the load_prog at tail in segment 0, or
+ * finds it already decoded; false if it is too long, maps or unmaps a
+ * segment, does I/O, halts or jumps */
+bool um_loop_decode(um_loop_t loop, um_mem_t memory, uint32_t head,
+                    uint32_t tail);
+
+/* returns the number of calls to um_loop_decode, and sets *hits to how
+ * many of them were answered from the cache */
+uint64_t um_loop_hits(um_loop_t loop, uint64_t *hits);
+
+/* runs whole iterations of the last loop decoded from its head, at most
+ * budget instructions in all, with loads and stores going to memory, or to
+ * words for segments other than 0 when IDs are handles; returns how many
+ * instructions it ran, and leaves *pc on the next instruction for the
+ * interpreter */
+uint64_t um_loop_run(um_loop_t loop, um_mem_t memory, uint32_t *words,
+                     uint32_t *regs, uint32_t *pc, uint64_t budget);
+
+#endif
@@ -9,27 +9,116 @@
  
 
  #include "um_mem.h"
+ #include "um_store.h"
+ #include "um_arena.h"
+ #include "um_huge.h"
  #include <seq.h>
  #include <uarray.h> 
  #include <stdint.h>
  #include <stdlib.h>
  #include <mem.h>
  #include <stdio.h>
+ #include <string.h>
  #include <assert.h>
 
+#define UNMAPPED_LENGTH UINT32_MAX
+
+/* fewest entries the segment table and its side tables shrink to */
+#define TABLE_MIN_CAPACITY 100
+/* IDs covered by one word of the available ID bitmap, and by one word of
+ * its summary */
+#define IDS_PER_WORD 64
+#define IDS_PER_SUMMARY (IDS_PER_WORD * IDS_PER_WORD)
+
 void fill_seg(UArray_T seg);
+UArray_T new_segment(um_mem_t memory, uint32_t length);
+void free_segment(um_mem_t memory, UArray_T *seg);
+void mark_dirty(um_mem_t memory, uint32_t seg_id);
+void count_map(um_mem_t memory, uint32_t seg_id, uint32_t length);
+void count_unmap(um_mem_t memory, uint32_t seg_id);
+unsigned bucket(uint64_t value);
+void print_histogram(FILE *fp, const char *title, const uint64_t *counts);
+void release_segment(um_mem_t memory, uint32_t seg_id);
+void unshare_segment(um_mem_t memory, uint32_t seg_id);
+void push_free_id(um_mem_t memory, uint32_t seg_id);
+void clear_free_id(um_mem_t memory, uint32_t seg_id);
+uint32_t take_free_id(um_mem_t memory);
+void resize_free_ids(um_mem_t memory, uint32_t capacity);
+void trim_table(um_mem_t memory);
+void shrink_tables(um_mem_t memory);
+void rebuild_free_ids(um_mem_t memory);
+bool read_u32(FILE *fp, uint32_t *value);
+
+
+/* struct shared_seg
+ * Purpose:     A segment held by more than one memory after um_mem_clone
+ * Members:     UArray_T words: the segment, which no holder may change
+ *              int refs: number of memories holding the segment; changed
+ *                  atomically since clones may run on different threads
+ */
+struct shared_seg {
+    UArray_T words;
+    int refs;
+};
 
 
 /* struct um_mem_t
  * Purpose:     Holds important data for the memory managment of a um instance
- * Members:     Seq_T segment_list: a sequence which holds the UM's segments
- *              Seq_T avail_ids: a sequence of currently available segment IDs
- *                  The last seq element is next ID after the highest ID that 
- *                  has already been mapped
+ * Members:     Seq_T segment_list: a sequence which holds the UM's segments,
+ *                  NULL for an unmapped ID; it never ends in an unmapped ID
+ *                  other than 0
+ *              uint64_t *free_bits: a bitmap with a bit set for each
+ *                  unmapped ID other than 0 below the end of segment_list,
+ *                  one bit per entry of capacity
+ *              uint64_t *free_summary: a bit set for each word of
+ *                  free_bits that is not 0, so that the lowest available
+ *                  ID is found with two bit scans
+ *              uint32_t free_low: no word of free_summary below this one
+ *                  is nonzero
+ *              uint32_t mapped: number of IDs mapped now
+ *              uint64_t program_version: bumped whenever segment 0 is
+ *                  stored to or replaced, so that code decoded from it
+ *                  can tell when it is stale
+ *              uint8_t *dirty: nonzero for each segment ID that has been
+ *                  mapped, unmapped, replaced or stored to since the last
+ *                  write_dirty_segments
+ *              struct shared_seg **shared: for each segment ID, the
+ *                  record of the segment's other holders, or NULL if this
+ *                  memory is its only holder
+ *              uint32_t capacity: number of entries in dirty, shared and
+ *                  born; grows with segment_list and shrinks once it is
+ *                  a quarter full
+ *              struct um_mem_stats *stats: statistics, or NULL if they are
+ *                  not being kept
+ *              const uint64_t *clock: instructions executed, when stats are
+ *                  kept
+ *              uint64_t *born: for each mapped segment ID, the clock when
+ *                  its segment was mapped, when stats are kept
+ *              um_store_t store: where large segments are made, or NULL to
+ *                  keep them all on the heap
+ *              um_huge_t huge: where the other segments are made, or NULL
+ *                  to keep them on the heap
+ *              um_arena_t arena: where every segment but 0 is made when
+ *                  IDs are handles (see um_mem_use_handles), else NULL
+ *              uint32_t *words: the arena's words, or NULL
  */
 struct um_mem_t {
     Seq_T segment_list;
-    Seq_T avail_ids;
+    uint64_t *free_bits;
+    uint64_t *free_summary;
+    uint32_t free_low;
+    uint32_t mapped;
+    uint64_t program_version;
+    uint8_t *dirty;
+    struct shared_seg **shared;
+    uint32_t capacity;
+    struct um_mem_stats *stats;
+    const uint64_t *clock;
+    uint64_t *born;
+    um_store_t store;
+    um_huge_t huge;
+    um_arena_t arena;
+    uint32_t *words;
 };
 
 
@@ -42,44 +131,141 @@ struct um_mem_t {
 um_mem_t um_mem_new()
 {
     um_mem_t new_mem = ALLOC(sizeof(struct um_mem_t));
-    new_mem->segment_list = Seq_new(100);
-    new_mem->avail_ids = Seq_new(100);
+    new_mem->segment_list = Seq_new(TABLE_MIN_CAPACITY);
+    new_mem->mapped = 0;
+    new_mem->program_version = 0;
+    new_mem->capacity = 0;
+    new_mem->free_bits = NULL;
+    new_mem->free_summary = NULL;
+    resize_free_ids(new_mem, TABLE_MIN_CAPACITY);
+    new_mem->free_low = 0;
+    new_mem->capacity = TABLE_MIN_CAPACITY;
+    new_mem->dirty = CALLOC(new_mem->capacity, sizeof(uint8_t));
+    new_mem->shared = CALLOC(new_mem->capacity, sizeof(struct shared_seg *));
+    new_mem->stats = NULL;
+    new_mem->clock = NULL;
+    new_mem->born = NULL;
+    new_mem->store = NULL;
+    new_mem->huge = NULL;
+    new_mem->arena = NULL;
+    new_mem->words = NULL;
     return new_mem;
 }
 
 
+/* um_mem_set_store
+ * Purpose:     Makes segments of at least UM_STORE_MIN_WORDS words in a
+ *                  file-backed store from now on
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              um_store_t store: the store, which must outlive memory and
+ *                  its clones; NULL to go back to the heap
+ * Returns:     None
+ * Notes:       Segments already mapped stay where they are. Clones made
+ *                  later use the same store.
+ *              It is a CRE for memory to be NULL.
+ */
+void um_mem_set_store(um_mem_t memory, um_store_t store)
+{
+    assert(memory != NULL);
+    memory->store = store;
+}
+
+
+/* um_mem_set_huge
+ * Purpose:     Makes segments in a huge-page pool from now on, except those
+ *                  a store takes
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              um_huge_t huge: the pool, which must outlive memory and its
+ *                  clones; NULL to go back to the heap
+ * Returns:     None
+ * Notes:       Segments already mapped stay where they are. Clones made
+ *                  later use the same pool.
+ *              It is a CRE for memory to be NULL.
+ */
+void um_mem_set_huge(um_mem_t memory, um_huge_t huge)
+{
+    assert(memory != NULL);
+    memory->huge = huge;
+}
+
+
+/* um_mem_use_handles
+ * Purpose:     Makes the ID of every segment mapped from now on a handle
+ *                  into a word arena, in place of a small index
+ * Parameters:  um_mem_t memory: struct containing UM memory data, with no
+ *                  segment mapped but segment 0
+ * Returns:     bool: false if the arena cannot be reserved, in which case
+ *                  IDs stay small indices
+ * Notes:       Loads and stores then index the arena directly by ID plus
+ *                  offset. Segment 0 stays where it is, since load_prog
+ *                  replaces it and ID 0 must keep naming it.
+ *              Such a memory cannot keep statistics, write or read dirty
+ *                  segments, or use a store.
+ *              It is a CRE for memory to be NULL.
+ */
+bool um_mem_use_handles(um_mem_t memory)
+{
+    assert(memory != NULL && memory->arena == NULL);
+    assert(Seq_length(memory->segment_list) <= 1);
+
+    memory->arena = um_arena_new();
+    if (memory->arena == NULL) {
+        return false;
+    }
+    memory->words = um_arena_words(memory->arena);
+    return true;
+}
+
+
+/* um_mem_handle_words
+ * Purpose:     Gives direct access to the segments named by handles
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ * Returns:     uint32_t *: the arena's words, where word i of the segment
+ *                  with ID h is at index h + i; NULL if IDs are not handles
+ * Notes:       Segment 0 is never in the arena.
+ *              It is a CRE for memory to be NULL.
+ */
+uint32_t *um_mem_handle_words(um_mem_t memory)
+{
+    assert(memory != NULL);
+    return memory->words;
+}
+
+
 /* map_segment
  * Purpose:     Creates a new segment of the desired length in memory, 
  *                  initializes its values to 0, and returns its ID
  * Parameters:  um_mem_t memory: the memory where the segment should be added
  *              int length: the number of 32-bit words the segment should hold
  * Returns:     unsigned: the ID of the newly created segment
+ * Notes:       Reuses the lowest unmapped ID, if there is one, so that the
+ *                  segments in use stay at the front of the table
  */
 unsigned map_segment(um_mem_t memory, unsigned length) 
 {
     assert(memory != NULL);
 
-    unsigned index;
+    if (memory->arena != NULL && Seq_length(memory->segment_list) > 0) {
+        return um_arena_alloc(memory->arena, length);
+    }
+
+    unsigned index = take_free_id(memory);
 
-    /* first segment creation */
-    if (Seq_length(memory->segment_list) == 0) {
-        Seq_addhi(memory->segment_list, UArray_new(length, sizeof(uint32_t)));
-        Seq_addhi(memory->avail_ids, (void *)(uintptr_t)1);
-        index = 0;
-    
     /* no recycled ids */
-    } else if(Seq_length(memory->avail_ids) == 1) {
-        Seq_addhi(memory->segment_list, UArray_new(length, sizeof(uint32_t)));
-        index = (unsigned)(uintptr_t)Seq_remlo(memory->avail_ids);
-        Seq_addhi(memory->avail_ids, (void *)(uintptr_t)(index + 1));
+    if (index == (unsigned)Seq_length(memory->segment_list)) {
+        Seq_addhi(memory->segment_list, new_segment(memory, length));
 
     /* using previously mapped segment */
     } else {
-        index = (unsigned)(uintptr_t)Seq_remlo(memory->avail_ids);
-        Seq_put(memory->segment_list, index, UArray_new(length, sizeof(uint32_t)));
+        Seq_put(memory->segment_list, index, new_segment(memory, length));
     }
+    memory->mapped++;
 
-    fill_seg(Seq_get(memory->segment_list, index));
+    mark_dirty(memory, index);
+
+    if (memory->stats != NULL) {
+        count_map(memory, index, length);
+    }
 
     return index;
 }
@@ -102,8 +288,22 @@ void set_seg_value(um_mem_t memory, uint32_t seg_id, uint32_t word_id,
                    uint32_t new_val)
 {
     assert(memory != NULL);
+
+    if (memory->words != NULL && seg_id != 0) {
+        memory->words[(size_t)seg_id + word_id] = new_val;
+        return;
+    }
+
+    if (memory->shared[seg_id] != NULL) {
+        unshare_segment(memory, seg_id);
+    }
+    if (seg_id == 0) {
+        memory->program_version++;
+    }
+
     *(uint32_t *)UArray_at(Seq_get(memory->segment_list, seg_id), word_id) = 
     new_val;
+    memory->dirty[seg_id] = 1;
 }
 
 
@@ -124,6 +324,10 @@ void set_seg_value(um_mem_t memory, uint32_t seg_id, uint32_t word_id,
 uint32_t get_seg_value(um_mem_t memory, uint32_t seg_id, uint32_t word_id)
 {
     assert(memory != NULL);
+
+    if (memory->words != NULL && seg_id != 0) {
+        return memory->words[(size_t)seg_id + word_id];
+    }
     return *(uint32_t *)UArray_at(Seq_get(memory->segment_list, seg_id), 
                                           word_id);
 }
@@ -137,19 +341,36 @@ uint32_t get_seg_value(um_mem_t memory, uint32_t seg_id, uint32_t word_id)
  *              uint32_t seg_id: ID of segment to unmap
  * Returns:     None
  * Notes:       Cannot unmap Segment 0. 
+ *              Unmapping the last ID in the table trims every unmapped ID
+ *                  off its end (see trim_table).
  *              It is a CRE for memory to be NULL. 
  */
 void unmap_segment(um_mem_t memory, uint32_t seg_id)
 {
     assert(memory != NULL);
 
+    if (memory->arena != NULL) {
+        um_arena_release(memory->arena, seg_id);
+        return;
+    }
+
+    if (memory->stats != NULL) {
+        count_unmap(memory, seg_id);
+    }
+
     /* free memory associated with the given segment */
-    UArray_T seg = (UArray_T)Seq_get(memory->segment_list, seg_id);
-    UArray_free(&seg);
+    release_segment(memory, seg_id);
     Seq_put(memory->segment_list, seg_id, NULL);
+    memory->dirty[seg_id] = 1;
+    memory->mapped--;
 
-    /* Add freed segment id to list of available ids */
-    Seq_addlo(memory->avail_ids, (void *)(uintptr_t)seg_id);
+    /* Add freed segment id to the available ids, unless it leaves the
+     * table */
+    if (seg_id + 1 == (uint32_t)Seq_length(memory->segment_list)) {
+        trim_table(memory);
+    } else {
+        push_free_id(memory, seg_id);
+    }
 }
 
 
@@ -167,16 +388,24 @@ void um_mem_free(um_mem_t memory)
     
     for (int i = 0; i < length; i++) {
         
-        UArray_T seg = (UArray_T)Seq_remlo(memory->segment_list);
-        
         /* Previously-unmapped segments should not be freed again */
-        if (seg != NULL){
-            UArray_free(&seg);
+        if (Seq_get(memory->segment_list, i) != NULL){
+            release_segment(memory, i);
         }
     }
 
     Seq_free(&(memory->segment_list));
-    Seq_free(&(memory->avail_ids));
+    FREE(memory->free_bits);
+    FREE(memory->free_summary);
+    FREE(memory->dirty);
+    FREE(memory->shared);
+    if (memory->stats != NULL) {
+        FREE(memory->stats);
+        FREE(memory->born);
+    }
+    if (memory->arena != NULL) {
+        um_arena_free(&memory->arena);
+    }
     FREE(memory);
 }
 
@@ -186,16 +415,57 @@ void um_mem_free(um_mem_t memory)
  * Parameters: UArray_T seg: Current segment to initialize
  * Returns:    None
  * Notes:      Helper function for map_segment
+ *             A UArray's elements are contiguous, so one memset clears them
  *             It is a CRE for seg to be NULL. 
  */
 void fill_seg(UArray_T seg)
 {
     assert(seg != NULL);
 
-    uint32_t *elmt;
-    for (int i = 0; i < UArray_length(seg); i++){
-        elmt = UArray_at(seg, i);
-        *elmt = 0;
+    if (UArray_length(seg) > 0) {
+        memset(UArray_at(seg, 0), 0, UArray_length(seg) * UArray_size(seg));
+    }
+}
+
+
+/* new_segment
+ * Purpose:     Makes a new segment, initialized to 0
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t length: number of 32-bit words in the segment
+ * Returns:     UArray_T: the segment, in the store if memory has one and
+ *                  the segment is large enough, else in the huge-page pool
+ *                  if memory has one, else on the heap
+ * Notes:       Free it with free_segment
+ */
+UArray_T new_segment(um_mem_t memory, uint32_t length)
+{
+    if (memory->store != NULL && length >= UM_STORE_MIN_WORDS) {
+        return um_store_alloc(memory->store, length);
+    }
+    if (memory->huge != NULL) {
+        return um_huge_alloc(memory->huge, length);
+    }
+
+    UArray_T seg = UArray_new(length, sizeof(uint32_t));
+    fill_seg(seg);
+    return seg;
+}
+
+
+/* free_segment
+ * Purpose:     Frees a segment made by new_segment
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              UArray_T *seg: pointer to the segment to free
+ * Returns:     None
+ */
+void free_segment(um_mem_t memory, UArray_T *seg)
+{
+    if (memory->store != NULL && um_store_owns(memory->store, *seg)) {
+        um_store_release(memory->store, seg);
+    } else if (memory->huge != NULL && um_huge_owns(memory->huge, *seg)) {
+        um_huge_release(memory->huge, seg);
+    } else {
+        UArray_free(seg);
     }
 }
 
@@ -209,9 +479,24 @@ void fill_seg(UArray_T seg)
  */
 UArray_T get_segment_copy(um_mem_t memory, uint32_t seg_id)
 {
+    if (memory->arena != NULL && seg_id != 0) {
+        uint32_t length = um_arena_length(memory->arena, seg_id);
+        UArray_T dest_seg = new_segment(memory, length);
+        if (length > 0) {
+            memcpy(UArray_at(dest_seg, 0), &memory->words[seg_id], 
+                   length * sizeof(uint32_t));
+        }
+        return dest_seg;
+    }
+
     UArray_T source_seg = Seq_get(memory->segment_list, seg_id);
     int length = UArray_length(source_seg);
-    UArray_T dest_seg = UArray_new(length, sizeof(uint32_t));
+    UArray_T dest_seg = new_segment(memory, length);
+
+    if (memory->stats != NULL) {
+        memory->stats->copies++;
+        memory->stats->copied_words += length;
+    }
 
     uint32_t *elem_ptr;
 
@@ -236,7 +521,850 @@ UArray_T get_segment_copy(um_mem_t memory, uint32_t seg_id)
  */
 void set_segment(um_mem_t memory, uint32_t seg_id, UArray_T segment)
 {
-    UArray_T seg = (UArray_T)Seq_get(memory->segment_list, seg_id);
-    UArray_free(&seg);
+    if (memory->stats != NULL) {
+        memory->stats->live_words -= get_seg_length(memory, seg_id);
+        memory->stats->live_words += UArray_length(segment);
+        if (memory->stats->live_words > memory->stats->peak_words) {
+            memory->stats->peak_words = memory->stats->live_words;
+        }
+    }
+
+    release_segment(memory, seg_id);
     Seq_put(memory->segment_list, seg_id, segment);
+    memory->dirty[seg_id] = 1;
+    if (seg_id == 0) {
+        memory->program_version++;
+    }
+}
+
+
+/* set_seg_words
+ * Purpose:     Copies a block of words into the start of a segment
+ * Parameters:  um_mem_t memory: the memory containing the segment
+ *              uint32_t seg_id: the ID of the segment to fill
+ *              const uint32_t *words: the words to copy
+ *              uint32_t length: the number of words to copy
+ * Returns:     None
+ * Notes:       Copies with a single memcpy, since a UArray's elements are
+ *                  contiguous.
+ *              It is a URE for seg_id to identify an unmapped segment or
+ *                  for the segment to be shorter than length
+ */
+void set_seg_words(um_mem_t memory, uint32_t seg_id, const uint32_t *words,
+                   uint32_t length)
+{
+    assert(memory != NULL);
+
+    UArray_T segment = Seq_get(memory->segment_list, seg_id);
+    assert(segment != NULL && (uint32_t)UArray_length(segment) >= length);
+
+    if (memory->shared[seg_id] != NULL) {
+        unshare_segment(memory, seg_id);
+        segment = Seq_get(memory->segment_list, seg_id);
+    }
+
+    if (length > 0) {
+        memcpy(UArray_at(segment, 0), words, length * sizeof(uint32_t));
+    }
+    memory->dirty[seg_id] = 1;
+    if (seg_id == 0) {
+        memory->program_version++;
+    }
+}
+
+
+/* is_seg_mapped
+ * Purpose:     Checks whether a segment ID is currently mapped
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: ID of the segment to check
+ * Returns:     bool: true iff seg_id identifies a mapped segment
+ * Notes:       Safe to call with any seg_id. 
+ *              It is a CRE for memory to be NULL.
+ */
+bool is_seg_mapped(um_mem_t memory, uint32_t seg_id)
+{
+    assert(memory != NULL);
+
+    if (memory->arena != NULL && seg_id != 0) {
+        return um_arena_holds(memory->arena, seg_id);
+    }
+    if (seg_id >= (uint32_t)Seq_length(memory->segment_list)) {
+        return false;
+    }
+
+    return Seq_get(memory->segment_list, seg_id) != NULL;
+}
+
+
+/* get_seg_length
+ * Purpose:     Gets the number of words in a segment
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: ID of the segment
+ * Returns:     uint32_t: the length of the segment in words
+ * Notes:       It is a URE for seg_id to identify an unmapped segment.
+ *              It is a CRE for memory to be NULL.
+ */
+uint32_t get_seg_length(um_mem_t memory, uint32_t seg_id)
+{
+    assert(memory != NULL);
+
+    if (memory->arena != NULL && seg_id != 0) {
+        return um_arena_length(memory->arena, seg_id);
+    }
+    return UArray_length(Seq_get(memory->segment_list, seg_id));
+}
+
+
+/* get_program_version
+ * Purpose:     Tells whether segment 0 has changed since an earlier call
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ * Returns:     uint64_t: a number that is different after every store to
+ *                  segment 0 and every replacement of it
+ * Notes:       It is a CRE for memory to be NULL.
+ */
+uint64_t get_program_version(um_mem_t memory)
+{
+    assert(memory != NULL);
+    return memory->program_version;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                       Segment table                        *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* push_free_id
+ * Purpose:     Makes an unmapped ID available to map_segment
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: the ID, which is below the table's capacity
+ * Returns:     None
+ */
+void push_free_id(um_mem_t memory, uint32_t seg_id)
+{
+    uint32_t word = seg_id / IDS_PER_WORD;
+    uint32_t summary = seg_id / IDS_PER_SUMMARY;
+
+    memory->free_bits[word] |= 1ULL << (seg_id % IDS_PER_WORD);
+    memory->free_summary[summary] |= 1ULL << (word % IDS_PER_WORD);
+    if (summary < memory->free_low) {
+        memory->free_low = summary;
+    }
+}
+
+
+/* clear_free_id
+ * Purpose:     Makes an ID no longer available to map_segment
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: the ID, which is below the table's capacity
+ * Returns:     None
+ * Notes:       Does nothing if the ID was not available
+ */
+void clear_free_id(um_mem_t memory, uint32_t seg_id)
+{
+    uint32_t word = seg_id / IDS_PER_WORD;
+
+    memory->free_bits[word] &= ~(1ULL << (seg_id % IDS_PER_WORD));
+    if (memory->free_bits[word] == 0) {
+        memory->free_summary[seg_id / IDS_PER_SUMMARY] &= 
+            ~(1ULL << (word % IDS_PER_WORD));
+    }
+}
+
+
+/* take_free_id
+ * Purpose:     Removes the lowest available ID
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ * Returns:     uint32_t: the ID, or the length of the table if no ID below
+ *                  it is available
+ * Notes:       Scans the summary from free_low, which only moves past
+ *                  words that are 0, so a map costs a few word reads
+ */
+uint32_t take_free_id(um_mem_t memory)
+{
+    uint32_t summaries = (memory->capacity + IDS_PER_SUMMARY - 1) / 
+                         IDS_PER_SUMMARY;
+
+    while (memory->free_low < summaries && 
+           memory->free_summary[memory->free_low] == 0) {
+        memory->free_low++;
+    }
+    if (memory->free_low >= summaries) {
+        return Seq_length(memory->segment_list);
+    }
+
+    uint32_t word = memory->free_low * IDS_PER_WORD + 
+                    __builtin_ctzll(memory->free_summary[memory->free_low]);
+    uint32_t id = word * IDS_PER_WORD + 
+                  __builtin_ctzll(memory->free_bits[word]);
+    clear_free_id(memory, id);
+    return id;
+}
+
+
+/* resize_free_ids
+ * Purpose:     Resizes the available ID bitmap and its summary to cover a
+ *                  new table capacity
+ * Parameters:  um_mem_t memory: struct containing UM memory data, whose
+ *                  capacity member still holds the old capacity
+ *              uint32_t capacity: the new capacity
+ * Returns:     None
+ * Notes:       Words added are cleared. When shrinking, no ID at or past
+ *                  the new capacity may be available.
+ */
+void resize_free_ids(um_mem_t memory, uint32_t capacity)
+{
+    size_t old_words = (memory->capacity + IDS_PER_WORD - 1) / IDS_PER_WORD;
+    size_t words = (capacity + IDS_PER_WORD - 1) / IDS_PER_WORD;
+    size_t old_summaries = (old_words + IDS_PER_WORD - 1) / IDS_PER_WORD;
+    size_t summaries = (words + IDS_PER_WORD - 1) / IDS_PER_WORD;
+
+    if (memory->free_bits == NULL) {
+        memory->free_bits = ALLOC(words * sizeof(uint64_t));
+        memory->free_summary = ALLOC(summaries * sizeof(uint64_t));
+    } else {
+        RESIZE(memory->free_bits, words * sizeof(uint64_t));
+        RESIZE(memory->free_summary, summaries * sizeof(uint64_t));
+    }
+    if (words > old_words) {
+        memset(memory->free_bits + old_words, 0,
+               (words - old_words) * sizeof(uint64_t));
+    }
+    if (summaries > old_summaries) {
+        memset(memory->free_summary + old_summaries, 0,
+               (summaries - old_summaries) * sizeof(uint64_t));
+    }
+}
+
+
+/* trim_table
+ * Purpose:     Drops the unmapped IDs from the end of the segment table,
+ *                  and shrinks the table's storage if it is then mostly
+ *                  empty
+ * Parameters:  um_mem_t memory: struct containing UM memory data, whose
+ *                  last ID has just been unmapped
+ * Returns:     None
+ * Notes:       Mapped IDs never move, since the program holds them. With
+ *                  the lowest ID always reused first, a burst of maps
+ *                  leaves its IDs at the end of the table, where they are
+ *                  trimmed once unmapped. Each ID is trimmed once for each
+ *                  time it was added, and each shrink is paid for by the
+ *                  trims before it, so unmapping stays amortized constant
+ *                  time.
+ */
+void trim_table(um_mem_t memory)
+{
+    uint32_t limit = Seq_length(memory->segment_list);
+
+    while (limit > 1 && Seq_get(memory->segment_list, limit - 1) == NULL) {
+        Seq_remhi(memory->segment_list);
+        memory->dirty[--limit] = 0;
+        clear_free_id(memory, limit);
+    }
+
+    if (memory->capacity / 4 > limit && 
+        memory->capacity / 2 >= TABLE_MIN_CAPACITY) {
+        shrink_tables(memory);
+    }
+}
+
+
+/* shrink_tables
+ * Purpose:     Halves the storage of the segment table and its side tables
+ *                  until the table fills at least a quarter of it
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ * Returns:     None
+ * Notes:       The sequence is copied into a new one, since a Seq_T never
+ *                  gives back the space it has grown to
+ */
+void shrink_tables(um_mem_t memory)
+{
+    uint32_t limit = Seq_length(memory->segment_list);
+    uint32_t capacity = memory->capacity;
+
+    while (capacity / 4 > limit && capacity / 2 >= TABLE_MIN_CAPACITY) {
+        capacity /= 2;
+    }
+
+    Seq_T segments = Seq_new(capacity);
+    for (uint32_t id = 0; id < limit; id++) {
+        Seq_addhi(segments, Seq_get(memory->segment_list, id));
+    }
+    Seq_free(&memory->segment_list);
+    memory->segment_list = segments;
+
+    resize_free_ids(memory, capacity);
+    RESIZE(memory->dirty, capacity);
+    RESIZE(memory->shared, capacity * sizeof(struct shared_seg *));
+    if (memory->born != NULL) {
+        RESIZE(memory->born, capacity * sizeof(uint64_t));
+    }
+    memory->capacity = capacity;
+
+    if (memory->stats != NULL) {
+        memory->stats->compactions++;
+    }
+}
+
+
+/* rebuild_free_ids
+ * Purpose:     Rebuilds the available IDs from the table
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ * Returns:     None
+ */
+void rebuild_free_ids(um_mem_t memory)
+{
+    uint32_t limit = Seq_length(memory->segment_list);
+    size_t words = (memory->capacity + IDS_PER_WORD - 1) / IDS_PER_WORD;
+
+    memset(memory->free_bits, 0, words * sizeof(uint64_t));
+    memset(memory->free_summary, 0, 
+           (words + IDS_PER_WORD - 1) / IDS_PER_WORD * sizeof(uint64_t));
+    memory->free_low = 0;
+    for (uint32_t id = 1; id < limit; id++) {
+        if (Seq_get(memory->segment_list, id) == NULL) {
+            push_free_id(memory, id);
+        }
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                       Copy-on-write                        *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* um_mem_clone
+ * Purpose:     Creates a memory with the same segments and available IDs as
+ *                  an existing one, sharing every segment between the two
+ * Parameters:  um_mem_t memory: the memory to clone
+ * Returns:     um_mem_t: the new memory; client frees it with um_mem_free
+ * Notes:       Takes time proportional to the number of segment IDs, not
+ *                  to the size of the segments. A shared segment is copied
+ *                  by whichever holder first stores to it, and the last
+ *                  holder to unmap, replace or free it frees it. Segments in
+ *                  an arena (see um_mem_use_handles) are copied at once.
+ *              The clone and the original may then be used on different
+ *                  threads, but memory must not be in use while it is being
+ *                  cloned.
+ *              It is a CRE for memory to be NULL.
+ */
+um_mem_t um_mem_clone(um_mem_t memory)
+{
+    assert(memory != NULL);
+
+    uint32_t limit = Seq_length(memory->segment_list);
+
+    um_mem_t clone = ALLOC(sizeof(struct um_mem_t));
+    clone->segment_list = Seq_new(limit + 1);
+    clone->mapped = memory->mapped;
+    clone->program_version = memory->program_version;
+    clone->capacity = 0;
+    clone->free_bits = NULL;
+    clone->free_summary = NULL;
+    resize_free_ids(clone, memory->capacity);
+    clone->capacity = memory->capacity;
+    clone->free_low = memory->free_low;
+    size_t words = (clone->capacity + IDS_PER_WORD - 1) / IDS_PER_WORD;
+    memcpy(clone->free_bits, memory->free_bits, words * sizeof(uint64_t));
+    memcpy(clone->free_summary, memory->free_summary, 
+           (words + IDS_PER_WORD - 1) / IDS_PER_WORD * sizeof(uint64_t));
+    clone->dirty = CALLOC(clone->capacity, sizeof(uint8_t));
+    clone->shared = CALLOC(clone->capacity, sizeof(struct shared_seg *));
+    clone->stats = NULL;
+    clone->clock = NULL;
+    clone->born = NULL;
+    clone->store = memory->store;
+    clone->huge = memory->huge;
+    clone->arena = NULL;
+    clone->words = NULL;
+    if (memory->arena != NULL) {
+        clone->arena = um_arena_copy(memory->arena);
+        if (clone->arena == NULL) {
+            fprintf(stderr, "Could not reserve a segment arena\n");
+            exit(EXIT_FAILURE);
+        }
+        clone->words = um_arena_words(clone->arena);
+    }
+
+    for (uint32_t id = 0; id < limit; id++) {
+        UArray_T seg = Seq_get(memory->segment_list, id);
+        Seq_addhi(clone->segment_list, seg);
+        clone->dirty[id] = 1;
+
+        if (seg == NULL) {
+            continue;
+        }
+
+        struct shared_seg *record = memory->shared[id];
+        if (record == NULL) {
+            NEW(record);
+            record->words = seg;
+            record->refs = 1;
+            memory->shared[id] = record;
+        }
+        __atomic_add_fetch(&record->refs, 1, __ATOMIC_ACQ_REL);
+        clone->shared[id] = record;
+    }
+
+    return clone;
+}
+
+
+/* unshare_segment
+ * Purpose:     Makes a shared segment this memory's own so that it can be
+ *                  stored to
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: ID of a shared segment
+ * Returns:     None
+ * Notes:       Copies the segment unless every other holder has already
+ *                  let go of it
+ */
+void unshare_segment(um_mem_t memory, uint32_t seg_id)
+{
+    struct shared_seg *record = memory->shared[seg_id];
+    memory->shared[seg_id] = NULL;
+
+    if (__atomic_load_n(&record->refs, __ATOMIC_ACQUIRE) == 1) {
+        FREE(record);
+        return;
+    }
+
+    uint32_t length = UArray_length(record->words);
+    UArray_T copy = new_segment(memory, length);
+    if (length > 0) {
+        memcpy(UArray_at(copy, 0), UArray_at(record->words, 0), 
+               length * sizeof(uint32_t));
+    }
+    Seq_put(memory->segment_list, seg_id, copy);
+
+    if (__atomic_sub_fetch(&record->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free_segment(memory, &record->words);
+        FREE(record);
+    }
+}
+
+
+/* release_segment
+ * Purpose:     Lets go of the segment at a mapped ID, freeing it unless 
+ *                  another memory still holds it
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: ID of a mapped segment
+ * Returns:     None
+ * Notes:       Does not change the ID's entry in segment_list
+ */
+void release_segment(um_mem_t memory, uint32_t seg_id)
+{
+    struct shared_seg *record = memory->shared[seg_id];
+
+    if (record == NULL) {
+        UArray_T seg = Seq_get(memory->segment_list, seg_id);
+        free_segment(memory, &seg);
+        return;
+    }
+
+    memory->shared[seg_id] = NULL;
+    if (__atomic_sub_fetch(&record->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free_segment(memory, &record->words);
+        FREE(record);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                         Statistics                         *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* um_mem_enable_stats
+ * Purpose:     Starts keeping statistics on memory use and segment churn
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              const uint64_t *clock: the number of instructions executed,
+ *                  kept up to date by the caller for as long as memory is
+ *                  in use; read to time segment lifetimes
+ * Returns:     None
+ * Notes:       Segments already mapped count as live and in the size 
+ *                  histogram, and as born now. Memories that never enable 
+ *                  statistics pay one NULL test per map, unmap and copy.
+ *              It is a CRE for memory or clock to be NULL, or for 
+ *                  statistics to be enabled twice.
+ */
+void um_mem_enable_stats(um_mem_t memory, const uint64_t *clock)
+{
+    assert(memory != NULL && clock != NULL && memory->stats == NULL);
+    assert(memory->arena == NULL);
+
+    NEW0(memory->stats);
+    memory->clock = clock;
+    memory->born = CALLOC(memory->capacity, sizeof(uint64_t));
+
+    uint32_t limit = Seq_length(memory->segment_list);
+    for (uint32_t id = 0; id < limit; id++) {
+        if (Seq_get(memory->segment_list, id) != NULL) {
+            count_map(memory, id, get_seg_length(memory, id));
+        }
+    }
+    memory->stats->maps = 0;
+}
+
+
+/* um_mem_get_stats
+ * Purpose:     Copies the statistics kept so far
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              struct um_mem_stats *stats: where to copy them
+ * Returns:     bool: false if statistics are not being kept
+ */
+bool um_mem_get_stats(um_mem_t memory, struct um_mem_stats *stats)
+{
+    assert(memory != NULL && stats != NULL);
+
+    if (memory->stats == NULL) {
+        return false;
+    }
+
+    memory->stats->table = Seq_length(memory->segment_list);
+    *stats = *memory->stats;
+    return true;
+}
+
+
+/* um_mem_report
+ * Purpose:     Prints the statistics kept so far
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              FILE *fp: where to print them
+ * Returns:     None
+ * Notes:       Prints only the non-empty histogram buckets. Segments still
+ *                  mapped have no lifetime yet and are not in that
+ *                  histogram.
+ */
+void um_mem_report(um_mem_t memory, FILE *fp)
+{
+    assert(memory != NULL && fp != NULL);
+
+    struct um_mem_stats *stats = memory->stats;
+    if (stats == NULL) {
+        fprintf(fp, "memory statistics are not being kept\n");
+        return;
+    }
+
+    fprintf(fp, "memory after %llu instructions:\n"
+                "  maps:              %llu\n"
+                "  unmaps:            %llu\n"
+                "  live segments:     %llu\n"
+                "  live words:        %llu\n"
+                "  peak words:        %llu\n"
+                "  load_prog copies:  %llu (%llu words)\n"
+                "  segment table:     %llu IDs, %llu at most, %llu shrinks\n",
+            (unsigned long long)*memory->clock,
+            (unsigned long long)stats->maps,
+            (unsigned long long)stats->unmaps,
+            (unsigned long long)stats->live_segments,
+            (unsigned long long)stats->live_words,
+            (unsigned long long)stats->peak_words,
+            (unsigned long long)stats->copies,
+            (unsigned long long)stats->copied_words,
+            (unsigned long long)Seq_length(memory->segment_list),
+            (unsigned long long)stats->peak_table,
+            (unsigned long long)stats->compactions);
+
+    print_histogram(fp, "segment length (words)", stats->sizes);
+    print_histogram(fp, "segment lifetime (instructions)", stats->lifetimes);
+}
+
+
+/* count_map
+ * Purpose:     Records a newly mapped segment in the statistics
+ * Parameters:  um_mem_t memory: memory that is keeping statistics
+ *              uint32_t seg_id: the segment's ID
+ *              uint32_t length: the segment's length in words
+ * Returns:     None
+ */
+void count_map(um_mem_t memory, uint32_t seg_id, uint32_t length)
+{
+    struct um_mem_stats *stats = memory->stats;
+
+    stats->maps++;
+    stats->live_segments++;
+    stats->live_words += length;
+    if (stats->live_words > stats->peak_words) {
+        stats->peak_words = stats->live_words;
+    }
+    stats->sizes[bucket(length)]++;
+    if ((uint64_t)Seq_length(memory->segment_list) > stats->peak_table) {
+        stats->peak_table = Seq_length(memory->segment_list);
+    }
+    memory->born[seg_id] = *memory->clock;
+}
+
+
+/* count_unmap
+ * Purpose:     Records a segment about to be unmapped in the statistics
+ * Parameters:  um_mem_t memory: memory that is keeping statistics
+ *              uint32_t seg_id: the segment's ID, still mapped
+ * Returns:     None
+ */
+void count_unmap(um_mem_t memory, uint32_t seg_id)
+{
+    struct um_mem_stats *stats = memory->stats;
+
+    stats->unmaps++;
+    stats->live_segments--;
+    stats->live_words -= get_seg_length(memory, seg_id);
+    stats->lifetimes[bucket(*memory->clock - memory->born[seg_id])]++;
+}
+
+
+/* bucket
+ * Purpose:     Finds the histogram bucket for a value
+ * Parameters:  uint64_t value: the value
+ * Returns:     unsigned: 0 for 0, otherwise 1 + floor(log2(value))
+ */
+unsigned bucket(uint64_t value)
+{
+    return (value == 0) ? 0 : 64 - __builtin_clzll(value);
+}
+
+
+/* print_histogram
+ * Purpose:     Prints the non-empty buckets of a histogram, one per line
+ * Parameters:  FILE *fp: where to print
+ *              const char *title: what the histogram counts
+ *              const uint64_t *counts: UM_MEM_BUCKETS counts
+ * Returns:     None
+ */
+void print_histogram(FILE *fp, const char *title, const uint64_t *counts)
+{
+    fprintf(fp, "  %s:\n", title);
+
+    for (unsigned k = 0; k < UM_MEM_BUCKETS; k++) {
+        if (counts[k] == 0) {
+            continue;
+        }
+
+        uint64_t low = (k == 0) ? 0 : (uint64_t)1 << (k - 1);
+        uint64_t high = (k == 0) ? 0 : low + (low - 1);
+        fprintf(fp, "    %10llu - %-10llu %10llu\n", (unsigned long long)low,
+                (unsigned long long)high, (unsigned long long)counts[k]);
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                        Checkpointing                       *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* mark_dirty
+ * Purpose:     Marks a segment ID as changed, growing the dirty and shared
+ *                  tables if the ID is new
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              uint32_t seg_id: the changed segment
+ * Returns:     None
+ * Notes:       Every mapped ID passes through here before it can be stored
+ *                  to, so set_seg_value can index the tables without a 
+ *                  check
+ */
+void mark_dirty(um_mem_t memory, uint32_t seg_id)
+{
+    if (seg_id >= memory->capacity) {
+        uint32_t capacity = memory->capacity * 2;
+        while (capacity <= seg_id) {
+            capacity *= 2;
+        }
+
+        resize_free_ids(memory, capacity);
+        RESIZE(memory->dirty, capacity);
+        RESIZE(memory->shared, capacity * sizeof(struct shared_seg *));
+        memset(memory->dirty + memory->capacity, 0,
+               capacity - memory->capacity);
+        memset(memory->shared + memory->capacity, 0,
+               (capacity - memory->capacity) * sizeof(struct shared_seg *));
+        if (memory->born != NULL) {
+            RESIZE(memory->born, capacity * sizeof(uint64_t));
+        }
+        memory->capacity = capacity;
+    }
+
+    memory->dirty[seg_id] = 1;
+}
+
+
+/* write_dirty_segments
+ * Purpose:     Writes the segments changed since the last call, and the
+ *                  list of available IDs, to a stream, then marks every 
+ *                  segment clean
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              FILE *fp: the stream to write to
+ *              bool all: write every segment, changed or not
+ * Returns:     None
+ * Notes:       Words are written in host byte order. The layout is the
+ *                  number of IDs in the table, the available ID list (the
+ *                  unmapped IDs below that number, then the number 
+ *                  itself), the number of segment entries, and then each 
+ *                  entry's ID, length (UNMAPPED_LENGTH for an unmapped ID)
+ *                  and words.
+ *              It is a CRE for memory or fp to be NULL.
+ */
+void write_dirty_segments(um_mem_t memory, FILE *fp, bool all)
+{
+    assert(memory != NULL && fp != NULL && memory->arena == NULL);
+
+    uint32_t limit = Seq_length(memory->segment_list);
+    uint32_t num_avail = limit - memory->mapped + 1;
+
+    fwrite(&limit, sizeof(limit), 1, fp);
+    fwrite(&num_avail, sizeof(num_avail), 1, fp);
+    for (uint32_t id = 1; id < limit; id++) {
+        if (Seq_get(memory->segment_list, id) == NULL) {
+            fwrite(&id, sizeof(id), 1, fp);
+        }
+    }
+    fwrite(&limit, sizeof(limit), 1, fp);
+
+    uint32_t num_entries = 0;
+    for (uint32_t id = 0; id < limit; id++) {
+        num_entries += all || memory->dirty[id];
+    }
+    fwrite(&num_entries, sizeof(num_entries), 1, fp);
+
+    for (uint32_t id = 0; id < limit; id++) {
+        if (!all && !memory->dirty[id]) {
+            continue;
+        }
+
+        UArray_T seg = Seq_get(memory->segment_list, id);
+        uint32_t length = (seg == NULL) ? UNMAPPED_LENGTH 
+                                        : (uint32_t)UArray_length(seg);
+
+        fwrite(&id, sizeof(id), 1, fp);
+        fwrite(&length, sizeof(length), 1, fp);
+        if (seg != NULL && length > 0) {
+            fwrite(UArray_at(seg, 0), sizeof(uint32_t), length, fp);
+        }
+    }
+
+    memset(memory->dirty, 0, memory->capacity);
+}
+
+
+/* read_dirty_segments
+ * Purpose:     Applies segments written by write_dirty_segments
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ *              FILE *fp: the stream to read from
+ * Returns:     bool: false if the stream ended early or was malformed
+ * Notes:       Segments not in the stream are left as they were, so a full
+ *                  write followed by each later write, in order, restores
+ *                  the memory as it was at the last write. IDs past the
+ *                  end of the written table are dropped.
+ *              It is a CRE for memory or fp to be NULL.
+ */
+bool read_dirty_segments(um_mem_t memory, FILE *fp)
+{
+    assert(memory != NULL && fp != NULL && memory->arena == NULL);
+
+    uint32_t limit, num_avail, num_entries;
+    if (!read_u32(fp, &limit) || !read_u32(fp, &num_avail)) {
+        return false;
+    }
+
+    while ((uint32_t)Seq_length(memory->segment_list) > limit) {
+        uint32_t id = Seq_length(memory->segment_list) - 1;
+        if (Seq_get(memory->segment_list, id) != NULL) {
+            release_segment(memory, id);
+            memory->mapped--;
+        }
+        Seq_remhi(memory->segment_list);
+    }
+    while ((uint32_t)Seq_length(memory->segment_list) < limit) {
+        Seq_addhi(memory->segment_list, NULL);
+        mark_dirty(memory, Seq_length(memory->segment_list) - 1);
+    }
+
+    /* the available IDs are rebuilt from the table once it is read */
+    for (uint32_t i = 0; i < num_avail; i++) {
+        uint32_t id;
+        if (!read_u32(fp, &id)) {
+            return false;
+        }
+    }
+
+    if (!read_u32(fp, &num_entries)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < num_entries; i++) {
+        uint32_t id, length;
+        if (!read_u32(fp, &id) || !read_u32(fp, &length) || id >= limit) {
+            return false;
+        }
+
+        if (Seq_get(memory->segment_list, id) != NULL) {
+            release_segment(memory, id);
+            memory->mapped--;
+        }
+
+        UArray_T seg = NULL;
+        if (length != UNMAPPED_LENGTH) {
+            seg = new_segment(memory, length);
+            if (length > 0 && fread(UArray_at(seg, 0), sizeof(uint32_t), 
+                                    length, fp) != length) {
+                free_segment(memory, &seg);
+                Seq_put(memory->segment_list, id, NULL);
+                return false;
+            }
+            memory->mapped++;
+        }
+        Seq_put(memory->segment_list, id, seg);
+        if (id == 0) {
+            memory->program_version++;
+        }
+    }
+
+    rebuild_free_ids(memory);
+    memset(memory->dirty, 0, memory->capacity);
+    return true;
+}
+
+
+/* hash_dirty_segments
+ * Purpose:     Hashes the segments changed since the last call or the last
+ *                  write_dirty_segments, then marks every segment clean
+ * Parameters:  um_mem_t memory: struct containing UM memory data
+ * Returns:     uint64_t: an FNV-1a hash of each changed entry's ID, length
+ *                  (UNMAPPED_LENGTH for an unmapped ID) and words, in ID
+ *                  order
+ * Notes:       Two memories that started the same and made the same
+ *                  changes hash the same. A clone starts with every segment
+ *                  changed, so its first hash covers all of memory.
+ *              It is a CRE for memory to be NULL.
+ */
+uint64_t hash_dirty_segments(um_mem_t memory)
+{
+    assert(memory != NULL && memory->arena == NULL);
+
+    uint32_t limit = Seq_length(memory->segment_list);
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (uint32_t id = 0; id < limit; id++) {
+        if (!memory->dirty[id]) {
+            continue;
+        }
+
+        UArray_T seg = Seq_get(memory->segment_list, id);
+        uint32_t length = (seg == NULL) ? UNMAPPED_LENGTH 
+                                        : (uint32_t)UArray_length(seg);
+        const uint32_t *words = (seg == NULL || length == 0) ? NULL 
+                                : UArray_at(seg, 0);
+
+        hash = (hash ^ id) * 1099511628211ULL;
+        hash = (hash ^ length) * 1099511628211ULL;
+        for (uint32_t i = 0; words != NULL && i < length; i++) {
+            hash = (hash ^ words[i]) * 1099511628211ULL;
+        }
+    }
+
+    memset(memory->dirty, 0, memory->capacity);
+    return hash;
+}
+
+
+bool read_u32(FILE *fp, uint32_t *value)
+{
+    return fread(value, sizeof(*value), 1, fp) == 1;
 }
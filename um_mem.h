@@ -12,17 +12,58 @@
 #define UM_MEM_H
 
 #include <seq.h>
+#include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <uarray.h>
+#include "um_store.h"
+#include "um_huge.h"
 
 typedef struct um_mem_t* um_mem_t;
 
+/* histogram buckets: 0 holds zero, bucket k holds values in [2^(k-1), 2^k) */
+#define UM_MEM_BUCKETS 65
+
+/* memory use and segment churn since um_mem_enable_stats */
+struct um_mem_stats {
+    uint64_t    maps;                   /* map_segment calls */
+    uint64_t    unmaps;                 /* unmap_segment calls */
+    uint64_t    live_segments;          /* segments mapped now */
+    uint64_t    live_words;             /* words in those segments */
+    uint64_t    peak_words;             /* most live_words ever reached */
+    uint64_t    copies;                 /* get_segment_copy calls */
+    uint64_t    copied_words;           /* words those calls copied */
+    uint64_t    table;                  /* IDs in the segment table now */
+    uint64_t    peak_table;             /* most table ever reached */
+    uint64_t    compactions;            /* times the table's storage shrank */
+    uint64_t    sizes[UM_MEM_BUCKETS];  /* segments by length in words */
+    uint64_t    lifetimes[UM_MEM_BUCKETS]; /* unmapped segments by number
+                                            * of instructions they lived */
+};
+
 /* allocates space for a new, empty um_mem_t */
 um_mem_t um_mem_new();
 
 /* frees all heap-allocated space associated with a um_mem_t */
 void um_mem_free(um_mem_t memory);
 
+/* creates a memory sharing every segment of another copy-on-write */
+um_mem_t um_mem_clone(um_mem_t memory);
+
+/* makes large segments in a file-backed store from now on (see um_store.h) */
+void um_mem_set_store(um_mem_t memory, um_store_t store);
+
+/* makes segments in a huge-page pool from now on (see um_huge.h) */
+void um_mem_set_huge(um_mem_t memory, um_huge_t huge);
+
+/* makes segment IDs handles into a word arena from now on (see um_arena.h);
+ * false if the arena cannot be reserved */
+bool um_mem_use_handles(um_mem_t memory);
+
+/* returns the arena's words, indexed by handle plus offset; NULL if IDs are
+ * not handles */
+uint32_t *um_mem_handle_words(um_mem_t memory);
+
 
 /* creates a new segment in memory with the provided number of words */
 unsigned map_segment(um_mem_t memory, unsigned length);
@@ -34,6 +75,10 @@ void unmap_segment(um_mem_t memory, uint32_t seg_id);
 /* sets the segment at the given id to be a provided uarray_t */
 void set_segment(um_mem_t memory, uint32_t seg_id, UArray_T segment);
 
+/* copies words into the start of a segment */
+void set_seg_words(um_mem_t memory, uint32_t seg_id, const uint32_t *words,
+                   uint32_t length);
+
 /* gets copy of given segment */
 UArray_T get_segment_copy(um_mem_t memory, uint32_t seg_id);
 
@@ -46,4 +91,37 @@ void set_seg_value(um_mem_t memory, uint32_t seg_id, uint32_t word_id,
 uint32_t get_seg_value(um_mem_t memory, uint32_t seg_id, uint32_t word_id);
 
 
+/* returns whether the given segment id identifies a mapped segment */
+bool is_seg_mapped(um_mem_t memory, uint32_t seg_id);
+
+/* returns the number of words in a mapped segment */
+uint32_t get_seg_length(um_mem_t memory, uint32_t seg_id);
+
+/* returns a number that changes whenever segment 0 is stored to or
+ * replaced */
+uint64_t get_program_version(um_mem_t memory);
+
+
+/* starts keeping statistics; *clock must hold the instructions executed */
+void um_mem_enable_stats(um_mem_t memory, const uint64_t *clock);
+
+/* copies the statistics; false if they are not being kept */
+bool um_mem_get_stats(um_mem_t memory, struct um_mem_stats *stats);
+
+/* prints the statistics in a readable form */
+void um_mem_report(um_mem_t memory, FILE *fp);
+
+
+/* writes the segments changed since the last call (or all of them) to a 
+ * stream and marks every segment clean */
+void write_dirty_segments(um_mem_t memory, FILE *fp, bool all);
+
+/* applies segments written by write_dirty_segments; false if truncated */
+bool read_dirty_segments(um_mem_t memory, FILE *fp);
+
+/* hashes the segments changed since the last call (or write) and marks
+ * every segment clean */
+uint64_t hash_dirty_segments(um_mem_t memory);
+
+
 #endif
\ No newline at end of file
@@ -0,0 +1,285 @@
+/*
+ * um_metrics.c
+ *
+ * Purpose: Implementation of live metrics.
+ *
+ *          The run loop only calls um_metrics_update once per batch, and
+ *          that call only copies the sample under a mutex, works out the
+ *          instruction rate since the previous sample and checks a flag.
+ *          The SIGUSR1 handler only sets that flag, so the dump itself is
+ *          printed from the run loop at the end of the current batch, and
+ *          not at all while the UM is blocked reading input. The socket is
+ *          served by its own thread from the latest sample, so it answers
+ *          even then. Resident memory is read from /proc when the metrics
+ *          are printed, not per sample.
+ */
+
+#include "um_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <mem.h>
+#include <assert.h>
+
+static volatile sig_atomic_t dump_requested = 0;
+
+
+/* struct um_metrics_t
+ * Purpose:     The latest sample and how to publish it
+ * Members:     struct um_metrics_sample sample: the latest sample
+ *              double start: time of um_metrics_new, in seconds
+ *              double last: time of the latest sample
+ *              double rate: instructions per second between the two
+ *                  latest samples
+ *              pthread_mutex_t lock: guards sample, last and rate
+ *              struct sigaction old_action: SIGUSR1's previous handler
+ *              char *path: the socket's path, or NULL if not serving
+ *              int listen_fd: the listening socket, or -1
+ *              pthread_t server: the thread answering the socket
+ */
+struct um_metrics_t {
+    struct um_metrics_sample sample;
+    double              start;
+    double              last;
+    double              rate;
+    pthread_mutex_t     lock;
+    struct sigaction    old_action;
+    char               *path;
+    int                 listen_fd;
+    pthread_t           server;
+};
+
+void request_dump(int signum);
+void *serve_metrics(void *metrics);
+void print_metrics(um_metrics_t metrics, FILE *fp);
+uint64_t resident_bytes();
+double now();
+
+
+/* um_metrics_new
+ * Purpose:     Starts publishing metrics
+ * Parameters:  const char *socket_path: where to create a socket serving
+ *                  the metrics, or NULL for SIGUSR1 dumps only; any file
+ *                  already there is removed
+ * Returns:     um_metrics_t: the metrics; client frees with um_metrics_free
+ * Notes:       Exits with an error message if the socket cannot be set up
+ */
+um_metrics_t um_metrics_new(const char *socket_path)
+{
+    um_metrics_t metrics;
+    NEW0(metrics);
+    metrics->start = metrics->last = now();
+    metrics->listen_fd = -1;
+    pthread_mutex_init(&metrics->lock, NULL);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_dump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, &metrics->old_action);
+
+    if (socket_path == NULL) {
+        return metrics;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    metrics->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (metrics->listen_fd == -1 ||
+        bind(metrics->listen_fd, (struct sockaddr *)&addr,
+             sizeof(addr)) == -1 ||
+        listen(metrics->listen_fd, 16) == -1 ||
+        pthread_create(&metrics->server, NULL, serve_metrics, metrics) != 0) {
+        perror(socket_path);
+        exit(EXIT_FAILURE);
+    }
+
+    metrics->path = ALLOC(strlen(socket_path) + 1);
+    strcpy(metrics->path, socket_path);
+
+    return metrics;
+}
+
+
+/* um_metrics_free
+ * Purpose:     Stops publishing metrics and frees them
+ * Parameters:  um_metrics_t *metrics: pointer to the metrics to free
+ * Returns:     None
+ * Notes:       Removes the socket and puts back SIGUSR1's old handler
+ */
+void um_metrics_free(um_metrics_t *metrics)
+{
+    assert(metrics != NULL && *metrics != NULL);
+    um_metrics_t m = *metrics;
+
+    if (m->listen_fd != -1) {
+        /* wakes the server thread out of accept */
+        shutdown(m->listen_fd, SHUT_RDWR);
+        pthread_join(m->server, NULL);
+        close(m->listen_fd);
+        unlink(m->path);
+        FREE(m->path);
+    }
+
+    sigaction(SIGUSR1, &m->old_action, NULL);
+    pthread_mutex_destroy(&m->lock);
+    FREE(*metrics);
+}
+
+
+/* um_metrics_update
+ * Purpose:     Records the latest counters from the run loop
+ * Parameters:  um_metrics_t metrics: the metrics
+ *              const struct um_metrics_sample *sample: the counters
+ * Returns:     None
+ * Notes:       Prints the metrics to stderr if SIGUSR1 has arrived since
+ *                  the previous call
+ */
+void um_metrics_update(um_metrics_t metrics,
+                       const struct um_metrics_sample *sample)
+{
+    assert(metrics != NULL && sample != NULL);
+
+    double time = now();
+
+    pthread_mutex_lock(&metrics->lock);
+    if (time > metrics->last) {
+        metrics->rate = (sample->instructions -
+                         metrics->sample.instructions) /
+                        (time - metrics->last);
+    }
+    metrics->sample = *sample;
+    metrics->last = time;
+    pthread_mutex_unlock(&metrics->lock);
+
+    if (dump_requested) {
+        dump_requested = 0;
+        print_metrics(metrics, stderr);
+        fflush(stderr);
+    }
+}
+
+
+/* request_dump
+ * Purpose:     SIGUSR1 handler; asks the run loop to print the metrics
+ * Parameters:  int signum: unused
+ * Returns:     None
+ */
+void request_dump(int signum)
+{
+    (void)signum;
+    dump_requested = 1;
+}
+
+
+/* serve_metrics
+ * Purpose:     Body of the server thread; writes the metrics to each client
+ *                  that connects and closes the connection
+ * Parameters:  void *arg: the metrics
+ * Returns:     NULL, once the listening socket is shut down
+ */
+void *serve_metrics(void *arg)
+{
+    um_metrics_t metrics = arg;
+    int fd;
+
+    while ((fd = accept(metrics->listen_fd, NULL, NULL)) != -1) {
+        FILE *fp = fdopen(fd, "w");
+        if (fp == NULL) {
+            close(fd);
+            continue;
+        }
+        print_metrics(metrics, fp);
+        fclose(fp);
+    }
+
+    return NULL;
+}
+
+
+/* print_metrics
+ * Purpose:     Prints the metrics in Prometheus text format
+ * Parameters:  um_metrics_t metrics: the metrics
+ *              FILE *fp: where to print them
+ * Returns:     None
+ */
+void print_metrics(um_metrics_t metrics, FILE *fp)
+{
+    pthread_mutex_lock(&metrics->lock);
+    struct um_metrics_sample s = metrics->sample;
+    double rate = metrics->rate;
+    double elapsed = metrics->last - metrics->start;
+    pthread_mutex_unlock(&metrics->lock);
+
+    static const struct {
+        const char *name, *type, *help;
+    } info[] = {
+        { "um_instructions_total", "counter", "Instructions executed" },
+        { "um_instructions_per_second", "gauge",
+          "Instructions per second over the latest batch" },
+        { "um_run_seconds", "gauge", "Seconds from start to latest batch" },
+        { "um_input_bytes_total", "counter", "Bytes read by input" },
+        { "um_output_bytes_total", "counter", "Bytes written by output" },
+        { "um_segments_mapped_total", "counter", "Segments mapped" },
+        { "um_segments_unmapped_total", "counter", "Segments unmapped" },
+        { "um_live_segments", "gauge", "Segments mapped now" },
+        { "um_live_words", "gauge", "Words in mapped segments" },
+        { "um_peak_words", "gauge", "Most words ever mapped at once" },
+        { "um_resident_bytes", "gauge", "Resident set size of the process" }
+    };
+    double values[] = {
+        s.instructions, rate, elapsed, s.input_bytes, s.output_bytes,
+        s.mem.maps, s.mem.unmaps, s.mem.live_segments, s.mem.live_words,
+        s.mem.peak_words, resident_bytes()
+    };
+
+    for (size_t i = 0; i < sizeof(info) / sizeof(info[0]); i++) {
+        fprintf(fp, "# HELP %s %s.\n# TYPE %s %s\n%s %.17g\n",
+                info[i].name, info[i].help, info[i].name, info[i].type,
+                info[i].name, values[i]);
+    }
+}
+
+
+/* resident_bytes
+ * Purpose:     Reads the process's resident set size
+ * Parameters:  None
+ * Returns:     uint64_t: the size in bytes, or 0 if /proc is unavailable
+ */
+uint64_t resident_bytes()
+{
+    unsigned long long size, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp != NULL) {
+        if (fscanf(fp, "%llu %llu", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+
+    return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,38 @@
+/*
+ * um_metrics.h
+ *
+ * Purpose: Interface for live metrics of a running UM. The run loop hands
+ *          in a sample every batch of instructions; the metrics are
+ *          printed to stderr in Prometheus text format when the process
+ *          gets SIGUSR1, and served in the same format to every client
+ *          that connects to an optional Unix domain socket.
+ */
+
+#ifndef UM_METRICS_H
+#define UM_METRICS_H
+
+#include <stdint.h>
+#include "um_mem.h"
+
+typedef struct um_metrics_t* um_metrics_t;
+
+/* the counters a run loop reports */
+struct um_metrics_sample {
+    uint64_t            instructions;
+    uint64_t            input_bytes;
+    uint64_t            output_bytes;
+    struct um_mem_stats mem;
+};
+
+/* installs the SIGUSR1 handler and, if socket_path is not NULL, starts
+ * serving metrics on a socket there */
+um_metrics_t um_metrics_new(const char *socket_path);
+
+/* stops serving, restores SIGUSR1 and frees the metrics */
+void um_metrics_free(um_metrics_t *metrics);
+
+/* records a sample; prints the metrics if SIGUSR1 arrived since the last */
+void um_metrics_update(um_metrics_t metrics,
+                       const struct um_metrics_sample *sample);
+
+#endif
@@ -8,26 +8,21 @@
 
 
 #include "um_operate.h"
+#include "um_data.h"
+#include "um_special.h"
+#include "um_checkpoint.h"
 #include <math.h>
 #include <mem.h>
 #include <bitpack.h> 
+#include <except.h>
 #include <assert.h>
+#include <string.h>
 
-/* struct um_data_t 
- * Purpose:     stores the data for a UM instance
- * Members:     uint32_t regs[8]: array holding the 8 registers for the machine
- *              uint32_t program_counter: holds the word index of the next 
- *                  instruction to be read in segment 0
- *              um_mem_t memory: the memory storage for the UM instance 
- *              bool halting: true iff the halt instruction has been executed
- */
-struct um_data_t {
-    uint32_t    regs[8];
-    uint32_t    program_counter;
-    um_mem_t    memory;
-    bool        halting;
-};
+/* instructions between samples sent to live metrics */
+#define METRICS_BATCH (1 << 20)
 
+/* Exception */
+Except_T Illegal_Instruction = { "Illegal instruction" };
 
 /* instruction functions 0-13 */
 void mov(um_data_t um, uint32_t inst);
@@ -45,13 +40,17 @@ void input(um_data_t um, uint32_t inst);
 void load_prog(um_data_t um, uint32_t inst);
 void load_val(um_data_t um, uint32_t inst);
 
-/* Array of instruction function pointers */
-void (*instructions[14])() = { mov, seg_load, seg_store, add, mult,
+/* Array of instruction function pointers, with opcodes 14 and 15 failing */
+void (*instructions[16])() = { mov, seg_load, seg_store, add, mult,
                                      div, nand, halt, map_seg, unmap_seg, 
-                                     output, input, load_prog, load_val };
+                                     output, input, load_prog, load_val,
+                                     illegal_inst, illegal_inst };
 /* helper functions */
 uint32_t read_word(FILE *fp);
 void get_abc(uint32_t inst, uint32_t *regs);
+uint64_t fast_forward(um_data_t um, uint64_t budget);
+void run_steps(um_data_t um, void (*step)(um_data_t), uint64_t *count,
+               uint64_t stop);
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
@@ -80,11 +79,158 @@ um_data_t initialize_um()
     um->memory = um_mem_new();
 
     um->halting = false;
+    um->waiting = false;
+    um->io = NULL;
+    um->stream = NULL;
+    um->input_bytes = 0;
+    um->output_bytes = 0;
+    um->fast_loops = false;
+    um->fast_loops_allowed = true;
+    um->looping = false;
+    um->loop = NULL;
+    um->words = NULL;
+    um->perf = NULL;
 
     return um;
 }
 
 
+/* clone_um
+ * Purpose:     Creates a UM in the same state as an existing one
+ * Parameters:  um_data_t um: the UM to clone
+ * Returns:     um_data_t: the new, heap-allocated UM; client frees it with
+ *                  free_um
+ * Notes:       Segments are shared copy-on-write (see um_mem_clone), so a
+ *                  clone costs time in the number of segments rather than
+ *                  in their size. um must not be running while it is cloned.
+ */
+um_data_t clone_um(um_data_t um)
+{
+    assert(um != NULL);
+
+    um_data_t clone = ALLOC(sizeof(struct um_data_t));
+    *clone = *um;
+    clone->memory = um_mem_clone(um->memory);
+    clone->io = NULL;
+    clone->stream = NULL;
+    clone->loop = NULL;
+    clone->words = um_mem_handle_words(clone->memory);
+    clone->perf = NULL;
+
+    return clone;
+}
+
+
+/* set_um_io
+ * Purpose:     Attaches input and output buffers to a UM in place of stdin
+ *                  and stdout
+ * Parameters:  um_data_t um: the UM
+ *              um_io_t io: the buffers, or NULL for stdin and stdout
+ * Returns:     None
+ * Notes:       The client keeps ownership of io
+ */
+void set_um_io(um_data_t um, um_io_t io)
+{
+    assert(um != NULL);
+    um->io = io;
+}
+
+
+/* set_um_fast_loops
+ * Purpose:     Turns loop fast-forwarding (see um_loop.h) on or off
+ * Parameters:  um_data_t um: the UM
+ *              bool allowed: whether its run loops may fast-forward
+ * Returns:     None
+ * Notes:       On by default. Clones inherit the setting. Tracing, the
+ *                  debugger and the other single-step modes never
+ *                  fast-forward either way.
+ */
+void set_um_fast_loops(um_data_t um, bool allowed)
+{
+    assert(um != NULL);
+    um->fast_loops_allowed = allowed;
+}
+
+
+/* set_um_store
+ * Purpose:     Makes a UM map its large segments in a file-backed store
+ * Parameters:  um_data_t um: the UM
+ *              um_store_t store: the store, or NULL for the heap
+ * Returns:     None
+ * Notes:       The client keeps ownership of store, and frees it only
+ *                  after the UM and its clones
+ */
+void set_um_store(um_data_t um, um_store_t store)
+{
+    assert(um != NULL);
+    um_mem_set_store(um->memory, store);
+}
+
+
+/* set_um_huge
+ * Purpose:     Makes a UM map its segments in a huge-page pool
+ * Parameters:  um_data_t um: the UM
+ *              um_huge_t huge: the pool, or NULL for the heap
+ * Returns:     None
+ * Notes:       The client keeps ownership of huge, and frees it only after
+ *                  the UM and its clones
+ */
+void set_um_huge(um_data_t um, um_huge_t huge)
+{
+    assert(um != NULL);
+    um_mem_set_huge(um->memory, huge);
+}
+
+
+/* use_um_handles
+ * Purpose:     Makes the segment IDs a UM maps from now on handles into a
+ *                  word arena, so loads and stores skip the segment table
+ * Parameters:  um_data_t um: a UM with only segment 0 mapped
+ * Returns:     bool: false if the arena cannot be reserved
+ * Notes:       IDs are then large and sparse, so programs that rely on
+ *                  small sequential IDs must not use this. See
+ *                  um_mem_use_handles for what such a UM cannot do.
+ */
+bool use_um_handles(um_data_t um)
+{
+    assert(um != NULL);
+
+    if (!um_mem_use_handles(um->memory)) {
+        return false;
+    }
+    um->words = um_mem_handle_words(um->memory);
+    return true;
+}
+
+
+/* set_um_stream
+ * Purpose:     Makes a UM do its input and output through asynchronous
+ *                  streams instead of stdio
+ * Parameters:  um_data_t um: the UM
+ *              um_stream_t stream: the streams, or NULL for stdio
+ * Returns:     None
+ * Notes:       The client keeps ownership of stream. Buffers attached with
+ *                  set_um_io take precedence over it.
+ */
+void set_um_stream(um_data_t um, um_stream_t stream)
+{
+    assert(um != NULL);
+    um->stream = stream;
+}
+
+
+/* is_waiting
+ * Purpose:     Checks whether a UM stopped to wait for input
+ * Parameters:  um_data_t um: the UM
+ * Returns:     bool: true iff the UM is waiting for its io buffers to be fed
+ */
+bool is_waiting(um_data_t um)
+{
+    assert(um != NULL);
+    return um->waiting;
+}
+
+
 /* is_halting
  * Purpose:     Get "halting" boolean from um_data_t struct
  * Parameters:  um_data_t um: UM struct from which to retrieve boolean
@@ -108,6 +254,9 @@ void free_um(um_data_t um)
 {
     assert(um != NULL);
     um_mem_free(um->memory);
+    if (um->loop != NULL) {
+        um_loop_free(&um->loop);
+    }
     FREE(um);
 }
 
@@ -132,6 +281,23 @@ void read_um_program(FILE *program, um_data_t um, int num_words)
 }
 
 
+/* load_um_words
+ * Purpose:     Loads a program whose words are already in host byte order
+ * Parameters:  um_data_t um: a UM with no segments mapped
+ *              const uint32_t *words: the program
+ *              uint32_t num_words: length of the program in words
+ * Returns:     None
+ * Notes:       Copies the words into segment 0 without converting them
+ */
+void load_um_words(um_data_t um, const uint32_t *words, uint32_t num_words)
+{
+    assert(um != NULL);
+
+    map_segment(um->memory, num_words);
+    set_seg_words(um->memory, 0, words, num_words);
+}
+
+
 /* read_word
  * Purpose:     Reads and bitpacks a word in big-endian order from a file
  * Parameters:  FILE *fp: File pointer to open file from which to read a word
@@ -172,6 +338,391 @@ void read_instruction(um_data_t um)
 }
 
 
+/* read_instruction_specialized
+ * Purpose:     Same as read_instruction, but executes the instruction with 
+ *                  the register-specialized handler selected by 
+ *                  special_decode instead of the generic handler
+ * Parameters:  um_data_t um: the um instance where the instruction is 
+ * Returns:     None
+ * Notes:       it is a URE to call this when the program counter is not set 
+ *                  to a valid index in segment 0 (the instruction segment)
+ */
+void read_instruction_specialized(um_data_t um)
+{
+    uint32_t instruction = get_seg_value(um->memory, 0, um->program_counter);
+
+    um->program_counter++;
+
+    special_decode(instruction)(um, instruction);
+}
+
+
+/* run_um
+ * Purpose:     Executes instructions until the UM halts
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ * Returns:     None
+ * Notes:       Assumes a program has already been read into um
+ */
+void run_um(um_data_t um, um_engine_t engine)
+{
+    assert(um != NULL);
+
+    um->fast_loops = um->fast_loops_allowed;
+    for (;;) {
+        if (engine == UM_ENGINE_SPECIALIZED) {
+            while (!um->halting) {
+                read_instruction_specialized(um);
+            }
+        } else {
+            while (!um->halting) {
+                read_instruction(um);
+            }
+        }
+
+        if (!um->looping) {
+            break;
+        }
+        fast_forward(um, UINT64_MAX);
+    }
+    um->fast_loops = false;
+}
+
+
+/* run_um_counted
+ * Purpose:     Executes instructions until the UM halts, counting them
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ * Returns:     uint64_t: the number of instructions executed
+ * Notes:       Kept separate from run_um so that uncounted runs pay nothing
+ *                  for the count
+ */
+uint64_t run_um_counted(um_data_t um, um_engine_t engine)
+{
+    assert(um != NULL);
+
+    uint64_t count = 0;
+
+    um->fast_loops = um->fast_loops_allowed;
+    for (;;) {
+        if (engine == UM_ENGINE_SPECIALIZED) {
+            while (!um->halting) {
+                read_instruction_specialized(um);
+                count++;
+            }
+        } else {
+            while (!um->halting) {
+                read_instruction(um);
+                count++;
+            }
+        }
+
+        if (!um->looping) {
+            break;
+        }
+        count += fast_forward(um, UINT64_MAX);
+    }
+    um->fast_loops = false;
+
+    return count;
+}
+
+
+/* run_um_stats
+ * Purpose:     Executes instructions until the UM halts, keeping memory
+ *                  statistics, and prints them
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ *              FILE *report: where to print the statistics
+ * Returns:     uint64_t: the number of instructions executed
+ * Notes:       Segment lifetimes are timed with the instruction count, so
+ *                  this is a separate loop for the same reason as
+ *                  run_um_counted
+ */
+uint64_t run_um_stats(um_data_t um, um_engine_t engine, FILE *report)
+{
+    assert(um != NULL && report != NULL);
+
+    void (*step)(um_data_t) = (engine == UM_ENGINE_SPECIALIZED) ?
+                              read_instruction_specialized : read_instruction;
+    uint64_t count = 0;
+
+    um_mem_enable_stats(um->memory, &count);
+    run_steps(um, step, &count, UINT64_MAX);
+
+    um_mem_report(um->memory, report);
+    if (um->loop != NULL) {
+        uint64_t hits;
+        uint64_t jumps = um_loop_hits(um->loop, &hits);
+        fprintf(report, "backward jumps:      %llu, %llu from the site "
+                        "cache\n", (unsigned long long)jumps, 
+                (unsigned long long)hits);
+    }
+    return count;
+}
+
+
+/* run_um_metrics
+ * Purpose:     Executes instructions until the UM halts, handing live
+ *                  metrics a sample every METRICS_BATCH instructions
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ *              um_metrics_t metrics: where to send the samples
+ * Returns:     uint64_t: the number of instructions executed
+ * Notes:       Keeps memory statistics for the segment counts
+ */
+uint64_t run_um_metrics(um_data_t um, um_engine_t engine,
+                        um_metrics_t metrics)
+{
+    assert(um != NULL && metrics != NULL);
+
+    void (*step)(um_data_t) = (engine == UM_ENGINE_SPECIALIZED) ?
+                              read_instruction_specialized : read_instruction;
+    uint64_t count = 0;
+    struct um_metrics_sample sample;
+
+    um_mem_enable_stats(um->memory, &count);
+    while (!um->halting) {
+        run_steps(um, step, &count, count + METRICS_BATCH);
+
+        sample.instructions = count;
+        sample.input_bytes = um->input_bytes;
+        sample.output_bytes = um->output_bytes;
+        um_mem_get_stats(um->memory, &sample.mem);
+        um_metrics_update(metrics, &sample);
+    }
+
+    return count;
+}
+
+
+/* run_um_for
+ * Purpose:     Executes instructions until the UM halts, stops to wait for
+ *                  input, or has executed a given number of instructions
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ *              uint64_t limit: the most instructions to execute
+ * Returns:     uint64_t: the number of instructions executed
+ * Notes:       A UM that was waiting for input is resumed first
+ */
+uint64_t run_um_for(um_data_t um, um_engine_t engine, uint64_t limit)
+{
+    assert(um != NULL);
+
+    if (um->waiting) {
+        um->waiting = false;
+        um->halting = false;
+    }
+
+    void (*step)(um_data_t) = (engine == UM_ENGINE_SPECIALIZED) ?
+                              read_instruction_specialized : read_instruction;
+    uint64_t n = 0;
+
+    run_steps(um, step, &n, limit);
+    return n - um->waiting;
+}
+
+
+/* run_um_checkpointed
+ * Purpose:     Executes instructions until the UM halts, appending a 
+ *                  checkpoint to a log after every given number of them
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ *              um_checkpoint_t log: the log to append to
+ *              uint64_t every: instructions between checkpoints
+ *              uint64_t executed: instructions the UM has already executed,
+ *                  when resuming from a checkpoint
+ * Returns:     None
+ * Notes:       Output is flushed before each checkpoint, so that output
+ *                  from before the checkpoint is never lost; output after 
+ *                  the last checkpoint is repeated by a resumed run
+ */
+void run_um_checkpointed(um_data_t um, um_engine_t engine, 
+                         um_checkpoint_t log, uint64_t every, 
+                         uint64_t executed)
+{
+    assert(um != NULL && log != NULL && every > 0);
+
+    void (*step)(um_data_t) = (engine == UM_ENGINE_SPECIALIZED) ?
+                              read_instruction_specialized : read_instruction;
+
+    um_checkpoint_write(log, um, executed);
+
+    while (!um->halting) {
+        run_steps(um, step, &executed, executed + every);
+
+        if (!um->halting) {
+            fflush(stdout);
+            if (um->stream != NULL) {
+                um_stream_flush(um->stream);
+            }
+            um_checkpoint_write(log, um, executed);
+        }
+    }
+}
+
+
+/* run_um_traced
+ * Purpose:     Executes instructions until the UM halts, appending a record
+ *                  of every instruction to a trace
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ *              um_trace_t trace: the trace to record into
+ * Returns:     None
+ * Notes:       Kept separate from run_um so that untraced runs pay nothing
+ *                  for tracing
+ */
+void run_um_traced(um_data_t um, um_engine_t engine, um_trace_t trace)
+{
+    assert(um != NULL && trace != NULL);
+
+    void (*step)(um_data_t) = (engine == UM_ENGINE_SPECIALIZED) ?
+                              read_instruction_specialized : read_instruction;
+    uint32_t regs_before[8];
+
+    while (!um->halting) {
+        uint32_t pc = um->program_counter;
+        uint32_t inst = get_seg_value(um->memory, 0, pc);
+
+        memcpy(regs_before, um->regs, sizeof(regs_before));
+        step(um);
+        um_trace_record(trace, pc, inst, regs_before, um->regs);
+    }
+}
+
+
+/* run_um_cfg
+ * Purpose:     Executes instructions until the UM halts, recording the
+ *                  blocks of segment 0 and the jumps between them
+ * Parameters:  um_data_t um: the UM instance to run
+ *              um_engine_t engine: which handlers execute the instructions
+ *              um_cfg_t cfg: the graph to record into
+ * Returns:     None
+ * Notes:       Loops are not fast-forwarded, so that every jump is seen.
+ *              A jump out of segment 0 is left for the next fetch to fault
+ *                  on.
+ */
+void run_um_cfg(um_data_t um, um_engine_t engine, um_cfg_t cfg)
+{
+    assert(um != NULL && cfg != NULL);
+
+    void (*step)(um_data_t) = (engine == UM_ENGINE_SPECIALIZED) ?
+                              read_instruction_specialized : read_instruction;
+
+    while (!um->halting) {
+        uint32_t pc = um->program_counter;
+        uint32_t inst = get_seg_value(um->memory, 0, pc);
+        uint32_t op = inst >> 28;
+
+        if (op == 7) {
+            um_cfg_halt(cfg, pc);
+        }
+        step(um);
+        if (op == 12 && um->program_counter < get_seg_length(um->memory, 0)) {
+            um_cfg_jump(cfg, pc, um->regs[(inst >> 3) & 0x7],
+                        um->program_counter);
+        }
+    }
+}
+
+
+/* run_steps
+ * Purpose:     Executes instructions one at a time until the UM halts or a
+ *                  count reaches a limit, fast-forwarding loops (see
+ *                  um_loop.h) along the way
+ * Parameters:  um_data_t um: the UM instance to run
+ *              void (*step)(um_data_t): executes one instruction
+ *              uint64_t *count: instructions executed, kept up to date as
+ *                  they run
+ *              uint64_t stop: the count at which to stop
+ * Returns:     None
+ * Notes:       A fast-forwarded loop stops short of stop rather than run
+ *                  part of an iteration, and the rest is then stepped
+ */
+void run_steps(um_data_t um, void (*step)(um_data_t), uint64_t *count,
+               uint64_t stop)
+{
+    um->fast_loops = um->fast_loops_allowed;
+
+    for (;;) {
+        while (*count < stop && !um->halting) {
+            step(um);
+            (*count)++;
+        }
+
+        if (!um->looping) {
+            break;
+        }
+        *count += fast_forward(um, stop - *count);
+    }
+
+    um->fast_loops = false;
+}
+
+
+/* find_loop
+ * Purpose:     Checks whether load_prog just closed a loop that can be
+ *                  fast-forwarded, and if so stops the UM so that its run
+ *                  loop can do it
+ * Parameters:  um_data_t um: the UM, whose program counter load_prog has
+ *                  just set to the loop's head
+ *              uint32_t tail: address of the load_prog
+ * Returns:     None
+ * Notes:       Sets halting and looping on success
+ */
+void find_loop(um_data_t um, uint32_t tail)
+{
+    if (um->loop == NULL) {
+        um->loop = um_loop_new();
+    }
+
+    if (um_loop_decode(um->loop, um->memory, um->program_counter, tail)) {
+        um->looping = true;
+        um->halting = true;
+    }
+}
+
+
+/* copy_program
+ * Purpose:     Replaces segment 0 with a copy of another segment
+ * Parameters:  um_data_t um: the UM
+ *              uint32_t seg_id: the segment to copy
+ * Returns:     None
+ * Notes:       It is a URE for seg_id to be unmapped
+ *              The copy is charged to the load_prog phase if the UM is
+ *                  counting (see run_um_perf)
+ */
+void copy_program(um_data_t um, uint32_t seg_id)
+{
+    if (um->perf != NULL) {
+        um_perf_enter(um->perf, UM_PERF_LOAD_PROG);
+    }
+
+    set_segment(um->memory, 0, get_segment_copy(um->memory, seg_id));
+
+    if (um->perf != NULL) {
+        um_perf_enter(um->perf, UM_PERF_RUN);
+    }
+}
+
+
+/* fast_forward
+ * Purpose:     Resumes a UM stopped by find_loop, running the loop
+ * Parameters:  um_data_t um: the UM, with looping set
+ *              uint64_t budget: the most instructions to run
+ * Returns:     uint64_t: the number of instructions run
+ * Notes:       The UM is left ready to step from its program counter
+ */
+uint64_t fast_forward(um_data_t um, uint64_t budget)
+{
+    um->looping = false;
+    um->halting = false;
+
+    return um_loop_run(um->loop, um->memory, um->words, um->regs,
+                       &um->program_counter, budget);
+}
+
+
 /* get_abc
  * Purpose:     Gets registers A, B, and C from a provided instruction
  * Parameters:  uint32_t instruction: instruction from which to retrieve 
@@ -218,11 +769,19 @@ void mov(um_data_t um, uint32_t inst)
  * Returns:     None 
  * Notes:       It is a URE for $m[$r[B]][$r[C]] to not indicate a valid word 
  *                 in a mapped segment
+ *              When IDs are handles, any segment but 0 is read straight
+ *                 from the arena
  */
 void seg_load(um_data_t um, uint32_t inst)
 {
     uint32_t abc[3];
     get_abc(inst, abc);
+
+    if (um->words != NULL && um->regs[abc[1]] != 0) {
+        um->regs[abc[0]] = um->words[(size_t)um->regs[abc[1]] + 
+                                     um->regs[abc[2]]];
+        return;
+    }
     um->regs[abc[0]] = get_seg_value(um->memory, 
                                         um->regs[abc[1]], um->regs[abc[2]]);
 }
@@ -235,11 +794,19 @@ void seg_load(um_data_t um, uint32_t inst)
  * Returns:     None 
  * Notes:       It is a URE for $m[$r[A]][$r[B]] to not indicate a valid word 
  *                 in a mapped segment
+ *              When IDs are handles, any segment but 0 is written straight
+ *                 to the arena
  */
 void seg_store(um_data_t um, uint32_t inst)
 {
     uint32_t abc[3];
     get_abc(inst, abc);
+
+    if (um->words != NULL && um->regs[abc[0]] != 0) {
+        um->words[(size_t)um->regs[abc[0]] + um->regs[abc[1]]] = 
+            um->regs[abc[2]];
+        return;
+    }
     set_seg_value(um->memory, um->regs[abc[0]], 
                   um->regs[abc[1]], um->regs[abc[2]]);
 }
@@ -271,7 +838,15 @@ void output(um_data_t um, uint32_t inst)
 {
     uint32_t abc[3];
     get_abc(inst, abc);
-    putc(um->regs[abc[2]], stdout);
+    um->output_bytes++;
+
+    if (um->io != NULL) {
+        um_io_put(um->io, um->regs[abc[2]]);
+    } else if (um->stream != NULL) {
+        um_stream_put(um->stream, um->regs[abc[2]]);
+    } else {
+        putc(um->regs[abc[2]], stdout);
+    }
 }
 
 
@@ -283,16 +858,32 @@ void output(um_data_t um, uint32_t inst)
  * Notes:       It is a URE if input is not in the range 0 to 255
  *              If the end of input has been signalled, $r[C] is loaded with 
  *                  a 32-bit word of all 1's
+ *              With io buffers attached and no input yet, stops the UM to
+ *                  wait, leaving the program counter on this instruction
  */
 void input(um_data_t um, uint32_t inst)
 {
     uint32_t abc[3];
     get_abc(inst, abc);
-    um->regs[abc[2]] = getc(stdin);
 
-    if (feof(stdin) != 0) {
-        um->regs[abc[2]] = ~(0); 
+    if (um->io != NULL) {
+        if (!um_io_get(um->io, &um->regs[abc[2]])) {
+            um->program_counter--;
+            um->waiting = true;
+            um->halting = true;
+            return;
+        }
+    } else if (um->stream != NULL) {
+        um->regs[abc[2]] = um_stream_get(um->stream);
+    } else {
+        um->regs[abc[2]] = getc(stdin);
+
+        if (feof(stdin) != 0) {
+            um->regs[abc[2]] = ~(0); 
+        }
     }
+
+    um->input_bytes++;
 }
 
 
@@ -336,21 +927,25 @@ void unmap_seg(um_data_t um, uint32_t inst)
  *              uint32_t inst: the instruction holding the register indices
  * Returns:     None 
  * Notes:       It is a URE for $m[$r[B]] to point to an unmapped segment 
+ *              A jump back within segment 0 may stop the UM to fast-forward
+ *                  the loop it closes (see find_loop)
  */
 void load_prog(um_data_t um, uint32_t inst)
 {
     uint32_t abc[3];
     get_abc(inst, abc);
     
+    uint32_t tail = um->program_counter - 1;
     um->program_counter = um->regs[abc[2]];
 
     if (um->regs[abc[1]] == 0) {
+        if (um->fast_loops && um->program_counter <= tail) {
+            find_loop(um, tail);
+        }
         return;
     }
     
-    UArray_T seg_copy = get_segment_copy(um->memory, um->regs[abc[1]]);
-    set_segment(um->memory, 0, seg_copy);
-
+    copy_program(um, um->regs[abc[1]]);
 }
 
 
@@ -369,6 +964,22 @@ void load_val(um_data_t um, uint32_t inst)
 }
 
 
+/* illegal_inst
+ * Purpose:     Fails the machine on an instruction with opcode 14 or 15
+ * Parameters:  um_data_t um: the UM where the data is stored
+ *              uint32_t inst: the instruction
+ * Returns:     None 
+ * Notes:       Prints the instruction and raises Illegal_Instruction, 
+ *                  since the UM has failed
+ */
+void illegal_inst(um_data_t um, uint32_t inst)
+{
+    fprintf(stderr, "Illegal instruction %08x at word %u\n", inst,
+            um->program_counter - 1);
+    RAISE(Illegal_Instruction);
+}
+
+
 /* add
  * Purpose:     Adds the values at $r[B] and $r[C] mod 2^32 and stores the 
                     result in $r[A].
@@ -12,19 +12,98 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "um_mem.h"
+#include "um_trace.h"
+#include "um_cfg.h"
+#include "um_io.h"
+#include "um_stream.h"
+#include "um_metrics.h"
 #include <stdio.h>
 
 typedef struct um_data_t* um_data_t;
 
+/* defined in um_checkpoint.h, which depends on this header */
+struct um_checkpoint_t;
+
+/* handler sets that can execute a UM program */
+typedef enum um_engine_t {
+    UM_ENGINE_GENERIC = 0,      /* one handler per opcode, decodes registers */
+    UM_ENGINE_SPECIALIZED       /* generated handler per opcode and registers */
+} um_engine_t;
+
 /* creates a new, empty, heap-allocated UM instance */
 um_data_t initialize_um();
 
+/* creates a UM in the same state as another, sharing its segments 
+ * copy-on-write */
+um_data_t clone_um(um_data_t um);
+
+/* attaches input and output buffers used in place of stdin and stdout */
+void set_um_io(um_data_t um, um_io_t io);
+
+/* makes a UM use asynchronous streams in place of stdin and stdout */
+void set_um_stream(um_data_t um, um_stream_t stream);
+
+/* turns fast-forwarding of loops on (the default) or off, so every
+ * instruction is dispatched */
+void set_um_fast_loops(um_data_t um, bool allowed);
+
+/* makes a UM keep its large segments in a file-backed store */
+void set_um_store(um_data_t um, um_store_t store);
+
+/* makes a UM keep its segments in a huge-page pool */
+void set_um_huge(um_data_t um, um_huge_t huge);
+
+/* makes a UM's segment IDs direct handles into a word arena; false if the
+ * arena cannot be reserved */
+bool use_um_handles(um_data_t um);
+
 /* reads program into a UM */
 void read_um_program(FILE *program, um_data_t um, int num_words);
 
+/* loads a program already in host byte order, such as a .umx image */
+void load_um_words(um_data_t um, const uint32_t *words, uint32_t num_words);
+
 /* interprets the instruction pointed to by the program counter */
 void read_instruction(um_data_t um);
 
+/* interprets the next instruction using register-specialized handlers */
+void read_instruction_specialized(um_data_t um);
+
+/* executes instructions with the given engine until the UM halts */
+void run_um(um_data_t um, um_engine_t engine);
+
+/* same as run_um, but returns the number of instructions executed */
+uint64_t run_um_counted(um_data_t um, um_engine_t engine);
+
+/* same as run_um_counted, but also keeps memory statistics and prints them
+ * to report when the UM halts */
+uint64_t run_um_stats(um_data_t um, um_engine_t engine, FILE *report);
+
+/* same as run_um_counted, but also sends live metrics a sample every batch
+ * of instructions */
+uint64_t run_um_metrics(um_data_t um, um_engine_t engine,
+                        um_metrics_t metrics);
+
+/* same as run_um, but appends a checkpoint to a log every so many 
+ * instructions; executed counts those run before a resumed checkpoint */
+void run_um_checkpointed(um_data_t um, um_engine_t engine, 
+                         struct um_checkpoint_t *log, uint64_t every, 
+                         uint64_t executed);
+
+/* same as run_um, but records every executed instruction into a trace */
+void run_um_traced(um_data_t um, um_engine_t engine, um_trace_t trace);
+
+/* same as run_um, but records every block and jump into a control-flow graph
+ * of segment 0 */
+void run_um_cfg(um_data_t um, um_engine_t engine, um_cfg_t cfg);
+
+/* same as run_um, but also stops after limit instructions or to wait for
+ * input; returns the number of instructions executed */
+uint64_t run_um_for(um_data_t um, um_engine_t engine, uint64_t limit);
+
+/* returns whether the UM stopped to wait for input */
+bool is_waiting(um_data_t um);
+
 /* returns whether the "halting" member is set to true */
 bool is_halting(um_data_t um);
 
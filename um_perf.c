@@ -0,0 +1,473 @@
+/*
+ * um_perf.c
+ *
+ * Purpose: Implementation of per-phase performance counters.
+ *
+ *          Each counter is its own perf event on this thread, so one the
+ *          host lacks does not keep the others from counting, and the
+ *          kernel multiplexes them if there are more than the hardware
+ *          has registers for. Every reading carries the time the event was
+ *          enabled and running, so multiplexed counts are scaled up to the
+ *          whole time. Entering a phase reads every counter and charges
+ *          the difference since the last reading to the phase being left.
+ *
+ *          A reading costs a system call per counter, so phases are only
+ *          entered where the emulator already does something costly. The
+ *          UM's input and output go through io buffers, and run_um_perf
+ *          moves them to and from stdin and stdout between slices of
+ *          instructions, as server mode and pipelines do; the output and
+ *          input instructions themselves are charged to running. A
+ *          load_prog that copies a segment is charged to its own phase by
+ *          copy_program.
+ *
+ *          Kernel work, such as the system calls that do the I/O, is
+ *          counted only if perf_event_paranoid allows it; otherwise every
+ *          counter is limited to user space, and the report says so.
+ */
+
+#include "um_perf.h"
+#include "um_data.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <mem.h>
+#include <assert.h>
+
+#define SLICE           (1 << 20)
+#define READ_CHUNK      (64 * 1024)
+
+#define CACHE_READ_MISS(cache) ((cache) |                                   \
+                                (PERF_COUNT_HW_CACHE_OP_READ << 8) |        \
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* the counters, in the order they are reported */
+enum {
+    TASK_CLOCK = 0, PAGE_FAULTS, CYCLES, INSTRUCTIONS, BRANCHES,
+    BRANCH_MISSES, L1D_MISSES, LLC_MISSES, DTLB_MISSES, NUM_COUNTERS
+};
+
+static const struct counter_info {
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+} counters[NUM_COUNTERS] = {
+    { "task-clock (ns)", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "page-faults",     PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "cycles",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branches",        PERF_TYPE_HARDWARE,
+                         PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branch-misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "L1d-misses",      PERF_TYPE_HW_CACHE,
+                         CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { "LLC-misses",      PERF_TYPE_HW_CACHE,
+                         CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { "dTLB-misses",     PERF_TYPE_HW_CACHE,
+                         CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) }
+};
+
+static const char *const phase_names[UM_PERF_PHASES] = {
+    "load", "run", "load_prog", "io"
+};
+
+static const char *const engine_names[] = { "generic", "specialized" };
+
+/* struct reading
+ * Purpose:     One counter's value, as read or summed over a phase
+ * Members:     uint64_t value: the count
+ *              uint64_t enabled, running: nanoseconds the event was
+ *                  enabled, and actually counting on the hardware
+ */
+struct reading {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+};
+
+/* struct um_perf_t
+ * Purpose:     Open counters and what each phase has been charged
+ * Members:     int fds[]: the event of each counter, or -1 if the host
+ *                  does not offer it
+ *              int error: errno from the first counter that failed to
+ *                  open, or 0
+ *              bool user_only: true iff the kernel is excluded from counts
+ *              struct reading last[]: each counter at the last charge
+ *              struct reading sums[][]: counts charged to each phase
+ *              uint64_t entries[]: times each phase has been entered
+ *              um_perf_phase_t phase: the current phase
+ *              bool stopped: true once um_perf_stop has been called
+ */
+struct um_perf_t {
+    int             fds[NUM_COUNTERS];
+    int             error;
+    bool            user_only;
+    struct reading  last[NUM_COUNTERS];
+    struct reading  sums[UM_PERF_PHASES][NUM_COUNTERS];
+    uint64_t        entries[UM_PERF_PHASES];
+    um_perf_phase_t phase;
+    bool            stopped;
+};
+
+int open_counter(const struct counter_info *info, bool user_only);
+void charge_phase(um_perf_t perf);
+double scaled_count(const struct reading *reading);
+double execution_count(um_perf_t perf, int counter);
+void write_perf_output(um_io_t io);
+void read_perf_input(um_io_t io);
+
+
+/* um_perf_new
+ * Purpose:     Opens the counters and starts charging the load phase
+ * Parameters:  None
+ * Returns:     um_perf_t: the counters; client frees with um_perf_free
+ * Notes:       The kernel is counted too if the host allows it. A counter
+ *                  that cannot be opened is left out of every phase.
+ */
+um_perf_t um_perf_new()
+{
+    um_perf_t perf;
+    NEW0(perf);
+
+    int probe = open_counter(&counters[TASK_CLOCK], false);
+    if (probe == -1 && (errno == EACCES || errno == EPERM)) {
+        perf->user_only = true;
+    } else if (probe != -1) {
+        close(probe);
+    }
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        perf->fds[i] = open_counter(&counters[i], perf->user_only);
+        if (perf->fds[i] == -1 && perf->error == 0) {
+            perf->error = errno;
+        }
+    }
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (perf->fds[i] != -1) {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    perf->phase = UM_PERF_LOAD;
+    perf->entries[UM_PERF_LOAD] = 1;
+    charge_phase(perf);
+    memset(perf->sums, 0, sizeof(perf->sums));
+
+    return perf;
+}
+
+
+/* um_perf_free
+ * Purpose:     Closes the counters and frees them
+ * Parameters:  um_perf_t *perf: pointer to the counters to free
+ * Returns:     None
+ */
+void um_perf_free(um_perf_t *perf)
+{
+    assert(perf != NULL && *perf != NULL);
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if ((*perf)->fds[i] != -1) {
+            close((*perf)->fds[i]);
+        }
+    }
+    FREE(*perf);
+}
+
+
+/* um_perf_enter
+ * Purpose:     Charges the counts since the last charge to the current
+ *                  phase, then switches phases
+ * Parameters:  um_perf_t perf: the counters
+ *              um_perf_phase_t phase: the phase the emulator is entering
+ * Returns:     None
+ * Notes:       Does nothing once the counters are stopped
+ */
+void um_perf_enter(um_perf_t perf, um_perf_phase_t phase)
+{
+    assert(perf != NULL && phase < UM_PERF_PHASES);
+
+    if (perf->stopped) {
+        return;
+    }
+
+    charge_phase(perf);
+    perf->phase = phase;
+    perf->entries[phase]++;
+}
+
+
+/* um_perf_stop
+ * Purpose:     Charges the counts since the last charge to the current
+ *                  phase, and stops counting
+ * Parameters:  um_perf_t perf: the counters
+ * Returns:     None
+ */
+void um_perf_stop(um_perf_t perf)
+{
+    assert(perf != NULL);
+
+    if (perf->stopped) {
+        return;
+    }
+
+    charge_phase(perf);
+    perf->stopped = true;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (perf->fds[i] != -1) {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+
+/* run_um_perf
+ * Purpose:     Runs a UM until it halts, charging running, load_prog
+ *                  copies and I/O to their phases
+ * Parameters:  um_data_t um: the UM, with no io or stream attached
+ *              um_engine_t engine: which handlers execute the instructions
+ *              um_perf_t perf: the counters
+ * Returns:     uint64_t: the number of instructions executed
+ * Notes:       Output is written after every SLICE instructions and
+ *                  whenever the UM waits for input, so interactive programs
+ *                  still work. Stops the counters when the UM halts.
+ */
+uint64_t run_um_perf(um_data_t um, um_engine_t engine, um_perf_t perf)
+{
+    assert(um != NULL && perf != NULL);
+    assert(um->io == NULL && um->stream == NULL);
+
+    um_io_t io = um_io_new();
+    uint64_t count = 0;
+    size_t pending;
+
+    set_um_io(um, io);
+    um->perf = perf;
+    um_perf_enter(perf, UM_PERF_RUN);
+
+    for (;;) {
+        count += run_um_for(um, engine, SLICE);
+
+        um_io_output(io, &pending);
+        if (pending > 0 || is_waiting(um)) {
+            um_perf_enter(perf, UM_PERF_IO);
+            write_perf_output(io);
+            if (is_waiting(um)) {
+                read_perf_input(io);
+            }
+            um_perf_enter(perf, UM_PERF_RUN);
+        }
+
+        if (is_halting(um) && !is_waiting(um)) {
+            break;
+        }
+    }
+
+    um_perf_stop(perf);
+    um->perf = NULL;
+    set_um_io(um, NULL);
+    um_io_free(&io);
+
+    return count;
+}
+
+
+/* um_perf_report
+ * Purpose:     Prints what each phase was charged, and the execution
+ *                  counts per UM instruction
+ * Parameters:  um_perf_t perf: the counters, stopped
+ *              FILE *fp: where to print
+ *              um_engine_t engine: the engine that ran, for the heading
+ *              uint64_t instructions: UM instructions executed
+ * Returns:     None
+ * Notes:       Execution is the run and load_prog phases together
+ */
+void um_perf_report(um_perf_t perf, FILE *fp, um_engine_t engine,
+                    uint64_t instructions)
+{
+    assert(perf != NULL && fp != NULL);
+
+    fprintf(fp, "perf: %s engine, %llu UM instructions%s\n",
+            engine_names[engine], (unsigned long long)instructions,
+            perf->user_only ? ", user space only" : "");
+
+    fprintf(fp, "%-16s", "counter");
+    for (int p = 0; p < UM_PERF_PHASES; p++) {
+        fprintf(fp, " %15s", phase_names[p]);
+    }
+    fprintf(fp, "\n%-16s", "entries");
+    for (int p = 0; p < UM_PERF_PHASES; p++) {
+        fprintf(fp, " %15llu", (unsigned long long)perf->entries[p]);
+    }
+    fprintf(fp, "\n");
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (perf->fds[i] == -1) {
+            continue;
+        }
+        fprintf(fp, "%-16s", counters[i].name);
+        for (int p = 0; p < UM_PERF_PHASES; p++) {
+            fprintf(fp, " %15.0f", scaled_count(&perf->sums[p][i]));
+        }
+        fprintf(fp, "\n");
+    }
+
+    if (instructions > 0) {
+        fprintf(fp, "per UM instruction, run and load_prog:\n");
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (perf->fds[i] != -1 && i != PAGE_FAULTS) {
+                fprintf(fp, "  %-16s %12.3f\n", counters[i].name,
+                        execution_count(perf, i) / instructions);
+            }
+        }
+    }
+    if (perf->fds[BRANCHES] != -1 && perf->fds[BRANCH_MISSES] != -1 &&
+        execution_count(perf, BRANCHES) > 0) {
+        fprintf(fp, "  branch-miss rate %11.2f%%\n", 100.0 *
+                execution_count(perf, BRANCH_MISSES) /
+                execution_count(perf, BRANCHES));
+    }
+
+    bool first = true;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (perf->fds[i] == -1) {
+            fprintf(fp, "%s%s", first ? "not counted: " : ", ",
+                    counters[i].name);
+            first = false;
+        }
+    }
+    if (!first) {
+        fprintf(fp, " (%s)\n", strerror(perf->error));
+    }
+}
+
+
+/* open_counter
+ * Purpose:     Opens one counter on the calling thread, enabled later
+ * Parameters:  const struct counter_info *info: the counter
+ *              bool user_only: whether to leave out the kernel
+ * Returns:     int: the event's file descriptor, or -1 with errno set
+ */
+int open_counter(const struct counter_info *info, bool user_only)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = info->type;
+    attr.config = info->config;
+    attr.disabled = 1;
+    attr.exclude_kernel = user_only;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/* charge_phase
+ * Purpose:     Reads every counter and adds what it counted since the last
+ *                  reading to the current phase
+ * Parameters:  um_perf_t perf: the counters
+ * Returns:     None
+ * Notes:       A counter that cannot be read is charged nothing
+ */
+void charge_phase(um_perf_t perf)
+{
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        struct reading now;
+
+        if (perf->fds[i] == -1 ||
+            read(perf->fds[i], &now, sizeof(now)) != sizeof(now)) {
+            continue;
+        }
+
+        struct reading *sum = &perf->sums[perf->phase][i];
+        sum->value += now.value - perf->last[i].value;
+        sum->enabled += now.enabled - perf->last[i].enabled;
+        sum->running += now.running - perf->last[i].running;
+        perf->last[i] = now;
+    }
+}
+
+
+/* scaled_count
+ * Purpose:     Estimates what a counter would have counted had it been on
+ *                  the hardware the whole time it was enabled
+ * Parameters:  const struct reading *reading: a phase's sum
+ * Returns:     double: the estimate
+ */
+double scaled_count(const struct reading *reading)
+{
+    if (reading->running == 0 || reading->running >= reading->enabled) {
+        return reading->value;
+    }
+    return (double)reading->value * reading->enabled / reading->running;
+}
+
+
+/* execution_count
+ * Purpose:     Adds up a counter over the phases that execute instructions
+ * Parameters:  um_perf_t perf: the counters
+ *              int counter: which counter
+ * Returns:     double: its scaled count over run and load_prog
+ */
+double execution_count(um_perf_t perf, int counter)
+{
+    return scaled_count(&perf->sums[UM_PERF_RUN][counter]) +
+           scaled_count(&perf->sums[UM_PERF_LOAD_PROG][counter]);
+}
+
+
+/* write_perf_output
+ * Purpose:     Writes everything the UM has output so far to stdout
+ * Parameters:  um_io_t io: the UM's buffers
+ * Returns:     None
+ * Notes:       Exits with an error message if stdout cannot be written
+ */
+void write_perf_output(um_io_t io)
+{
+    size_t pending;
+    const char *bytes = um_io_output(io, &pending);
+
+    while (pending > 0) {
+        ssize_t n = write(STDOUT_FILENO, bytes, pending);
+
+        if (n > 0) {
+            um_io_drain(io, n);
+            bytes = um_io_output(io, &pending);
+        } else if (n == -1 && errno != EINTR) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+/* read_perf_input
+ * Purpose:     Feeds the UM the next block of stdin, waiting for it if
+ *                  necessary
+ * Parameters:  um_io_t io: the UM's buffers
+ * Returns:     None
+ * Notes:       Ends the UM's input at the end of stdin or on an error
+ */
+void read_perf_input(um_io_t io)
+{
+    char buffer[READ_CHUNK];
+    ssize_t n;
+
+    do {
+        n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    } while (n == -1 && errno == EINTR);
+
+    if (n > 0) {
+        um_io_feed(io, buffer, n);
+    } else {
+        um_io_end_input(io);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * um_perf.h
+ *
+ * Purpose: Interface for reading the host's performance counters while a
+ *          UM runs. Counters are opened with Linux perf_event_open and
+ *          charged to the phase the emulator is in: loading the program,
+ *          running it, copying segments for load_prog, or reading and
+ *          writing for the program. Counters the host does not offer, as
+ *          in most virtual machines, are reported as not counted rather
+ *          than failing the run.
+ */
+
+#ifndef UM_PERF_H
+#define UM_PERF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "um_operate.h"
+
+/* what the emulator is doing, for charging counts */
+typedef enum um_perf_phase_t {
+    UM_PERF_LOAD = 0,           /* reading the program into segment 0 */
+    UM_PERF_RUN,                /* executing instructions */
+    UM_PERF_LOAD_PROG,          /* copying a segment to replace segment 0 */
+    UM_PERF_IO,                 /* reading input and writing output */
+    UM_PERF_PHASES
+} um_perf_phase_t;
+
+typedef struct um_perf_t* um_perf_t;
+
+/* opens every counter the host offers and starts charging the load phase;
+ * never NULL, even if no counter could be opened */
+um_perf_t um_perf_new();
+
+/* closes the counters */
+void um_perf_free(um_perf_t *perf);
+
+
+/* charges the counts since the last call to the current phase, then makes
+ * phase current */
+void um_perf_enter(um_perf_t perf, um_perf_phase_t phase);
+
+/* charges the counts to the current phase and stops charging */
+void um_perf_stop(um_perf_t perf);
+
+
+/* runs a UM until it halts, charging each phase, with its input and output
+ * on stdin and stdout; returns the number of instructions executed */
+uint64_t run_um_perf(um_data_t um, um_engine_t engine, um_perf_t perf);
+
+/* prints the counts of each phase, and host cycles, instructions and
+ * branch misses per UM instruction */
+void um_perf_report(um_perf_t perf, FILE *fp, um_engine_t engine,
+                    uint64_t instructions);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * um_pipeline.c
+ *
+ * Purpose: Implementation of in-process pipelines.
+ *
+ *          Every machine gets io buffers, and each buffer's input is
+ *          chained to the previous machine's output, so a byte written by
+ *          one output instruction is read in place by the next machine's
+ *          input instruction. The machines take turns on the calling
+ *          thread, each running up to SLICE instructions per turn, the
+ *          same way server mode runs sessions. A machine is skipped while
+ *          it waits for input that has not been written yet, or while the
+ *          next machine has OUTPUT_LIMIT bytes of its output still to
+ *          read. Only when no machine can run does the pipeline block, to
+ *          read more of its own input for the first machine.
+ *
+ *          When a machine halts, the next one sees the end of its input,
+ *          and the machines before it are stopped, as a shell pipeline's
+ *          writers are once their reader exits.
+ */
+
+#include "um_pipeline.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <seq.h>
+#include <mem.h>
+#include <assert.h>
+
+#define SLICE           (1 << 20)
+#define OUTPUT_LIMIT    (64 * 1024)
+#define READ_CHUNK      (64 * 1024)
+
+
+/* struct stage
+ * Purpose:     One machine in a pipeline
+ * Members:     um_data_t um: the machine
+ *              um_io_t io: its input and output
+ *              bool done: true once it has halted or been stopped
+ */
+struct stage {
+    um_data_t   um;
+    um_io_t     io;
+    bool        done;
+};
+
+/* struct um_pipeline_t
+ * Purpose:     A chain of machines
+ * Members:     Seq_T stages: struct stage *, first to last
+ *              um_engine_t engine: the handlers every machine runs on
+ */
+struct um_pipeline_t {
+    Seq_T       stages;
+    um_engine_t engine;
+};
+
+bool run_stage(um_pipeline_t pipeline, int i);
+void read_pipeline_input(struct stage *first, int in_fd);
+void write_pipeline_output(struct stage *last, int out_fd);
+
+
+/* um_pipeline_new
+ * Purpose:     Creates a pipeline with no machines
+ * Parameters:  um_engine_t engine: which handlers run the machines
+ * Returns:     um_pipeline_t: the pipeline; client frees with
+ *                  um_pipeline_free
+ */
+um_pipeline_t um_pipeline_new(um_engine_t engine)
+{
+    um_pipeline_t pipeline;
+    NEW(pipeline);
+    pipeline->stages = Seq_new(4);
+    pipeline->engine = engine;
+
+    return pipeline;
+}
+
+
+/* um_pipeline_free
+ * Purpose:     Frees a pipeline and its machines
+ * Parameters:  um_pipeline_t *pipeline: pointer to the pipeline to free
+ * Returns:     None
+ */
+void um_pipeline_free(um_pipeline_t *pipeline)
+{
+    assert(pipeline != NULL && *pipeline != NULL);
+    Seq_T stages = (*pipeline)->stages;
+
+    while (Seq_length(stages) > 0) {
+        struct stage *stage = Seq_remhi(stages);
+        free_um(stage->um);
+        um_io_free(&stage->io);
+        FREE(stage);
+    }
+
+    Seq_free(&stages);
+    FREE(*pipeline);
+}
+
+
+/* um_pipeline_add
+ * Purpose:     Adds a machine that reads the output of the current last one
+ * Parameters:  um_pipeline_t pipeline: the pipeline
+ *              um_data_t um: a loaded machine; the pipeline now owns it
+ * Returns:     None
+ */
+void um_pipeline_add(um_pipeline_t pipeline, um_data_t um)
+{
+    assert(pipeline != NULL && um != NULL);
+
+    struct stage *stage;
+    NEW0(stage);
+    stage->um = um;
+    stage->io = um_io_new();
+    set_um_io(um, stage->io);
+
+    int n = Seq_length(pipeline->stages);
+    if (n > 0) {
+        struct stage *previous = Seq_get(pipeline->stages, n - 1);
+        um_io_chain(previous->io, stage->io);
+    }
+
+    Seq_addhi(pipeline->stages, stage);
+}
+
+
+/* um_pipeline_run
+ * Purpose:     Runs a pipeline until its last machine halts
+ * Parameters:  um_pipeline_t pipeline: a pipeline of at least one machine
+ *              int in_fd: where the first machine's input comes from
+ *              int out_fd: where the last machine's output goes
+ * Returns:     None
+ * Notes:       Everything output so far is written before the pipeline
+ *                  blocks reading in_fd. Exits with an error message if
+ *                  out_fd cannot be written.
+ */
+void um_pipeline_run(um_pipeline_t pipeline, int in_fd, int out_fd)
+{
+    assert(pipeline != NULL && Seq_length(pipeline->stages) > 0);
+
+    int n = Seq_length(pipeline->stages);
+    struct stage *first = Seq_get(pipeline->stages, 0);
+    struct stage *last = Seq_get(pipeline->stages, n - 1);
+
+    while (!last->done) {
+        bool ran = false;
+
+        for (int i = 0; i < n; i++) {
+            ran = run_stage(pipeline, i) || ran;
+        }
+        write_pipeline_output(last, out_fd);
+
+        /* a linear chain can only be stuck on the first machine's input */
+        if (!ran) {
+            assert(!first->done && is_waiting(first->um));
+            read_pipeline_input(first, in_fd);
+        }
+    }
+}
+
+
+/* run_stage
+ * Purpose:     Gives one machine a turn if it can use it
+ * Parameters:  um_pipeline_t pipeline: the pipeline
+ *              int i: the machine's place in the pipeline
+ * Returns:     bool: true iff the machine ran
+ */
+bool run_stage(um_pipeline_t pipeline, int i)
+{
+    int n = Seq_length(pipeline->stages);
+    struct stage *stage = Seq_get(pipeline->stages, i);
+    size_t pending;
+
+    um_io_output(stage->io, &pending);
+    if (stage->done ||
+        (is_waiting(stage->um) && !um_io_readable(stage->io)) ||
+        (i < n - 1 && pending >= OUTPUT_LIMIT)) {
+        return false;
+    }
+
+    run_um_for(stage->um, pipeline->engine, SLICE);
+    if (!is_halting(stage->um) || is_waiting(stage->um)) {
+        return true;
+    }
+
+    stage->done = true;
+    if (i < n - 1) {
+        struct stage *next = Seq_get(pipeline->stages, i + 1);
+        um_io_end_input(next->io);
+    }
+    for (int j = 0; j < i; j++) {
+        struct stage *writer = Seq_get(pipeline->stages, j);
+        writer->done = true;
+    }
+
+    return true;
+}
+
+
+/* read_pipeline_input
+ * Purpose:     Feeds the first machine the next block of the pipeline's
+ *                  input, waiting for it if necessary
+ * Parameters:  struct stage *first: the first machine
+ *              int in_fd: the pipeline's input
+ * Returns:     None
+ * Notes:       Ends the machine's input at the end of in_fd or on an error
+ */
+void read_pipeline_input(struct stage *first, int in_fd)
+{
+    char buffer[READ_CHUNK];
+    ssize_t n;
+
+    do {
+        n = read(in_fd, buffer, sizeof(buffer));
+    } while (n == -1 && errno == EINTR);
+
+    if (n > 0) {
+        um_io_feed(first->io, buffer, n);
+    } else {
+        um_io_end_input(first->io);
+    }
+}
+
+
+/* write_pipeline_output
+ * Purpose:     Writes everything the last machine has output so far
+ * Parameters:  struct stage *last: the last machine
+ *              int out_fd: the pipeline's output
+ * Returns:     None
+ */
+void write_pipeline_output(struct stage *last, int out_fd)
+{
+    size_t pending;
+    const char *bytes = um_io_output(last->io, &pending);
+
+    while (pending > 0) {
+        ssize_t n = write(out_fd, bytes, pending);
+
+        if (n > 0) {
+            um_io_drain(last->io, n);
+            bytes = um_io_output(last->io, &pending);
+        } else if (n == -1 && errno != EINTR) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
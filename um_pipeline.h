@@ -0,0 +1,30 @@
+/*
+ * um_pipeline.h
+ *
+ * Purpose: Interface for running a chain of UMs in one process, each
+ *          reading the output of the one before it, as a shell pipeline
+ *          would but without kernel pipes. The first reads the pipeline's
+ *          input and the last writes its output.
+ */
+
+#ifndef UM_PIPELINE_H
+#define UM_PIPELINE_H
+
+#include "um_operate.h"
+
+typedef struct um_pipeline_t* um_pipeline_t;
+
+/* creates an empty pipeline whose machines run on engine */
+um_pipeline_t um_pipeline_new(um_engine_t engine);
+
+/* frees the pipeline and every machine added to it */
+void um_pipeline_free(um_pipeline_t *pipeline);
+
+/* adds a machine to the end of the pipeline, which takes ownership of it */
+void um_pipeline_add(um_pipeline_t pipeline, um_data_t um);
+
+/* runs the machines until the last one halts, reading input from in_fd and
+ * writing output to out_fd */
+void um_pipeline_run(um_pipeline_t pipeline, int in_fd, int out_fd);
+
+#endif
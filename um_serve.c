@@ -0,0 +1,426 @@
+/*
+ * um_serve.c
+ *
+ * Purpose: Implementation of server mode.
+ *
+ *          The main thread waits in epoll for new connections and for
+ *          sockets to become readable or writable. A new connection gets a
+ *          session holding a clone of the image (see clone_um), which costs
+ *          time in the image's segment count rather than its size, and the
+ *          session goes on the run queue. Worker threads take sessions off
+ *          the queue, read whatever input has arrived, run the machine for
+ *          up to SLICE instructions and send whatever output it produced,
+ *          all without blocking. A session that is waiting for input, or
+ *          has more than OUTPUT_LIMIT bytes the client has not taken yet,
+ *          is handed back to epoll until its socket is ready; one that used
+ *          up its slice goes to the back of the queue.
+ *
+ *          Input is bounded the same way: no more is read once INPUT_LIMIT
+ *          bytes are waiting for the machine, and the rest stays in the
+ *          socket, so a client that sends faster than its program reads is
+ *          held back by the kernel. EPOLLIN is only armed for a session
+ *          whose machine is waiting for input, which means it has read
+ *          everything it was given.
+ *
+ *          Before each slice the socket is polled for a hangup, so a
+ *          session whose client has closed the connection is dropped even
+ *          if its machine never writes again. A client that has only shut
+ *          down writing still gets its output.
+ *
+ *          Sockets are registered with EPOLLONESHOT, so a session is owned
+ *          by exactly one of the queue, a worker or epoll at any time and
+ *          needs no lock of its own.
+ */
+
+#define _GNU_SOURCE     /* accept4 */
+
+#include "um_serve.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <mem.h>
+#include <assert.h>
+
+#define SLICE           (1 << 20)
+#define OUTPUT_LIMIT    (64 * 1024)
+#define INPUT_LIMIT     (64 * 1024)
+#define MAX_EVENTS      64
+
+/* struct session
+ * Purpose:     One client connection and its machine
+ * Members:     int fd: the connection
+ *              um_data_t um: the client's clone of the image
+ *              um_io_t io: the machine's input and output
+ *              bool registered: true iff fd has been added to epoll
+ *              bool input_ended: true iff the client has shut down writing
+ *              bool done: true iff the machine has halted
+ *              bool broken: true iff the connection failed
+ *              struct session *next: next session on the run queue
+ */
+struct session {
+    int             fd;
+    um_data_t       um;
+    um_io_t         io;
+    bool            registered;
+    bool            input_ended;
+    bool            done;
+    bool            broken;
+    struct session *next;
+};
+
+/* struct server
+ * Purpose:     State shared by the main thread and the workers
+ * Members:     int epoll_fd: waits on the listening socket and sessions
+ *              um_engine_t engine: handlers the machines run with
+ *              pthread_mutex_t lock: guards the run queue
+ *              pthread_cond_t ready: signalled when a session is queued
+ *              struct session *head, *tail: the run queue
+ */
+struct server {
+    int             epoll_fd;
+    um_engine_t     engine;
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;
+    struct session *head;
+    struct session *tail;
+};
+
+static struct server server;
+
+int listen_on(const char *path);
+void accept_all(int listen_fd, um_data_t image);
+void *worker(void *unused);
+void service(struct session *session);
+void check_hangup(struct session *session);
+void read_input(struct session *session);
+void write_output(struct session *session);
+void arm(struct session *session, uint32_t events);
+void close_session(struct session *session);
+void enqueue(struct session *session);
+struct session *dequeue();
+
+
+/* run_um_server
+ * Purpose:     Serves an image to clients of a Unix domain socket
+ * Parameters:  const char *path: where to create the socket; any file
+ *                  already there is removed
+ *              um_data_t image: a UM with its program loaded; it is only
+ *                  cloned, never run
+ *              um_engine_t engine: which handlers run the sessions
+ *              int workers: number of worker threads
+ * Returns:     Never returns
+ * Notes:       Exits with an error message if the socket cannot be set up
+ */
+void run_um_server(const char *path, um_data_t image, um_engine_t engine,
+                   int workers)
+{
+    assert(image != NULL && workers > 0);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = listen_on(path);
+    server.epoll_fd = epoll_create1(0);
+    server.engine = engine;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+
+    struct epoll_event event = { EPOLLIN, { .ptr = NULL } };
+    if (server.epoll_fd == -1 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) {
+        perror("epoll");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+            fprintf(stderr, "Could not start worker threads\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
+
+    fprintf(stderr, "Serving on %s with %d workers\n", path, workers);
+
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int count = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_all(listen_fd, image);
+            } else {
+                enqueue(events[i].data.ptr);
+            }
+        }
+    }
+}
+
+
+/* listen_on
+ * Purpose:     Creates a non-blocking listening Unix domain socket
+ * Parameters:  const char *path: where to create the socket
+ * Returns:     int: the socket
+ */
+int listen_on(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, SOMAXCONN) == -1) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
+
+/* accept_all
+ * Purpose:     Starts a session for every pending connection
+ * Parameters:  int listen_fd: the listening socket
+ *              um_data_t image: the machine each session starts from
+ * Returns:     None
+ */
+void accept_all(int listen_fd, um_data_t image)
+{
+    int fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+        struct session *session;
+        NEW0(session);
+        session->fd = fd;
+        session->um = clone_um(image);
+        session->io = um_io_new();
+        set_um_io(session->um, session->io);
+
+        enqueue(session);
+    }
+}
+
+
+/* worker
+ * Purpose:     Services queued sessions forever
+ * Parameters:  void *unused: required by pthread_create
+ * Returns:     Never returns
+ */
+void *worker(void *unused)
+{
+    (void)unused;
+
+    for (;;) {
+        service(dequeue());
+    }
+
+    return NULL;
+}
+
+
+/* service
+ * Purpose:     Moves a session forward as far as it can go without blocking,
+ *                  then hands it to whoever should see it next
+ * Parameters:  struct session *session: a session owned by the caller
+ * Returns:     None
+ */
+void service(struct session *session)
+{
+    size_t pending;
+
+    check_hangup(session);
+    read_input(session);
+
+    um_io_output(session->io, &pending);
+    if (!session->broken && !session->done && pending < OUTPUT_LIMIT) {
+        run_um_for(session->um, server.engine, SLICE);
+        session->done = is_halting(session->um) &&
+                        !is_waiting(session->um);
+    }
+
+    write_output(session);
+    um_io_output(session->io, &pending);
+
+    if (session->broken || (session->done && pending == 0)) {
+        close_session(session);
+    } else if (session->done || pending >= OUTPUT_LIMIT) {
+        arm(session, EPOLLOUT);
+    } else if (is_waiting(session->um)) {
+        arm(session, EPOLLIN | (pending > 0 ? EPOLLOUT : 0));
+    } else {
+        enqueue(session);
+    }
+}
+
+
+/* check_hangup
+ * Purpose:     Finds out, without blocking, whether the client has closed
+ *                  the connection
+ * Parameters:  struct session *session: the session to check
+ * Returns:     None
+ * Notes:       Marks the session broken on a hangup or a socket error. A
+ *                  client that has only shut down writing is not a hangup,
+ *                  since it still reads the output.
+ */
+void check_hangup(struct session *session)
+{
+    struct pollfd check = { session->fd, 0, 0 };
+
+    if (poll(&check, 1, 0) == 1 && (check.revents & (POLLHUP | POLLERR))) {
+        session->broken = true;
+    }
+}
+
+
+/* read_input
+ * Purpose:     Feeds what the client has sent so far to the machine, until
+ *                  INPUT_LIMIT bytes are waiting to be read
+ * Parameters:  struct session *session: the session to read for
+ * Returns:     None
+ */
+void read_input(struct session *session)
+{
+    char buffer[INPUT_LIMIT];
+    size_t unread;
+
+    while (!session->input_ended &&
+           (unread = um_io_unread(session->io)) < INPUT_LIMIT) {
+        ssize_t n = recv(session->fd, buffer, INPUT_LIMIT - unread,
+                         MSG_DONTWAIT);
+
+        if (n > 0) {
+            um_io_feed(session->io, buffer, n);
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                              errno != EINTR)) {
+            session->input_ended = true;
+            um_io_end_input(session->io);
+        } else if (errno != EINTR) {
+            return;
+        }
+    }
+}
+
+
+/* write_output
+ * Purpose:     Sends as much of the machine's output as the socket takes
+ * Parameters:  struct session *session: the session to write for
+ * Returns:     None
+ * Notes:       Marks the session broken if the client has gone away
+ */
+void write_output(struct session *session)
+{
+    size_t pending;
+    const char *bytes = um_io_output(session->io, &pending);
+
+    while (pending > 0) {
+        ssize_t n = send(session->fd, bytes, pending,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (n > 0) {
+            um_io_drain(session->io, n);
+            bytes = um_io_output(session->io, &pending);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            session->broken = true;
+            return;
+        }
+    }
+}
+
+
+/* arm
+ * Purpose:     Hands a session to epoll until its socket is ready
+ * Parameters:  struct session *session: the session
+ *              uint32_t events: EPOLLIN and/or EPOLLOUT
+ * Returns:     None
+ * Notes:       The caller must not touch the session afterwards, since the
+ *                  main thread may queue it at once
+ */
+void arm(struct session *session, uint32_t events)
+{
+    struct epoll_event event = { events | EPOLLONESHOT, { .ptr = session } };
+    int op = session->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    session->registered = true;
+
+    if (epoll_ctl(server.epoll_fd, op, session->fd, &event) == -1) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* close_session
+ * Purpose:     Closes a session's connection and frees the session
+ * Parameters:  struct session *session: a session owned by the caller
+ * Returns:     None
+ */
+void close_session(struct session *session)
+{
+    close(session->fd);
+    free_um(session->um);
+    um_io_free(&session->io);
+    FREE(session);
+}
+
+
+/* enqueue
+ * Purpose:     Puts a session at the back of the run queue
+ * Parameters:  struct session *session: a session owned by the caller
+ * Returns:     None
+ */
+void enqueue(struct session *session)
+{
+    pthread_mutex_lock(&server.lock);
+
+    session->next = NULL;
+    if (server.tail == NULL) {
+        server.head = session;
+    } else {
+        server.tail->next = session;
+    }
+    server.tail = session;
+
+    pthread_cond_signal(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+}
+
+
+/* dequeue
+ * Purpose:     Takes the session at the front of the run queue, waiting for
+ *                  one if the queue is empty
+ * Parameters:  None
+ * Returns:     struct session *: the session, now owned by the caller
+ */
+struct session *dequeue()
+{
+    pthread_mutex_lock(&server.lock);
+
+    while (server.head == NULL) {
+        pthread_cond_wait(&server.ready, &server.lock);
+    }
+
+    struct session *session = server.head;
+    server.head = session->next;
+    if (server.head == NULL) {
+        server.tail = NULL;
+    }
+
+    pthread_mutex_unlock(&server.lock);
+    return session;
+}
@@ -0,0 +1,19 @@
+/*
+ * um_serve.h
+ *
+ * Purpose: Interface for serving a loaded UM program to clients of a Unix
+ *          domain socket. Every connection gets its own copy of the
+ *          machine, whose input and output are the connection.
+ */
+
+#ifndef UM_SERVE_H
+#define UM_SERVE_H
+
+#include "um_operate.h"
+
+/* accepts connections on a socket at path forever, running a clone of
+ * image for each on a pool of worker threads */
+void run_um_server(const char *path, um_data_t image, um_engine_t engine,
+                   int workers);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * um_special.h
+ *
+ * Purpose: Interface to the register-specialized instruction handlers. 
+ *          The handlers themselves are generated at build time by 
+ *          um_specialize into um_special.c; each one has its register 
+ *          indices baked in as constants, so the handler does no field
+ *          extraction of its own.
+ *
+ *          The handler is still selected every time an instruction runs:
+ *          special_decode extracts the opcode and the nine register bits
+ *          and indexes a two-dimensional table. Selecting it once per word
+ *          of segment 0 would need a decoded copy of segment 0 kept in step
+ *          with every store to it and every load_prog that replaces it, and
+ *          midmark and sandmark both change segment 0 about once every ten
+ *          instructions.
+ */
+
+#ifndef UM_SPECIAL_H
+#define UM_SPECIAL_H
+
+#include <stdint.h>
+#include "um_operate.h"
+
+typedef void (*um_special_fn)(um_data_t um, uint32_t inst);
+
+/* Table of specialized handlers, indexed by opcode and then by the low nine
+ * bits of the instruction (A, B, C). Row 13 (load_val) is indexed by the 
+ * register A field at bits 25-27 instead, since its low bits hold the value.
+ * Rows 14 and 15 hold illegal_inst, so every instruction word decodes.
+ */
+extern um_special_fn const um_special_handlers[16][512];
+
+/* special_decode
+ * Purpose:     Selects the specialized handler for an instruction
+ * Parameters:  uint32_t inst: the instruction to decode
+ * Returns:     um_special_fn: handler that executes exactly this instruction
+ * Notes:       An opcode greater than 13 selects illegal_inst
+ */
+static inline um_special_fn special_decode(uint32_t inst)
+{
+    uint32_t opcode = inst >> 28;
+
+    if (opcode == 13) {
+        return um_special_handlers[13][(inst >> 25) & 0x7];
+    }
+
+    return um_special_handlers[opcode][inst & 0x1ff];
+}
+
+#endif
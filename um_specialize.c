@@ -0,0 +1,242 @@
+/*
+ * um_specialize.c
+ *
+ * Purpose: Build-time generator for um_special.c. Writes one handler per
+ *          (opcode, A, B, C) combination to stdout with the register 
+ *          indices as constants, along with the table used by 
+ *          special_decode to select them. Fields an opcode ignores are not
+ *          expanded; every table slot that differs only in an ignored field 
+ *          shares the same handler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* struct op_info
+ * Purpose:     Describes how one opcode is specialized
+ * Members:     const char *name: prefix used for the generated handler names
+ *              bool uses_a, uses_b, uses_c: whether the handler body 
+ *                  depends on each register field
+ */
+struct op_info {
+    const char *name;
+    bool uses_a, uses_b, uses_c;
+};
+
+static const struct op_info ops[14] = {
+    { "mov",       true,  true,  true  },
+    { "seg_load",  true,  true,  true  },
+    { "seg_store", true,  true,  true  },
+    { "add",       true,  true,  true  },
+    { "mult",      true,  true,  true  },
+    { "div",       true,  true,  true  },
+    { "nand",      true,  true,  true  },
+    { "halt",      false, false, false },
+    { "map_seg",   false, true,  true  },
+    { "unmap_seg", false, false, true  },
+    { "output",    false, false, true  },
+    { "input",     false, false, true  },
+    { "load_prog", false, true,  true  },
+    { "load_val",  true,  false, false }
+};
+
+void emit_handler(unsigned op, unsigned a, unsigned b, unsigned c);
+void emit_body(unsigned op, unsigned a, unsigned b, unsigned c);
+void emit_table(void);
+
+
+int main(void)
+{
+    printf("/*\n"
+           " * um_special.c\n"
+           " *\n"
+           " * Generated by um_specialize -- do not edit.\n"
+           " */\n\n"
+           "#include <stdio.h>\n"
+           "#include \"um_special.h\"\n"
+           "#include \"um_data.h\"\n\n");
+
+    for (unsigned op = 0; op < 14; op++) {
+        unsigned a_max = ops[op].uses_a ? 8 : 1;
+        unsigned b_max = ops[op].uses_b ? 8 : 1;
+        unsigned c_max = ops[op].uses_c ? 8 : 1;
+
+        for (unsigned a = 0; a < a_max; a++) {
+            for (unsigned b = 0; b < b_max; b++) {
+                for (unsigned c = 0; c < c_max; c++) {
+                    emit_handler(op, a, b, c);
+                }
+            }
+        }
+    }
+
+    emit_table();
+
+    return EXIT_SUCCESS;
+}
+
+
+/* emit_handler
+ * Purpose:     Writes the definition of one specialized handler
+ * Parameters:  unsigned op: opcode of the handler
+ *              unsigned a, b, c: register indices baked into the handler
+ * Returns:     None
+ * Notes:       Fields the opcode does not use should be passed as 0
+ */
+void emit_handler(unsigned op, unsigned a, unsigned b, unsigned c)
+{
+    printf("static void %s_%u_%u_%u(um_data_t um, uint32_t inst)\n{\n",
+           ops[op].name, a, b, c);
+
+    if (op != 13) {
+        printf("    (void) inst;\n");
+    }
+
+    emit_body(op, a, b, c);
+    printf("}\n\n");
+}
+
+
+/* emit_body
+ * Purpose:     Writes the statements of a specialized handler; these mirror
+ *                  the generic instruction functions in um_operate.c
+ * Parameters:  unsigned op: opcode of the handler
+ *              unsigned a, b, c: register indices baked into the handler
+ * Returns:     None
+ */
+void emit_body(unsigned op, unsigned a, unsigned b, unsigned c)
+{
+    switch (op) {
+    case 0:
+        printf("    if (um->regs[%u] != 0) {\n"
+               "        um->regs[%u] = um->regs[%u];\n"
+               "    }\n", c, a, b);
+        break;
+    case 1:
+        printf("    if (um->words != NULL && um->regs[%u] != 0) {\n"
+               "        um->regs[%u] = um->words[(size_t)um->regs[%u] + "
+               "um->regs[%u]];\n"
+               "    } else {\n"
+               "        um->regs[%u] = get_seg_value(um->memory, "
+               "um->regs[%u], um->regs[%u]);\n"
+               "    }\n", b, a, b, c, a, b, c);
+        break;
+    case 2:
+        printf("    if (um->words != NULL && um->regs[%u] != 0) {\n"
+               "        um->words[(size_t)um->regs[%u] + um->regs[%u]] = "
+               "um->regs[%u];\n"
+               "    } else {\n"
+               "        set_seg_value(um->memory, um->regs[%u], "
+               "um->regs[%u], um->regs[%u]);\n"
+               "    }\n", a, a, b, c, a, b, c);
+        break;
+    case 3:
+        printf("    um->regs[%u] = um->regs[%u] + um->regs[%u];\n", a, b, c);
+        break;
+    case 4:
+        printf("    um->regs[%u] = um->regs[%u] * um->regs[%u];\n", a, b, c);
+        break;
+    case 5:
+        printf("    um->regs[%u] = um->regs[%u] / um->regs[%u];\n", a, b, c);
+        break;
+    case 6:
+        printf("    um->regs[%u] = ~(um->regs[%u] & um->regs[%u]);\n", 
+               a, b, c);
+        break;
+    case 7:
+        printf("    um->halting = true;\n");
+        break;
+    case 8:
+        printf("    um->regs[%u] = map_segment(um->memory, um->regs[%u]);\n",
+               b, c);
+        break;
+    case 9:
+        printf("    unmap_segment(um->memory, um->regs[%u]);\n", c);
+        break;
+    case 10:
+        printf("    um->output_bytes++;\n"
+               "    if (um->io != NULL) {\n"
+               "        um_io_put(um->io, um->regs[%u]);\n"
+               "    } else if (um->stream != NULL) {\n"
+               "        um_stream_put(um->stream, um->regs[%u]);\n"
+               "    } else {\n"
+               "        putc(um->regs[%u], stdout);\n"
+               "    }\n", c, c, c);
+        break;
+    case 11:
+        printf("    if (um->io != NULL) {\n"
+               "        if (!um_io_get(um->io, &um->regs[%u])) {\n"
+               "            um->program_counter--;\n"
+               "            um->waiting = true;\n"
+               "            um->halting = true;\n"
+               "            return;\n"
+               "        }\n"
+               "    } else if (um->stream != NULL) {\n"
+               "        um->regs[%u] = um_stream_get(um->stream);\n"
+               "    } else {\n"
+               "        um->regs[%u] = getc(stdin);\n"
+               "        if (feof(stdin) != 0) {\n"
+               "            um->regs[%u] = ~(0);\n"
+               "        }\n"
+               "    }\n"
+               "    um->input_bytes++;\n", c, c, c, c);
+        break;
+    case 12:
+        printf("    uint32_t tail = um->program_counter - 1;\n"
+               "    um->program_counter = um->regs[%u];\n"
+               "    if (um->regs[%u] != 0) {\n"
+               "        copy_program(um, um->regs[%u]);\n"
+               "    } else if (um->fast_loops && "
+               "um->program_counter <= tail) {\n"
+               "        find_loop(um, tail);\n"
+               "    }\n", c, b, b);
+        break;
+    case 13:
+        printf("    um->regs[%u] = inst & 0x1ffffff;\n", a);
+        break;
+    }
+}
+
+
+/* emit_table
+ * Purpose:     Writes um_special_handlers, mapping every table slot to the
+ *                  handler generated for its opcode and used fields
+ * Parameters:  None
+ * Returns:     None
+ * Notes:       The load_val row is indexed by register A, so only its first
+ *                  eight slots are filled. Rows 14 and 15 are all
+ *                  illegal_inst.
+ */
+void emit_table(void)
+{
+    printf("um_special_fn const um_special_handlers[16][512] = {\n");
+
+    for (unsigned op = 0; op < 14; op++) {
+        printf("    {\n");
+
+        unsigned slots = (op == 13) ? 8 : 512;
+        for (unsigned i = 0; i < slots; i++) {
+            unsigned a = (op == 13) ? i : (i >> 6) & 0x7;
+            unsigned b = (i >> 3) & 0x7;
+            unsigned c = i & 0x7;
+
+            printf("        %s_%u_%u_%u,\n", ops[op].name, 
+                   ops[op].uses_a ? a : 0, 
+                   ops[op].uses_b ? b : 0, 
+                   ops[op].uses_c ? c : 0);
+        }
+
+        printf("    },\n");
+    }
+
+    for (unsigned op = 14; op < 16; op++) {
+        printf("    {\n");
+        for (unsigned i = 0; i < 512; i++) {
+            printf("        illegal_inst,\n");
+        }
+        printf("    },\n");
+    }
+
+    printf("};\n");
+}
@@ -0,0 +1,193 @@
+/*
+ * um_store.c
+ *
+ * Purpose: Implementation of the file-backed segment store.
+ *
+ *          The store is a sparse file of STORE_BYTES bytes, unlinked as
+ *          soon as it is created and mapped shared, so its pages belong to
+ *          the page cache rather than to the process: the kernel keeps the
+ *          recently used ones resident and writes the rest back to the file
+ *          when memory runs short, in its usual least recently used order.
+ *          The mapping is marked random access, so a fault brings in one
+ *          page and not a readahead window of neighbours the program may
+ *          never touch.
+ *
+ *          Segments are carved out in blocks of a power of two pages, by a
+ *          um_blocks allocator counting pages, from a free list per size or
+ *          else from the end of the used part of the file. The allocator is
+ *          locked, since clones sharing the store may run on different
+ *          threads. A block is always all zeros when handed out: the file
+ *          starts as one hole, and a released block is punched back into a
+ *          hole with MADV_REMOVE, which also frees its disk blocks and
+ *          pages. A new segment therefore costs no writes at all, and its
+ *          pages take no memory until they are touched.
+ */
+
+#include "um_store.h"
+#include "um_blocks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <uarrayrep.h>
+#include <mem.h>
+#include <assert.h>
+
+#define STORE_SHIFT     40
+#define STORE_BYTES     (1ULL << STORE_SHIFT)
+#define PAGE_SHIFT      12
+
+/* pages of the block a segment of length words needs */
+#define BLOCK_PAGES(length) (((uint64_t)(length) * sizeof(uint32_t) +      \
+                              (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT)
+
+
+/* struct um_store_t
+ * Purpose:     The store's file and the blocks carved out of it
+ * Members:     int fd: the unlinked file
+ *              char *base: the whole file, mapped shared
+ *              um_blocks_t blocks: the blocks of the file, in pages
+ */
+struct um_store_t {
+    int             fd;
+    char           *base;
+    um_blocks_t     blocks;
+};
+
+
+
+/* um_store_new
+ * Purpose:     Creates an empty store
+ * Parameters:  const char *dir: directory to create the store's file in;
+ *                  it should be on a disk, since a file in memory (such
+ *                  as on tmpfs) would gain nothing
+ * Returns:     um_store_t: the store; client frees with um_store_free.
+ *                  NULL if the file cannot be created, grown or mapped.
+ */
+um_store_t um_store_new(const char *dir)
+{
+    assert(dir != NULL);
+
+    size_t path_length = strlen(dir) + sizeof("/um-store.XXXXXX");
+    char *path = ALLOC(path_length);
+    snprintf(path, path_length, "%s/um-store.XXXXXX", dir);
+
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+    FREE(path);
+
+    if (fd == -1 || ftruncate(fd, STORE_BYTES) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    void *base = mmap(NULL, STORE_BYTES, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    madvise(base, STORE_BYTES, MADV_RANDOM);
+
+    um_store_t store;
+    NEW0(store);
+    store->fd = fd;
+    store->base = base;
+    store->blocks = um_blocks_new(STORE_SHIFT - PAGE_SHIFT, 0, true);
+
+    return store;
+}
+
+
+/* um_store_free
+ * Purpose:     Unmaps a store and closes its file, which frees the file
+ * Parameters:  um_store_t *store: pointer to the store to free
+ * Returns:     None
+ * Notes:       Segments not yet released are lost with it
+ */
+void um_store_free(um_store_t *store)
+{
+    assert(store != NULL && *store != NULL);
+    um_store_t s = *store;
+
+    munmap(s->base, STORE_BYTES);
+    close(s->fd);
+    um_blocks_free(&s->blocks);
+    FREE(*store);
+}
+
+
+/* um_store_alloc
+ * Purpose:     Makes a new segment in the store
+ * Parameters:  um_store_t store: the store
+ *              uint32_t length: the segment's length in words; at least 1
+ * Returns:     UArray_T: the segment, all zeros; release it with
+ *                  um_store_release, never UArray_free
+ * Notes:       Exits with an error message if the store's file is full
+ */
+UArray_T um_store_alloc(um_store_t store, uint32_t length)
+{
+    assert(store != NULL && length > 0 && length <= INT32_MAX);
+
+    uint64_t page;
+    if (!um_blocks_alloc(store->blocks, BLOCK_PAGES(length), &page)) {
+        fprintf(stderr, "Segment store is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    UArray_T segment;
+    NEW(segment);
+    UArrayRep_init(segment, length, sizeof(uint32_t),
+                   store->base + (page << PAGE_SHIFT));
+
+    return segment;
+}
+
+
+/* um_store_release
+ * Purpose:     Frees a segment made by um_store_alloc
+ * Parameters:  um_store_t store: the store that made the segment
+ *              UArray_T *segment: pointer to the segment; set to NULL
+ * Returns:     None
+ * Notes:       Punches the segment's block back into a hole; if the file
+ *                  system cannot, the used words are zeroed instead
+ */
+void um_store_release(um_store_t store, UArray_T *segment)
+{
+    assert(store != NULL && segment != NULL && um_store_owns(store, *segment));
+
+    uint32_t length = UArray_length(*segment);
+    int k = um_blocks_class(store->blocks, BLOCK_PAGES(length));
+    char *block = UArray_at(*segment, 0);
+
+    if (madvise(block, (size_t)1 << (k + PAGE_SHIFT), MADV_REMOVE) == -1) {
+        memset(block, 0, (size_t)length * sizeof(uint32_t));
+    }
+
+    um_blocks_release(store->blocks, k, (block - store->base) >> PAGE_SHIFT);
+
+    FREE(*segment);
+}
+
+
+/* um_store_owns
+ * Purpose:     Tells segments made by the store from heap segments
+ * Parameters:  um_store_t store: the store
+ *              UArray_T segment: a segment
+ * Returns:     bool: true iff the segment's words are in the store
+ */
+bool um_store_owns(um_store_t store, UArray_T segment)
+{
+    assert(store != NULL && segment != NULL);
+
+    if (UArray_length(segment) == 0) {
+        return false;
+    }
+    char *words = UArray_at(segment, 0);
+    return words >= store->base && words < store->base + STORE_BYTES;
+}
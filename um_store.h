@@ -0,0 +1,41 @@
+/*
+ * um_store.h
+ *
+ * Purpose: Interface for a file-backed segment store. Large segments live
+ *          in a sparse temporary file mapped into memory, so the kernel
+ *          can write their pages back to disk and drop them under memory
+ *          pressure, instead of the process being killed for running out
+ *          of memory.
+ */
+
+#ifndef UM_STORE_H
+#define UM_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <uarray.h>
+
+/* segments shorter than this stay on the heap */
+#define UM_STORE_MIN_WORDS 1024
+
+typedef struct um_store_t* um_store_t;
+
+/* creates an empty store in a new, already unlinked file in dir; NULL if
+ * the file cannot be created or mapped */
+um_store_t um_store_new(const char *dir);
+
+/* unmaps and closes the store, whose segments must all be released */
+void um_store_free(um_store_t *store);
+
+
+/* returns a new segment of length 32-bit words, all 0, in the store */
+UArray_T um_store_alloc(um_store_t store, uint32_t length);
+
+/* gives a segment's space back to the store, and its disk blocks and
+ * pages back to the system */
+void um_store_release(um_store_t store, UArray_T *segment);
+
+/* returns whether a segment's words are in the store */
+bool um_store_owns(um_store_t store, UArray_T segment);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * um_stream.c
+ *
+ * Purpose: Implementation of asynchronous standard streams.
+ *
+ *          Output bytes are stored in a ring buffer of RING_SIZE bytes
+ *          with no locking at all. Every BATCH bytes, and at every newline
+ *          when the output is a terminal, the UM publishes what it has
+ *          stored by a release store of its count, which the writer thread
+ *          reads with an acquire load before writing the bytes out. The
+ *          writer frees their space the same way, with a release store of
+ *          tail. The UM only waits when the ring is full. Before blocking
+ *          on a read for more input, the UM publishes everything it has
+ *          output, so a prompt always reaches the reader before the UM
+ *          waits for the answer.
+ *
+ *          The mutex and condition variables are only for parking: a side
+ *          with nothing to do sets its parked flag under the mutex and
+ *          checks the other side's count again before it sleeps, and the
+ *          other side takes the mutex to signal only when it sees that
+ *          flag set. The flag and the count are stored and loaded
+ *          sequentially consistently, so one side always sees the other's
+ *          store and no wakeup is lost.
+ *
+ *          Byte counts only ever grow, so a byte's place in the ring is
+ *          its count modulo RING_SIZE, and the ring holds the bytes
+ *          [tail, head).
+ */
+
+#include "um_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <mem.h>
+#include <assert.h>
+
+#define RING_SIZE       (1 << 20)
+#define BATCH           4096
+#define INPUT_CHUNK     (64 * 1024)
+
+
+/* struct um_stream_t
+ * Purpose:     A UM's asynchronous input and output
+ * Members:     int in_fd, out_fd: where input comes from and output goes
+ *              unsigned char *ring: output not yet written
+ *              uint64_t head: bytes output so far; only the UM uses it
+ *              uint64_t limit: head may not pass this without waiting,
+ *                  since the writer has not yet freed the space after it;
+ *                  only the UM uses it
+ *              uint64_t published: bytes the writer may write; stored by
+ *                  the UM, loaded by the writer
+ *              uint64_t tail: bytes the writer has written; stored by the
+ *                  writer, loaded by the UM
+ *              bool closing: true iff the writer should stop once it has
+ *                  written everything published
+ *              bool writer_parked: true while the writer sleeps on data
+ *              bool um_parked: true while the UM sleeps on space
+ *              bool line_buffered: true iff each newline is published
+ *              pthread_mutex_t lock: guards closing and the parked flags'
+ *                  sleeps
+ *              pthread_cond_t data: signalled when bytes are published to
+ *                  a parked writer
+ *              pthread_cond_t space: signalled when bytes are written
+ *                  while the UM is parked
+ *              pthread_t writer: the writer thread
+ *              unsigned char input[INPUT_CHUNK]: input read ahead
+ *              size_t in_start, in_end: unread input is input[start, end)
+ *              bool in_ended: true iff the end of the input was reached
+ */
+struct um_stream_t {
+    int             in_fd;
+    int             out_fd;
+    unsigned char  *ring;
+    uint64_t        head;
+    uint64_t        limit;
+    uint64_t        published;
+    uint64_t        tail;
+    bool            closing;
+    bool            writer_parked;
+    bool            um_parked;
+    bool            line_buffered;
+    pthread_mutex_t lock;
+    pthread_cond_t  data;
+    pthread_cond_t  space;
+    pthread_t       writer;
+    unsigned char   input[INPUT_CHUNK];
+    size_t          in_start;
+    size_t          in_end;
+    bool            in_ended;
+};
+
+void publish(um_stream_t stream);
+void wait_for_space(um_stream_t stream);
+void *write_published(void *stream);
+void write_all(int fd, const unsigned char *bytes, size_t length);
+
+
+/* um_stream_new
+ * Purpose:     Creates a stream and starts its writer thread
+ * Parameters:  int in_fd: the file descriptor to read input from
+ *              int out_fd: the file descriptor to write output to
+ * Returns:     um_stream_t: the stream; client frees with um_stream_free
+ * Notes:       Exits with an error message if the thread cannot be started
+ */
+um_stream_t um_stream_new(int in_fd, int out_fd)
+{
+    um_stream_t stream;
+    NEW0(stream);
+    stream->in_fd = in_fd;
+    stream->out_fd = out_fd;
+    stream->ring = ALLOC(RING_SIZE);
+    stream->limit = RING_SIZE;
+    stream->line_buffered = isatty(out_fd);
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->data, NULL);
+    pthread_cond_init(&stream->space, NULL);
+
+    if (pthread_create(&stream->writer, NULL, write_published, stream) != 0) {
+        fprintf(stderr, "Could not start output thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return stream;
+}
+
+
+/* um_stream_free
+ * Purpose:     Writes out any buffered output, stops the writer thread and
+ *                  frees a stream
+ * Parameters:  um_stream_t *stream: pointer to the stream to free
+ * Returns:     None
+ */
+void um_stream_free(um_stream_t *stream)
+{
+    assert(stream != NULL && *stream != NULL);
+    um_stream_t s = *stream;
+
+    publish(s);
+    pthread_mutex_lock(&s->lock);
+    s->closing = true;
+    pthread_cond_signal(&s->data);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->writer, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->data);
+    pthread_cond_destroy(&s->space);
+    FREE(s->ring);
+    FREE(*stream);
+}
+
+
+/* um_stream_flush
+ * Purpose:     Waits until all output so far has been written
+ * Parameters:  um_stream_t stream: the stream
+ * Returns:     None
+ */
+void um_stream_flush(um_stream_t stream)
+{
+    assert(stream != NULL);
+
+    publish(stream);
+    pthread_mutex_lock(&stream->lock);
+    __atomic_store_n(&stream->um_parked, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&stream->tail, __ATOMIC_SEQ_CST) != stream->head) {
+        pthread_cond_wait(&stream->space, &stream->lock);
+    }
+    __atomic_store_n(&stream->um_parked, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+
+/* um_stream_put
+ * Purpose:     Outputs one byte
+ * Parameters:  um_stream_t stream: the stream
+ *              uint32_t c: the byte; only its low 8 bits are kept
+ * Returns:     None
+ * Notes:       Only waits for the writer if the ring is full
+ */
+void um_stream_put(um_stream_t stream, uint32_t c)
+{
+    if (stream->head == stream->limit) {
+        wait_for_space(stream);
+    }
+
+    stream->ring[stream->head % RING_SIZE] = (unsigned char)c;
+    stream->head++;
+
+    if (stream->head - __atomic_load_n(&stream->published,
+                                       __ATOMIC_RELAXED) >= BATCH ||
+        (stream->line_buffered && (unsigned char)c == '\n')) {
+        publish(stream);
+    }
+}
+
+
+/* um_stream_get
+ * Purpose:     Inputs one byte
+ * Parameters:  um_stream_t stream: the stream
+ * Returns:     uint32_t: the byte, or ~0 at the end of the input
+ * Notes:       Publishes all output before reading more input, since the
+ *                  read may block until the reader has seen that output
+ */
+uint32_t um_stream_get(um_stream_t stream)
+{
+    if (stream->in_start == stream->in_end) {
+        if (stream->in_ended) {
+            return ~(uint32_t)0;
+        }
+
+        publish(stream);
+
+        ssize_t n;
+        do {
+            n = read(stream->in_fd, stream->input, INPUT_CHUNK);
+        } while (n == -1 && errno == EINTR);
+
+        if (n <= 0) {
+            stream->in_ended = true;
+            return ~(uint32_t)0;
+        }
+        stream->in_start = 0;
+        stream->in_end = n;
+    }
+
+    return stream->input[stream->in_start++];
+}
+
+
+/* publish
+ * Purpose:     Lets the writer write every byte output so far
+ * Parameters:  um_stream_t stream: the stream
+ * Returns:     None
+ * Notes:       Also learns how much space the writer has freed. Takes the
+ *                  lock only to wake a parked writer.
+ */
+void publish(um_stream_t stream)
+{
+    if (stream->head == __atomic_load_n(&stream->published,
+                                        __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    __atomic_store_n(&stream->published, stream->head, __ATOMIC_SEQ_CST);
+    stream->limit = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE) +
+                    RING_SIZE;
+
+    if (__atomic_load_n(&stream->writer_parked, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&stream->lock);
+        pthread_cond_signal(&stream->data);
+        pthread_mutex_unlock(&stream->lock);
+    }
+}
+
+
+/* wait_for_space
+ * Purpose:     Waits until the ring has room for another byte
+ * Parameters:  um_stream_t stream: the stream, whose ring is full as far as
+ *                  the UM knows
+ * Returns:     None
+ * Notes:       Only parks if the writer has not freed any space since the
+ *                  UM last looked
+ */
+void wait_for_space(um_stream_t stream)
+{
+    publish(stream);
+    stream->limit = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE) +
+                    RING_SIZE;
+    if (stream->head != stream->limit) {
+        return;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    __atomic_store_n(&stream->um_parked, true, __ATOMIC_SEQ_CST);
+    while (stream->head - __atomic_load_n(&stream->tail, __ATOMIC_SEQ_CST)
+           == RING_SIZE) {
+        pthread_cond_wait(&stream->space, &stream->lock);
+    }
+    __atomic_store_n(&stream->um_parked, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&stream->lock);
+
+    stream->limit = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE) +
+                    RING_SIZE;
+}
+
+
+/* write_published
+ * Purpose:     Body of the writer thread; writes published bytes until the
+ *                  stream is closed
+ * Parameters:  void *arg: the stream
+ * Returns:     NULL
+ * Notes:       Writes as much as is published at once, in at most two
+ *                  pieces when the bytes wrap around the end of the ring.
+ *                  Takes the lock only to park or to wake a parked UM.
+ */
+void *write_published(void *arg)
+{
+    um_stream_t stream = arg;
+    uint64_t tail = 0;
+
+    for (;;) {
+        uint64_t published = __atomic_load_n(&stream->published,
+                                             __ATOMIC_ACQUIRE);
+        if (tail == published) {
+            pthread_mutex_lock(&stream->lock);
+            __atomic_store_n(&stream->writer_parked, true, __ATOMIC_SEQ_CST);
+            while ((published = __atomic_load_n(&stream->published,
+                                                __ATOMIC_SEQ_CST)) == tail &&
+                   !stream->closing) {
+                pthread_cond_wait(&stream->data, &stream->lock);
+            }
+            __atomic_store_n(&stream->writer_parked, false,
+                             __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&stream->lock);
+
+            if (tail == published) {
+                break;
+            }
+        }
+
+        size_t offset = tail % RING_SIZE;
+        size_t length = published - tail;
+        if (length > RING_SIZE - offset) {
+            length = RING_SIZE - offset;
+        }
+
+        write_all(stream->out_fd, stream->ring + offset, length);
+
+        tail += length;
+        __atomic_store_n(&stream->tail, tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&stream->um_parked, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&stream->lock);
+            pthread_cond_signal(&stream->space);
+            pthread_mutex_unlock(&stream->lock);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* write_all
+ * Purpose:     Writes bytes to a file descriptor, retrying short writes
+ * Parameters:  int fd: the file descriptor
+ *              const unsigned char *bytes: the bytes to write
+ *              size_t length: how many bytes to write
+ * Returns:     None
+ * Notes:       Bytes that cannot be written are dropped, as stdio does
+ */
+void write_all(int fd, const unsigned char *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = write(fd, bytes, length);
+
+        if (n > 0) {
+            bytes += n;
+            length -= n;
+        } else if (n == 0 || errno != EINTR) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * um_stream.h
+ *
+ * Purpose: Interface for asynchronous standard streams. Output goes into a
+ *          ring buffer that a writer thread drains to a file descriptor, so
+ *          a UM keeps executing while a slow reader catches up; input is
+ *          read in large blocks, and everything output so far is handed to
+ *          the writer before the UM blocks waiting for more input.
+ */
+
+#ifndef UM_STREAM_H
+#define UM_STREAM_H
+
+#include <stdint.h>
+
+typedef struct um_stream_t* um_stream_t;
+
+/* starts a writer thread for out_fd and reads input from in_fd */
+um_stream_t um_stream_new(int in_fd, int out_fd);
+
+/* writes out everything still buffered, stops the writer and frees the
+ * stream */
+void um_stream_free(um_stream_t *stream);
+
+/* waits until everything output so far has been written */
+void um_stream_flush(um_stream_t stream);
+
+
+/* used by the output instruction */
+void um_stream_put(um_stream_t stream, uint32_t c);
+
+/* used by the input instruction; gives ~0 at the end of the input */
+uint32_t um_stream_get(um_stream_t stream);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <uarray.h>
 #include "um_operate.h"
+#include "um_data.h"
 #include <sys/stat.h>
 
 void test_initialize_um();
@@ -34,7 +35,7 @@ void test_initialize_um()
     printf("Register values: ");
 
     for (int i = 0; i < 8; i++){
-        printf("%d ", um->registers[i]);
+        printf("%d ", um->regs[i]);
     }
     printf("\n");
 
@@ -49,10 +50,14 @@ void test_read_program()
 {
     printf("Testing Read Program\n");
     um_data_t UM = initialize_um();
-    FILE *fp = fopen("add.um", "r");
+    FILE *fp = fopen("testing/tests/add.um", "r");
     struct stat st;
-    stat("add.um", &st);
+    if (fp == NULL || stat("testing/tests/add.um", &st) != 0) {
+        printf("testing/tests/add.um not found\n");
+        return;
+    }
     read_um_program(fp, UM, st.st_size / 4);
+    fclose(fp);
 
     printf("Words are: ");
     for (int i = 0; i < st.st_size / 4; i++) {
@@ -66,10 +71,14 @@ void test_read_instruction()
 {
     printf("Testing Read Instruction\n");
     um_data_t UM = initialize_um();
-    FILE *fp = fopen("print-six.um", "r");
+    FILE *fp = fopen("testing/tests/print-six.um", "r");
     struct stat st;
-    stat("print-six.um", &st);
+    if (fp == NULL || stat("testing/tests/print-six.um", &st) != 0) {
+        printf("testing/tests/print-six.um not found\n");
+        return;
+    }
     read_um_program(fp, UM, st.st_size / 4);
+    fclose(fp);
 
     printf("Instructions are: \n");
     for (int i = 0; i < st.st_size / 4; i++) {
@@ -0,0 +1,762 @@
+/*
+ * um_trace.c
+ *
+ * Purpose: Implementation of the binary execution trace format.
+ *
+ *          A trace file starts with the 8-byte magic "UMTRACE1" and is
+ *          followed by chunks. Every chunk begins with a header holding the
+ *          payload length, the record count, the index of its first
+ *          instruction and the decoder state at that point (previous PC,
+ *          previous segment ID and all 8 registers), so a chunk can be
+ *          decoded or skipped without reading the ones before it. All
+ *          header fields are little-endian.
+ *
+ *          Each record in a payload starts with a flags byte:
+ *              SEQ_PC     pc is the previous pc + 1; otherwise a zigzag
+ *                         varint delta from previous pc + 1 follows
+ *              CACHED     inst matches the last instruction seen at this pc
+ *                         in the chunk; otherwise 4 big-endian bytes follow
+ *              WROTE_REG  a zigzag varint delta from the old value of the
+ *                         destination register follows (the register
+ *                         itself is implied by the instruction)
+ *              SEG        a zigzag varint delta from the previous segment
+ *                         ID follows
+ *          A loop iteration that does not touch memory typically costs one
+ *          or two bytes per instruction (50mil.um averages 2.3). Loads and
+ *          stores cost more, since the loaded value and the segment ID
+ *          both change: midmark.um averages 6.5 bytes per instruction.
+ *
+ *          The UM encodes chunks into a ring of RING_CHUNKS slots, each
+ *          holding a header and a payload, and a writer thread streams
+ *          full slots to the file. Handing over a slot takes the lock once
+ *          per chunk, and the UM only waits when every slot is still
+ *          waiting to be written.
+ */
+
+#include "um_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mem.h>
+#include <assert.h>
+
+#define CHUNK_BYTES     65536
+#define MAX_RECORD      20
+#define HEADER_BYTES    56
+#define CACHE_SIZE      1024
+#define RING_CHUNKS     8
+#define SLOT_BYTES      (HEADER_BYTES + CHUNK_BYTES)
+
+#define FLAG_SEQ_PC     0x1
+#define FLAG_CACHED     0x2
+#define FLAG_WROTE_REG  0x4
+#define FLAG_SEG        0x8
+
+static const char magic[8] = { 'U', 'M', 'T', 'R', 'A', 'C', 'E', '1' };
+
+
+/* struct coder_state
+ * Purpose:     State shared by the encoder and decoder; reset at each chunk
+ * Members:     uint32_t regs[8]: register values after the last record
+ *              uint32_t prev_pc: pc of the last record
+ *              uint32_t prev_seg: segment ID of the last record with one
+ *              uint32_t cache_pc[CACHE_SIZE]: pc + 1 of the instruction held
+ *                  in each cache slot (0 when empty)
+ *              uint32_t cache_inst[CACHE_SIZE]: instruction in each slot
+ */
+struct coder_state {
+    uint32_t regs[8];
+    uint32_t prev_pc;
+    uint32_t prev_seg;
+    uint32_t cache_pc[CACHE_SIZE];
+    uint32_t cache_inst[CACHE_SIZE];
+};
+
+
+/* struct um_trace_t
+ * Purpose:     Writer side of a trace
+ * Members:     FILE *fp: the file chunks are streamed to
+ *              struct coder_state state: state after the last record
+ *              struct coder_state chunk_start: state when the buffered
+ *                  chunk was started, written as its header
+ *              uint64_t index: number of records written so far
+ *              uint64_t chunk_index: index of the first buffered record
+ *              unsigned char *ring: RING_CHUNKS slots of SLOT_BYTES; chunk
+ *                  n is encoded into slot n % RING_CHUNKS
+ *              unsigned char *buffer: payload of the slot being filled
+ *              unsigned length: number of bytes used in buffer
+ *              uint64_t published: chunks handed to the writer thread
+ *              uint64_t written: chunks the writer thread has written
+ *              bool closing: true iff the writer thread should stop once
+ *                  it has written everything published
+ *              pthread_mutex_t lock: guards published, written and closing
+ *              pthread_cond_t data: signalled when a chunk is published
+ *              pthread_cond_t space: signalled when a chunk is written
+ *              pthread_t writer: the writer thread
+ */
+struct um_trace_t {
+    FILE                *fp;
+    struct coder_state  state;
+    struct coder_state  chunk_start;
+    uint64_t            index;
+    uint64_t            chunk_index;
+    unsigned char       *ring;
+    unsigned char       *buffer;
+    unsigned            length;
+    uint64_t            published;
+    uint64_t            written;
+    bool                closing;
+    pthread_mutex_t     lock;
+    pthread_cond_t      data;
+    pthread_cond_t      space;
+    pthread_t           writer;
+};
+
+
+/* struct um_trace_reader_t
+ * Purpose:     Reader side of a trace
+ * Members:     FILE *fp: the trace file
+ *              struct coder_state state: state after the last decoded record
+ *              uint64_t index: index of the next record
+ *              unsigned char buffer[CHUNK_BYTES]: payload of current chunk
+ *              unsigned length, pos: payload length and read position
+ *              unsigned remaining: records of the current chunk not yet
+ *                  decoded
+ *              bool damaged: true once a truncated or malformed chunk has
+ *                  been met; no more records are decoded after that
+ */
+struct um_trace_reader_t {
+    FILE                *fp;
+    struct coder_state  state;
+    uint64_t            index;
+    unsigned char       buffer[CHUNK_BYTES];
+    unsigned            length;
+    unsigned            pos;
+    unsigned            remaining;
+    bool                damaged;
+};
+
+
+static void flush_chunk(um_trace_t trace);
+static void *write_chunks(void *trace);
+static void reset_cache(struct coder_state *state);
+static bool written_register(uint32_t inst, const uint32_t *regs_before,
+                             unsigned *reg);
+static bool touched_segment(uint32_t inst, const uint32_t *regs_before,
+                            const uint32_t *regs_after, uint32_t *seg_id);
+static bool read_chunk_header(um_trace_reader_t reader, unsigned *length,
+                              unsigned *count);
+static bool read_chunk(um_trace_reader_t reader, unsigned length,
+                       unsigned count);
+static void put_varint(um_trace_t trace, uint32_t value);
+static bool get_varint(um_trace_reader_t reader, uint32_t *value);
+static void put_le32(unsigned char *bytes, uint32_t value);
+static uint32_t get_le32(const unsigned char *bytes);
+
+static inline uint32_t zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ (uint32_t)-(delta >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ (uint32_t)-(value & 1);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                         Writer                             *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* um_trace_new
+ * Purpose:     Starts a new trace and writes the file header
+ * Parameters:  FILE *fp: file open for writing where the trace is streamed
+ * Returns:     um_trace_t: the new trace
+ * Notes:       It is a CRE for fp to be NULL. Client must call um_trace_free.
+ *                  Exits with an error message if the writer thread cannot
+ *                  be started.
+ */
+um_trace_t um_trace_new(FILE *fp)
+{
+    assert(fp != NULL);
+
+    um_trace_t trace;
+    NEW0(trace);
+    trace->state.prev_pc = (uint32_t)-1;
+    trace->chunk_start = trace->state;
+    trace->fp = fp;
+    trace->ring = ALLOC(RING_CHUNKS * SLOT_BYTES);
+    trace->buffer = trace->ring + HEADER_BYTES;
+
+    fwrite(magic, 1, sizeof(magic), fp);
+
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->data, NULL);
+    pthread_cond_init(&trace->space, NULL);
+    if (pthread_create(&trace->writer, NULL, write_chunks, trace) != 0) {
+        fprintf(stderr, "Could not start trace writer thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return trace;
+}
+
+
+/* um_trace_record
+ * Purpose:     Appends the record for one executed instruction
+ * Parameters:  um_trace_t trace: the trace to append to
+ *              uint32_t pc: where the instruction was fetched from
+ *              uint32_t inst: the instruction that was executed
+ *              const uint32_t *regs_before: the 8 registers before it ran
+ *              const uint32_t *regs_after: the 8 registers after it ran
+ * Returns:     None
+ * Notes:       Writes a chunk to the file whenever the buffer fills up
+ */
+void um_trace_record(um_trace_t trace, uint32_t pc, uint32_t inst,
+                     const uint32_t *regs_before, const uint32_t *regs_after)
+{
+    if (trace->length + MAX_RECORD > CHUNK_BYTES) {
+        flush_chunk(trace);
+    }
+
+    struct coder_state *state = &trace->state;
+    unsigned flags_pos = trace->length++;
+    unsigned char flags = 0;
+
+    uint32_t expected_pc = state->prev_pc + 1;
+    if (pc == expected_pc) {
+        flags |= FLAG_SEQ_PC;
+    } else {
+        put_varint(trace, zigzag(pc - expected_pc));
+    }
+    state->prev_pc = pc;
+
+    unsigned slot = pc % CACHE_SIZE;
+    if (state->cache_pc[slot] == pc + 1 && state->cache_inst[slot] == inst) {
+        flags |= FLAG_CACHED;
+    } else {
+        for (int lsb = 24; lsb >= 0; lsb -= 8) {
+            trace->buffer[trace->length++] = (inst >> lsb) & 0xff;
+        }
+        state->cache_pc[slot] = pc + 1;
+        state->cache_inst[slot] = inst;
+    }
+
+    unsigned reg;
+    if (written_register(inst, regs_before, &reg)) {
+        flags |= FLAG_WROTE_REG;
+        put_varint(trace, zigzag(regs_after[reg] - state->regs[reg]));
+        state->regs[reg] = regs_after[reg];
+    }
+
+    uint32_t seg_id;
+    if (touched_segment(inst, regs_before, regs_after, &seg_id)) {
+        flags |= FLAG_SEG;
+        put_varint(trace, zigzag(seg_id - state->prev_seg));
+        state->prev_seg = seg_id;
+    }
+
+    trace->buffer[flags_pos] = flags;
+    trace->index++;
+}
+
+
+/* um_trace_free
+ * Purpose:     Writes the last partial chunk, stops the writer thread and
+ *                  frees the trace
+ * Parameters:  um_trace_t *trace: pointer to the trace to free
+ * Returns:     None
+ * Notes:       Flushes the file but leaves it open
+ */
+void um_trace_free(um_trace_t *trace)
+{
+    assert(trace != NULL && *trace != NULL);
+    um_trace_t t = *trace;
+
+    flush_chunk(t);
+    pthread_mutex_lock(&t->lock);
+    t->closing = true;
+    pthread_cond_signal(&t->data);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->writer, NULL);
+    fflush(t->fp);
+
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->data);
+    pthread_cond_destroy(&t->space);
+    FREE(t->ring);
+    FREE(*trace);
+}
+
+
+/* flush_chunk
+ * Purpose:     Hands the buffered chunk to the writer thread and starts a
+ *                  new one in the next slot
+ * Parameters:  um_trace_t trace: the trace whose buffer is written
+ * Returns:     None
+ * Notes:       Waits while every slot is still waiting to be written. The
+ *                  new chunk starts with an empty instruction cache so it
+ *                  can be decoded on its own.
+ */
+static void flush_chunk(um_trace_t trace)
+{
+    if (trace->length == 0) {
+        return;
+    }
+
+    unsigned char *header = trace->buffer - HEADER_BYTES;
+    uint64_t first = trace->chunk_index;
+
+    put_le32(header, trace->length);
+    put_le32(header + 4, (uint32_t)(trace->index - first));
+    put_le32(header + 8, (uint32_t)first);
+    put_le32(header + 12, (uint32_t)(first >> 32));
+    put_le32(header + 16, trace->chunk_start.prev_pc);
+    put_le32(header + 20, trace->chunk_start.prev_seg);
+    for (int i = 0; i < 8; i++) {
+        put_le32(header + 24 + 4 * i, trace->chunk_start.regs[i]);
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    trace->published++;
+    pthread_cond_signal(&trace->data);
+    while (trace->published - trace->written == RING_CHUNKS) {
+        pthread_cond_wait(&trace->space, &trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    trace->buffer = trace->ring + (trace->published % RING_CHUNKS) *
+                                  SLOT_BYTES + HEADER_BYTES;
+    trace->length = 0;
+    trace->chunk_index = trace->index;
+    reset_cache(&trace->state);
+    trace->chunk_start = trace->state;
+}
+
+
+/* write_chunks
+ * Purpose:     Body of the writer thread: writes published chunks in order
+ * Parameters:  void *trace: the um_trace_t to write
+ * Returns:     void *: NULL
+ * Notes:       Stops once closing is set and every chunk is written. The
+ *                  slot is written outside the lock, since the UM never
+ *                  touches a published slot until it is freed.
+ */
+static void *write_chunks(void *trace)
+{
+    um_trace_t t = trace;
+
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (t->written == t->published && !t->closing) {
+            pthread_cond_wait(&t->data, &t->lock);
+        }
+        if (t->written == t->published) {
+            break;
+        }
+        unsigned char *slot = t->ring + (t->written % RING_CHUNKS) *
+                                        SLOT_BYTES;
+        pthread_mutex_unlock(&t->lock);
+
+        fwrite(slot, 1, HEADER_BYTES + get_le32(slot), t->fp);
+
+        pthread_mutex_lock(&t->lock);
+        t->written++;
+        pthread_cond_signal(&t->space);
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    return NULL;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                         Reader                             *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* um_trace_reader_new
+ * Purpose:     Starts reading a trace file
+ * Parameters:  FILE *fp: file open for reading, positioned at its start
+ * Returns:     um_trace_reader_t: the new reader, or NULL if the file does
+ *                  not start with the trace magic
+ * Notes:       It is a CRE for fp to be NULL
+ */
+um_trace_reader_t um_trace_reader_new(FILE *fp)
+{
+    assert(fp != NULL);
+
+    char header[sizeof(magic)];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, magic, sizeof(magic)) != 0) {
+        return NULL;
+    }
+
+    um_trace_reader_t reader;
+    NEW(reader);
+    reader->fp = fp;
+    reader->index = 0;
+    reader->length = 0;
+    reader->pos = 0;
+    reader->remaining = 0;
+    reader->damaged = false;
+
+    return reader;
+}
+
+
+/* um_trace_next
+ * Purpose:     Decodes the next record of a trace
+ * Parameters:  um_trace_reader_t reader: the reader to advance
+ *              um_trace_record_t *record: where the record is stored
+ * Returns:     bool: false if there are no more records
+ * Notes:       Every byte is checked against the payload length before it
+ *                  is read. A record that runs past the end of its chunk,
+ *                  or a chunk whose payload does not hold exactly its
+ *                  record count, ends the trace and marks it damaged.
+ */
+bool um_trace_next(um_trace_reader_t reader, um_trace_record_t *record)
+{
+    if (reader->damaged) {
+        return false;
+    }
+
+    while (reader->remaining == 0) {
+        unsigned length, count;
+        if (reader->pos < reader->length) {
+            reader->damaged = true;
+            return false;
+        }
+        if (!read_chunk_header(reader, &length, &count) ||
+            !read_chunk(reader, length, count)) {
+            return false;
+        }
+    }
+
+    struct coder_state *state = &reader->state;
+    if (reader->pos >= reader->length) {
+        reader->damaged = true;
+        return false;
+    }
+    unsigned char flags = reader->buffer[reader->pos++];
+
+    uint32_t pc = state->prev_pc + 1;
+    if (!(flags & FLAG_SEQ_PC)) {
+        uint32_t delta;
+        if (!get_varint(reader, &delta)) {
+            return false;
+        }
+        pc += unzigzag(delta);
+    }
+    state->prev_pc = pc;
+
+    unsigned slot = pc % CACHE_SIZE;
+    uint32_t inst;
+    if (flags & FLAG_CACHED) {
+        inst = state->cache_inst[slot];
+    } else {
+        if (reader->length - reader->pos < 4) {
+            reader->damaged = true;
+            return false;
+        }
+        inst = 0;
+        for (int i = 0; i < 4; i++) {
+            inst = (inst << 8) | reader->buffer[reader->pos++];
+        }
+        state->cache_pc[slot] = pc + 1;
+        state->cache_inst[slot] = inst;
+    }
+
+    record->index = reader->index++;
+    record->pc = pc;
+    record->inst = inst;
+    record->wrote_reg = (flags & FLAG_WROTE_REG) != 0;
+    record->touched_seg = (flags & FLAG_SEG) != 0;
+    record->reg = 0;
+    record->reg_value = 0;
+    record->seg_id = 0;
+
+    if (record->wrote_reg) {
+        unsigned reg = (inst >> 28 == 13) ? (inst >> 25) & 0x7 :
+                       (inst >> 28 == 8)  ? (inst >> 3) & 0x7 :
+                       (inst >> 28 == 11) ? inst & 0x7 : (inst >> 6) & 0x7;
+        uint32_t delta;
+        if (!get_varint(reader, &delta)) {
+            return false;
+        }
+        state->regs[reg] += unzigzag(delta);
+        record->reg = reg;
+        record->reg_value = state->regs[reg];
+    }
+
+    if (record->touched_seg) {
+        uint32_t delta;
+        if (!get_varint(reader, &delta)) {
+            return false;
+        }
+        state->prev_seg += unzigzag(delta);
+        record->seg_id = state->prev_seg;
+    }
+
+    reader->remaining--;
+    return true;
+}
+
+
+/* um_trace_skip_to
+ * Purpose:     Skips over chunks whose records all precede a given index
+ * Parameters:  um_trace_reader_t reader: the reader to advance
+ *              uint64_t index: the first instruction index of interest
+ * Returns:     None
+ * Notes:       Only whole chunks are skipped; the caller discards remaining
+ *                  records before index as they are decoded. Has no effect
+ *                  once a chunk has been partially read.
+ */
+void um_trace_skip_to(um_trace_reader_t reader, uint64_t index)
+{
+    if (reader->damaged || reader->pos < reader->length) {
+        return;
+    }
+
+    unsigned length, count;
+    while (read_chunk_header(reader, &length, &count)) {
+        if (reader->index + count > index) {
+            read_chunk(reader, length, count);
+            return;
+        }
+        fseek(reader->fp, length, SEEK_CUR);
+    }
+
+    reader->length = 0;
+    reader->pos = 0;
+    reader->remaining = 0;
+}
+
+
+/* um_trace_damaged
+ * Purpose:     Tells a trace that ended cleanly from one that was cut short
+ * Parameters:  um_trace_reader_t reader: the reader
+ * Returns:     bool: true iff a truncated or malformed chunk was met
+ */
+bool um_trace_damaged(um_trace_reader_t reader)
+{
+    assert(reader != NULL);
+    return reader->damaged;
+}
+
+
+/* um_trace_reader_free
+ * Purpose:     Frees a trace reader
+ * Parameters:  um_trace_reader_t *reader: pointer to the reader to free
+ * Returns:     None
+ * Notes:       Leaves the file open
+ */
+void um_trace_reader_free(um_trace_reader_t *reader)
+{
+    assert(reader != NULL && *reader != NULL);
+    FREE(*reader);
+}
+
+
+/* read_chunk_header
+ * Purpose:     Reads a chunk header and resets the decoder state from it
+ * Parameters:  um_trace_reader_t reader: the reader
+ *              unsigned *length: set to the payload length of the chunk
+ *              unsigned *count: set to the number of records in the chunk
+ * Returns:     bool: false at the end of the file or on a bad header
+ * Notes:       A partial header, a payload longer than CHUNK_BYTES, or a
+ *                  record count of 0 or more than the payload could hold
+ *                  marks the trace damaged
+ */
+static bool read_chunk_header(um_trace_reader_t reader, unsigned *length,
+                              unsigned *count)
+{
+    unsigned char header[HEADER_BYTES];
+    size_t got = fread(header, 1, HEADER_BYTES, reader->fp);
+    if (got != HEADER_BYTES) {
+        reader->damaged = got != 0;
+        return false;
+    }
+
+    *length = get_le32(header);
+    *count = get_le32(header + 4);
+    if (*length > CHUNK_BYTES || *count == 0 || *count > *length) {
+        reader->damaged = true;
+        return false;
+    }
+
+    reader->index = (uint64_t)get_le32(header + 12) << 32 |
+                    get_le32(header + 8);
+    reader->state.prev_pc = get_le32(header + 16);
+    reader->state.prev_seg = get_le32(header + 20);
+    for (int i = 0; i < 8; i++) {
+        reader->state.regs[i] = get_le32(header + 24 + 4 * i);
+    }
+    reset_cache(&reader->state);
+
+    return true;
+}
+
+
+/* read_chunk
+ * Purpose:     Reads the payload of a chunk whose header was just read
+ * Parameters:  um_trace_reader_t reader: the reader
+ *              unsigned length: the payload length from the header
+ *              unsigned count: the record count from the header
+ * Returns:     bool: false if the file ends inside the payload, which
+ *                  marks the trace damaged
+ */
+static bool read_chunk(um_trace_reader_t reader, unsigned length,
+                       unsigned count)
+{
+    if (fread(reader->buffer, 1, length, reader->fp) != length) {
+        reader->damaged = true;
+        reader->length = 0;
+        reader->pos = 0;
+        reader->remaining = 0;
+        return false;
+    }
+    reader->length = length;
+    reader->pos = 0;
+    reader->remaining = count;
+
+    return true;
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                         Helpers                            *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* reset_cache
+ * Purpose:     Empties the per-chunk instruction cache
+ * Parameters:  struct coder_state *state: state holding the cache
+ * Returns:     None
+ */
+static void reset_cache(struct coder_state *state)
+{
+    memset(state->cache_pc, 0, sizeof(state->cache_pc));
+}
+
+
+/* written_register
+ * Purpose:     Determines which register, if any, an instruction writes
+ * Parameters:  uint32_t inst: the instruction
+ *              const uint32_t *regs_before: registers before it ran
+ *              unsigned *reg: set to the index of the register written
+ * Returns:     bool: true iff the instruction wrote a register
+ * Notes:       A conditional move whose condition is 0 writes nothing
+ */
+static bool written_register(uint32_t inst, const uint32_t *regs_before,
+                             unsigned *reg)
+{
+    switch (inst >> 28) {
+    case 0:
+        *reg = (inst >> 6) & 0x7;
+        return regs_before[inst & 0x7] != 0;
+    case 1: case 3: case 4: case 5: case 6:
+        *reg = (inst >> 6) & 0x7;
+        return true;
+    case 8:
+        *reg = (inst >> 3) & 0x7;
+        return true;
+    case 11:
+        *reg = inst & 0x7;
+        return true;
+    case 13:
+        *reg = (inst >> 25) & 0x7;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/* touched_segment
+ * Purpose:     Determines which segment, if any, an instruction used
+ * Parameters:  uint32_t inst: the instruction
+ *              const uint32_t *regs_before: registers before it ran
+ *              const uint32_t *regs_after: registers after it ran
+ *              uint32_t *seg_id: set to the segment ID
+ * Returns:     bool: true iff the instruction used a segment ID
+ * Notes:       A load_prog from segment 0 is a jump and touches no segment
+ */
+static bool touched_segment(uint32_t inst, const uint32_t *regs_before,
+                            const uint32_t *regs_after, uint32_t *seg_id)
+{
+    uint32_t a = (inst >> 6) & 0x7;
+    uint32_t b = (inst >> 3) & 0x7;
+    uint32_t c = inst & 0x7;
+
+    switch (inst >> 28) {
+    case 1:
+        *seg_id = regs_before[b];
+        return true;
+    case 2:
+        *seg_id = regs_before[a];
+        return true;
+    case 8:
+        *seg_id = regs_after[b];
+        return true;
+    case 9:
+        *seg_id = regs_before[c];
+        return true;
+    case 12:
+        *seg_id = regs_before[b];
+        return *seg_id != 0;
+    default:
+        return false;
+    }
+}
+
+
+static void put_varint(um_trace_t trace, uint32_t value)
+{
+    while (value >= 0x80) {
+        trace->buffer[trace->length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    trace->buffer[trace->length++] = value;
+}
+
+
+/* get_varint
+ * Purpose:     Decodes a varint from the current chunk
+ * Parameters:  um_trace_reader_t reader: the reader, advanced past it
+ *              uint32_t *value: set to the decoded value
+ * Returns:     bool: false, marking the trace damaged, if the varint runs
+ *                  past the payload or is longer than 5 bytes
+ */
+static bool get_varint(um_trace_reader_t reader, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (reader->pos >= reader->length) {
+            break;
+        }
+        unsigned char byte = reader->buffer[reader->pos++];
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+
+    reader->damaged = true;
+    return false;
+}
+
+
+static void put_le32(unsigned char *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+
+static uint32_t get_le32(const unsigned char *bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
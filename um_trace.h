@@ -0,0 +1,74 @@
+/*
+ * um_trace.h
+ *
+ * Purpose: Interface for recording and reading binary execution traces.
+ *          A trace holds one record per executed instruction: its program
+ *          counter, the instruction word, the register it wrote and the
+ *          segment it touched. Records are delta-encoded into fixed-size
+ *          chunks, which a writer thread streams to the file from a small
+ *          ring, so that tracing needs a bounded amount of memory no matter
+ *          how long the program runs.
+ */
+
+#ifndef UM_TRACE_H
+#define UM_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct um_trace_t* um_trace_t;
+typedef struct um_trace_reader_t* um_trace_reader_t;
+
+/* struct um_trace_record_t
+ * Purpose:     One decoded trace record
+ * Members:     uint64_t index: number of instructions executed before this one
+ *              uint32_t pc: word index of the instruction in segment 0
+ *              uint32_t inst: the instruction word
+ *              bool wrote_reg: true iff the instruction wrote a register
+ *              unsigned reg: index of the register written
+ *              uint32_t reg_value: value written to that register
+ *              bool touched_seg: true iff the instruction used a segment ID
+ *              uint32_t seg_id: the segment loaded, stored, mapped, unmapped
+ *                  or duplicated by the instruction
+ */
+typedef struct um_trace_record_t {
+    uint64_t    index;
+    uint32_t    pc;
+    uint32_t    inst;
+    bool        wrote_reg;
+    unsigned    reg;
+    uint32_t    reg_value;
+    bool        touched_seg;
+    uint32_t    seg_id;
+} um_trace_record_t;
+
+
+/* starts a trace that is streamed to an open, writable file */
+um_trace_t um_trace_new(FILE *fp);
+
+/* records one instruction given the registers before and after it ran */
+void um_trace_record(um_trace_t trace, uint32_t pc, uint32_t inst,
+                     const uint32_t *regs_before, const uint32_t *regs_after);
+
+/* writes any buffered records and frees the trace; does not close the file */
+void um_trace_free(um_trace_t *trace);
+
+
+/* starts reading a trace from an open file; returns NULL if not a trace */
+um_trace_reader_t um_trace_reader_new(FILE *fp);
+
+/* decodes the next record; returns false at the end of the trace */
+bool um_trace_next(um_trace_reader_t reader, um_trace_record_t *record);
+
+/* skips whole chunks that end before the given instruction index */
+void um_trace_skip_to(um_trace_reader_t reader, uint64_t index);
+
+/* returns whether reading stopped at a truncated or malformed chunk rather
+ * than at the end of the trace */
+bool um_trace_damaged(um_trace_reader_t reader);
+
+/* frees a trace reader; does not close the file */
+void um_trace_reader_free(um_trace_reader_t *reader);
+
+#endif
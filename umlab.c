@@ -20,6 +20,7 @@
 #include <seq.h>
 #include <bitpack.h>
 #include <math.h>
+#include "um_builder.h"
 
 
 typedef uint32_t Um_instruction;
@@ -144,14 +145,15 @@ const uint32_t Um_word_width = 32;
 void Um_write_sequence(FILE *output, Seq_T stream)
 {
         assert(output != NULL && stream != NULL);
+        um_builder_t builder = um_builder_new(output);
         int stream_length = Seq_length(stream);
         for (int i = 0; i < stream_length; i++) {
                 Um_instruction inst = (uintptr_t)Seq_remlo(stream);
-                for (int lsb = Um_word_width - 8; lsb >= 0; lsb -= 8) {
-                        fputc(Bitpack_getu(inst, 8, lsb), output);
-                }
+                um_builder_emit(builder, inst);
         }
-      
+        bool ok = um_builder_finish(&builder);
+        assert(ok);
+        (void)ok;
 }
 
 
@@ -425,6 +427,60 @@ void build_map_unmap_test(Seq_T stream)
         append(stream, halt());
 }
 
+/*
+ * Twice over, maps MAP_BURST_SEGMENTS one-word segments, keeping their IDs
+ * in a table, and unmaps them in the order they were mapped. Then maps one
+ * more segment and prints its ID, the lowest one free: '2', the first ID
+ * of the burst, since the table is ID 1.
+ */
+#define MAP_BURST_SEGMENTS 50000
+
+void build_map_burst_test(Seq_T stream)
+{
+        append(stream, loadval(r6, 0));
+        append(stream, nand(r6, r6, r6));               //r6 is -1
+        append(stream, loadval(r4, 0));                 //r4 is segment 0
+        append(stream, loadval(r7, MAP_BURST_SEGMENTS));
+        append(stream, map(r0, r7));                    //r0 is the table
+        append(stream, loadval(r5, 2));                 //r5 counts bursts
+
+        unsigned burst = Seq_length(stream);
+        append(stream, loadval(r1, MAP_BURST_SEGMENTS));
+        unsigned map_loop = Seq_length(stream);
+        append(stream, add(r1, r1, r6));
+        append(stream, loadval(r7, 1));
+        append(stream, map(r2, r7));
+        append(stream, segstore(r0, r1, r2));
+        append(stream, loadval(r3, Seq_length(stream) + 4));
+        append(stream, loadval(r7, map_loop));
+        append(stream, mov(r3, r7, r1));                //back if r1 != 0
+        append(stream, prog(r4, r3));
+
+        append(stream, loadval(r1, MAP_BURST_SEGMENTS));
+        unsigned unmap_loop = Seq_length(stream);
+        append(stream, add(r1, r1, r6));
+        append(stream, segload(r2, r0, r1));
+        append(stream, unmap(r2));
+        append(stream, loadval(r3, Seq_length(stream) + 4));
+        append(stream, loadval(r7, unmap_loop));
+        append(stream, mov(r3, r7, r1));                //back if r1 != 0
+        append(stream, prog(r4, r3));
+
+        append(stream, loadval(r7, 1));
+        append(stream, map(r2, r7));
+        append(stream, loadval(r7, '0'));
+        append(stream, add(r7, r2, r7));
+        append(stream, output(r7));
+        append(stream, unmap(r2));
+
+        append(stream, add(r5, r5, r6));
+        append(stream, loadval(r3, Seq_length(stream) + 4));
+        append(stream, loadval(r7, burst));
+        append(stream, mov(r3, r7, r5));                //back if r5 != 0
+        append(stream, prog(r4, r3));
+        append(stream, halt());
+}
+
 void build_unmap_fail(Seq_T stream)
 {
         append(stream, map(r1, 0));
@@ -530,6 +586,89 @@ void build_segloadstore_test(Seq_T stream)
         append(stream, halt());
 }
 
+/*
+ * Loops small enough for um to fast-forward, which load and store. Each
+ * counts r2 down to 0 from its head, kept in r5; r4 is 0 and r6 is -1.
+ *
+ * The first loop fills a 26-word segment with 'A' to 'Z', the second
+ * prints it backward, and the third lowercases it in place before it is
+ * printed again. The last loop rewrites its own first instruction on every
+ * pass, so each pass adds what the pass before stored: 7 + 6 + ... + 1 =
+ * 28, printed as ']' ('A' + 28).
+ */
+
+static void countdown_head(Seq_T stream, unsigned count)
+{
+        append(stream, loadval(r2, count));
+        append(stream, loadval(r5, Seq_length(stream) + 1));
+}
+
+static void countdown_tail(Seq_T stream)
+{
+        unsigned end = Seq_length(stream) + 3;
+        append(stream, loadval(r3, end));
+        append(stream, mov(r3, r5, r2));         //back to the head if r2 != 0
+        append(stream, prog(r4, r3));
+}
+
+static void print_backward(Seq_T stream)
+{
+        countdown_head(stream, 26);
+        append(stream, add(r2, r2, r6));
+        append(stream, segload(r7, r1, r2));
+        append(stream, output(r7));
+        countdown_tail(stream);
+}
+
+void build_mem_loop_test(Seq_T stream)
+{
+        append(stream, loadval(r6, 0));
+        append(stream, nand(r6, r6, r6));
+        append(stream, loadval(r4, 0));
+        append(stream, loadval(r2, 26));
+        append(stream, map(r1, r2));
+
+        append(stream, loadval(r0, 'A'));
+        countdown_head(stream, 26);
+        append(stream, add(r2, r2, r6));
+        append(stream, add(r7, r2, r0));
+        append(stream, segstore(r1, r2, r7));
+        countdown_tail(stream);
+
+        print_backward(stream);
+
+        append(stream, loadval(r0, 'a' - 'A'));
+        countdown_head(stream, 26);
+        append(stream, add(r2, r2, r6));
+        append(stream, segload(r7, r1, r2));
+        append(stream, add(r7, r7, r0));
+        append(stream, segstore(r1, r2, r7));
+        countdown_tail(stream);
+
+        print_backward(stream);
+        append(stream, loadval(r7, '\n'));
+        append(stream, output(r7));
+
+        append(stream, loadval(r1, 0xde00));     //load value into r7, << 16
+        append(stream, loadval(r7, 0x10000));
+        append(stream, mult(r1, r1, r7));
+        append(stream, loadval(r0, 0));
+        countdown_head(stream, 8);
+        append(stream, loadval(r7, 0));          //rewritten by the store
+        append(stream, add(r0, r0, r7));
+        append(stream, add(r2, r2, r6));
+        append(stream, add(r7, r1, r2));
+        append(stream, segstore(r4, r5, r7));
+        countdown_tail(stream);
+
+        append(stream, loadval(r7, 'A'));
+        append(stream, add(r0, r0, r7));
+        append(stream, output(r0));
+        append(stream, loadval(r7, '\n'));
+        append(stream, output(r7));
+        append(stream, halt());
+}
+
 
 void build_50m_loop(Seq_T stream)
 {
@@ -566,3 +705,432 @@ void build_50m_loop(Seq_T stream)
 }
 
 
+
+
+/* Microbenchmarks for the UM
+ *
+ * Each benchmark runs a loop `iterations` times. The body of the loop is
+ * the instruction being measured, repeated BENCH_UNROLL times, and the
+ * loop itself costs four more instructions per iteration. bench-loop has
+ * an empty body, so subtracting its time leaves the cost of the measured
+ * instructions alone. The body may use r0-r2; the loop uses r3-r7.
+ *
+ * Most of these loops are register-only, so run them with
+ * `um --no-fast-loops` to have every instruction dispatched; runtests
+ * --micro does.
+ */
+
+#define BENCH_UNROLL 16
+#define BENCH_SEGMENT_WORDS 65536
+
+static void bench_loop(Seq_T stream, unsigned iterations,
+                       const Um_instruction *body, int body_length,
+                       int unroll)
+{
+        assert(iterations > 0 && iterations < (1u << 25));
+
+        append(stream, loadval(r7, iterations)); //r7 counts down
+        append(stream, loadval(r6, 0));
+        append(stream, nand(r6, r6, r6));        //r6 is -1
+        append(stream, loadval(r4, 0));          //r4 is segment 0
+        append(stream, loadval(r5, Seq_length(stream) + 1));
+
+        for (int i = 0; i < unroll; i++) {
+                for (int j = 0; j < body_length; j++) {
+                        append(stream, body[j]);
+                }
+        }
+
+        unsigned end = Seq_length(stream) + 4;
+        append(stream, add(r7, r7, r6));
+        append(stream, loadval(r3, end));
+        append(stream, mov(r3, r5, r7));         //back to the body if r7 != 0
+        append(stream, prog(r4, r3));
+        append(stream, halt());
+}
+
+
+void build_bench_loop(Seq_T stream, unsigned iterations)
+{
+        bench_loop(stream, iterations, NULL, 0, 0);
+}
+
+
+void build_bench_cmov(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body = mov(r0, r1, r2);
+
+        append(stream, loadval(r2, 1));
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+void build_bench_sload(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body = segload(r0, r1, r2);
+
+        append(stream, loadval(r2, 1));
+        append(stream, map(r1, r2));
+        append(stream, loadval(r2, 0));
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+void build_bench_sstore(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body = segstore(r1, r2, r0);
+
+        append(stream, loadval(r2, 1));
+        append(stream, map(r1, r2));
+        append(stream, loadval(r2, 0));
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+static void bench_arithmetic(Seq_T stream, unsigned iterations,
+                             Um_instruction body)
+{
+        append(stream, loadval(r1, 12345));
+        append(stream, loadval(r2, 7));
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+void build_bench_add(Seq_T stream, unsigned iterations)
+{
+        bench_arithmetic(stream, iterations, add(r0, r1, r2));
+}
+
+
+void build_bench_mult(Seq_T stream, unsigned iterations)
+{
+        bench_arithmetic(stream, iterations, mult(r0, r1, r2));
+}
+
+
+void build_bench_div(Seq_T stream, unsigned iterations)
+{
+        bench_arithmetic(stream, iterations, div(r0, r1, r2));
+}
+
+
+void build_bench_nand(Seq_T stream, unsigned iterations)
+{
+        bench_arithmetic(stream, iterations, nand(r0, r1, r2));
+}
+
+
+void build_bench_loadval(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body = loadval(r0, 12345);
+
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+/* maps and unmaps an 8 word segment, so the same id is reused each time */
+void build_bench_map_unmap(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body[] = { map(r0, r1), unmap(r0) };
+
+        append(stream, loadval(r1, 8));
+        bench_loop(stream, iterations, body, 2, BENCH_UNROLL / 2);
+}
+
+
+void build_bench_output(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body = output(r0);
+
+        append(stream, loadval(r0, 'x'));
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+/* reads iterations * BENCH_UNROLL bytes, so give it /dev/zero */
+void build_bench_input(Seq_T stream, unsigned iterations)
+{
+        Um_instruction body = input(r0);
+
+        bench_loop(stream, iterations, &body, 1, BENCH_UNROLL);
+}
+
+
+/*
+ * Copies the whole program into a segment of BENCH_SEGMENT_WORDS words,
+ * then loads that segment as the program once per iteration. The copy is
+ * identical to segment 0, so execution carries on at the loop's tail.
+ */
+void build_bench_load_prog(Seq_T stream, unsigned iterations)
+{
+        append(stream, loadval(r4, 0));
+        int length_at = Seq_length(stream);
+        append(stream, loadval(r3, 0)); //program length, patched below
+        append(stream, loadval(r0, BENCH_SEGMENT_WORDS));
+        append(stream, map(r1, r0));
+        append(stream, loadval(r2, 0)); //r2 indexes the copy
+
+        unsigned copy = Seq_length(stream);
+        append(stream, segload(r0, r4, r2));
+        append(stream, segstore(r1, r2, r0));
+        append(stream, loadval(r0, 1));
+        append(stream, add(r2, r2, r0));
+        append(stream, nand(r0, r2, r2));
+        append(stream, add(r0, r0, r3));
+        append(stream, loadval(r5, 1));
+        append(stream, add(r0, r0, r5)); //r0 is length - r2
+        append(stream, loadval(r5, copy + 12));
+        append(stream, loadval(r7, copy));
+        append(stream, mov(r5, r7, r0));
+        append(stream, prog(r4, r5));
+
+        int tail_at = Seq_length(stream);
+        append(stream, loadval(r2, 0)); //loop tail, patched below
+        Um_instruction body = prog(r1, r2);
+        bench_loop(stream, iterations, &body, 1, 1);
+
+        unsigned tail = Seq_length(stream) - 5;
+        Seq_put(stream, tail_at, (void *)(uintptr_t)loadval(r2, tail));
+        Seq_put(stream, length_at,
+                (void *)(uintptr_t)loadval(r3, Seq_length(stream)));
+}
+
+
+/* Stress programs for the UM
+ *
+ * These are written straight to a file through a um_builder_t instead of
+ * being held in a Seq_T, so they can be hundreds of megabytes long.
+ */
+
+#define STRESS_BLOCK 64
+
+/*
+ * Runs through blocks of adds, each ending in a jump to the next block,
+ * until about 'words' instructions have run, then prints '!'. The block
+ * addresses are loaded before they are known, and the last block jumps
+ * to an address loaded at the very start, so the builder has to patch
+ * the start of the file. Addresses are loaded with the five instruction
+ * form, so the program may be longer than 2^25 words.
+ */
+void build_stress(um_builder_t builder, uint32_t words)
+{
+        um_label_t finish = um_builder_label(builder);
+
+        um_builder_emit(builder, loadval(r0, 0));
+        um_builder_emit(builder, loadval(r2, 1));
+        um_builder_load_label_wide(builder, r5, r4, finish);
+
+        while (um_builder_here(builder) + STRESS_BLOCK + 4 <= words) {
+                um_label_t next = um_builder_label(builder);
+                for (int i = 0; i < STRESS_BLOCK - 6; i++) {
+                        um_builder_emit(builder, add(r1, r1, r2));
+                }
+                um_builder_load_label_wide(builder, r3, r4, next);
+                um_builder_emit(builder, prog(r0, r3));
+                um_builder_bind(builder, next);
+        }
+        um_builder_emit(builder, prog(r0, r5));
+
+        um_builder_bind(builder, finish);
+        um_builder_emit(builder, loadval(r7, 33));
+        um_builder_emit(builder, output(r7)); //!
+        um_builder_emit(builder, halt());
+}
+
+
+/* Random programs for the UM
+ *
+ * These exercise an engine on code no one wrote by hand, for checking it
+ * against the reference with um --check. A program is a run of random
+ * steps drawn from a seeded generator, so the same seed always writes the
+ * same program. Every step is well defined whatever the registers hold:
+ * r0-r2 hold data, divisors are never zero, segment offsets and output
+ * bytes are masked into range, and every loop counts down from a constant.
+ * r3, r4 and r6 are temporaries, r5 holds a segment of RANDOM_SEGMENT_WORDS
+ * words, and r7 counts loops.
+ */
+
+#define RANDOM_SEGMENT_WORDS 256
+#define RANDOM_LOOP_BODY 16
+#define RANDOM_LOOP_TRIPS 5000
+
+static uint32_t random_state;
+
+/* xorshift32; never returns 0 */
+static uint32_t next_random(void)
+{
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+}
+
+static unsigned random_data_register(void)
+{
+        return next_random() % 3;
+}
+
+/* leaves $r[c] & mask in rt */
+static void emit_masked(um_builder_t builder, unsigned rt, unsigned rc,
+                        unsigned mask)
+{
+        um_builder_emit(builder, loadval(rt, mask));
+        um_builder_emit(builder, nand(rt, rc, rt));
+        um_builder_emit(builder, nand(rt, rt, rt));
+}
+
+/*
+ * one random instruction that only uses r0-r2, plus r6 as a divisor when
+ * 'minus_one' says r6 holds ~0
+ */
+static void emit_random_arithmetic(um_builder_t builder, bool minus_one)
+{
+        unsigned a = random_data_register();
+        unsigned b = random_data_register();
+        unsigned c = random_data_register();
+
+        switch (next_random() % (minus_one ? 6 : 5)) {
+        case 0: um_builder_emit(builder, mov(a, b, c));   break;
+        case 1: um_builder_emit(builder, add(a, b, c));   break;
+        case 2: um_builder_emit(builder, mult(a, b, c));  break;
+        case 3: um_builder_emit(builder, nand(a, b, c));  break;
+        case 4: um_builder_emit(builder, 
+                                loadval(a, next_random() & 0x1ffffff));
+                break;
+        default: um_builder_emit(builder, div(a, b, r6)); break;
+        }
+}
+
+/*
+ * a loop of up to RANDOM_LOOP_BODY random instructions, run up to
+ * RANDOM_LOOP_TRIPS times; one that only touches registers can be
+ * fast-forwarded, and one that also stores and loads cannot
+ */
+static void emit_random_loop(um_builder_t builder, bool touch_memory)
+{
+        um_label_t head = um_builder_label(builder);
+        um_label_t done = um_builder_label(builder);
+        unsigned length = 1 + next_random() % RANDOM_LOOP_BODY;
+
+        um_builder_emit(builder, 
+                        loadval(r7, 1 + next_random() % RANDOM_LOOP_TRIPS));
+        um_builder_emit(builder, loadval(r6, 0));
+        um_builder_emit(builder, nand(r6, r6, r6));     //r6 is -1
+
+        um_builder_bind(builder, head);
+        for (unsigned i = 0; i < length; i++) {
+                emit_random_arithmetic(builder, true);
+        }
+        if (touch_memory) {
+                emit_masked(builder, r4, random_data_register(),
+                            RANDOM_SEGMENT_WORDS - 1);
+                um_builder_emit(builder, 
+                                segstore(r5, r4, random_data_register()));
+                um_builder_emit(builder, 
+                                segload(random_data_register(), r5, r4));
+        }
+
+        um_builder_emit(builder, add(r7, r7, r6));
+        um_builder_load_label(builder, r3, done);
+        um_builder_load_label(builder, r4, head);
+        um_builder_emit(builder, mov(r3, r4, r7));      //back if r7 != 0
+        um_builder_emit(builder, loadval(r4, 0));
+        um_builder_emit(builder, prog(r4, r3));
+        um_builder_bind(builder, done);
+}
+
+/* skips a few random instructions if a random data register is nonzero */
+static void emit_random_branch(um_builder_t builder)
+{
+        um_label_t next = um_builder_label(builder);
+        um_label_t over = um_builder_label(builder);
+        unsigned length = 1 + next_random() % 4;
+
+        um_builder_load_label(builder, r3, next);
+        um_builder_load_label(builder, r4, over);
+        um_builder_emit(builder, mov(r3, r4, random_data_register()));
+        um_builder_emit(builder, loadval(r4, 0));
+        um_builder_emit(builder, prog(r4, r3));
+
+        um_builder_bind(builder, next);
+        for (unsigned i = 0; i < length; i++) {
+                emit_random_arithmetic(builder, false);
+        }
+        um_builder_bind(builder, over);
+}
+
+/* maps a small segment, stores into it and loads back, and unmaps it half
+ * the time, so segment IDs are both reused and left in use */
+static void emit_random_segment(um_builder_t builder)
+{
+        um_builder_emit(builder, loadval(r6, 1 + next_random() % 64));
+        um_builder_emit(builder, map(r3, r6));
+        um_builder_emit(builder, loadval(r4, 0));
+        um_builder_emit(builder, segstore(r3, r4, random_data_register()));
+        um_builder_emit(builder, segload(random_data_register(), r3, r4));
+        if (next_random() % 2 == 0) {
+                um_builder_emit(builder, unmap(r3));
+        }
+}
+
+void build_random(um_builder_t builder, uint32_t seed, uint32_t steps)
+{
+        random_state = (seed == 0) ? 1 : seed;
+
+        for (unsigned r = r0; r <= r2; r++) {
+                um_builder_emit(builder, 
+                                loadval(r, next_random() & 0x1ffffff));
+        }
+        um_builder_emit(builder, loadval(r6, RANDOM_SEGMENT_WORDS));
+        um_builder_emit(builder, map(r5, r6));
+
+        for (uint32_t i = 0; i < steps; i++) {
+                switch (next_random() % 12) {
+                case 0:
+                case 1:
+                case 2:
+                case 3:
+                        emit_random_arithmetic(builder, false);
+                        break;
+                case 4:
+                        um_builder_emit(builder, 
+                                        loadval(r6, 1 + next_random() % 999));
+                        um_builder_emit(builder, 
+                                        div(random_data_register(),
+                                            random_data_register(), r6));
+                        break;
+                case 5:
+                        emit_masked(builder, r6, random_data_register(),
+                                    RANDOM_SEGMENT_WORDS - 1);
+                        um_builder_emit(builder, 
+                                        segstore(r5, r6, 
+                                                 random_data_register()));
+                        break;
+                case 6:
+                        emit_masked(builder, r6, random_data_register(),
+                                    RANDOM_SEGMENT_WORDS - 1);
+                        um_builder_emit(builder, 
+                                        segload(random_data_register(), 
+                                                r5, r6));
+                        break;
+                case 7:
+                        emit_masked(builder, r6, random_data_register(), 127);
+                        um_builder_emit(builder, output(r6));
+                        break;
+                case 8:
+                        emit_random_segment(builder);
+                        break;
+                case 9:
+                        emit_random_branch(builder);
+                        break;
+                case 10:
+                        emit_random_loop(builder, false);
+                        break;
+                default:
+                        emit_random_loop(builder, next_random() % 2 == 0);
+                        break;
+                }
+        }
+
+        um_builder_emit(builder, halt());
+}
@@ -6,6 +6,7 @@
 #include "assert.h"
 #include "fmt.h"
 #include "seq.h"
+#include "um_builder.h"
 
 extern void Um_write_sequence(FILE *output, Seq_T instructions);
 
@@ -23,11 +24,30 @@ extern void build_mov_test(Seq_T stream);
 extern void build_load_prog_test(Seq_T stream);
 extern void build_div_0_test(Seq_T stream);
 extern void build_map_unmap_test(Seq_T stream);
+extern void build_map_burst_test(Seq_T stream);
 extern void build_segloadstore_test(Seq_T stream);
+extern void build_mem_loop_test(Seq_T stream);
 extern void build_unmap_fail(Seq_T stream);
 extern void build_input_test(Seq_T stream);
 extern void build_50m_loop(Seq_T stream);
 
+extern void build_bench_loop(Seq_T stream, unsigned iterations);
+extern void build_bench_cmov(Seq_T stream, unsigned iterations);
+extern void build_bench_sload(Seq_T stream, unsigned iterations);
+extern void build_bench_sstore(Seq_T stream, unsigned iterations);
+extern void build_bench_add(Seq_T stream, unsigned iterations);
+extern void build_bench_mult(Seq_T stream, unsigned iterations);
+extern void build_bench_div(Seq_T stream, unsigned iterations);
+extern void build_bench_nand(Seq_T stream, unsigned iterations);
+extern void build_bench_map_unmap(Seq_T stream, unsigned iterations);
+extern void build_bench_output(Seq_T stream, unsigned iterations);
+extern void build_bench_input(Seq_T stream, unsigned iterations);
+extern void build_bench_load_prog(Seq_T stream, unsigned iterations);
+extern void build_bench_loadval(Seq_T stream, unsigned iterations);
+
+extern void build_stress(um_builder_t builder, uint32_t words);
+extern void build_random(um_builder_t builder, uint32_t seed, uint32_t steps);
+
 /* The array `tests` contains all unit tests for the lab. */
 
 static struct test_info {
@@ -50,16 +70,54 @@ static struct test_info {
         { "mov",            NULL, "AB", build_mov_test },
         { "load-prog",      NULL, "A", build_load_prog_test },
         { "div-0",          NULL, "", build_div_0_test },
-        { "map-unmap",      NULL, "1 2 3 2 1 4", build_map_unmap_test },
+        { "map-unmap",      NULL, "1 2 3 1 2 4", build_map_unmap_test },
+        { "map-burst",      NULL, "22", build_map_burst_test },
         { "load-store",     NULL, "Hello World!\n", build_segloadstore_test },
         { "unmap-fail",     NULL, "1", build_unmap_fail },
         { "input",          "a",  "a", build_input_test },
+        { "mem-loop",       NULL, "ZYXWVUTSRQPONMLKJIHGFEDCBA"
+                                  "zyxwvutsrqponmlkjihgfedcba\n]\n",
+                                  build_mem_loop_test },
         { "50mil",          NULL, "!", build_50m_loop }
 };
 
   
 #define NTESTS (sizeof(tests)/sizeof(tests[0]))
 
+/*
+ * The array `benches` contains the microbenchmarks, written by
+ * `writetests --bench`. bench-loop must come first: it is the empty loop
+ * whose time the runner subtracts from the others.
+ */
+
+static struct bench_info {
+        const char *name;
+        unsigned ops;           /* measured instructions per iteration */
+        unsigned divisor;       /* runs (iterations / divisor) times */
+        /* writes instructions into sequence */
+        void (*build_bench)(Seq_T stream, unsigned iterations);
+} benches[] = {
+        { "bench-loop",      0,  1,    build_bench_loop },
+        { "bench-cmov",      16, 1,    build_bench_cmov },
+        { "bench-sload",     16, 1,    build_bench_sload },
+        { "bench-sstore",    16, 1,    build_bench_sstore },
+        { "bench-add",       16, 1,    build_bench_add },
+        { "bench-mult",      16, 1,    build_bench_mult },
+        { "bench-div",       16, 1,    build_bench_div },
+        { "bench-nand",      16, 1,    build_bench_nand },
+        { "bench-map-unmap", 16, 1,    build_bench_map_unmap },
+        { "bench-output",    16, 1,    build_bench_output },
+        { "bench-input",     16, 1,    build_bench_input },
+        { "bench-load-prog", 1,  1000, build_bench_load_prog },
+        { "bench-loadval",   16, 1,    build_bench_loadval }
+};
+
+#define NBENCHES (sizeof(benches)/sizeof(benches[0]))
+#define DEFAULT_ITERATIONS 1000000
+#define DEFAULT_RANDOM_STEPS 1000
+#define MAX_RANDOM_STEPS 100000
+#define MAX_ITERATIONS ((1u << 25) - 1)
+
 /*
  * open file 'path' for writing, then free the pathname;
  * if anything fails, checked runtime error
@@ -67,17 +125,72 @@ static struct test_info {
 static FILE *open_and_free_pathname(char *path);
 
 /*
- * if contents is NULL or empty, remove the given 'path', 
- * otherwise write 'contents' into 'path'.  Either way, free 'path'.
+ * if contents is NULL or empty, remove the given 'path' * otherwise write 'contents' into 'path'.  Either way, free 'path'.
  */
 static void write_or_remove_file(char *path, const char *contents);
 
 static void write_test_files(struct test_info *test);
 
+/*
+ * write ./tests/NAME.um for each bench in 'wanted' (all of them if
+ * 'wanted' is empty, bench-loop always), and list them in ./MICROBENCH
+ */
+static bool write_benches(int nwanted, char *wanted[], unsigned iterations);
+static bool write_bench(FILE *list, struct bench_info *bench,
+                        unsigned iterations);
+
+/*
+ * write ./tests/stress.um, about 'words' instructions long, and
+ * ./tests/stress.1
+ */
+static bool write_stress(uint32_t words);
+
+/*
+ * write ./tests/random-SEED.um, 'steps' random steps long; it has no
+ * expected output, since it is meant to be run with um --check
+ */
+static bool write_random(uint32_t seed, uint32_t steps);
+
 
 int main (int argc, char *argv[])
 {
         bool failed = false;
+        if (argc > 1 && !strcmp(argv[1], "--bench")) {
+                unsigned long iterations = DEFAULT_ITERATIONS;
+                int first = 2;
+                if (argc > 3 && !strcmp(argv[2], "--iterations")) {
+                        iterations = strtoul(argv[3], NULL, 10);
+                        first = 4;
+                }
+                if (iterations < 1 || iterations > MAX_ITERATIONS) {
+                        fprintf(stderr, "***** Iterations must be 1 to %u "
+                                "*****\n", MAX_ITERATIONS);
+                        return 1;
+                }
+                return !write_benches(argc - first, argv + first, iterations);
+        }
+        if (argc == 3 && !strcmp(argv[1], "--stress")) {
+                unsigned long words = strtoul(argv[2], NULL, 10);
+                if (words < 1 || words > UINT32_MAX - 1) {
+                        fprintf(stderr, "***** Words must be 1 to %u "
+                                "*****\n", UINT32_MAX - 1);
+                        return 1;
+                }
+                return !write_stress(words);
+        }
+        if ((argc == 3 || argc == 4) && !strcmp(argv[1], "--random")) {
+                unsigned long seed = strtoul(argv[2], NULL, 10);
+                unsigned long steps = (argc == 4) ? strtoul(argv[3], NULL, 10)
+                                                  : DEFAULT_RANDOM_STEPS;
+                if (seed > UINT32_MAX || steps < 1 ||
+                    steps > MAX_RANDOM_STEPS) {
+                        fprintf(stderr, "***** Seed must be at most %u and "
+                                "steps 1 to %u *****\n", UINT32_MAX,
+                                MAX_RANDOM_STEPS);
+                        return 1;
+                }
+                return !write_random(seed, steps);
+        }
         if (argc == 1)
                 for (unsigned i = 0; i < NTESTS; i++) {
                         printf("***** Writing test '%s'.\n", tests[i].name);
@@ -118,6 +231,89 @@ static void write_test_files(struct test_info *test)
 }
 
 
+static bool write_benches(int nwanted, char *wanted[], unsigned iterations)
+{
+        bool written[NBENCHES] = { false };
+        bool ok = true;
+
+        for (int j = 0; j < nwanted; j++) {
+                bool found = false;
+                for (unsigned i = 0; i < NBENCHES; i++)
+                        if (!strcmp(benches[i].name, wanted[j]))
+                                found = written[i] = true;
+                if (!found) {
+                        ok = false;
+                        fprintf(stderr, "***** No benchmark named %s *****\n",
+                                wanted[j]);
+                }
+        }
+
+        FILE *list = fopen("./MICROBENCH", "w");
+        assert(list != NULL);
+        for (unsigned i = 0; i < NBENCHES; i++)
+                if (i == 0 || nwanted == 0 || written[i]) {
+                        printf("***** Writing benchmark '%s'.\n",
+                               benches[i].name);
+                        ok = write_bench(list, &benches[i], iterations) && ok;
+                }
+        fclose(list);
+
+        return ok;
+}
+
+
+static bool write_bench(FILE *list, struct bench_info *bench,
+                        unsigned iterations)
+{
+        unsigned runs = iterations / bench->divisor;
+        if (runs == 0) {
+                fprintf(stderr, "***** %s needs at least %u iterations "
+                        "*****\n", bench->name, bench->divisor);
+                return false;
+        }
+
+        FILE *binary = open_and_free_pathname(Fmt_string("./tests/%s.um",
+                                                         bench->name));
+        Seq_T instructions = Seq_new(0);
+        bench->build_bench(instructions, runs);
+        Um_write_sequence(binary, instructions);
+        Seq_free(&instructions);
+        fclose(binary);
+
+        fprintf(list, "%s.um %u %u\n", bench->name, bench->ops, runs);
+        return true;
+}
+
+
+static bool write_stress(uint32_t words)
+{
+        printf("***** Writing stress program of %u words.\n", words);
+
+        FILE *binary = open_and_free_pathname(Fmt_string("./tests/stress.um"));
+        um_builder_t builder = um_builder_new(binary);
+        build_stress(builder, words);
+        bool ok = um_builder_finish(&builder);
+        ok = (fclose(binary) == 0) && ok;
+
+        write_or_remove_file(Fmt_string("./tests/stress.1"), "!");
+        return ok;
+}
+
+
+static bool write_random(uint32_t seed, uint32_t steps)
+{
+        printf("***** Writing random program %u of %u steps.\n", seed,
+               steps);
+
+        FILE *binary = open_and_free_pathname(Fmt_string("./tests/random-%u.um",
+                                                         seed));
+        um_builder_t builder = um_builder_new(binary);
+        build_random(builder, seed, steps);
+        bool ok = um_builder_finish(&builder);
+        return (fclose(binary) == 0) && ok;
+}
+
+
 static void write_or_remove_file(char *path, const char *contents)
 {
         if (contents == NULL || *contents == '\0') {
@@ -0,0 +1,996 @@
+/*
+ * umopt.c
+ *
+ * Purpose: Offline peephole optimizer that rewrites a .um program into an
+ *          equivalent one that executes fewer instructions.
+ *
+ *          The optimizer finds the code in segment 0 by following
+ *          load_prog targets from word 0, tracking each register as either
+ *          unknown or a small set of possible constants. Basic blocks that
+ *          end in load_prog or halt are then rewritten in place: constant
+ *          chains of load_val/add/mult/div/nand are folded into one
+ *          load_val, load_vals of a value the register already holds and
+ *          movs that cannot change anything are dropped, and definitions
+ *          that are overwritten before use are removed. The surviving
+ *          instructions are packed toward the start of the block, so every
+ *          block still starts at its original address and no jump needs to
+ *          be relocated.
+ *
+ *          Safety: any block containing a word the program may load from
+ *          or store to segment 0 is left untouched, since that code is
+ *          data to the program or is rewritten by it at run time. If some
+ *          jump target or segment 0 access cannot be bounded, the whole
+ *          program is left unchanged unless --trust is given, in which case
+ *          the optimizer assumes that
+ *              - every computed jump target is a load_val operand or a
+ *                constant built from them, other than constants only ever
+ *                used as segment offsets
+ *              - loads and stores at unknown segment 0 offsets only touch
+ *                words that are never executed
+ *          which holds for code produced by typical UM compilers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <seq.h>
+#include <mem.h>
+#include <assert.h>
+#include "open_or_die.h"
+
+#define MAX_VALS        4
+#define TOP             0xff
+#define MAX_LOAD_VAL    0x1ffffff
+#define ALL_REGS        0xff
+
+#define OPCODE(inst)    ((inst) >> 28)
+#define REG_A(inst)     (((inst) >> 6) & 0x7)
+#define REG_B(inst)     (((inst) >> 3) & 0x7)
+#define REG_C(inst)     ((inst) & 0x7)
+#define LV_REG(inst)    (((inst) >> 25) & 0x7)
+#define LV_VAL(inst)    ((inst) & MAX_LOAD_VAL)
+
+enum { MOV = 0, SLOAD, SSTORE, ADD, MUL, DIV, NAND, HALT, MAP, UNMAP, OUT, IN,
+       LOADP, LV };
+
+/* struct vset
+ * Purpose:     Abstract value of a register
+ * Members:     uint8_t count: number of possible values, or TOP if unknown
+ *              bool nonzero: for TOP, true iff the value is known to be
+ *                  nonzero (segment IDs returned by map_seg)
+ *              uint32_t vals[MAX_VALS]: the possible values
+ */
+typedef struct vset {
+    uint8_t     count;
+    bool        nonzero;
+    uint32_t    vals[MAX_VALS];
+} vset;
+
+typedef struct state {
+    vset r[8];
+} state;
+
+/* struct program
+ * Purpose:     A program being analyzed and its analysis results
+ * Members:     uint32_t *words, n: the image of segment 0
+ *              bool trust: true iff --trust assumptions may be used
+ *              bool *leader: word starts a basic block
+ *              bool *code: word is reachable as an instruction
+ *              bool *target: word may be the target of a computed jump
+ *              bool *seg0_read, *seg0_written: the program may load or
+ *                  store this word of segment 0 as data
+ *              state **entry: state on entry to each reached leader
+ *              Seq_T worklist: leaders whose entry state changed
+ *              uint8_t global_zero: registers never written by any code,
+ *                  which therefore always hold their initial 0
+ *              uint8_t written: registers written by reachable code
+ *              bool new_leader: a leader was added inside walked code
+ *              bool code_modified: the program may store over its code
+ *              bool indirect, unknown_access: some jump target or segment
+ *                  0 offset could not be bounded
+ *              uint32_t indirect_pc, unknown_access_pc: first such place
+ */
+struct program {
+    uint32_t   *words;
+    uint32_t    n;
+    bool        trust;
+    bool       *leader;
+    bool       *code;
+    bool       *target;
+    bool       *seg0_read;
+    bool       *seg0_written;
+    state     **entry;
+    Seq_T       worklist;
+    uint8_t     global_zero;
+    uint8_t     written;
+    bool        new_leader;
+    bool        code_modified;
+    bool        indirect;
+    bool        unknown_access;
+    uint32_t    indirect_pc;
+    uint32_t    unknown_access_pc;
+};
+
+/* struct report
+ * Purpose:     What the rewrite changed
+ */
+struct report {
+    uint32_t    code_words;
+    uint32_t    blocks;
+    uint32_t    optimized;
+    uint32_t    excluded;
+    uint32_t    fall_through;
+    uint32_t    removed;
+    uint32_t    folded;
+};
+
+void usage_and_exit();
+uint32_t *read_program(char *path, uint32_t *n);
+void write_program(char *path, uint32_t *words, uint32_t n);
+void analyze(struct program *prog);
+void analyze_pass(struct program *prog);
+void walk_block(struct program *prog, uint32_t start);
+void add_edge(struct program *prog, uint32_t target, state *s);
+void step(struct program *prog, state *s, uint32_t pc, uint32_t inst);
+void record_access(struct program *prog, uint32_t pc, vset *seg, vset *index,
+                   bool is_write);
+void find_targets(struct program *prog);
+bool only_offset_uses(struct program *prog, uint32_t pc);
+uint32_t block_end(struct program *prog, uint32_t start);
+bool optimize_block(struct program *prog, uint32_t start, uint32_t end,
+                    struct report *report);
+uint8_t regs_read(uint32_t inst);
+uint8_t reg_killed(uint32_t inst);
+void free_program(struct program *prog);
+
+static inline vset vs_top(bool nonzero)
+{
+    vset v = { TOP, nonzero, { 0 } };
+    return v;
+}
+
+static inline vset vs_const(uint32_t k)
+{
+    vset v = { 1, k != 0, { k } };
+    return v;
+}
+
+static inline bool vs_is_const(vset *v, uint32_t *k)
+{
+    if (v->count == 1) {
+        *k = v->vals[0];
+        return true;
+    }
+    return false;
+}
+
+bool vs_may_be_zero(vset *v);
+bool vs_is_zero(vset *v);
+vset vs_join(vset *a, vset *b);
+bool vs_equal(vset *a, vset *b);
+vset vs_apply(unsigned op, vset *b, vset *c);
+
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "trust", no_argument, NULL, 't' },
+        { NULL,    0,           NULL, 0   }
+    };
+
+    struct program prog;
+    memset(&prog, 0, sizeof(prog));
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "t", long_options, NULL)) != -1) {
+        if (opt == 't') {
+            prog.trust = true;
+        } else {
+            usage_and_exit();
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage_and_exit();
+    }
+
+    prog.words = read_program(argv[optind], &prog.n);
+    prog.leader = CALLOC(prog.n + 1, sizeof(bool));
+    prog.code = CALLOC(prog.n + 1, sizeof(bool));
+    prog.target = CALLOC(prog.n + 1, sizeof(bool));
+    prog.seg0_read = CALLOC(prog.n + 1, sizeof(bool));
+    prog.seg0_written = CALLOC(prog.n + 1, sizeof(bool));
+    prog.entry = CALLOC(prog.n + 1, sizeof(state *));
+    prog.worklist = Seq_new(100);
+
+    analyze(&prog);
+
+    printf("%s: %u words\n", argv[optind], prog.n);
+
+    if (!prog.trust && prog.indirect) {
+        printf("  refused: jump target at pc %u cannot be determined; "
+               "--trust assumes targets are program constants\n",
+               prog.indirect_pc);
+    } else if (!prog.trust && prog.unknown_access) {
+        printf("  refused: segment 0 may be accessed at an unknown offset "
+               "at pc %u; --trust assumes such accesses only touch data\n",
+               prog.unknown_access_pc);
+    } else {
+        struct report report;
+        memset(&report, 0, sizeof(report));
+
+        for (uint32_t pc = 0; pc < prog.n; pc++) {
+            report.code_words += prog.code[pc];
+        }
+
+        for (uint32_t pc = 0; pc < prog.n; pc++) {
+            if (prog.leader[pc] && prog.code[pc] && prog.entry[pc] != NULL) {
+                uint32_t end = block_end(&prog, pc);
+                report.blocks++;
+                report.optimized += optimize_block(&prog, pc, end, &report);
+            }
+        }
+
+        printf("  reachable code:        %u words in %u blocks\n",
+               report.code_words, report.blocks);
+        printf("  blocks rewritten:      %u\n", report.optimized);
+        printf("  blocks left alone:     %u self-modifying or read as "
+               "data, %u falling through\n", report.excluded,
+               report.fall_through);
+        printf("  constants folded:      %u\n", report.folded);
+        printf("  instructions removed:  %u (%.1f%% of reachable code)\n",
+               report.removed, report.code_words ?
+               100.0 * report.removed / report.code_words : 0.0);
+    }
+
+    write_program(argv[optind + 1], prog.words, prog.n);
+    free_program(&prog);
+
+    return EXIT_SUCCESS;
+}
+
+
+/* usage_and_exit
+ * Purpose:     Prints the command line usage and exits with failure
+ * Parameters:  None
+ * Returns:     None
+ */
+void usage_and_exit()
+{
+    fprintf(stderr, "USAGE: ./umopt [--trust] input.um output.um\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/* read_program
+ * Purpose:     Reads a .um file of big-endian words
+ * Parameters:  char *path: the file to read
+ *              uint32_t *n: set to the number of words read
+ * Returns:     uint32_t *: heap-allocated words; client frees with FREE
+ */
+uint32_t *read_program(char *path, uint32_t *n)
+{
+    struct stat sb;
+    if (stat(path, &sb) == -1) {
+        fprintf(stderr, "Stat Error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *fp = open_or_die(path);
+    *n = sb.st_size / 4;
+    uint32_t *words = CALLOC(*n + 1, sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < *n; i++) {
+        uint32_t word = 0;
+        for (int j = 0; j < 4; j++) {
+            word = (word << 8) | (getc(fp) & 0xff);
+        }
+        words[i] = word;
+    }
+
+    fclose(fp);
+    return words;
+}
+
+
+/* write_program
+ * Purpose:     Writes words as a .um file
+ * Parameters:  char *path: the file to write
+ *              uint32_t *words, n: the words to write
+ * Returns:     None
+ */
+void write_program(char *path, uint32_t *words, uint32_t n)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        for (int lsb = 24; lsb >= 0; lsb -= 8) {
+            putc((words[i] >> lsb) & 0xff, fp);
+        }
+    }
+
+    fclose(fp);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                          Analysis                          *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* analyze
+ * Purpose:     Finds the reachable code, its basic blocks, the state on
+ *                  entry to each block and the words used as data
+ * Parameters:  struct program *prog: the program to analyze
+ * Returns:     None
+ * Notes:       Repeats whole passes until the leaders, the potential jump
+ *                  targets and the registers known to stay zero all stop
+ *                  changing. Registers are first assumed to be written
+ *                  everywhere; once the code is known, registers it never
+ *                  writes are assumed zero, and the assumption is dropped
+ *                  again if the new pass finds code that writes them.
+ */
+void analyze(struct program *prog)
+{
+    bool checked_zero = false;
+
+    for (;;) {
+        analyze_pass(prog);
+
+        if (prog->new_leader) {
+            continue;
+        }
+
+        if (prog->trust && prog->indirect) {
+            uint32_t targets = 0;
+            for (uint32_t pc = 0; pc < prog->n; pc++) {
+                targets += prog->target[pc];
+            }
+            find_targets(prog);
+            for (uint32_t pc = 0; pc < prog->n; pc++) {
+                targets -= prog->target[pc];
+            }
+            if (targets != 0) {
+                continue;
+            }
+        }
+
+        uint8_t zero = prog->code_modified ? 0 : (uint8_t)~prog->written;
+        if ((zero & prog->global_zero) != prog->global_zero) {
+            prog->global_zero &= zero;
+            continue;
+        } else if (!checked_zero && zero != prog->global_zero) {
+            prog->global_zero = zero;
+            checked_zero = true;
+            continue;
+        }
+
+        return;
+    }
+}
+
+
+/* analyze_pass
+ * Purpose:     Runs the dataflow analysis once over the current leaders
+ * Parameters:  struct program *prog: the program to analyze
+ * Returns:     None
+ */
+void analyze_pass(struct program *prog)
+{
+    uint32_t n = prog->n;
+
+    for (uint32_t pc = 0; pc <= n; pc++) {
+        if (prog->entry[pc] != NULL) {
+            FREE(prog->entry[pc]);
+        }
+    }
+    memset(prog->code, 0, n + 1);
+    memset(prog->seg0_read, 0, n + 1);
+    memset(prog->seg0_written, 0, n + 1);
+    prog->written = 0;
+    prog->new_leader = false;
+    prog->code_modified = false;
+    prog->indirect = false;
+    prog->unknown_access = false;
+
+    /* the machine starts with every register 0 */
+    state initial;
+    for (int r = 0; r < 8; r++) {
+        initial.r[r] = vs_const(0);
+    }
+    prog->leader[0] = true;
+    add_edge(prog, 0, &initial);
+
+    /* computed jumps may land on any potential target */
+    state unknown;
+    for (int r = 0; r < 8; r++) {
+        unknown.r[r] = (prog->global_zero & (1 << r)) ? vs_const(0)
+                                                      : vs_top(false);
+    }
+    for (uint32_t pc = 0; pc < n; pc++) {
+        if (prog->target[pc]) {
+            prog->leader[pc] = true;
+            add_edge(prog, pc, &unknown);
+        }
+    }
+
+    while (Seq_length(prog->worklist) > 0) {
+        walk_block(prog, (uint32_t)(uintptr_t)Seq_remhi(prog->worklist));
+    }
+
+    for (uint32_t pc = 0; pc < n; pc++) {
+        if (prog->code[pc] && prog->seg0_written[pc]) {
+            prog->code_modified = true;
+        }
+    }
+}
+
+
+/* walk_block
+ * Purpose:     Abstractly executes the block starting at a leader,
+ *                  propagating its exit state to its successors
+ * Parameters:  struct program *prog: the program being analyzed
+ *              uint32_t start: the leader to start from
+ * Returns:     None
+ */
+void walk_block(struct program *prog, uint32_t start)
+{
+    state s = *prog->entry[start];
+
+    for (uint32_t pc = start; pc < prog->n; pc++) {
+        if (pc != start && prog->leader[pc]) {
+            add_edge(prog, pc, &s);
+            return;
+        }
+
+        prog->code[pc] = true;
+        uint32_t inst = prog->words[pc];
+        unsigned op = OPCODE(inst);
+
+        if (op == HALT || op > LV) {
+            return;
+        } else if (op == LOADP) {
+            vset *b = &s.r[REG_B(inst)];
+            vset *c = &s.r[REG_C(inst)];
+
+            /* load_prog from a nonzero segment replaces the program */
+            if (!vs_may_be_zero(b)) {
+                return;
+            } else if (c->count == TOP) {
+                if (!prog->indirect) {
+                    prog->indirect = true;
+                    prog->indirect_pc = pc;
+                }
+                return;
+            }
+
+            for (unsigned i = 0; i < c->count; i++) {
+                if (c->vals[i] < prog->n) {
+                    add_edge(prog, c->vals[i], &s);
+                }
+            }
+            return;
+        }
+
+        step(prog, &s, pc, inst);
+    }
+}
+
+
+/* add_edge
+ * Purpose:     Joins a state into the entry state of a leader, queueing the
+ *                  leader if its entry state changed
+ * Parameters:  struct program *prog: the program being analyzed
+ *              uint32_t target: the word control transfers to
+ *              state *s: the state at the transfer
+ * Returns:     None
+ * Notes:       Making a leader of a word already walked as the middle of a
+ *                  block invalidates the pass, which must then be repeated
+ */
+void add_edge(struct program *prog, uint32_t target, state *s)
+{
+    if (!prog->leader[target]) {
+        prog->leader[target] = true;
+        if (prog->code[target]) {
+            prog->new_leader = true;
+        }
+    }
+
+    state *entry = prog->entry[target];
+    if (entry == NULL) {
+        NEW(entry);
+        *entry = *s;
+        prog->entry[target] = entry;
+    } else {
+        bool changed = false;
+        for (int r = 0; r < 8; r++) {
+            vset joined = vs_join(&entry->r[r], &s->r[r]);
+            if (!vs_equal(&joined, &entry->r[r])) {
+                entry->r[r] = joined;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            return;
+        }
+    }
+
+    Seq_addhi(prog->worklist, (void *)(uintptr_t)target);
+}
+
+
+/* step
+ * Purpose:     Applies one non-branching instruction to an abstract state
+ * Parameters:  struct program *prog: the program being analyzed
+ *              state *s: the state to update
+ *              uint32_t pc, inst: the instruction and where it is
+ * Returns:     None
+ * Notes:       Also records the segment 0 words the instruction may use
+ *                  as data and the registers it writes
+ */
+void step(struct program *prog, state *s, uint32_t pc, uint32_t inst)
+{
+    vset *a = &s->r[REG_A(inst)];
+    vset *b = &s->r[REG_B(inst)];
+    vset *c = &s->r[REG_C(inst)];
+
+    switch (OPCODE(inst)) {
+    case MOV:
+        if (!vs_is_zero(c)) {
+            *a = vs_may_be_zero(c) ? vs_join(a, b) : *b;
+            prog->written |= 1 << REG_A(inst);
+        }
+        break;
+    case SLOAD:
+        record_access(prog, pc, b, c, false);
+        *a = vs_top(false);
+        prog->written |= 1 << REG_A(inst);
+        break;
+    case SSTORE:
+        record_access(prog, pc, a, b, true);
+        break;
+    case ADD: case MUL: case DIV: case NAND:
+        *a = vs_apply(OPCODE(inst), b, c);
+        prog->written |= 1 << REG_A(inst);
+        break;
+    case MAP:
+        *b = vs_top(true);
+        prog->written |= 1 << REG_B(inst);
+        break;
+    case IN:
+        *c = vs_top(false);
+        prog->written |= 1 << REG_C(inst);
+        break;
+    case LV:
+        s->r[LV_REG(inst)] = vs_const(LV_VAL(inst));
+        prog->written |= 1 << LV_REG(inst);
+        break;
+    default:
+        break;
+    }
+}
+
+
+/* record_access
+ * Purpose:     Records the segment 0 words a load or store may use
+ * Parameters:  struct program *prog: the program being analyzed
+ *              uint32_t pc: where the load or store is
+ *              vset *seg, *index: abstract segment ID and offset
+ *              bool is_write: true for a store
+ * Returns:     None
+ */
+void record_access(struct program *prog, uint32_t pc, vset *seg, vset *index,
+                   bool is_write)
+{
+    if (!vs_may_be_zero(seg)) {
+        return;
+    }
+
+    if (index->count == TOP) {
+        if (!prog->unknown_access) {
+            prog->unknown_access = true;
+            prog->unknown_access_pc = pc;
+        }
+        return;
+    }
+
+    for (unsigned i = 0; i < index->count; i++) {
+        if (index->vals[i] < prog->n) {
+            bool *words = is_write ? prog->seg0_written : prog->seg0_read;
+            words[index->vals[i]] = true;
+        }
+    }
+}
+
+
+/* find_targets
+ * Purpose:     Marks every word that --trust assumes a computed jump may
+ *                  reach: load_val operands other than those only used as
+ *                  segment offsets, and constants produced by folding
+ * Notes:       Words of the image are not targets even when their value is
+ *                  in range, since compressed data is full of such values
+ * Parameters:  struct program *prog: the analyzed program
+ * Returns:     None
+ */
+void find_targets(struct program *prog)
+{
+    for (uint32_t pc = 0; pc < prog->n; pc++) {
+        uint32_t word = prog->words[pc];
+
+        if (prog->code[pc] && OPCODE(word) == LV && LV_VAL(word) < prog->n &&
+            !only_offset_uses(prog, pc)) {
+            prog->target[LV_VAL(word)] = true;
+        }
+    }
+
+    /* folded constants */
+    for (uint32_t pc = 0; pc < prog->n; pc++) {
+        if (!prog->leader[pc] || !prog->code[pc] || prog->entry[pc] == NULL) {
+            continue;
+        }
+
+        state s = *prog->entry[pc];
+        uint32_t end = block_end(prog, pc);
+        for (uint32_t i = pc; i <= end; i++) {
+            uint32_t inst = prog->words[i];
+            unsigned op = OPCODE(inst);
+            uint32_t k;
+
+            if (op == LOADP || op == HALT || op > LV) {
+                break;
+            }
+            step(prog, &s, i, inst);
+            if (op >= ADD && op <= NAND &&
+                vs_is_const(&s.r[REG_A(inst)], &k) && k < prog->n) {
+                prog->target[k] = true;
+            }
+        }
+    }
+}
+
+
+/* only_offset_uses
+ * Purpose:     Checks whether the value loaded by a load_val is only used
+ *                  as a segment offset before being overwritten in the
+ *                  same block
+ * Parameters:  struct program *prog: the analyzed program
+ *              uint32_t pc: the load_val
+ * Returns:     bool: true iff the value cannot reach a jump
+ */
+bool only_offset_uses(struct program *prog, uint32_t pc)
+{
+    unsigned r = LV_REG(prog->words[pc]);
+
+    for (uint32_t i = pc + 1; i < prog->n && !prog->leader[i]; i++) {
+        uint32_t inst = prog->words[i];
+        unsigned op = OPCODE(inst);
+        uint8_t uses = regs_read(inst);
+
+        if (op == SLOAD) {
+            uses &= ~(1 << REG_C(inst));
+        } else if (op == SSTORE) {
+            uses &= ~(1 << REG_B(inst));
+        }
+
+        if (uses & (1 << r)) {
+            return false;
+        } else if (reg_killed(inst) & (1 << r)) {
+            return true;
+        } else if (op == LOADP || op == HALT || op > LV) {
+            return op == HALT;
+        }
+    }
+
+    return false;
+}
+
+
+/* block_end
+ * Purpose:     Finds the last word of the block starting at a leader
+ * Parameters:  struct program *prog: the analyzed program
+ *              uint32_t start: the leader
+ * Returns:     uint32_t: the index of the block's last instruction
+ */
+uint32_t block_end(struct program *prog, uint32_t start)
+{
+    uint32_t pc = start;
+
+    for (;;) {
+        unsigned op = OPCODE(prog->words[pc]);
+        if (op == LOADP || op == HALT || op > LV || pc + 1 >= prog->n ||
+            prog->leader[pc + 1] || !prog->code[pc + 1]) {
+            return pc;
+        }
+        pc++;
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                          Rewriting                         *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* optimize_block
+ * Purpose:     Rewrites one basic block in place
+ * Parameters:  struct program *prog: the analyzed program
+ *              uint32_t start, end: first and last word of the block
+ *              struct report *report: totals to update
+ * Returns:     bool: true iff the block was changed
+ * Notes:       Only blocks ending in load_prog or halt are shortened; the
+ *                  words freed at the end of the block become unreachable
+ *                  and are left as they were
+ */
+bool optimize_block(struct program *prog, uint32_t start, uint32_t end,
+                    struct report *report)
+{
+    for (uint32_t pc = start; pc <= end; pc++) {
+        if (prog->seg0_read[pc] || prog->seg0_written[pc]) {
+            report->excluded++;
+            return false;
+        }
+    }
+
+    unsigned last_op = OPCODE(prog->words[end]);
+    if (last_op != LOADP && last_op != HALT) {
+        report->fall_through++;
+        return false;
+    }
+
+    uint32_t length = end - start + 1;
+    uint32_t *out = CALLOC(length, sizeof(uint32_t));
+    bool *keep = CALLOC(length, sizeof(bool));
+    uint32_t folded = 0;
+
+    /* forward: fold constants and drop instructions with no effect */
+    state s = *prog->entry[start];
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t inst = prog->words[start + i];
+        unsigned op = OPCODE(inst);
+        uint32_t k, cur;
+
+        out[i] = inst;
+        keep[i] = true;
+
+        if (op == MOV) {
+            keep[i] = !vs_is_zero(&s.r[REG_C(inst)]) &&
+                      REG_A(inst) != REG_B(inst);
+        } else if (op >= ADD && op <= NAND) {
+            vset result = vs_apply(op, &s.r[REG_B(inst)], &s.r[REG_C(inst)]);
+            if (vs_is_const(&result, &k) && k <= MAX_LOAD_VAL) {
+                out[i] = (uint32_t)LV << 28 | REG_A(inst) << 25 | k;
+                folded++;
+                keep[i] = !vs_is_const(&s.r[REG_A(inst)], &cur) || cur != k;
+            }
+        } else if (op == LV) {
+            keep[i] = !vs_is_const(&s.r[LV_REG(inst)], &cur) ||
+                      cur != LV_VAL(inst);
+        }
+
+        if (op != LOADP && op != HALT) {
+            step(prog, &s, start + i, inst);
+        }
+    }
+
+    /* backward: drop definitions overwritten before they are used */
+    uint8_t live = (last_op == HALT) ? 0 : ALL_REGS;
+    for (uint32_t i = length; i-- > 0;) {
+        if (!keep[i]) {
+            continue;
+        }
+
+        uint32_t inst = out[i];
+        unsigned op = OPCODE(inst);
+        unsigned dest = (op == LV) ? LV_REG(inst) : REG_A(inst);
+
+        if ((op == LV || op == MOV || (op >= ADD && op <= NAND)) &&
+            !(live & (1 << dest))) {
+            keep[i] = false;
+            continue;
+        }
+
+        live = (live & ~reg_killed(inst)) | regs_read(inst);
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        if (keep[i]) {
+            out[kept++] = out[i];
+        }
+    }
+
+    bool changed = kept < length;
+    if (changed) {
+        memcpy(prog->words + start, out, kept * sizeof(uint32_t));
+        report->removed += length - kept;
+        report->folded += folded;
+    }
+
+    FREE(out);
+    FREE(keep);
+    return changed;
+}
+
+
+/* regs_read
+ * Purpose:     Gives the registers an instruction reads
+ * Parameters:  uint32_t inst: the instruction
+ * Returns:     uint8_t: bit r is set iff register r is read
+ * Notes:       A conditional move reads its destination too, since the
+ *                  destination keeps its old value when the condition is 0
+ */
+uint8_t regs_read(uint32_t inst)
+{
+    uint8_t a = 1 << REG_A(inst), b = 1 << REG_B(inst), c = 1 << REG_C(inst);
+
+    switch (OPCODE(inst)) {
+    case MOV:                       return a | b | c;
+    case SLOAD:                     return b | c;
+    case SSTORE:                    return a | b | c;
+    case ADD: case MUL: case DIV:
+    case NAND:                      return b | c;
+    case MAP: case UNMAP: case OUT: return c;
+    case LOADP:                     return b | c;
+    default:                        return 0;
+    }
+}
+
+
+/* reg_killed
+ * Purpose:     Gives the register an instruction always overwrites
+ * Parameters:  uint32_t inst: the instruction
+ * Returns:     uint8_t: bit r is set iff register r is overwritten
+ */
+uint8_t reg_killed(uint32_t inst)
+{
+    switch (OPCODE(inst)) {
+    case SLOAD: case ADD: case MUL: case DIV: case NAND:
+        return 1 << REG_A(inst);
+    case MAP:
+        return 1 << REG_B(inst);
+    case IN:
+        return 1 << REG_C(inst);
+    case LV:
+        return 1 << LV_REG(inst);
+    default:
+        return 0;
+    }
+}
+
+
+void free_program(struct program *prog)
+{
+    for (uint32_t pc = 0; pc <= prog->n; pc++) {
+        if (prog->entry[pc] != NULL) {
+            FREE(prog->entry[pc]);
+        }
+    }
+
+    FREE(prog->entry);
+    FREE(prog->words);
+    FREE(prog->leader);
+    FREE(prog->code);
+    FREE(prog->target);
+    FREE(prog->seg0_read);
+    FREE(prog->seg0_written);
+    Seq_free(&prog->worklist);
+}
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *\
+|                        Value sets                          *|
+\* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+bool vs_may_be_zero(vset *v)
+{
+    if (v->count == TOP) {
+        return !v->nonzero;
+    }
+
+    for (unsigned i = 0; i < v->count; i++) {
+        if (v->vals[i] == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool vs_is_zero(vset *v)
+{
+    return v->count == 1 && v->vals[0] == 0;
+}
+
+
+vset vs_join(vset *a, vset *b)
+{
+    if (a->count == TOP || b->count == TOP) {
+        return vs_top(!vs_may_be_zero(a) && !vs_may_be_zero(b));
+    }
+
+    vset v = *a;
+    for (unsigned i = 0; i < b->count; i++) {
+        bool found = false;
+        for (unsigned j = 0; j < v.count; j++) {
+            found |= v.vals[j] == b->vals[i];
+        }
+        if (found) {
+            continue;
+        } else if (v.count == MAX_VALS) {
+            return vs_top(!vs_may_be_zero(a) && !vs_may_be_zero(b));
+        }
+        v.vals[v.count++] = b->vals[i];
+    }
+
+    v.nonzero = !vs_may_be_zero(&v);
+    return v;
+}
+
+
+bool vs_equal(vset *a, vset *b)
+{
+    if (a->count != b->count || a->nonzero != b->nonzero) {
+        return false;
+    } else if (a->count == TOP) {
+        return true;
+    }
+
+    for (unsigned i = 0; i < a->count; i++) {
+        bool found = false;
+        for (unsigned j = 0; j < b->count; j++) {
+            found |= a->vals[i] == b->vals[j];
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/* vs_apply
+ * Purpose:     Abstractly applies an arithmetic or nand instruction
+ * Parameters:  unsigned op: ADD, MUL, DIV or NAND
+ *              vset *b, *c: abstract operands
+ * Returns:     vset: every possible result, or TOP if there are too many
+ *                  or a division by zero is possible
+ */
+vset vs_apply(unsigned op, vset *b, vset *c)
+{
+    if (b->count == TOP || c->count == TOP) {
+        return vs_top(false);
+    }
+
+    vset v = { 0, false, { 0 } };
+    for (unsigned i = 0; i < b->count; i++) {
+        for (unsigned j = 0; j < c->count; j++) {
+            uint32_t x = b->vals[i], y = c->vals[j], r;
+
+            switch (op) {
+            case ADD:   r = x + y;      break;
+            case MUL:   r = x * y;      break;
+            case DIV:
+                if (y == 0) {
+                    return vs_top(false);
+                }
+                r = x / y;
+                break;
+            default:    r = ~(x & y);   break;
+            }
+
+            vset single = vs_const(r);
+            v = (v.count == 0) ? single : vs_join(&v, &single);
+            if (v.count == TOP) {
+                return v;
+            }
+        }
+    }
+
+    return v;
+}
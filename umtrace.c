@@ -0,0 +1,315 @@
+/*
+ * umtrace.c
+ *
+ * Purpose: Reader for traces written by `um --trace FILE`. Prints the
+ *          records that match the given filters, or summarizes them with
+ *          per-opcode counts and the hottest program counters.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <mem.h>
+#include "um_trace.h"
+#include "open_or_die.h"
+
+static const char *op_names[16] = {
+    "mov", "seg_load", "seg_store", "add", "mult", "div", "nand", "halt",
+    "map_seg", "unmap_seg", "output", "input", "load_prog", "load_val",
+    "op14", "op15"
+};
+
+/* struct filter
+ * Purpose:     Which records to print or summarize
+ * Members:     uint64_t from, to: range of instruction indices, inclusive
+ *              uint32_t pc_lo, pc_hi: range of program counters, inclusive
+ *              int op: opcode to match, or -1 for any
+ *              bool match_seg: true iff only records touching seg_id match
+ *              uint32_t seg_id: the segment to match
+ */
+struct filter {
+    uint64_t    from, to;
+    uint32_t    pc_lo, pc_hi;
+    int         op;
+    bool        match_seg;
+    uint32_t    seg_id;
+};
+
+/* struct summary
+ * Purpose:     Totals gathered over the matching records
+ * Members:     uint64_t records: number of matching records
+ *              uint64_t op_counts[16]: matching records per opcode
+ *              uint64_t reg_writes, seg_touches: records of each kind
+ *              uint64_t *pc_counts: matching records per program counter
+ *              uint32_t pc_capacity: number of entries in pc_counts
+ */
+struct summary {
+    uint64_t    records;
+    uint64_t    op_counts[16];
+    uint64_t    reg_writes;
+    uint64_t    seg_touches;
+    uint64_t   *pc_counts;
+    uint32_t    pc_capacity;
+};
+
+void usage_and_exit();
+bool matches(struct filter *filter, um_trace_record_t *record);
+void print_record(um_trace_record_t *record);
+void add_to_summary(struct summary *summary, um_trace_record_t *record);
+void print_summary(struct summary *summary, unsigned top);
+int parse_op(const char *name);
+
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        { "summary", no_argument,       NULL, 's' },
+        { "top",     required_argument, NULL, 'k' },
+        { "from",    required_argument, NULL, 'f' },
+        { "to",      required_argument, NULL, 'T' },
+        { "pc",      required_argument, NULL, 'p' },
+        { "op",      required_argument, NULL, 'o' },
+        { "seg",     required_argument, NULL, 'g' },
+        { NULL,      0,                 NULL, 0   }
+    };
+
+    struct filter filter = { 0, UINT64_MAX, 0, UINT32_MAX, -1, false, 0 };
+    bool summarize = false;
+    unsigned top = 10;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "sk:f:T:p:o:g:", long_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            summarize = true;
+            break;
+        case 'k':
+            top = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            filter.from = strtoull(optarg, NULL, 10);
+            break;
+        case 'T':
+            filter.to = strtoull(optarg, NULL, 10);
+            break;
+        case 'p': {
+            char *end;
+            filter.pc_lo = strtoul(optarg, &end, 10);
+            filter.pc_hi = (*end == '-') ? strtoul(end + 1, NULL, 10)
+                                         : filter.pc_lo;
+            break;
+        }
+        case 'o':
+            filter.op = parse_op(optarg);
+            break;
+        case 'g':
+            filter.match_seg = true;
+            filter.seg_id = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage_and_exit();
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage_and_exit();
+    }
+
+    FILE *fp = open_or_die(argv[optind]);
+    um_trace_reader_t reader = um_trace_reader_new(fp);
+    if (reader == NULL) {
+        fprintf(stderr, "%s is not a UM trace\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct summary summary;
+    memset(&summary, 0, sizeof(summary));
+
+    um_trace_record_t record;
+    um_trace_skip_to(reader, filter.from);
+    while (um_trace_next(reader, &record) && record.index <= filter.to) {
+        if (!matches(&filter, &record)) {
+            continue;
+        }
+
+        if (summarize) {
+            add_to_summary(&summary, &record);
+        } else {
+            print_record(&record);
+        }
+    }
+
+    if (summarize) {
+        print_summary(&summary, top);
+    }
+
+    bool damaged = um_trace_damaged(reader);
+    if (damaged) {
+        fprintf(stderr, "%s ends in a truncated or damaged chunk\n",
+                argv[optind]);
+    }
+
+    if (summary.pc_counts != NULL) {
+        FREE(summary.pc_counts);
+    }
+    um_trace_reader_free(&reader);
+    fclose(fp);
+
+    return damaged ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/* usage_and_exit
+ * Purpose:     Prints the command line usage and exits with failure
+ * Parameters:  None
+ * Returns:     None
+ */
+void usage_and_exit()
+{
+    fprintf(stderr, "USAGE: ./umtrace [--summary [--top K]] [--from N] "
+                    "[--to N] [--pc LO[-HI]] [--op NAME] [--seg ID] "
+                    "trace_file\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/* matches
+ * Purpose:     Checks whether a record passes every filter
+ * Parameters:  struct filter *filter: the filters to apply
+ *              um_trace_record_t *record: the record to check
+ * Returns:     bool: true iff the record matches
+ */
+bool matches(struct filter *filter, um_trace_record_t *record)
+{
+    if (record->index < filter->from || record->index > filter->to) {
+        return false;
+    }
+    if (record->pc < filter->pc_lo || record->pc > filter->pc_hi) {
+        return false;
+    }
+    if (filter->op >= 0 && (int)(record->inst >> 28) != filter->op) {
+        return false;
+    }
+    if (filter->match_seg &&
+        (!record->touched_seg || record->seg_id != filter->seg_id)) {
+        return false;
+    }
+
+    return true;
+}
+
+
+/* print_record
+ * Purpose:     Prints one record on a line
+ * Parameters:  um_trace_record_t *record: the record to print
+ * Returns:     None
+ */
+void print_record(um_trace_record_t *record)
+{
+    printf("%llu pc=%u %08x %-9s", (unsigned long long)record->index,
+           record->pc, record->inst, op_names[record->inst >> 28]);
+
+    if (record->wrote_reg) {
+        printf(" r%u=%u", record->reg, record->reg_value);
+    }
+    if (record->touched_seg) {
+        printf(" seg=%u", record->seg_id);
+    }
+
+    printf("\n");
+}
+
+
+/* add_to_summary
+ * Purpose:     Adds a matching record to the running totals
+ * Parameters:  struct summary *summary: the totals to update
+ *              um_trace_record_t *record: the record to add
+ * Returns:     None
+ * Notes:       Grows the per-pc table as larger pcs are seen
+ */
+void add_to_summary(struct summary *summary, um_trace_record_t *record)
+{
+    summary->records++;
+    summary->op_counts[record->inst >> 28]++;
+    summary->reg_writes += record->wrote_reg;
+    summary->seg_touches += record->touched_seg;
+
+    if (record->pc >= summary->pc_capacity) {
+        uint32_t capacity = summary->pc_capacity ? summary->pc_capacity : 1024;
+        while (capacity <= record->pc) {
+            capacity *= 2;
+        }
+
+        if (summary->pc_counts == NULL) {
+            summary->pc_counts = ALLOC(capacity * sizeof(uint64_t));
+        } else {
+            RESIZE(summary->pc_counts, capacity * sizeof(uint64_t));
+        }
+        memset(summary->pc_counts + summary->pc_capacity, 0,
+               (capacity - summary->pc_capacity) * sizeof(uint64_t));
+        summary->pc_capacity = capacity;
+    }
+    summary->pc_counts[record->pc]++;
+}
+
+
+/* print_summary
+ * Purpose:     Prints the totals and the hottest program counters
+ * Parameters:  struct summary *summary: the totals to print
+ *              unsigned top: how many program counters to list
+ * Returns:     None
+ */
+void print_summary(struct summary *summary, unsigned top)
+{
+    printf("records:       %llu\n", (unsigned long long)summary->records);
+    printf("reg writes:    %llu\n", (unsigned long long)summary->reg_writes);
+    printf("seg touches:   %llu\n", (unsigned long long)summary->seg_touches);
+
+    printf("\nopcode         count\n");
+    for (int op = 0; op < 16; op++) {
+        if (summary->op_counts[op] != 0) {
+            printf("%-10s %10llu\n", op_names[op],
+                   (unsigned long long)summary->op_counts[op]);
+        }
+    }
+
+    printf("\nhot pcs        count\n");
+    for (unsigned n = 0; n < top; n++) {
+        uint32_t best = 0;
+        for (uint32_t pc = 1; pc < summary->pc_capacity; pc++) {
+            if (summary->pc_counts[pc] > summary->pc_counts[best]) {
+                best = pc;
+            }
+        }
+        if (summary->pc_capacity == 0 || summary->pc_counts[best] == 0) {
+            break;
+        }
+
+        printf("%-10u %10llu\n", best,
+               (unsigned long long)summary->pc_counts[best]);
+        summary->pc_counts[best] = 0;
+    }
+}
+
+
+/* parse_op
+ * Purpose:     Converts an instruction name to its opcode
+ * Parameters:  const char *name: the name, as printed by umtrace
+ * Returns:     int: the opcode
+ * Notes:       Prints usage and exits on an unknown name
+ */
+int parse_op(const char *name)
+{
+    for (int op = 0; op < 14; op++) {
+        if (strcmp(name, op_names[op]) == 0) {
+            return op;
+        }
+    }
+
+    fprintf(stderr, "Unknown instruction: %s\n", name);
+    usage_and_exit();
+    return -1;
+}
@@ -0,0 +1,86 @@
+/*
+ * umx.c
+ *
+ * Purpose: Converts a .um program of big-endian words into a .umx image
+ *          (see um_image.h), which um maps and loads without converting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <mem.h>
+#include "um_image.h"
+#include "open_or_die.h"
+
+void usage_and_exit();
+uint32_t *read_program(char *path, uint32_t *n);
+
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        usage_and_exit();
+    }
+
+    uint32_t n;
+    uint32_t *words = read_program(argv[1], &n);
+
+    FILE *fp = fopen(argv[2], "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    bool ok = um_image_write(fp, words, n);
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Could not write %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    FREE(words);
+    return EXIT_SUCCESS;
+}
+
+
+/* usage_and_exit
+ * Purpose:     Prints the command line usage and exits with failure
+ * Parameters:  None
+ * Returns:     None
+ */
+void usage_and_exit()
+{
+    fprintf(stderr, "USAGE: ./umx input.um output.umx\n");
+    exit(EXIT_FAILURE);
+}
+
+
+/* read_program
+ * Purpose:     Reads a .um file of big-endian words
+ * Parameters:  char *path: the file to read
+ *              uint32_t *n: set to the number of words read
+ * Returns:     uint32_t *: heap-allocated words; client frees with FREE
+ */
+uint32_t *read_program(char *path, uint32_t *n)
+{
+    struct stat sb;
+    if (stat(path, &sb) == -1) {
+        fprintf(stderr, "Stat Error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *fp = open_or_die(path);
+    *n = sb.st_size / 4;
+    uint32_t *words = CALLOC(*n + 1, sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < *n; i++) {
+        uint32_t word = 0;
+        for (int j = 0; j < 4; j++) {
+            word = (word << 8) | (getc(fp) & 0xff);
+        }
+        words[i] = word;
+    }
+
+    fclose(fp);
+    return words;
+}